@@ -3,13 +3,19 @@ LOCAL_PATH:= $(call my-dir)
 include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES:=                                      \
+                  AsyncOperations.cpp                  \
                   BandwidthController.cpp              \
+                  BinaryProtocol.cpp                   \
                   ClatdController.cpp                  \
+                  CommandExecutor.cpp                  \
                   CommandListener.cpp                  \
+                  CommandTrace.cpp                     \
                   DnsProxyListener.cpp                 \
                   FirewallController.cpp               \
                   IdletimerController.cpp              \
                   InterfaceController.cpp              \
+                  IptablesRuleset.cpp                  \
+                  LatencyMetrics.cpp                   \
                   MDnsSdListener.cpp                   \
                   NatController.cpp                    \
                   NetdCommand.cpp                      \
@@ -17,8 +23,11 @@ LOCAL_SRC_FILES:=                                      \
                   NetlinkHandler.cpp                   \
                   NetlinkManager.cpp                   \
                   PppController.cpp                    \
+                  ProcessSupervisor.cpp                \
+                  QtaguidStats.cpp                     \
                   ResolverController.cpp               \
                   SecondaryTableController.cpp         \
+                  TetherConntrackStats.cpp             \
                   TetherController.cpp                 \
                   oem_iptables_hook.cpp                \
                   UidMarkMap.cpp                       \
@@ -48,11 +57,11 @@ else ifeq ($(WIFI_DRIVER_MODULE_NAME),ar6000)
     LOCAL_CFLAGS += -DWIFI_MODULE_PATH=\"$(WIFI_DRIVER_MODULE_PATH)\"
   endif
   LOCAL_C_INCLUDES += external/wpa_supplicant_8/src/common
-  LOCAL_SRC_FILES += SoftapControllerATH.cpp
+  LOCAL_SRC_FILES += SoftapControllerATH.cpp SoftapEvents.cpp
   LOCAL_SHARED_LIBRARIES := $(LOCAL_SHARED_LIBRARIES) libwpa_client
   LOCAL_CFLAGS += -DBLADE_SOFTAP
 else
-  LOCAL_SRC_FILES += SoftapController.cpp
+  LOCAL_SRC_FILES += SoftapController.cpp SoftapEvents.cpp
 endif
 
 ifdef WIFI_DRIVER_MODULE_AP_ARG
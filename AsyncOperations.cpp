@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define LOG_TAG "AsyncOperations"
+#include <cutils/log.h>
+
+#include <sysutils/SocketClient.h>
+
+#include "AsyncOperations.h"
+#include "ResponseCode.h"
+
+AsyncOperations::AsyncOperations() {
+    mNextId = 0;
+}
+
+AsyncOperations *AsyncOperations::Instance() {
+    static AsyncOperations sInstance;
+    return &sInstance;
+}
+
+int AsyncOperations::start(SocketListener *listener, NetdCommand *cmd, int argc, char **argv) {
+    Operation *op = new Operation();
+    pthread_t thread;
+
+    op->id = __sync_add_and_fetch(&mNextId, 1);
+    op->listener = listener;
+    op->cmd = cmd;
+    for (int i = 0; i < argc; i++) {
+        op->args.push_back(argv[i]);
+    }
+
+    if (pthread_create(&thread, NULL, AsyncOperations::threadStart, op)) {
+        ALOGE("pthread_create (%s)", strerror(errno));
+        delete op;
+        return -1;
+    }
+    pthread_detach(thread);
+    return op->id;
+}
+
+void *AsyncOperations::threadStart(void *obj) {
+    Operation *op = reinterpret_cast<Operation *>(obj);
+
+    run(op);
+    delete op;
+    pthread_exit(NULL);
+    return NULL;
+}
+
+void *AsyncOperations::drainStart(void *obj) {
+    Drain *drain = reinterpret_cast<Drain *>(obj);
+    char buf[1024];
+    ssize_t len;
+
+    while ((len = TEMP_FAILURE_RETRY(read(drain->fd, buf, sizeof(buf)))) > 0) {
+        drain->replies.append(buf, len);
+    }
+    return NULL;
+}
+
+void AsyncOperations::run(Operation *op) {
+    char *argv[op->args.size()];
+    int fds[2];
+    SocketClient *capture;
+    pthread_t drainThread;
+    Drain drain;
+    char *msg;
+
+    for (size_t i = 0; i < op->args.size(); i++) {
+        argv[i] = (char *) op->args[i].c_str();
+    }
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+        ALOGE("socketpair failed (%s)", strerror(errno));
+        asprintf(&msg, "%d %d Unable to run command", op->id, ResponseCode::OperationFailed);
+        op->listener->sendBroadcast(ResponseCode::AsyncOperationCompleted, msg, false);
+        free(msg);
+        return;
+    }
+    /*
+     * Listing commands can send more than the socket buffer holds, so read
+     * while the command runs; it would otherwise block in sendMsg, holding
+     * its TimedCommand lock.
+     */
+    drain.fd = fds[1];
+    if (pthread_create(&drainThread, NULL, AsyncOperations::drainStart, &drain)) {
+        ALOGE("pthread_create (%s)", strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        asprintf(&msg, "%d %d Unable to run command", op->id, ResponseCode::OperationFailed);
+        op->listener->sendBroadcast(ResponseCode::AsyncOperationCompleted, msg, false);
+        free(msg);
+        return;
+    }
+    capture = new SocketClient(fds[0], false, false);
+    op->cmd->runCommand(capture, op->args.size(), argv);
+    capture->decRef();
+    close(fds[0]);
+
+    pthread_join(drainThread, NULL);
+    close(fds[1]);
+    std::string &replies = drain.replies;
+
+    /* Replies are "<code> <message>\0"; the last one is the outcome. */
+    if (!replies.empty() && replies[replies.size() - 1] == '\0') {
+        replies.erase(replies.size() - 1);
+    }
+    size_t last = replies.rfind('\0');
+    std::string result = replies.substr(last == std::string::npos ? 0 : last + 1);
+    if (result.size() < 4 || result[3] != ' ') {
+        result = "400 Command gave no result";
+    }
+
+    asprintf(&msg, "%d %s", op->id, result.c_str());
+    op->listener->sendBroadcast(ResponseCode::AsyncOperationCompleted, msg, false);
+    free(msg);
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _ASYNC_OPERATIONS_H
+#define _ASYNC_OPERATIONS_H
+
+#include <string>
+#include <vector>
+
+#include <sysutils/SocketListener.h>
+
+#include "NetdCommand.h"
+
+/*
+ * Commands run off the listener thread, for the ones that take seconds
+ * (softap startap, tether start, ...) and would otherwise hold up the
+ * caller and every command behind it.
+ *
+ * Each operation gets an id and a thread of its own. The command's replies
+ * go to a socket pair instead of the caller; the last one becomes the
+ * completion, broadcast as an AsyncOperationCompleted
+ *   "<id> <code> <message>"
+ * Operations on different commands overlap. Those on the same command,
+ * async or not, are kept apart by TimedCommand.
+ */
+class AsyncOperations {
+public:
+    static AsyncOperations *Instance();
+
+    /* Returns the operation id, or -1 if it could not be started. */
+    int start(SocketListener *listener, NetdCommand *cmd, int argc, char **argv);
+
+private:
+    class Operation {
+    public:
+        int id;
+        SocketListener *listener;
+        NetdCommand *cmd;
+        std::vector<std::string> args;
+    };
+
+    /* The replies read off the capture socket pair. */
+    class Drain {
+    public:
+        int fd;
+        std::string replies;
+    };
+
+    AsyncOperations();
+    static void *threadStart(void *obj);
+    static void *drainStart(void *obj);
+    static void run(Operation *op);
+
+    volatile int mNextId;
+};
+
+#endif
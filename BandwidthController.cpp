@@ -22,11 +22,14 @@
  * If they ever were to allow it, then netd/ would need some tweaking.
  */
 
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -42,14 +45,20 @@
 #include <cutils/properties.h>
 #include <logwrap/logwrap.h>
 
+#include "BinaryProtocol.h"
+#include "CommandExecutor.h"
 #include "NetdConstants.h"
 #include "BandwidthController.h"
 #include "NatController.h"  /* For LOCAL_TETHER_COUNTERS_CHAIN */
 #include "ResponseCode.h"
+#include "TetherConntrackStats.h"
 
 /* Alphabetical */
 #define ALERT_IPT_TEMPLATE "%s %s -m quota2 ! --quota %lld --name %s"
 const char BandwidthController::ALERT_GLOBAL_NAME[] = "globalAlert";
+const char BandwidthController::JOURNAL_DIR[] = "/data/misc/net";
+const char BandwidthController::JOURNAL_PATH[] = "/data/misc/net/bandwidth.journal";
+const int  BandwidthController::JOURNAL_VERSION = 2;
 const char* BandwidthController::LOCAL_INPUT = "bw_INPUT";
 const char* BandwidthController::LOCAL_FORWARD = "bw_FORWARD";
 const char* BandwidthController::LOCAL_OUTPUT = "bw_OUTPUT";
@@ -148,6 +157,13 @@ const char *BandwidthController::IPT_BASIC_ACCOUNTING_COMMANDS[] = {
 };
 
 BandwidthController::BandwidthController(void) {
+    pthread_mutex_init(&alertThresholdsLock, NULL);
+    pthread_mutex_init(&journalLock, NULL);
+    rulesDigest = 0;
+    sharedQuotaBytes = sharedAlertBytes = 0;
+    globalAlertBytes = 0;
+    globalAlertTetherCount = 0;
+    bandwidthEnabled = false;
 }
 
 int BandwidthController::runIpxtablesCmd(const char *cmd, IptJumpOp jumpHandling,
@@ -213,7 +229,7 @@ int BandwidthController::runIptablesCmd(const char *cmd, IptJumpOp jumpHandling,
     }
 
     argv[argc] = NULL;
-    res = android_fork_execvp(argc, (char **)argv, &status, false,
+    res = CommandExecutor::get()->execvp(argc, argv, &status,
             failureHandling == IptFailShow);
     res = res || !WIFEXITED(status) || WEXITSTATUS(status);
     if (res && failureHandling == IptFailShow) {
@@ -224,6 +240,9 @@ int BandwidthController::runIptablesCmd(const char *cmd, IptJumpOp jumpHandling,
 }
 
 void BandwidthController::flushCleanTables(bool doClean) {
+    /* Whatever counters we had open are about to go away. */
+    closeQuotaCounterFds();
+
     /* Flush and remove the bw_costly_<iface> tables */
     flushExistingCostlyTables(doClean);
 
@@ -258,6 +277,18 @@ int BandwidthController::enableBandwidthControl(bool force) {
     }
 
     /* Let's pretend we started from scratch ... */
+    resetState();
+
+    flushCleanTables(false);
+    res = runCommands(sizeof(IPT_BASIC_ACCOUNTING_COMMANDS) / sizeof(char*),
+            IPT_BASIC_ACCOUNTING_COMMANDS, RunCmdFailureBad);
+    bandwidthEnabled = true;
+
+    return res;
+
+}
+
+void BandwidthController::resetState(void) {
     sharedQuotaIfaces.clear();
     quotaIfaces.clear();
     naughtyAppUids.clear();
@@ -265,18 +296,68 @@ int BandwidthController::enableBandwidthControl(bool force) {
     globalAlertBytes = 0;
     globalAlertTetherCount = 0;
     sharedQuotaBytes = sharedAlertBytes = 0;
+    pthread_mutex_lock(&alertThresholdsLock);
+    alertThresholds.clear();
+    pthread_mutex_unlock(&alertThresholdsLock);
+}
 
-    flushCleanTables(false);
-    res = runCommands(sizeof(IPT_BASIC_ACCOUNTING_COMMANDS) / sizeof(char*),
-            IPT_BASIC_ACCOUNTING_COMMANDS, RunCmdFailureBad);
+void BandwidthController::compileCommand(IptablesRuleset *rs, const char *cmd) {
+    char table[MAX_IPT_OUTPUT_LINE_LEN] = "filter";
+    char chain[MAX_IPT_OUTPUT_LINE_LEN];
+    int skip = 0;
+
+    sscanf(cmd, "-t %s %n", table, &skip);
+    cmd += skip;
+    if (sscanf(cmd, "-F %s", chain) == 1 || sscanf(cmd, "-N %s", chain) == 1) {
+        /* Declaring flushes, or creates; that also covers "-X" then "-N". */
+        rs->declareChain(V4V6, table, chain);
+    } else if (!strncmp(cmd, "-A ", 3)) {
+        rs->addRule(V4V6, table, cmd);
+    }
+}
 
-    return res;
+int BandwidthController::compileIptablesHooks(IptablesRuleset *rs) {
+    std::list<std::string> costlyChains;
+    std::list<std::string>::iterator it;
+    char value[PROPERTY_VALUE_MAX];
+    unsigned int i;
+
+    /* Whatever counters we had open are about to go away. */
+    closeQuotaCounterFds();
 
+    /* Only lookup ip4 table names as ip6 will have the same tables. */
+    rs->findChains("filter", "bw_costly_", costlyChains);
+    for (it = costlyChains.begin(); it != costlyChains.end(); it++) {
+        if (*it == "bw_costly_shared") {
+            continue;
+        }
+        rs->declareChain(V4V6, "filter", it->c_str());
+        rs->deleteChain(V4V6, "filter", it->c_str());
+    }
+    for (i = 0; i < ARRAY_SIZE(IPT_FLUSH_COMMANDS); i++) {
+        compileCommand(rs, IPT_FLUSH_COMMANDS[i]);
+    }
+    for (i = 0; i < ARRAY_SIZE(IPT_SETUP_COMMANDS); i++) {
+        compileCommand(rs, IPT_SETUP_COMMANDS[i]);
+    }
+
+    property_get("persist.bandwidth.enable", value, "1");
+    if (!strcmp(value, "0")) {
+        return 0;
+    }
+    resetState();
+    for (i = 0; i < ARRAY_SIZE(IPT_BASIC_ACCOUNTING_COMMANDS); i++) {
+        compileCommand(rs, IPT_BASIC_ACCOUNTING_COMMANDS[i]);
+    }
+    bandwidthEnabled = true;
+
+    return 0;
 }
 
 int BandwidthController::disableBandwidthControl(void) {
 
     flushCleanTables(false);
+    bandwidthEnabled = false;
     return 0;
 }
 
@@ -764,26 +845,362 @@ int BandwidthController::setInterfaceQuota(const char *iface, int64_t maxBytes)
     return -1;
 }
 
+/*
+ * Returns the rules prepCostlyIface() and the quota append in
+ * setInterfaceQuota() would run for ifn, in iptables-restore format.
+ * Declaring the chain flushes it if it was left over from a previous run.
+ * With undo, returns the rules that take them out again.
+ */
+std::string BandwidthController::makeCostlyIfaceRules(const char *ifn, int64_t quota,
+                                                      int ruleInsertPos, bool undo) {
+    std::string rules;
+    char *buff;
+
+    if (!undo) {
+        asprintf(&buff,
+                ":bw_costly_%s - [0:0]\n"
+                "-A bw_costly_%s -j bw_penalty_box\n"
+                "%s --jump REJECT\n"
+                "-I bw_INPUT %d -i %s --jump bw_costly_%s\n"
+                "-I bw_OUTPUT %d -o %s --jump bw_costly_%s\n",
+                ifn, ifn, makeIptablesQuotaCmd(IptOpAppend, ifn, quota).c_str(),
+                ruleInsertPos, ifn, ifn, ruleInsertPos, ifn, ifn);
+    } else {
+        asprintf(&buff,
+                "-D bw_INPUT -i %s --jump bw_costly_%s\n"
+                "-D bw_OUTPUT -o %s --jump bw_costly_%s\n"
+                "-F bw_costly_%s\n"
+                "-X bw_costly_%s\n",
+                ifn, ifn, ifn, ifn, ifn, ifn);
+    }
+    rules = buff;
+    free(buff);
+    return rules;
+}
+
+/*
+ * Commits rules to both iptables and ip6tables in one iptables-restore each.
+ * If ip6tables rejects them, undoRules takes the ipv4 ones back out.
+ */
+int BandwidthController::commitRules(const std::string &rules, const std::string &undoRules) {
+    std::string ruleset = "*filter\n" + rules + "COMMIT\n";
+
+    if (execIptablesRestore(V4, ruleset)) {
+        return -1;
+    }
+    if (execIptablesRestore(V6, ruleset)) {
+        execIptablesRestore(V4, "*filter\n" + undoRules + "COMMIT\n");
+        return -1;
+    }
+    return 0;
+}
+
+int BandwidthController::setInterfaceSharedQuotas(int numIfaces, char *ifaces[], int64_t maxBytes) {
+    char ifn[MAX_IFACENAME_LEN];
+    char *buff;
+    int res = 0;
+    int ruleInsertPos = globalAlertBytes ? 2 : 1;
+    const char *costName = "shared";
+    bool addQuotaRule = sharedQuotaIfaces.empty();
+    std::list<std::string> newIfaces;
+    std::list<std::string>::iterator it;
+    std::string rules, undoRules;
+
+    if (maxBytes <= 0) {
+        ALOGE("Invalid bytes value. 1..max_int64.");
+        return -1;
+    }
+
+    for (int i = 0; i < numIfaces; i++) {
+        if (StrncpyAndCheck(ifn, ifaces[i], sizeof(ifn))) {
+            ALOGE("Interface name longer than %d", MAX_IFACENAME_LEN);
+            return -1;
+        }
+        for (it = sharedQuotaIfaces.begin(); it != sharedQuotaIfaces.end(); it++) {
+            if (*it == ifn)
+                break;
+        }
+        if (it != sharedQuotaIfaces.end())
+            continue;
+        for (it = newIfaces.begin(); it != newIfaces.end(); it++) {
+            if (*it == ifn)
+                break;
+        }
+        if (it != newIfaces.end())
+            continue;
+        newIfaces.push_back(ifn);
+    }
+
+    if (!newIfaces.empty()) {
+        if (addQuotaRule) {
+            rules = makeIptablesQuotaCmd(IptOpInsert, costName, maxBytes) + " --jump REJECT\n";
+            undoRules = makeIptablesQuotaCmd(IptOpDelete, costName, maxBytes) + " --jump REJECT\n";
+        }
+        for (it = newIfaces.begin(); it != newIfaces.end(); it++) {
+            asprintf(&buff,
+                    "-I bw_INPUT %d -i %s --jump bw_costly_shared\n"
+                    "-I bw_OUTPUT %d -o %s --jump bw_costly_shared\n",
+                    ruleInsertPos, it->c_str(), ruleInsertPos, it->c_str());
+            rules += buff;
+            free(buff);
+            asprintf(&buff,
+                    "-D bw_INPUT -i %s --jump bw_costly_shared\n"
+                    "-D bw_OUTPUT -o %s --jump bw_costly_shared\n",
+                    it->c_str(), it->c_str());
+            undoRules += buff;
+            free(buff);
+        }
+        if (commitRules(rules, undoRules)) {
+            ALOGE("Failed to set shared quota rules for %d ifaces", (int) newIfaces.size());
+            return -1;
+        }
+        if (addQuotaRule) {
+            sharedQuotaBytes = maxBytes;
+        }
+        sharedQuotaIfaces.splice(sharedQuotaIfaces.begin(), newIfaces);
+    }
+
+    /* Nothing to commit for a plain value change, just move the counter. */
+    if (maxBytes != sharedQuotaBytes) {
+        res = updateQuota(costName, maxBytes);
+        if (res) {
+            ALOGE("Failed update quota for %s", costName);
+            return -1;
+        }
+        sharedQuotaBytes = maxBytes;
+    }
+    return 0;
+}
+
+int BandwidthController::setInterfaceQuotas(
+        const std::list<std::pair<std::string, int64_t> > &quotas) {
+    std::list<std::pair<std::string, int64_t> >::const_iterator qit;
+    std::list<std::pair<std::string, int64_t> > newQuotas;
+    std::list<std::pair<std::string, int64_t> >::iterator nit;
+    std::list<QuotaInfo>::iterator it;
+    int ruleInsertPos = globalAlertBytes ? 2 : 1;
+    std::string rules, undoRules;
+    int res = 0;
+
+    for (qit = quotas.begin(); qit != quotas.end(); qit++) {
+        if (qit->second <= 0) {
+            ALOGE("Invalid bytes value. 1..max_int64.");
+            return -1;
+        }
+        if (qit->first.size() >= (size_t) MAX_IFACENAME_LEN) {
+            ALOGE("Interface name longer than %d", MAX_IFACENAME_LEN);
+            return -1;
+        }
+    }
+
+    for (qit = quotas.begin(); qit != quotas.end(); qit++) {
+        for (it = quotaIfaces.begin(); it != quotaIfaces.end(); it++) {
+            if (it->ifaceName == qit->first)
+                break;
+        }
+        if (it != quotaIfaces.end())
+            continue;
+        for (nit = newQuotas.begin(); nit != newQuotas.end(); nit++) {
+            if (nit->first == qit->first)
+                break;
+        }
+        if (nit != newQuotas.end()) {
+            /* Last one wins, as with back to back setiquota calls. */
+            nit->second = qit->second;
+            continue;
+        }
+        newQuotas.push_back(*qit);
+    }
+
+    if (!newQuotas.empty()) {
+        for (nit = newQuotas.begin(); nit != newQuotas.end(); nit++) {
+            rules += makeCostlyIfaceRules(nit->first.c_str(), nit->second, ruleInsertPos, false);
+            undoRules += makeCostlyIfaceRules(nit->first.c_str(), nit->second, ruleInsertPos, true);
+        }
+        if (commitRules(rules, undoRules)) {
+            ALOGE("Failed to set quota rules for %d ifaces", (int) newQuotas.size());
+            return -1;
+        }
+        for (nit = newQuotas.begin(); nit != newQuotas.end(); nit++) {
+            quotaIfaces.push_front(QuotaInfo(nit->first, nit->second, 0));
+        }
+    }
+
+    /* Interfaces that already had a quota only need their counter moved. */
+    for (qit = quotas.begin(); qit != quotas.end(); qit++) {
+        for (it = quotaIfaces.begin(); it != quotaIfaces.end(); it++) {
+            if (it->ifaceName == qit->first)
+                break;
+        }
+        if (it->quota == qit->second)
+            continue;
+        if (updateQuota(qit->first.c_str(), qit->second)) {
+            ALOGE("Failed update quota for %s", qit->first.c_str());
+            res = -1;
+            continue;
+        }
+        it->quota = qit->second;
+    }
+    return res;
+}
+
 int BandwidthController::getInterfaceSharedQuota(int64_t *bytes) {
     return getInterfaceQuota("shared", bytes);
 }
 
 int BandwidthController::getInterfaceQuota(const char *costName, int64_t *bytes) {
-    FILE *fp;
-    char *fname;
-    int scanRes;
+    int res;
 
-    asprintf(&fname, "/proc/net/xt_quota/%s", costName);
-    fp = fopen(fname, "r");
-    free(fname);
-    if (!fp) {
+    res = readQuotaCounter(costName, bytes);
+    if (res) {
         ALOGE("Reading quota %s failed (%s)", costName, strerror(errno));
         return -1;
     }
-    scanRes = fscanf(fp, "%lld", bytes);
-    ALOGV("Read quota res=%d bytes=%lld", scanRes, *bytes);
-    fclose(fp);
-    return scanRes == 1 ? 0 : -1;
+    ALOGV("Read quota %s bytes=%lld", costName, *bytes);
+    return 0;
+}
+
+int BandwidthController::readQuotaCounter(const char *quotaName, int64_t *bytes) {
+    std::list<QuotaCounterFd>::iterator it;
+    char buff[32];
+    char *endPtr;
+    ssize_t len = -1;
+
+    for (it = quotaCounterFds.begin(); it != quotaCounterFds.end(); it++) {
+        if (it->name == quotaName)
+            break;
+    }
+
+    for (int attempt = 0; attempt < 2 && len <= 0; attempt++) {
+        if (it == quotaCounterFds.end()) {
+            char *fname;
+            int fd;
+
+            asprintf(&fname, "/proc/net/xt_quota/%s", quotaName);
+            fd = open(fname, O_RDONLY | O_CLOEXEC);
+            free(fname);
+            if (fd < 0) {
+                return -1;
+            }
+            it = quotaCounterFds.insert(quotaCounterFds.end(), QuotaCounterFd(quotaName, fd));
+        }
+        len = pread(it->fd, buff, sizeof(buff) - 1, 0);
+        if (len <= 0) {
+            close(it->fd);
+            quotaCounterFds.erase(it);
+            it = quotaCounterFds.end();
+        }
+    }
+    if (len <= 0) {
+        if (!len)
+            errno = EIO;
+        return -1;
+    }
+
+    buff[len] = '\0';
+    *bytes = strtoll(buff, &endPtr, 10);
+    if (endPtr == buff) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+void BandwidthController::closeQuotaCounterFds(void) {
+    std::list<QuotaCounterFd>::iterator it;
+
+    for (it = quotaCounterFds.begin(); it != quotaCounterFds.end(); it++) {
+        close(it->fd);
+    }
+    quotaCounterFds.clear();
+}
+
+int BandwidthController::getAllQuotas(SocketClient *cli) {
+    std::list<std::string> names;
+    std::list<std::string>::iterator nameIt;
+    std::list<QuotaInfo>::iterator quotaIt;
+    std::list<QuotaCounterFd>::iterator fdIt;
+    std::list<std::pair<std::string, int64_t> > snapshot;
+    std::list<std::pair<std::string, int64_t> >::iterator snapIt;
+    struct timespec now;
+    long long timestamp;
+    DIR *dir;
+    struct dirent *de;
+    char *msg;
+
+    if (sharedQuotaBytes) {
+        names.push_back("shared");
+        if (sharedAlertBytes)
+            names.push_back("sharedAlert");
+    }
+    for (quotaIt = quotaIfaces.begin(); quotaIt != quotaIfaces.end(); quotaIt++) {
+        names.push_back(quotaIt->ifaceName);
+        if (quotaIt->alert)
+            names.push_back(quotaIt->ifaceName + "Alert");
+    }
+    if (globalAlertBytes)
+        names.push_back(ALERT_GLOBAL_NAME);
+
+    /*
+     * The tether counters belong to NatController, which keeps no list of
+     * them. Anything else in xt_quota is one of those, as netd is the only
+     * user of quota2.
+     */
+    if ((dir = opendir("/proc/net/xt_quota"))) {
+        while ((de = readdir(dir))) {
+            if (de->d_name[0] == '.')
+                continue;
+            for (nameIt = names.begin(); nameIt != names.end(); nameIt++) {
+                if (*nameIt == de->d_name)
+                    break;
+            }
+            if (nameIt == names.end())
+                names.push_back(de->d_name);
+        }
+        closedir(dir);
+    } else {
+        ALOGW("Unable to list xt_quota counters (%s)", strerror(errno));
+    }
+
+    /* Don't hold on to counters that are no longer ours. */
+    fdIt = quotaCounterFds.begin();
+    while (fdIt != quotaCounterFds.end()) {
+        for (nameIt = names.begin(); nameIt != names.end(); nameIt++) {
+            if (*nameIt == fdIt->name)
+                break;
+        }
+        if (nameIt == names.end()) {
+            close(fdIt->fd);
+            fdIt = quotaCounterFds.erase(fdIt);
+        } else {
+            fdIt++;
+        }
+    }
+
+    /*
+     * Read everything back to back before talking to the client, so a slow
+     * reader doesn't stretch the snapshot.
+     */
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    timestamp = (long long) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    for (nameIt = names.begin(); nameIt != names.end(); nameIt++) {
+        int64_t bytes;
+        if (readQuotaCounter(nameIt->c_str(), &bytes)) {
+            ALOGE("Reading quota %s failed (%s)", nameIt->c_str(), strerror(errno));
+            continue;
+        }
+        snapshot.push_back(std::pair<std::string, int64_t>(*nameIt, bytes));
+    }
+
+    for (snapIt = snapshot.begin(); snapIt != snapshot.end(); snapIt++) {
+        asprintf(&msg, "%s %lld", snapIt->first.c_str(), snapIt->second);
+        cli->sendMsg(ResponseCode::QuotaCounterListResult, msg, false);
+        free(msg);
+    }
+    asprintf(&msg, "%lld Quota counter list completed", timestamp);
+    cli->sendMsg(ResponseCode::CommandOkay, msg, false);
+    free(msg);
+    return 0;
 }
 
 int BandwidthController::removeInterfaceQuota(const char *iface) {
@@ -813,6 +1230,10 @@ int BandwidthController::removeInterfaceQuota(const char *iface) {
 
     /* This also removes the quota command of CostlyIface chain. */
     res |= cleanupCostlyIface(ifn, QuotaUnique);
+    if (it->alert) {
+        ifaceName += "Alert";
+        clearAlertThresholds(ifaceName.c_str());
+    }
 
     quotaIfaces.erase(it);
 
@@ -895,7 +1316,7 @@ int BandwidthController::runIptablesAlertFwdCmd(IptOp op, const char *alertName,
     return res;
 }
 
-int BandwidthController::setGlobalAlert(int64_t bytes) {
+int BandwidthController::setGlobalAlert(int64_t bytes, const std::list<int64_t> *pending) {
     const char *alertName = ALERT_GLOBAL_NAME;
     int res = 0;
 
@@ -903,6 +1324,7 @@ int BandwidthController::setGlobalAlert(int64_t bytes) {
         ALOGE("Invalid bytes value. 1..max_int64.");
         return -1;
     }
+    resetAlertThresholds(alertName, bytes, pending);
     if (globalAlertBytes) {
         res = updateQuota(alertName, bytes);
     } else {
@@ -912,6 +1334,9 @@ int BandwidthController::setGlobalAlert(int64_t bytes) {
             res |= runIptablesAlertFwdCmd(IptOpInsert, alertName, bytes);
         }
     }
+    if (res && pending) {
+        clearAlertThresholds(alertName);
+    }
     globalAlertBytes = bytes;
     return res;
 }
@@ -951,6 +1376,7 @@ int BandwidthController::removeGlobalAlert(void) {
         res |= runIptablesAlertFwdCmd(IptOpDelete, alertName, globalAlertBytes);
     }
     globalAlertBytes = 0;
+    clearAlertThresholds(alertName);
     return res;
 }
 
@@ -978,7 +1404,7 @@ int BandwidthController::removeGlobalAlertInForwardChain(void) {
     return res;
 }
 
-int BandwidthController::setSharedAlert(int64_t bytes) {
+int BandwidthController::setSharedAlert(int64_t bytes, const std::list<int64_t> *pending) {
     if (!sharedQuotaBytes) {
         ALOGE("Need to have a prior shared quota set to set an alert");
         return -1;
@@ -987,14 +1413,15 @@ int BandwidthController::setSharedAlert(int64_t bytes) {
         ALOGE("Invalid bytes value. 1..max_int64.");
         return -1;
     }
-    return setCostlyAlert("shared", bytes, &sharedAlertBytes);
+    return setCostlyAlert("shared", bytes, &sharedAlertBytes, pending);
 }
 
 int BandwidthController::removeSharedAlert(void) {
     return removeCostlyAlert("shared", &sharedAlertBytes);
 }
 
-int BandwidthController::setInterfaceAlert(const char *iface, int64_t bytes) {
+int BandwidthController::setInterfaceAlert(const char *iface, int64_t bytes,
+                                           const std::list<int64_t> *pending) {
     std::list<QuotaInfo>::iterator it;
 
     if (!bytes) {
@@ -1011,7 +1438,7 @@ int BandwidthController::setInterfaceAlert(const char *iface, int64_t bytes) {
         return -1;
     }
 
-    return setCostlyAlert(iface, bytes, &it->alert);
+    return setCostlyAlert(iface, bytes, &it->alert, pending);
 }
 
 int BandwidthController::removeInterfaceAlert(const char *iface) {
@@ -1030,7 +1457,8 @@ int BandwidthController::removeInterfaceAlert(const char *iface) {
     return removeCostlyAlert(iface, &it->alert);
 }
 
-int BandwidthController::setCostlyAlert(const char *costName, int64_t bytes, int64_t *alertBytes) {
+int BandwidthController::setCostlyAlert(const char *costName, int64_t bytes, int64_t *alertBytes,
+                                        const std::list<int64_t> *pending) {
     char *alertQuotaCmd;
     char *chainName;
     int res = 0;
@@ -1041,8 +1469,9 @@ int BandwidthController::setCostlyAlert(const char *costName, int64_t bytes, int
         return -1;
     }
     asprintf(&alertName, "%sAlert", costName);
+    resetAlertThresholds(alertName, bytes, pending);
     if (*alertBytes) {
-        res = updateQuota(alertName, *alertBytes);
+        res = updateQuota(alertName, bytes);
     } else {
         asprintf(&chainName, "bw_costly_%s", costName);
         asprintf(&alertQuotaCmd, ALERT_IPT_TEMPLATE, "-A", chainName, bytes, alertName);
@@ -1050,6 +1479,9 @@ int BandwidthController::setCostlyAlert(const char *costName, int64_t bytes, int
         free(alertQuotaCmd);
         free(chainName);
     }
+    if (res && pending) {
+        clearAlertThresholds(alertName);
+    }
     *alertBytes = bytes;
     free(alertName);
     return res;
@@ -1074,10 +1506,113 @@ int BandwidthController::removeCostlyAlert(const char *costName, int64_t *alertB
     free(chainName);
 
     *alertBytes = 0;
+    clearAlertThresholds(alertName);
     free(alertName);
     return res;
 }
 
+void BandwidthController::clearAlertThresholds(const char *alertName) {
+    std::list<AlertThresholds>::iterator it;
+
+    pthread_mutex_lock(&alertThresholdsLock);
+    for (it = alertThresholds.begin(); it != alertThresholds.end(); it++) {
+        if (it->alertName == alertName) {
+            alertThresholds.erase(it);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&alertThresholdsLock);
+}
+
+/*
+ * Replaces the thresholds of alertName with pending, if any. Called before
+ * the alert is armed, so that one firing right away finds what to rearm with.
+ */
+void BandwidthController::resetAlertThresholds(const char *alertName, int64_t armed,
+                                               const std::list<int64_t> *pending) {
+    clearAlertThresholds(alertName);
+    if (!pending || pending->empty()) {
+        return;
+    }
+
+    AlertThresholds entry(alertName, armed);
+    entry.pending = *pending;
+    pthread_mutex_lock(&alertThresholdsLock);
+    alertThresholds.push_back(entry);
+    pthread_mutex_unlock(&alertThresholdsLock);
+}
+
+int BandwidthController::setAlerts(const char *scope, int numThresholds,
+                                   const int64_t thresholds[]) {
+    std::list<int64_t> pending;
+
+    if (numThresholds < 1) {
+        ALOGE("Need at least one threshold");
+        return -1;
+    }
+    for (int i = 0; i < numThresholds; i++) {
+        if (thresholds[i] <= 0 || (i && thresholds[i] <= thresholds[i - 1])) {
+            ALOGE("Thresholds must be ascending and in 1..max_int64.");
+            return -1;
+        }
+    }
+
+    for (int i = 1; i < numThresholds; i++) {
+        pending.push_back(thresholds[i]);
+    }
+
+    if (!strcmp(scope, "global")) {
+        return setGlobalAlert(thresholds[0], &pending);
+    } else if (!strcmp(scope, "shared")) {
+        return setSharedAlert(thresholds[0], &pending);
+    }
+    return setInterfaceAlert(scope, thresholds[0], &pending);
+}
+
+int BandwidthController::rearmAlert(const char *alertName, int64_t *crossed) {
+    std::list<AlertThresholds>::iterator it;
+
+    if (!alertName) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&alertThresholdsLock);
+    for (it = alertThresholds.begin(); it != alertThresholds.end(); it++) {
+        if (it->alertName == alertName)
+            break;
+    }
+    if (it == alertThresholds.end()) {
+        pthread_mutex_unlock(&alertThresholdsLock);
+        return -1;
+    }
+
+    *crossed = it->armed;
+    if (it->pending.empty()) {
+        /* The last one stays spent, like a plain alert. */
+        alertThresholds.erase(it);
+    } else {
+        /*
+         * The counter sits at 0 until rewritten, so whatever went by since
+         * it fired is not counted towards the next threshold.
+         */
+        int64_t next = it->pending.front();
+        it->pending.pop_front();
+        if (updateQuota(alertName, next - it->armed)) {
+            ALOGE("Failed to rearm %s for %lld", alertName, next);
+            alertThresholds.erase(it);
+        } else {
+            it->armed = next;
+        }
+    }
+    pthread_mutex_unlock(&alertThresholdsLock);
+
+    /* A restarted netd should rearm from where this one left off. */
+    pthread_mutex_lock(&journalLock);
+    writeJournal();
+    pthread_mutex_unlock(&journalLock);
+    return 0;
+}
+
 /*
  * Parse the ptks and bytes out of:
  *   Chain natctrl_tether_counters (4 references)
@@ -1164,15 +1699,13 @@ int BandwidthController::parseForwardChainStats(SocketClient *cli, const TetherS
         if (stats.rxBytes != -1 && stats.txBytes != -1) {
             ALOGV("rx_bytes=%lld tx_bytes=%lld filterPair=%d", stats.rxBytes, stats.txBytes, filterPair);
             /* Send out stats, and prep for the next if needed. */
-            char *msg = stats.getStatsLine();
             if (filterPair) {
-                cli->sendMsg(ResponseCode::TetheringStatsResult, msg, false);
+                stats.send(cli, ResponseCode::TetheringStatsResult);
                 return 0;
             } else {
-                cli->sendMsg(ResponseCode::TetheringStatsListResult, msg, false);
+                stats.send(cli, ResponseCode::TetheringStatsListResult);
                 stats = filter;
             }
-            free(msg);
         }
     }
     /* Successful if the last stats entry wasn't partial. */
@@ -1190,12 +1723,38 @@ char *BandwidthController::TetherStats::getStatsLine(void) const {
     return msg;
 }
 
+void BandwidthController::TetherStats::send(SocketClient *cli, int code) const {
+    if (BinaryProtocol::Instance()->isBinary(cli)) {
+        std::string payload;
+        BinaryProtocol::putString(&payload, intIface);
+        BinaryProtocol::putString(&payload, extIface);
+        BinaryProtocol::putInt(&payload, rxBytes);
+        BinaryProtocol::putInt(&payload, rxPackets);
+        BinaryProtocol::putInt(&payload, txBytes);
+        BinaryProtocol::putInt(&payload, txPackets);
+        cli->sendBinaryMsg(code, payload.data(), payload.size());
+        return;
+    }
+    char *msg = getStatsLine();
+    cli->sendMsg(code, msg, false);
+    free(msg);
+}
+
 int BandwidthController::getTetherStats(SocketClient *cli, TetherStats &stats, std::string &extraProcessingInfo) {
     int res;
     std::string fullCmd;
     FILE *iptOutput;
     const char *cmd;
 
+    /* Counted from conntrack, IPv6 included, without running iptables. */
+    if (TetherConntrackStats::Instance()->isRunning()) {
+        res = TetherConntrackStats::Instance()->sendStats(cli, stats.intIface, stats.extIface);
+        if (res) {
+            extraProcessingInfo += "Failed to get conntrack tether stats.";
+        }
+        return res;
+    }
+
     /*
      * Why not use some kind of lib to talk to iptables?
      * Because the only libs are libiptc and libip6tc in iptables, and they are
@@ -1219,6 +1778,14 @@ int BandwidthController::getTetherStats(SocketClient *cli, TetherStats &stats, s
     return res;
 }
 
+int BandwidthController::getUidStats(SocketClient *cli, const QtaguidStats::Filter &filter) {
+    return uidStats.sendStats(cli, filter);
+}
+
+int BandwidthController::resetUidStats(void) {
+    return uidStats.reset();
+}
+
 void BandwidthController::flushExistingCostlyTables(bool doClean) {
     int res;
     std::string fullCmd;
@@ -1266,3 +1833,361 @@ void BandwidthController::parseAndFlushCostlyTables(FILE *fp, bool doRemove) {
         }
     }
 }
+
+/*
+ * The journal is a line per item, so that it stays small and a torn
+ * write is easy to spot:
+ *   version <n>
+ *   bootid <kernel boot_id>
+ *   shared <quota> <alert>
+ *   global <alert> <tetherCount>
+ *   sharedif <iface>
+ *   quota <iface> <quota> <alert>
+ *   naughty <uid>
+ *   nice <uid>
+ *   rules <digest of the bw_* and fw_* rules>
+ *   alerts <alertName> <armed> <pending> ...
+ *   end
+ * It is replaced atomically through rename().
+ */
+std::string BandwidthController::makeJournal(void) {
+    std::list<std::string>::iterator ifaceIt;
+    std::list<QuotaInfo>::iterator quotaIt;
+    std::list<int>::iterator uidIt;
+    char bootId[64];
+    std::string journal;
+    char *line;
+
+    if (readBootId(bootId, sizeof(bootId))) {
+        return "";
+    }
+
+    asprintf(&line, "version %d\nbootid %s\nshared %lld %lld\nglobal %lld %d\n",
+             JOURNAL_VERSION, bootId, sharedQuotaBytes, sharedAlertBytes,
+             globalAlertBytes, globalAlertTetherCount);
+    journal = line;
+    free(line);
+    for (ifaceIt = sharedQuotaIfaces.begin(); ifaceIt != sharedQuotaIfaces.end(); ifaceIt++) {
+        asprintf(&line, "sharedif %s\n", ifaceIt->c_str());
+        journal += line;
+        free(line);
+    }
+    for (quotaIt = quotaIfaces.begin(); quotaIt != quotaIfaces.end(); quotaIt++) {
+        asprintf(&line, "quota %s %lld %lld\n", quotaIt->ifaceName.c_str(),
+                 quotaIt->quota, quotaIt->alert);
+        journal += line;
+        free(line);
+    }
+    for (uidIt = naughtyAppUids.begin(); uidIt != naughtyAppUids.end(); uidIt++) {
+        asprintf(&line, "naughty %d\n", *uidIt);
+        journal += line;
+        free(line);
+    }
+    for (uidIt = niceAppUids.begin(); uidIt != niceAppUids.end(); uidIt++) {
+        asprintf(&line, "nice %d\n", *uidIt);
+        journal += line;
+        free(line);
+    }
+    asprintf(&line, "rules %08x\n", rulesDigest);
+    journal += line;
+    free(line);
+    return journal;
+}
+
+void BandwidthController::writeJournal(void) {
+    std::list<AlertThresholds>::iterator alertIt;
+    std::list<int64_t>::iterator pendingIt;
+    std::string journal;
+    std::string tmpPath;
+    char *line;
+    int fd;
+
+    if (journalState.empty()) {
+        if (!lastJournal.empty()) {
+            unlink(JOURNAL_PATH);
+            lastJournal.clear();
+        }
+        return;
+    }
+
+    journal = journalState;
+    pthread_mutex_lock(&alertThresholdsLock);
+    for (alertIt = alertThresholds.begin(); alertIt != alertThresholds.end(); alertIt++) {
+        asprintf(&line, "alerts %s %lld", alertIt->alertName.c_str(), alertIt->armed);
+        journal += line;
+        free(line);
+        for (pendingIt = alertIt->pending.begin(); pendingIt != alertIt->pending.end();
+                pendingIt++) {
+            asprintf(&line, " %lld", *pendingIt);
+            journal += line;
+            free(line);
+        }
+        journal += "\n";
+    }
+    pthread_mutex_unlock(&alertThresholdsLock);
+    journal += "end\n";
+    if (journal == lastJournal) {
+        return;
+    }
+
+    mkdir(JOURNAL_DIR, 0770);
+    tmpPath = JOURNAL_PATH;
+    tmpPath += ".tmp";
+    fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        ALOGE("Unable to open %s (%s)", tmpPath.c_str(), strerror(errno));
+        return;
+    }
+    if (write(fd, journal.c_str(), journal.size()) != (ssize_t) journal.size() || fsync(fd)) {
+        ALOGE("Unable to write %s (%s)", tmpPath.c_str(), strerror(errno));
+        close(fd);
+        unlink(tmpPath.c_str());
+        return;
+    }
+    close(fd);
+    if (rename(tmpPath.c_str(), JOURNAL_PATH)) {
+        ALOGE("Unable to rename %s (%s)", tmpPath.c_str(), strerror(errno));
+        unlink(tmpPath.c_str());
+        return;
+    }
+    lastJournal = journal;
+}
+
+void BandwidthController::syncJournal(bool rulesChanged) {
+    std::list<std::string> chains;
+    std::string state;
+
+    if (bandwidthEnabled) {
+        if (rulesChanged && hashRules(chains, &rulesDigest)) {
+            /* Rules we cannot vouch for must not be adopted. */
+            ALOGE("Unable to take the rules digest, dropping the journal");
+        } else {
+            state = makeJournal();
+        }
+    }
+
+    pthread_mutex_lock(&journalLock);
+    journalState = state;
+    writeJournal();
+    pthread_mutex_unlock(&journalLock);
+}
+
+int BandwidthController::parseJournal(FILE *fp) {
+    char lineBuffer[MAX_IPT_OUTPUT_LINE_LEN];
+    char name[MAX_IPT_OUTPUT_LINE_LEN];
+    char bootId[64];
+    int64_t quota, alert;
+    unsigned int digest;
+    int version = 0;
+    int num;
+    bool bootIdOk = false;
+    bool digestOk = false;
+    bool complete = false;
+
+    while (!complete && fgets(lineBuffer, sizeof(lineBuffer), fp)) {
+        if (sscanf(lineBuffer, "version %d", &version) == 1) {
+            if (version != JOURNAL_VERSION) {
+                ALOGW("Journal version %d, expected %d", version, JOURNAL_VERSION);
+                return -1;
+            }
+        } else if (sscanf(lineBuffer, "bootid %63s", name) == 1) {
+            /* A journal from before a reboot describes rules that are long gone. */
+            bootIdOk = !readBootId(bootId, sizeof(bootId)) && !strcmp(bootId, name);
+            if (!bootIdOk) {
+                return -1;
+            }
+        } else if (sscanf(lineBuffer, "shared %lld %lld", &quota, &alert) == 2) {
+            sharedQuotaBytes = quota;
+            sharedAlertBytes = alert;
+        } else if (sscanf(lineBuffer, "global %lld %d", &alert, &num) == 2) {
+            globalAlertBytes = alert;
+            globalAlertTetherCount = num;
+        } else if (sscanf(lineBuffer, "sharedif %s", name) == 1) {
+            sharedQuotaIfaces.push_back(name);
+        } else if (sscanf(lineBuffer, "quota %s %lld %lld", name, &quota, &alert) == 3) {
+            quotaIfaces.push_back(QuotaInfo(name, quota, alert));
+        } else if (sscanf(lineBuffer, "naughty %d", &num) == 1) {
+            naughtyAppUids.push_back(num);
+        } else if (sscanf(lineBuffer, "nice %d", &num) == 1) {
+            niceAppUids.push_back(num);
+        } else if (sscanf(lineBuffer, "rules %x", &digest) == 1) {
+            rulesDigest = digest;
+            digestOk = true;
+        } else if (sscanf(lineBuffer, "alerts %s %lld%n", name, &alert, &num) == 2) {
+            AlertThresholds entry(name, alert);
+            char *pos = lineBuffer + num;
+            char *end;
+
+            while (*pos && *pos != '\n') {
+                entry.pending.push_back(strtoll(pos, &end, 10));
+                if (end == pos) {
+                    ALOGW("Unexpected journal line <%s>", lineBuffer);
+                    return -1;
+                }
+                pos = end;
+            }
+            pthread_mutex_lock(&alertThresholdsLock);
+            alertThresholds.push_back(entry);
+            pthread_mutex_unlock(&alertThresholdsLock);
+        } else if (!strcmp(lineBuffer, "end\n")) {
+            complete = true;
+        } else {
+            ALOGW("Unexpected journal line <%s>", lineBuffer);
+            return -1;
+        }
+    }
+    if (version != JOURNAL_VERSION || !bootIdOk || !digestOk || !complete) {
+        ALOGW("Incomplete journal");
+        return -1;
+    }
+    return 0;
+}
+
+int BandwidthController::readBootId(char *buff, size_t buffSize) {
+    int size = buffSize - 1;
+
+    if (readFile("/proc/sys/kernel/random/boot_id", buff, &size)) {
+        return -1;
+    }
+    buff[size] = '\0';
+    buff[strcspn(buff, "\n")] = '\0';
+    return 0;
+}
+
+int BandwidthController::listChains(const char *iptPath, const char *table,
+                                    std::list<std::string> &chains, uint32_t *hash) {
+    char lineBuffer[MAX_IPT_OUTPUT_LINE_LEN];
+    char chain[MAX_IPT_OUTPUT_LINE_LEN];
+    std::string fullCmd;
+    FILE *iptOutput;
+
+    fullCmd = iptPath;
+    fullCmd += " -t ";
+    fullCmd += table;
+    fullCmd += " -S";
+    iptOutput = popen(fullCmd.c_str(), "r");
+    if (!iptOutput) {
+        ALOGE("Failed to run %s err=%s", fullCmd.c_str(), strerror(errno));
+        return -1;
+    }
+    /* The command is hashed too, so the same rule in another table differs. */
+    for (const char *p = fullCmd.c_str(); *p; p++) {
+        *hash = *hash * 33 + (unsigned char) *p;
+    }
+    while (fgets(lineBuffer, sizeof(lineBuffer), iptOutput)) {
+        if (sscanf(lineBuffer, "-N %s", chain) == 1) {
+            chains.push_back(chain);
+        }
+        if (sscanf(lineBuffer, "-%*c %s", chain) != 1 ||
+                (strncmp(chain, "bw_", 3) && strncmp(chain, "fw_", 3))) {
+            continue;
+        }
+        for (const char *p = lineBuffer; *p; p++) {
+            *hash = *hash * 33 + (unsigned char) *p;
+        }
+    }
+    return pclose(iptOutput) ? -1 : 0;
+}
+
+int BandwidthController::hashRules(std::list<std::string> &chains, uint32_t *hash) {
+    const char *iptPaths[] = { IPTABLES_PATH, IP6TABLES_PATH };
+    const char *tables[] = { "filter", "raw", "mangle" };
+
+    *hash = 5381;
+    for (unsigned i = 0; i < ARRAY_SIZE(iptPaths); i++) {
+        for (unsigned j = 0; j < ARRAY_SIZE(tables); j++) {
+            if (listChains(iptPaths[i], tables[j], chains, hash)) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * Checks that every quota2 counter the journal implies is there, and that
+ * the bw_* and fw_* rules are the very ones the journal was written for.
+ */
+int BandwidthController::validateJournaledState(void) {
+    std::list<QuotaInfo>::iterator quotaIt;
+    std::list<std::string> wantedCounters;
+    std::list<std::string> chains;
+    std::list<std::string>::iterator it;
+    uint32_t digest;
+    char *path;
+
+    for (quotaIt = quotaIfaces.begin(); quotaIt != quotaIfaces.end(); quotaIt++) {
+        wantedCounters.push_back(quotaIt->ifaceName);
+        if (quotaIt->alert)
+            wantedCounters.push_back(quotaIt->ifaceName + "Alert");
+    }
+    if (sharedQuotaBytes)
+        wantedCounters.push_back("shared");
+    if (sharedAlertBytes)
+        wantedCounters.push_back("sharedAlert");
+    if (globalAlertBytes)
+        wantedCounters.push_back(ALERT_GLOBAL_NAME);
+
+    for (it = wantedCounters.begin(); it != wantedCounters.end(); it++) {
+        asprintf(&path, "/proc/net/xt_quota/%s", it->c_str());
+        int missing = access(path, F_OK);
+        free(path);
+        if (missing) {
+            ALOGW("Journaled quota %s is gone", it->c_str());
+            return -1;
+        }
+    }
+
+    /*
+     * The digest covers every bw_* and fw_* chain and rule, so a missing,
+     * partial or changed ruleset shows.
+     */
+    if (hashRules(chains, &digest)) {
+        return -1;
+    }
+    if (digest != rulesDigest) {
+        ALOGW("Rules changed since the journal was written (%08x, journaled %08x)",
+              digest, rulesDigest);
+        return -1;
+    }
+    return 0;
+}
+
+int BandwidthController::adoptJournal(void) {
+    FILE *fp;
+    int res;
+
+    fp = fopen(JOURNAL_PATH, "r");
+    if (!fp) {
+        return -1;
+    }
+    res = parseJournal(fp);
+    fclose(fp);
+    if (!res) {
+        res = validateJournaledState();
+    }
+
+    if (res) {
+        ALOGI("Not adopting bandwidth journal, starting from scratch");
+        resetState();
+        unlink(JOURNAL_PATH);
+        return -1;
+    }
+
+    /*
+     * NatController starts over, and the framework will re-enable NAT, which
+     * sets the FORWARD alert up again. So take ours out now.
+     */
+    if (globalAlertBytes && globalAlertTetherCount) {
+        runIptablesAlertFwdCmd(IptOpDelete, ALERT_GLOBAL_NAME, globalAlertBytes);
+    }
+    globalAlertTetherCount = 0;
+
+    bandwidthEnabled = true;
+    ALOGI("Adopted bandwidth journal: %d quotas, %d shared, %d naughty, %d nice, %d alerts",
+          (int) quotaIfaces.size(), (int) sharedQuotaIfaces.size(),
+          (int) naughtyAppUids.size(), (int) niceAppUids.size(),
+          (int) alertThresholds.size());
+    syncJournal();
+    return 0;
+}
@@ -16,12 +16,17 @@
 #ifndef _BANDWIDTH_CONTROLLER_H
 #define _BANDWIDTH_CONTROLLER_H
 
+#include <pthread.h>
+
 #include <list>
 #include <string>
 #include <utility>  // for pair
 
 #include <sysutils/SocketClient.h>
 
+#include "IptablesRuleset.h"
+#include "QtaguidStats.h"
+
 class BandwidthController {
 public:
     class TetherStats {
@@ -47,11 +52,36 @@ public:
          * The caller is responsible for free()'ing the returned ptr.
          */
         char *getStatsLine(void) const;
+        /*
+         * Sends this as code: as getStatsLine(), or as tlvs to a
+         * BinaryProtocol client.
+         */
+        void send(SocketClient *cli, int code) const;
     };
 
     BandwidthController();
 
     int setupIptablesHooks(void);
+    /*
+     * Adds what setupIptablesHooks() then enableBandwidthControl(false)
+     * would run to rs instead; rs must have been load()ed.
+     */
+    int compileIptablesHooks(IptablesRuleset *rs);
+
+    /*
+     * The state below, the multi-threshold alerts and a digest of the bw_*
+     * and fw_* rules are journaled so that a restarted netd can take over the
+     * rules its predecessor left in the kernel instead of flushing them.
+     * The firewall keeps no state besides its rules, so the digest is all
+     * it needs.
+     * adoptJournal() loads the journal if the kernel still matches it, rules
+     * included, and returns 0; the caller must then skip setupIptablesHooks()
+     * and enableBandwidthControl(), and leave the bw_* and fw_* chains alone.
+     * syncJournal() rewrites the journal if anything changed; rulesChanged
+     * says to take the digest again, which lists the tables.
+     */
+    int adoptJournal(void);
+    void syncJournal(bool rulesChanged = true);
 
     int enableBandwidthControl(bool force);
     int disableBandwidthControl(void);
@@ -64,6 +94,15 @@ public:
     int getInterfaceQuota(const char *iface, int64_t *bytes);
     int removeInterfaceQuota(const char *iface);
 
+    /*
+     * Multi-interface versions of the above. Interfaces that are new get all
+     * their rules in a single iptables-restore commit per IP version, so
+     * either all of them are set up or none is. Interfaces that already have
+     * a quota only get their counter updated through /proc/net/xt_quota.
+     */
+    int setInterfaceSharedQuotas(int numIfaces, char *ifaces[], int64_t bytes);
+    int setInterfaceQuotas(const std::list<std::pair<std::string, int64_t> > &quotas);
+
     int enableHappyBox(void);
     int disableHappyBox(void);
     int addNaughtyApps(int numUids, char *appUids[]);
@@ -71,17 +110,32 @@ public:
     int addNiceApps(int numUids, char *appUids[]);
     int removeNiceApps(int numUids, char *appUids[]);
 
-    int setGlobalAlert(int64_t bytes);
+    int setGlobalAlert(int64_t bytes, const std::list<int64_t> *pending = NULL);
     int removeGlobalAlert(void);
     int setGlobalAlertInForwardChain(void);
     int removeGlobalAlertInForwardChain(void);
 
-    int setSharedAlert(int64_t bytes);
+    int setSharedAlert(int64_t bytes, const std::list<int64_t> *pending = NULL);
     int removeSharedAlert(void);
 
-    int setInterfaceAlert(const char *iface, int64_t bytes);
+    int setInterfaceAlert(const char *iface, int64_t bytes,
+                          const std::list<int64_t> *pending = NULL);
     int removeInterfaceAlert(const char *iface);
 
+    /*
+     * Sets numThresholds ascending alerts, in bytes from now, for scope
+     * "global", "shared" or an interface with a quota. Only the first one is
+     * a rule; rearmAlert() moves the same counter on to the next one each
+     * time it fires. The remove*Alert() calls drop all of them.
+     */
+    int setAlerts(const char *scope, int numThresholds, const int64_t thresholds[]);
+    /*
+     * Called from the quota2 netlink handler when alertName fired. If it has
+     * thresholds left, arms the next one. Returns 0 with the threshold just
+     * crossed in *crossed, or -1 if alertName is a plain single alert.
+     */
+    int rearmAlert(const char *alertName, int64_t *crossed);
+
     /*
      * For single pair of ifaces, stats should have ifaceIn and ifaceOut initialized.
      * For all pairs, stats should have ifaceIn=ifaceOut="".
@@ -91,6 +145,19 @@ public:
      */
     int getTetherStats(SocketClient *cli, TetherStats &stats, std::string &extraProcessingInfo);
 
+    /*
+     * Snapshots every quota2 counter netd manages: the shared and per
+     * interface quotas, their alerts, the globalAlert and the tether
+     * counters. Sends a QuotaCounterListResult "<name> <bytes>" per counter,
+     * then CommandOkay "<timestamp_ms> ..." with the CLOCK_MONOTONIC time the
+     * snapshot was taken at. Error is to be handled on the outside.
+     */
+    int getAllQuotas(SocketClient *cli);
+
+    /* See QtaguidStats::sendStats(). */
+    int getUidStats(SocketClient *cli, const QtaguidStats::Filter &filter);
+    int resetUidStats(void);
+
     static const char* LOCAL_INPUT;
     static const char* LOCAL_FORWARD;
     static const char* LOCAL_OUTPUT;
@@ -107,6 +174,25 @@ protected:
         int64_t alert;
     };
 
+    /* The thresholds of a setAlerts() alert not yet crossed. */
+    class AlertThresholds {
+    public:
+      AlertThresholds(std::string n, int64_t a)
+              : alertName(n), armed(a) {};
+        std::string alertName;
+        int64_t armed;
+        std::list<int64_t> pending;
+    };
+
+    /* Keeps /proc/net/xt_quota/<name> open between reads. */
+    class QuotaCounterFd {
+    public:
+      QuotaCounterFd(std::string n, int f)
+              : name(n), fd(f) {};
+        std::string name;
+        int fd;
+    };
+
     enum IptIpVer { IptIpV4, IptIpV6 };
     enum IptOp { IptOpInsert, IptOpReplace, IptOpDelete, IptOpAppend };
     enum IptJumpOp { IptJumpReject, IptJumpReturn, IptJumpNoAdd };
@@ -131,6 +217,9 @@ protected:
 
     std::string makeIptablesSpecialAppCmd(IptOp op, int uid, const char *chain);
     std::string makeIptablesQuotaCmd(IptOp op, const char *costName, int64_t quota);
+    std::string makeCostlyIfaceRules(const char *ifn, int64_t quota, int ruleInsertPos,
+                                     bool undo);
+    int commitRules(const std::string &rules, const std::string &undoRules);
 
     int runIptablesAlertCmd(IptOp op, const char *alertName, int64_t bytes);
     int runIptablesAlertFwdCmd(IptOp op, const char *alertName, int64_t bytes);
@@ -149,8 +238,20 @@ protected:
 
     int updateQuota(const char *alertName, int64_t bytes);
 
-    int setCostlyAlert(const char *costName, int64_t bytes, int64_t *alertBytes);
+    /*
+     * Reads a quota2 counter through quotaCounterFds, opening it on first use.
+     * A cached fd whose counter was deleted (and maybe recreated) fails the
+     * read, so it is reopened once before giving up.
+     */
+    int readQuotaCounter(const char *quotaName, int64_t *bytes);
+    void closeQuotaCounterFds(void);
+
+    int setCostlyAlert(const char *costName, int64_t bytes, int64_t *alertBytes,
+                       const std::list<int64_t> *pending);
     int removeCostlyAlert(const char *costName, int64_t *alertBytes);
+    void clearAlertThresholds(const char *alertName);
+    void resetAlertThresholds(const char *alertName, int64_t armed,
+                              const std::list<int64_t> *pending);
 
     /*
      * stats should never have only intIface initialized. Other 3 combos are ok.
@@ -179,6 +280,25 @@ protected:
      * Deals with both ip4 and ip6 tables.
      */
     void flushCleanTables(bool doClean);
+    /* Forgets all quotas, alerts and app lists. */
+    void resetState(void);
+    /* Adds one of the IPT_*_COMMANDS to rs. */
+    static void compileCommand(IptablesRuleset *rs, const char *cmd);
+
+    std::string makeJournal(void);
+    /* Writes journalState and the alerts; call with journalLock held. */
+    void writeJournal(void);
+    int parseJournal(FILE *fp);
+    int validateJournaledState(void);
+    /*
+     * Adds the chains "<iptables> -t table -S" lists to chains, and folds
+     * the rules of the bw_* and fw_* ones into hash.
+     */
+    static int listChains(const char *iptPath, const char *table,
+                          std::list<std::string> &chains, uint32_t *hash);
+    /* Over filter, raw and mangle, for both families. */
+    static int hashRules(std::list<std::string> &chains, uint32_t *hash);
+    static int readBootId(char *buff, size_t buffSize);
 
     /*------------------*/
 
@@ -199,6 +319,31 @@ protected:
     std::list<QuotaInfo> quotaIfaces;
     std::list<int /*appUid*/> naughtyAppUids;
     std::list<int /*appUid*/> niceAppUids;
+    std::list<QuotaCounterFd> quotaCounterFds;
+    QtaguidStats uidStats;
+
+    /* Between enableBandwidthControl() and disableBandwidthControl(). */
+    bool bandwidthEnabled;
+    /* Of the rules when syncJournal() last took it. */
+    uint32_t rulesDigest;
+
+    /*
+     * The netlink thread rewrites the journal too, when rearmAlert() moves
+     * on to the next threshold. So these are only touched with journalLock
+     * held, which is taken before alertThresholdsLock.
+     */
+    /* The journal up to the alerts, empty for none. */
+    std::string journalState;
+    /* What writeJournal() last wrote. */
+    std::string lastJournal;
+    pthread_mutex_t journalLock;
+
+    /*
+     * Unlike the rest, this is also used from the netlink thread through
+     * rearmAlert(), so it is only touched with alertThresholdsLock held.
+     */
+    std::list<AlertThresholds> alertThresholds;
+    pthread_mutex_t alertThresholdsLock;
 
 private:
     static const char *IPT_FLUSH_COMMANDS[];
@@ -208,6 +353,9 @@ private:
 
     /* Alphabetical */
     static const char ALERT_GLOBAL_NAME[];
+    static const char JOURNAL_DIR[];
+    static const char JOURNAL_PATH[];
+    static const int  JOURNAL_VERSION;
     static const int  MAX_CMD_ARGS;
     static const int  MAX_CMD_LEN;
     static const int  MAX_IFACENAME_LEN;
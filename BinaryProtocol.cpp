@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#define LOG_TAG "BinaryProtocol"
+#include <cutils/log.h>
+
+#include "BinaryProtocol.h"
+
+BinaryProtocol::BinaryProtocol() {
+    pthread_mutex_init(&mLock, NULL);
+}
+
+BinaryProtocol *BinaryProtocol::Instance() {
+    static BinaryProtocol sInstance;
+    return &sInstance;
+}
+
+BinaryProtocol::Client *BinaryProtocol::findClient(SocketClient *cli) {
+    std::list<Client>::iterator it;
+
+    for (it = mClients.begin(); it != mClients.end(); it++) {
+        if (it->cli == cli) {
+            return &*it;
+        }
+    }
+    return NULL;
+}
+
+void BinaryProtocol::setBinary(SocketClient *cli, bool binary) {
+    pthread_mutex_lock(&mLock);
+    if (binary && !findClient(cli)) {
+        Client client;
+        client.cli = cli;
+        mClients.push_back(client);
+    } else if (!binary) {
+        std::list<Client>::iterator it;
+        for (it = mClients.begin(); it != mClients.end(); it++) {
+            if (it->cli == cli) {
+                mClients.erase(it);
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&mLock);
+}
+
+bool BinaryProtocol::isBinary(SocketClient *cli) {
+    bool binary;
+
+    pthread_mutex_lock(&mLock);
+    binary = findClient(cli) != NULL;
+    pthread_mutex_unlock(&mLock);
+    return binary;
+}
+
+static uint16_t get16(const uint8_t *p) {
+    return (p[0] << 8) | p[1];
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+bool BinaryProtocol::decode(const uint8_t *buf, uint32_t len, Request *request) {
+    uint32_t off = 4;
+
+    if (len < 4) {
+        return false;
+    }
+    request->cmdNum = (int) get32(buf);
+    request->args.clear();
+
+    while (off < len) {
+        if (len - off < 4 || request->args.size() >= MAX_ARGS) {
+            return false;
+        }
+        uint16_t type = get16(buf + off);
+        uint16_t valueLen = get16(buf + off + 2);
+        const uint8_t *value = buf + off + 4;
+        char arg[INET6_ADDRSTRLEN];
+
+        off += 4;
+        if (len - off < valueLen) {
+            return false;
+        }
+        off += valueLen;
+
+        if (request->args.empty() && type != TLV_STRING) {
+            return false;
+        }
+        switch (type) {
+        case TLV_STRING:
+            if (memchr(value, '\0', valueLen)) {
+                return false;
+            }
+            request->args.push_back(std::string((const char *) value, valueLen));
+            break;
+        case TLV_INT:
+            if (valueLen != 8) {
+                return false;
+            }
+            snprintf(arg, sizeof(arg), "%lld",
+                     (long long) (((uint64_t) get32(value) << 32) | get32(value + 4)));
+            request->args.push_back(arg);
+            break;
+        case TLV_ADDR:
+            if ((valueLen != 4 && valueLen != 16) ||
+                    !inet_ntop(valueLen == 4 ? AF_INET : AF_INET6, value, arg, sizeof(arg))) {
+                return false;
+            }
+            request->args.push_back(arg);
+            break;
+        case TLV_UID:
+            if (valueLen != 4) {
+                return false;
+            }
+            snprintf(arg, sizeof(arg), "%u", get32(value));
+            request->args.push_back(arg);
+            break;
+        default:
+            return false;
+        }
+    }
+    return !request->args.empty();
+}
+
+bool BinaryProtocol::receive(SocketClient *cli, std::list<Request> *requests) {
+    char buf[4096];
+    ssize_t len;
+    Client *client;
+    bool ok = true;
+
+    len = TEMP_FAILURE_RETRY(read(cli->getSocket(), buf, sizeof(buf)));
+    if (len <= 0) {
+        if (len < 0) {
+            ALOGE("read() failed (%s)", strerror(errno));
+        }
+        setBinary(cli, false);
+        return false;
+    }
+
+    pthread_mutex_lock(&mLock);
+    if (!(client = findClient(cli))) {
+        pthread_mutex_unlock(&mLock);
+        return false;
+    }
+    client->pending.append(buf, len);
+
+    size_t off = 0;
+    while (client->pending.size() - off >= 4) {
+        const uint8_t *frame = (const uint8_t *) client->pending.data() + off;
+        uint32_t frameLen = get32(frame);
+        Request request;
+
+        if (frameLen > MAX_FRAME_LEN) {
+            ALOGE("Dropping client with a %u byte frame", frameLen);
+            ok = false;
+            break;
+        }
+        if (client->pending.size() - off - 4 < frameLen) {
+            break;
+        }
+        if (!decode(frame + 4, frameLen, &request)) {
+            ALOGE("Dropping client with a malformed frame");
+            ok = false;
+            break;
+        }
+        requests->push_back(request);
+        off += 4 + frameLen;
+    }
+    client->pending.erase(0, off);
+    pthread_mutex_unlock(&mLock);
+
+    if (!ok) {
+        setBinary(cli, false);
+    }
+    return ok;
+}
+
+void BinaryProtocol::putTlv(std::string *out, uint16_t type, const void *value, uint16_t len) {
+    uint8_t header[4] = { (uint8_t) (type >> 8), (uint8_t) type,
+                          (uint8_t) (len >> 8), (uint8_t) len };
+
+    out->append((const char *) header, sizeof(header));
+    out->append((const char *) value, len);
+}
+
+void BinaryProtocol::putString(std::string *out, const std::string &value) {
+    putTlv(out, TLV_STRING, value.data(), value.size());
+}
+
+void BinaryProtocol::putInt(std::string *out, int64_t value) {
+    uint8_t buf[8];
+
+    for (int i = 0; i < 8; i++) {
+        buf[i] = (uint8_t) ((uint64_t) value >> (56 - 8 * i));
+    }
+    putTlv(out, TLV_INT, buf, sizeof(buf));
+}
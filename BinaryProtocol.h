@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _BINARY_PROTOCOL_H
+#define _BINARY_PROTOCOL_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <list>
+#include <string>
+#include <vector>
+
+#include <sysutils/SocketClient.h>
+
+/*
+ * Length prefixed binary requests on the netd socket, as an alternative
+ * to the text commands that FrameworkListener tokenizes.
+ *
+ * A client switches with "protocol binary" and, once that has been
+ * answered, sends frames instead of text:
+ *   <u32 length of the rest> <u32 command number> <tlv>...
+ * each tlv being
+ *   <u16 type> <u16 length> <value>
+ * all big endian. The first tlv is the command name as a TLV_STRING; the
+ * rest are its arguments, which commands get as the usual argv strings,
+ * without any quoting or escaping to undo.
+ *
+ * Replies stay the usual text lines, except for those that have a binary
+ * form, which come through SocketClient::sendBinaryMsg() with tlvs for a
+ * payload:
+ *   TetheringStatsResult, TetheringStatsListResult
+ *       STRING intIface, STRING extIface,
+ *       INT rxBytes, INT rxPackets, INT txBytes, INT txPackets
+ */
+class BinaryProtocol {
+public:
+    enum {
+        TLV_STRING = 1,     /* Bytes, without a NUL */
+        TLV_INT    = 2,     /* 8 bytes, signed */
+        TLV_ADDR   = 3,     /* 4 or 16 bytes, IPv4 or IPv6 */
+        TLV_UID    = 4,     /* 4 bytes */
+    };
+
+    class Request {
+    public:
+        int cmdNum;
+        std::vector<std::string> args;
+    };
+
+    static BinaryProtocol *Instance();
+
+    void setBinary(SocketClient *cli, bool binary);
+    bool isBinary(SocketClient *cli);
+
+    /*
+     * Reads what a binary client sent and decodes every complete frame into
+     * requests. Returns false when the client went away or sent a frame that
+     * doesn't decode; it is then back to text, and should be dropped.
+     */
+    bool receive(SocketClient *cli, std::list<Request> *requests);
+
+    static void putString(std::string *out, const std::string &value);
+    static void putInt(std::string *out, int64_t value);
+
+private:
+    static const uint32_t MAX_FRAME_LEN = 65536;
+    static const size_t MAX_ARGS = 64;
+
+    class Client {
+    public:
+        SocketClient *cli;
+        /* Bytes of a frame not complete yet. */
+        std::string pending;
+    };
+
+    BinaryProtocol();
+    Client *findClient(SocketClient *cli);
+    static bool decode(const uint8_t *buf, uint32_t len, Request *request);
+    static void putTlv(std::string *out, uint16_t type, const void *value, uint16_t len);
+
+    std::list<Client> mClients;
+    pthread_mutex_t mLock;
+};
+
+#endif
@@ -13,8 +13,11 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <signal.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 
@@ -25,22 +28,18 @@
 
 ClatdController::ClatdController() {
     mClatdPid = 0;
+    mStoppingPid = 0;
+    mInterface = NULL;
+    pthread_mutex_init(&mLock, NULL);
 }
 
 ClatdController::~ClatdController() {
+    free(mInterface);
 }
 
-int ClatdController::startClatd(char *interface) {
+pid_t ClatdController::spawnClatd(char *interface) {
     pid_t pid;
 
-    if(mClatdPid != 0) {
-        ALOGE("clatd already running");
-        errno = EBUSY;
-        return -1;
-    }
-
-    ALOGD("starting clatd");
-
     if ((pid = fork()) < 0) {
         ALOGE("fork failed (%s)", strerror(errno));
         return -1;
@@ -59,39 +58,124 @@ int ClatdController::startClatd(char *interface) {
         ALOGE("Should never get here!");
         free(args);
         _exit(0);
-    } else {
-        mClatdPid = pid;
-        ALOGD("clatd started");
     }
+    return pid;
+}
+
+int ClatdController::startClatd(char *interface) {
+    pid_t pid;
+
+    pthread_mutex_lock(&mLock);
+    pid = mStoppingPid;
+    pthread_mutex_unlock(&mLock);
+
+    // clatd holds the tun device until it is gone, so a previous instance
+    // that is still exiting has to finish first (the supervisor SIGKILLs
+    // stragglers).
+    if (pid != 0 &&
+        ProcessSupervisor::Instance()->waitForExit(pid,
+                ProcessSupervisor::DEFAULT_STOP_TIMEOUT_MS + 500)) {
+        ALOGE("clatd (%d) did not exit", pid);
+    }
+
+    pthread_mutex_lock(&mLock);
+    if(mClatdPid != 0) {
+        pthread_mutex_unlock(&mLock);
+        ALOGE("clatd already running");
+        errno = EBUSY;
+        return -1;
+    }
+
+    ALOGD("starting clatd");
+
+    free(mInterface);
+    mInterface = strdup(interface);
+    if ((pid = spawnClatd(mInterface)) < 0) {
+        pthread_mutex_unlock(&mLock);
+        return -1;
+    }
+    mClatdPid = pid;
+    pthread_mutex_unlock(&mLock);
 
+    ProcessSupervisor::Instance()->watch(pid, "clatd", this,
+                                         ProcessSupervisor::RESTART_ON_FAILURE);
+    ALOGD("clatd started");
     return 0;
 }
 
 int ClatdController::stopClatd() {
-    if (mClatdPid == 0) {
+    pid_t pid;
+
+    pthread_mutex_lock(&mLock);
+    pid = mClatdPid;
+    mClatdPid = 0;
+    if (pid != 0) {
+        mStoppingPid = pid;
+    }
+    pthread_mutex_unlock(&mLock);
+
+    if (pid == 0) {
         ALOGE("clatd already stopped");
         return -1;
     }
 
     ALOGD("Stopping clatd");
+    ProcessSupervisor::Instance()->stop(pid);
+    return 0;
+}
 
-    kill(mClatdPid, SIGTERM);
-    waitpid(mClatdPid, NULL, 0);
-    mClatdPid = 0;
+bool ClatdController::isClatdStarted() {
+    bool started;
 
-    ALOGD("clatd stopped");
+    pthread_mutex_lock(&mLock);
+    started = (mClatdPid != 0);
+    pthread_mutex_unlock(&mLock);
+    return started;
+}
 
-    return 0;
+void ClatdController::onChildExited(pid_t pid, int status) {
+    pthread_mutex_lock(&mLock);
+    if (mClatdPid == pid) {
+        ALOGE("clatd exited unexpectedly");
+        mClatdPid = 0; // child exited, let it be started again
+    } else {
+        ALOGD("clatd stopped");
+        if (mStoppingPid == pid) {
+            mStoppingPid = 0;
+        }
+    }
+    pthread_mutex_unlock(&mLock);
 }
 
-bool ClatdController::isClatdStarted() {
-    pid_t waitpid_status;
-    if(mClatdPid == 0) {
-        return false;
+pid_t ClatdController::onChildRestart(pid_t pid) {
+    pid_t newPid;
+    char *interface;
+
+    pthread_mutex_lock(&mLock);
+    // Only restart if nobody called stopClatd() in the meantime.
+    if (mClatdPid != pid) {
+        pthread_mutex_unlock(&mLock);
+        return -1;
     }
-    waitpid_status = waitpid(mClatdPid, NULL, WNOHANG);
-    if(waitpid_status != 0) {
-        mClatdPid = 0; // child exited, don't call waitpid on it again
+    interface = strdup(mInterface);
+    pthread_mutex_unlock(&mLock);
+
+    // Forked without mLock, so stopClatd() and isClatdStarted() never wait on it.
+    ALOGW("clatd died, restarting on %s", interface);
+    newPid = spawnClatd(interface);
+    free(interface);
+
+    pthread_mutex_lock(&mLock);
+    if (mClatdPid != pid) {
+        // stopClatd() ran while we forked; it found nothing to stop.
+        pthread_mutex_unlock(&mLock);
+        if (newPid > 0) {
+            kill(newPid, SIGKILL);
+            waitpid(newPid, NULL, 0);
+        }
+        return -1;
     }
-    return waitpid_status == 0; // 0 while child is running
+    mClatdPid = (newPid > 0 ? newPid : 0);
+    pthread_mutex_unlock(&mLock);
+    return newPid;
 }
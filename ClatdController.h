@@ -17,8 +17,15 @@
 #ifndef _CLATD_CONTROLLER_H
 #define _CLATD_CONTROLLER_H
 
-class ClatdController {
+#include <pthread.h>
+
+#include "ProcessSupervisor.h"
+
+class ClatdController : public ProcessSupervisor::Client {
     pid_t mClatdPid;
+    pid_t mStoppingPid; // stopped but maybe not gone yet
+    char *mInterface;
+    pthread_mutex_t mLock; // mClatdPid is also updated from the supervisor thread
 
 public:
     ClatdController();
@@ -27,6 +34,12 @@ public:
     int startClatd(char *interface);
     int stopClatd();
     bool isClatdStarted();
+
+    virtual void onChildExited(pid_t pid, int status);
+    virtual pid_t onChildRestart(pid_t pid);
+
+private:
+    pid_t spawnClatd(char *interface);
 };
 
 #endif
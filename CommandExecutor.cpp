@@ -0,0 +1,372 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <vector>
+
+#define LOG_TAG "CommandExecutor"
+
+#include <cutils/log.h>
+#include <logwrap/logwrap.h>
+
+#include "CommandExecutor.h"
+#include "CommandTrace.h"
+#include "LatencyMetrics.h"
+#include "NetdConstants.h"
+#include "ResponseCode.h"
+
+CommandExecutor *CommandExecutor::sCurrent = NULL;
+
+CommandExecutor *CommandExecutor::get() {
+    return sCurrent ? sCurrent : ForkExecutor::Instance();
+}
+
+void CommandExecutor::set(CommandExecutor *executor) {
+    if (get()->flush()) {
+        ALOGE("Some commands held by the %s executor failed", get()->getName());
+    }
+    sCurrent = executor;
+}
+
+ForkExecutor *ForkExecutor::Instance() {
+    static ForkExecutor sInstance;
+    return &sInstance;
+}
+
+/*
+ * Into "exec.<binary>.<exit code>" and the trace; -1 for children that did
+ * not exit.
+ */
+static void recordExec(int argc, const char **argv, int exitCode, int64_t startUs) {
+    const char *binary = strrchr(argv[0], '/');
+    char name[64];
+
+    CommandTrace::Instance()->execEnd(argc, argv, startUs, exitCode);
+    snprintf(name, sizeof(name), "exec.%s.%d", binary ? binary + 1 : argv[0], exitCode);
+    LatencyMetrics::Instance()->record(name, LatencyMetrics::nowUs() - startUs);
+}
+
+int ForkExecutor::execvp(int argc, const char **argv, int *status, bool logwrap) {
+    int64_t start = LatencyMetrics::nowUs();
+    int res;
+
+    CommandTrace::Instance()->execStart(argc, argv);
+    res = android_fork_execvp(argc, (char **) argv, status, false, logwrap);
+    if (!status) {
+        recordExec(argc, argv, res, start);
+    } else if (!res) {
+        recordExec(argc, argv, WIFEXITED(*status) ? WEXITSTATUS(*status) : -1, start);
+    } else {
+        recordExec(argc, argv, -1, start);
+    }
+    return res;
+}
+
+int ForkExecutor::execWithInput(const char **argv, const std::string &input) {
+    const char *path = argv[0];
+    int argc = 0;
+    int64_t start = LatencyMetrics::nowUs();
+    int pipeFds[2];
+    int status;
+    pid_t pid;
+
+    if (pipe(pipeFds) < 0) {
+        ALOGE("pipe failed (%s)", strerror(errno));
+        return -1;
+    }
+
+    if ((pid = fork()) < 0) {
+        ALOGE("fork failed (%s)", strerror(errno));
+        close(pipeFds[0]);
+        close(pipeFds[1]);
+        return -1;
+    }
+
+    if (!pid) {
+        sigset_t mask;
+
+        sigemptyset(&mask);
+        sigprocmask(SIG_SETMASK, &mask, NULL);
+        dup2(pipeFds[0], STDIN_FILENO);
+        close(pipeFds[0]);
+        close(pipeFds[1]);
+        execv(path, (char **) argv);
+        ALOGE("execv(%s) failed (%s)", path, strerror(errno));
+        _exit(127);
+    }
+
+    while (argv[argc]) {
+        argc++;
+    }
+    CommandTrace::Instance()->execStart(argc, argv);
+    close(pipeFds[0]);
+    const char *buf = input.c_str();
+    size_t left = input.size();
+    while (left > 0) {
+        ssize_t len = write(pipeFds[1], buf, left);
+        if (len < 0) {
+            if (errno == EINTR)
+                continue;
+            /* The child died early; its exit status says why. */
+            ALOGE("Writing to %s failed (%s)", path, strerror(errno));
+            break;
+        }
+        buf += len;
+        left -= len;
+    }
+    close(pipeFds[1]);
+
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            ALOGE("waitpid(%s) failed (%s)", path, strerror(errno));
+            recordExec(argc, argv, -1, start);
+            return -1;
+        }
+    }
+    recordExec(argc, argv, WIFEXITED(status) ? WEXITSTATUS(status) : -1, start);
+    if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+        ALOGE("%s exited with status %d; rejected input:\n%s", path, status, input.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+BatchExecutor::BatchExecutor() {
+    pthread_mutex_init(&mLock, NULL);
+}
+
+std::string BatchExecutor::toRestoreLine(const char **argv, int argc, std::string *table) {
+    static const char *batchedOps[] = { "-A", "-D", "-I", "-R", "-N", "-F", "-X" };
+    std::string line;
+    int i = 1;
+
+    *table = "filter";
+    if (i + 1 < argc && argv[i] && argv[i + 1] && !strcmp(argv[i], "-t")) {
+        *table = argv[i + 1];
+        i += 2;
+    }
+    if (i >= argc || !argv[i]) {
+        return "";
+    }
+    unsigned int op;
+    for (op = 0; op < ARRAY_SIZE(batchedOps); op++) {
+        if (!strcmp(argv[i], batchedOps[op]))
+            break;
+    }
+    if (op == ARRAY_SIZE(batchedOps)) {
+        return "";
+    }
+    for (; i < argc && argv[i]; i++) {
+        /* Not worth quoting; those run on their own. */
+        if (!argv[i][0] || strpbrk(argv[i], " \t\n\"'")) {
+            return "";
+        }
+        if (!line.empty()) {
+            line += " ";
+        }
+        line += argv[i];
+    }
+    return line;
+}
+
+int BatchExecutor::execvp(int argc, const char **argv, int *status, bool logwrap) {
+    int family = -1;
+    std::string table, line;
+
+    if (!strcmp(argv[0], IPTABLES_PATH)) {
+        family = 0;
+    } else if (!strcmp(argv[0], IP6TABLES_PATH)) {
+        family = 1;
+    }
+    if (family != -1) {
+        line = toRestoreLine(argv, argc, &table);
+    }
+    if (line.empty()) {
+        flush();
+        return ForkExecutor::Instance()->execvp(argc, argv, status, logwrap);
+    }
+
+    pthread_mutex_lock(&mLock);
+    mQueued[family].push_back(std::make_pair(table, line));
+    pthread_mutex_unlock(&mLock);
+    if (status) {
+        *status = 0;
+    }
+    return 0;
+}
+
+int BatchExecutor::execWithInput(const char **argv, const std::string &input) {
+    flush();
+    return ForkExecutor::Instance()->execWithInput(argv, input);
+}
+
+/*
+ * One iptables-restore per table of each family. A single rejected line
+ * fails its whole commit, and deletes of rules that may not be there are
+ * common, so a rejected table is replayed one command at a time. Each table
+ * goes on its own because iptables-restore applies every table at its own
+ * COMMIT: replaying a batch of several after a later table was rejected
+ * would apply the earlier ones twice.
+ */
+int BatchExecutor::flush() {
+    const char *paths[] = { IPTABLES_PATH, IP6TABLES_PATH };
+    const char *restorePaths[] = { IPTABLES_RESTORE_PATH, IP6TABLES_RESTORE_PATH };
+    std::list<std::pair<std::string, std::string> > queued[2];
+    std::list<std::pair<std::string, std::string> >::iterator it;
+    int res = 0;
+
+    pthread_mutex_lock(&mLock);
+    for (int family = 0; family < 2; family++) {
+        queued[family].swap(mQueued[family]);
+    }
+    pthread_mutex_unlock(&mLock);
+
+    for (int family = 0; family < 2; family++) {
+        std::list<std::string> tables;
+        std::list<std::string>::iterator tableIt;
+
+        for (it = queued[family].begin(); it != queued[family].end(); it++) {
+            tables.push_back(it->first);
+        }
+        tables.sort();
+        tables.unique();
+        for (tableIt = tables.begin(); tableIt != tables.end(); tableIt++) {
+            std::string input = "*" + *tableIt + "\n";
+            int count = 0;
+
+            for (it = queued[family].begin(); it != queued[family].end(); it++) {
+                if (it->first == *tableIt) {
+                    input += it->second + "\n";
+                    count++;
+                }
+            }
+            input += "COMMIT\n";
+            const char *restoreArgv[] = { restorePaths[family], "--noflush", NULL };
+            if (!ForkExecutor::Instance()->execWithInput(restoreArgv, input)) {
+                continue;
+            }
+
+            ALOGW("Batch for table %s rejected, replaying %d commands one by one",
+                  tableIt->c_str(), count);
+            for (it = queued[family].begin(); it != queued[family].end(); it++) {
+                if (it->first != *tableIt) {
+                    continue;
+                }
+                std::vector<char> words(it->second.begin(), it->second.end());
+                std::vector<const char *> argv;
+                char *next;
+                char *word;
+
+                words.push_back('\0');
+                next = &words[0];
+                argv.push_back(paths[family]);
+                argv.push_back("-t");
+                argv.push_back(it->first.c_str());
+                while ((word = strsep(&next, " "))) {
+                    argv.push_back(word);
+                }
+                argv.push_back(NULL);
+                if (ForkExecutor::Instance()->execvp(argv.size() - 1, &argv[0], NULL, false)) {
+                    res = -1;
+                }
+            }
+        }
+    }
+    return res;
+}
+
+const size_t RecordingExecutor::MAX_RECORDS = 4096;
+
+RecordingExecutor::RecordingExecutor() {
+    pthread_mutex_init(&mLock, NULL);
+    mDropped = 0;
+}
+
+int RecordingExecutor::execvp(int argc, const char **argv, int *status, bool logwrap) {
+    std::string record;
+
+    for (int i = 0; i < argc && argv[i]; i++) {
+        if (i) {
+            record += " ";
+        }
+        record += argv[i];
+    }
+    pthread_mutex_lock(&mLock);
+    if (mRecords.size() < MAX_RECORDS) {
+        mRecords.push_back(record);
+    } else {
+        mDropped++;
+    }
+    pthread_mutex_unlock(&mLock);
+    if (status) {
+        *status = 0;
+    }
+    return 0;
+}
+
+int RecordingExecutor::execWithInput(const char **argv, const std::string &input) {
+    std::list<std::string> lines;
+    size_t start = 0;
+    int argc = 0;
+
+    while (argv[argc]) {
+        argc++;
+    }
+    execvp(argc, argv, NULL, false);
+    /* One record per input line, indented under its command. */
+    while (start < input.size()) {
+        size_t end = input.find('\n', start);
+        if (end == std::string::npos) {
+            end = input.size();
+        }
+        lines.push_back("  " + input.substr(start, end - start));
+        start = end + 1;
+    }
+    pthread_mutex_lock(&mLock);
+    if (mRecords.size() + lines.size() <= MAX_RECORDS) {
+        mRecords.splice(mRecords.end(), lines);
+    } else {
+        mDropped += lines.size();
+    }
+    pthread_mutex_unlock(&mLock);
+    return 0;
+}
+
+void RecordingExecutor::dump(SocketClient *cli) {
+    std::list<std::string>::iterator it;
+    char *msg;
+
+    pthread_mutex_lock(&mLock);
+    for (it = mRecords.begin(); it != mRecords.end(); it++) {
+        cli->sendMsg(ResponseCode::CommandRecordResult, it->c_str(), false);
+    }
+    asprintf(&msg, "%d commands recorded, %d dropped", (int) mRecords.size(), (int) mDropped);
+    pthread_mutex_unlock(&mLock);
+    cli->sendMsg(ResponseCode::CommandOkay, msg, false);
+    free(msg);
+}
+
+void RecordingExecutor::clear() {
+    pthread_mutex_lock(&mLock);
+    mRecords.clear();
+    mDropped = 0;
+    pthread_mutex_unlock(&mLock);
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _COMMAND_EXECUTOR_H
+#define _COMMAND_EXECUTOR_H
+
+#include <pthread.h>
+
+#include <list>
+#include <string>
+#include <utility>
+
+#include <sysutils/SocketClient.h>
+
+/*
+ * Everything netd runs to change rules and routes (iptables, ip, tc, the
+ * restore tools) goes through the current executor, so the way commands
+ * reach the kernel can be swapped without touching the controllers:
+ *
+ *  - ForkExecutor runs each command, as netd always did.
+ *  - BatchExecutor queues iptables/ip6tables rule changes and applies them
+ *    with one iptables-restore per table on flush(). Anything else flushes
+ *    the queue and runs as usual.
+ *  - RecordingExecutor runs nothing; it keeps each command in memory and
+ *    reports success.
+ *
+ * With the last two, failures are either late or never seen, so they are
+ * for measuring netd's own cost per ndc command against the fork/exec one,
+ * not for normal use. Commands that read output (popen) always run.
+ */
+class CommandExecutor {
+public:
+    virtual ~CommandExecutor() {}
+
+    /* Same contract as android_fork_execvp(); argv may be NULL padded. */
+    virtual int execvp(int argc, const char **argv, int *status, bool logwrap) = 0;
+    /* Runs argv with input on its stdin; returns 0 if it exited with 0. */
+    virtual int execWithInput(const char **argv, const std::string &input) = 0;
+    /* Applies anything held back; returns -1 if some of it failed. */
+    virtual int flush() { return 0; }
+    virtual const char *getName() = 0;
+
+    static CommandExecutor *get();
+    /* Flushes the current executor, then switches; NULL means fork/exec. */
+    static void set(CommandExecutor *executor);
+
+private:
+    static CommandExecutor *sCurrent;
+};
+
+class ForkExecutor : public CommandExecutor {
+public:
+    virtual int execvp(int argc, const char **argv, int *status, bool logwrap);
+    virtual int execWithInput(const char **argv, const std::string &input);
+    virtual const char *getName() { return "fork"; }
+
+    static ForkExecutor *Instance();
+};
+
+class BatchExecutor : public CommandExecutor {
+public:
+    BatchExecutor();
+    virtual ~BatchExecutor() {}
+
+    virtual int execvp(int argc, const char **argv, int *status, bool logwrap);
+    virtual int execWithInput(const char **argv, const std::string &input);
+    virtual int flush();
+    virtual const char *getName() { return "batch"; }
+
+private:
+    /* Returns the restore line for argv, or "" if it has to run on its own. */
+    static std::string toRestoreLine(const char **argv, int argc, std::string *table);
+
+    pthread_mutex_t mLock;
+    /* (table, rule) in arrival order; 0 for v4, 1 for v6. */
+    std::list<std::pair<std::string, std::string> > mQueued[2];
+};
+
+class RecordingExecutor : public CommandExecutor {
+public:
+    RecordingExecutor();
+    virtual ~RecordingExecutor() {}
+
+    virtual int execvp(int argc, const char **argv, int *status, bool logwrap);
+    virtual int execWithInput(const char **argv, const std::string &input);
+    virtual const char *getName() { return "record"; }
+
+    /* Sends a CommandRecordResult per recorded command, then a CommandOkay. */
+    void dump(SocketClient *cli);
+    void clear();
+
+private:
+    static const size_t MAX_RECORDS;
+
+    pthread_mutex_t mLock;
+    std::list<std::string> mRecords;
+    size_t mDropped;
+};
+
+#endif
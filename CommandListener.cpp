@@ -29,18 +29,24 @@
 #include <errno.h>
 #include <string.h>
 #include <ctype.h>
+#include <time.h>
 #include <linux/if.h>
 
 #define LOG_TAG "CommandListener"
 
 #include <cutils/log.h>
+#include <cutils/properties.h>
 #include <netutils/ifc.h>
 #include <sysutils/SocketClient.h>
 
 #include "CommandListener.h"
 #include "ResponseCode.h"
+#include "AsyncOperations.h"
 #include "BandwidthController.h"
+#include "CommandExecutor.h"
+#include "CommandTrace.h"
 #include "IdletimerController.h"
+#include "LatencyMetrics.h"
 #include "SecondaryTableController.h"
 #include "oem_iptables_hook.h"
 #include "NetdConstants.h"
@@ -125,10 +131,38 @@ static const char* NAT_POSTROUTING[] = {
         NULL,
 };
 
+static const char* JOURNALED_CHAINS[] = {
+        BandwidthController::LOCAL_INPUT,
+        BandwidthController::LOCAL_FORWARD,
+        BandwidthController::LOCAL_OUTPUT,
+        BandwidthController::LOCAL_RAW_PREROUTING,
+        BandwidthController::LOCAL_MANGLE_POSTROUTING,
+        FirewallController::LOCAL_INPUT,
+        FirewallController::LOCAL_OUTPUT,
+        FirewallController::LOCAL_FORWARD,
+        NULL,
+};
+
+static bool isKeptChain(const char* chain, const char** keptChains) {
+    for (; keptChains && *keptChains; keptChains++) {
+        if (!strcmp(chain, *keptChains))
+            return true;
+    }
+    return false;
+}
+
 static void createChildChains(IptablesTarget target, const char* table, const char* parentChain,
-        const char** childChains) {
+        const char** childChains, const char** keptChains) {
     const char** childChain = childChains;
     do {
+        if (isKeptChain(*childChain, keptChains)) {
+            // Keep the chain and its rules, only move the jump to its place
+            // in the ordering. Appending first means no packet skips it.
+            execIptables(target, "-t", table, "-A", parentChain, "-j", *childChain, NULL);
+            execIptables(target, "-t", table, "-D", parentChain, "-j", *childChain, NULL);
+            continue;
+        }
+
         // Order is important:
         // -D to delete any pre-existing jump rule (removes references
         //    that would prevent -X from working)
@@ -145,6 +179,22 @@ static void createChildChains(IptablesTarget target, const char* table, const ch
     } while (*(++childChain) != NULL);
 }
 
+/* Same as createChildChains(), as rules for rs; rs must have been load()ed. */
+static void compileChildChains(IptablesRuleset* rs, IptablesTarget target, const char* table,
+        const char* parentChain, const char** childChains, const char** keptChains) {
+    const char** childChain = childChains;
+    do {
+        std::string jump = std::string(parentChain) + " -j " + *childChain;
+
+        // One commit, so the order no longer matters to packets.
+        rs->deleteExisting(target, table, jump);
+        if (!isKeptChain(*childChain, keptChains)) {
+            rs->declareChain(target, table, *childChain);
+        }
+        rs->addRule(target, table, "-A " + jump);
+    } while (*(++childChain) != NULL);
+}
+
 /**
  * Check if string is a valid interface name.
  * Utilize if_nametoindex, on success it returns ifindex, and on error 0.
@@ -187,25 +237,75 @@ static bool isValidIp(const char* str, const char* af) {
     return false;
 }
 
+void CommandListener::registerCmd(NetdCommand *cmd) {
+    mCommands.push_back(cmd);
+    FrameworkListener::registerCmd(cmd);
+}
+
+bool CommandListener::onDataAvailable(SocketClient *c) {
+    std::list<BinaryProtocol::Request> requests;
+    std::list<BinaryProtocol::Request>::iterator it;
+    bool ok;
+
+    if (!BinaryProtocol::Instance()->isBinary(c)) {
+        return FrameworkListener::onDataAvailable(c);
+    }
+    ok = BinaryProtocol::Instance()->receive(c, &requests);
+    /* A "protocol text" among them leaves the rest unread. */
+    for (it = requests.begin(); it != requests.end() &&
+            BinaryProtocol::Instance()->isBinary(c); it++) {
+        dispatchBinary(c, *it);
+    }
+    return ok;
+}
+
+void CommandListener::dispatchBinary(SocketClient *cli, BinaryProtocol::Request &request) {
+    std::list<NetdCommand *>::iterator it;
+    char *argv[request.args.size()];
+
+    for (size_t i = 0; i < request.args.size(); i++) {
+        argv[i] = (char *) request.args[i].c_str();
+    }
+    cli->setCmdNum(request.cmdNum);
+    for (it = mCommands.begin(); it != mCommands.end(); it++) {
+        if (!strcmp(argv[0], (*it)->getCommand())) {
+            if ((*it)->runCommand(cli, request.args.size(), argv)) {
+                ALOGW("Handler '%s' error (%s)", (*it)->getCommand(), strerror(errno));
+            }
+            return;
+        }
+    }
+    cli->sendMsg(ResponseCode::CommandSyntaxError, "Command not recognized", false);
+}
+
 CommandListener::CommandListener(UidMarkMap *map) :
                  FrameworkListener("netd", true) {
-    registerCmd(new InterfaceCmd());
-    registerCmd(new IpFwdCmd());
-    registerCmd(new TetherCmd());
-    registerCmd(new NatCmd());
-    registerCmd(new ListTtysCmd());
-    registerCmd(new PppdCmd());
+    /* ipfwd and ttys use the controllers of the async capable tether and pppd. */
+    TimedCommand *tetherCmd = new TimedCommand(new TetherCmd());
+    TimedCommand *pppdCmd = new TimedCommand(new PppdCmd());
+
+    registerCmd(new TimedCommand(new InterfaceCmd()));
+    registerCmd(new TimedCommand(new IpFwdCmd(), tetherCmd));
+    registerCmd(tetherCmd);
+    registerCmd(new TimedCommand(new NatCmd()));
+    registerCmd(new TimedCommand(new ListTtysCmd(), pppdCmd));
+    registerCmd(pppdCmd);
 #ifdef QSAP_WLAN
-    registerCmd(new QsoftapCmd());
+    registerCmd(new TimedCommand(new QsoftapCmd()));
 #else /* QSAP_WLAN */
-    registerCmd(new SoftapCmd());
+    registerCmd(new TimedCommand(new SoftapCmd()));
 #endif /* QSAP_WLAN */
-    registerCmd(new BandwidthControlCmd());
-    registerCmd(new IdletimerControlCmd());
-    registerCmd(new ResolverCmd());
-    registerCmd(new FirewallCmd());
-    registerCmd(new ClatdCmd());
-    registerCmd(new RouteCmd());
+    registerCmd(new TimedCommand(new BandwidthControlCmd()));
+    registerCmd(new TimedCommand(new IdletimerControlCmd()));
+    registerCmd(new TimedCommand(new ResolverCmd()));
+    registerCmd(new TimedCommand(new FirewallCmd()));
+    registerCmd(new TimedCommand(new ClatdCmd()));
+    registerCmd(new TimedCommand(new RouteCmd()));
+    registerCmd(new TimedCommand(new ExecutorCmd()));
+    registerCmd(new MetricsCmd());
+    registerCmd(new TraceCmd());
+    registerCmd(new ProtocolCmd());
+    registerCmd(new AsyncCmd(this));
 
     if (!sSecondaryTableCtrl)
         sSecondaryTableCtrl = new SecondaryTableController(map);
@@ -242,15 +342,54 @@ CommandListener::CommandListener(UidMarkMap *map) :
      * otherwise DROP/REJECT.
      */
 
+    /*
+     * If the netd before us left bandwidth and firewall rules that match its
+     * journal, they are kept as they are: no flush, no gap in accounting,
+     * quotas or firewall.
+     */
+    bool bandwidthAdopted = !sBandwidthCtrl->adoptJournal();
+    const char** keptChains = bandwidthAdopted ? JOURNALED_CHAINS : NULL;
+
+    /*
+     * Everything below is normally compiled into one iptables-restore per
+     * family; persist.netd.compile_iptables=0 runs it one command at a time,
+     * e.g. to compare the startup times logged here.
+     */
+    struct timespec start, end;
+    char value[PROPERTY_VALUE_MAX];
+    bool compiled = false;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    property_get("persist.netd.compile_iptables", value, "1");
+    if (strcmp(value, "0")) {
+        compiled = !compileIptablesSetup(keptChains, bandwidthAdopted);
+        if (!compiled) {
+            ALOGE("Compiled iptables setup failed, running it command by command");
+        }
+    }
+    if (!compiled) {
+        setupIptables(keptChains, bandwidthAdopted);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ALOGI("iptables setup took %lld ms (%s)",
+          (long long) (end.tv_sec - start.tv_sec) * 1000 +
+          (end.tv_nsec - start.tv_nsec) / 1000000,
+          compiled ? "compiled" : "command by command");
+
+    if (!bandwidthAdopted)
+        sBandwidthCtrl->syncJournal();
+}
+
+void CommandListener::setupIptables(const char** keptChains, bool bandwidthAdopted) {
     // Create chains for children modules
-    createChildChains(V4V6, "filter", "INPUT", FILTER_INPUT);
-    createChildChains(V4V6, "filter", "FORWARD", FILTER_FORWARD);
-    createChildChains(V4V6, "filter", "OUTPUT", FILTER_OUTPUT);
-    createChildChains(V4V6, "raw", "PREROUTING", RAW_PREROUTING);
-    createChildChains(V4V6, "mangle", "POSTROUTING", MANGLE_POSTROUTING);
-    createChildChains(V4V6, "mangle", "OUTPUT", MANGLE_OUTPUT);
-    createChildChains(V4, "nat", "PREROUTING", NAT_PREROUTING);
-    createChildChains(V4, "nat", "POSTROUTING", NAT_POSTROUTING);
+    createChildChains(V4V6, "filter", "INPUT", FILTER_INPUT, keptChains);
+    createChildChains(V4V6, "filter", "FORWARD", FILTER_FORWARD, keptChains);
+    createChildChains(V4V6, "filter", "OUTPUT", FILTER_OUTPUT, keptChains);
+    createChildChains(V4V6, "raw", "PREROUTING", RAW_PREROUTING, keptChains);
+    createChildChains(V4V6, "mangle", "POSTROUTING", MANGLE_POSTROUTING, keptChains);
+    createChildChains(V4V6, "mangle", "OUTPUT", MANGLE_OUTPUT, keptChains);
+    createChildChains(V4, "nat", "PREROUTING", NAT_PREROUTING, keptChains);
+    createChildChains(V4, "nat", "POSTROUTING", NAT_POSTROUTING, keptChains);
 
     // Let each module setup their child chains
     setupOemIptablesHook();
@@ -264,444 +403,451 @@ CommandListener::CommandListener(UidMarkMap *map) :
      * Does REJECT in INPUT, OUTPUT. Does counting also.
      * No DROP/REJECT allowed later in netfilter-flow hook order.
      */
-    sBandwidthCtrl->setupIptablesHooks();
+    if (!bandwidthAdopted)
+        sBandwidthCtrl->setupIptablesHooks();
     /*
      * Counts in nat: PREROUTING, POSTROUTING.
      * No DROP/REJECT allowed later in netfilter-flow hook order.
      */
     sIdletimerCtrl->setupIptablesHooks();
 
-    sBandwidthCtrl->enableBandwidthControl(false);
+    if (!bandwidthAdopted)
+        sBandwidthCtrl->enableBandwidthControl(false);
 
     sSecondaryTableCtrl->setupIptablesHooks();
 }
 
+int CommandListener::compileIptablesSetup(const char** keptChains, bool bandwidthAdopted) {
+    IptablesRuleset rs;
+
+    if (rs.load())
+        return -1;
+
+    compileChildChains(&rs, V4V6, "filter", "INPUT", FILTER_INPUT, keptChains);
+    compileChildChains(&rs, V4V6, "filter", "FORWARD", FILTER_FORWARD, keptChains);
+    compileChildChains(&rs, V4V6, "filter", "OUTPUT", FILTER_OUTPUT, keptChains);
+    compileChildChains(&rs, V4V6, "raw", "PREROUTING", RAW_PREROUTING, keptChains);
+    compileChildChains(&rs, V4V6, "mangle", "POSTROUTING", MANGLE_POSTROUTING, keptChains);
+    compileChildChains(&rs, V4V6, "mangle", "OUTPUT", MANGLE_OUTPUT, keptChains);
+    compileChildChains(&rs, V4, "nat", "PREROUTING", NAT_PREROUTING, keptChains);
+    compileChildChains(&rs, V4, "nat", "POSTROUTING", NAT_POSTROUTING, keptChains);
+
+    // The firewall and idletimer chains start out empty, as declared above.
+    sNatCtrl->compileIptablesHooks(&rs);
+    if (!bandwidthAdopted)
+        sBandwidthCtrl->compileIptablesHooks(&rs);
+    sSecondaryTableCtrl->compileIptablesHooks(&rs);
+
+    if (rs.commit())
+        return -1;
+
+    // The OEM script is opaque; it fills its chains, flushed above, itself.
+    setupOemIptablesHook();
+    return 0;
+}
+
+//     0       1       2        3          4           5        6      7
+// interface route add/remove iface default/secondary dest    prefix gateway
+// interface fwmark  rule  add/remove    iface
+// interface fwmark  route add/remove    iface        dest    prefix
+// interface fwmark  uid   add/remove    iface      uid_start uid_end
+// interface fwmark exempt add/remove    dest
+// interface fwmark  get     protect
+// interface fwmark  get     mark        uid
+const SubcommandTable::Entry CommandListener::InterfaceCmd::sSubcommands[] = {
+    { "list", NULL, "", NULL, 0, 0, "list", list },
+    { "driver", NULL, "ss", "s", 0, -1, "driver <interface> <cmd> <args>", driver },
+    { "fwmark", NULL, "s", "s", 0, -1, "fwmark <cmd> <args...>", fwmark, "Missing argument" },
+    { "route", NULL, "ssssss", NULL, 0, 0,
+      "route <add|remove> <interface> <default|secondary> <dest> <prefix> <gateway>", route,
+      "Missing argument" },
+    { "getcfg", NULL, "s", NULL, 0, 0, "getcfg <interface>", getCfg, "Missing argument" },
+    { "setcfg", NULL, "s", "s", 1, -1, "setcfg <interface> [<addr> <prefixLength>] <flags>",
+      setCfg, "Missing argument" },
+    { "clearaddrs", NULL, "s", NULL, 0, 0, "clearaddrs <interface>", clearAddrs,
+      "Missing argument" },
+    { "ipv6privacyextensions", NULL, "ss", NULL, 0, 0,
+      "ipv6privacyextensions <interface> <enable|disable>", ipv6PrivacyExtensions },
+    { "ipv6", NULL, "ss", NULL, 0, 0, "ipv6 <interface> <enable|disable>", ipv6 },
+    { "getmtu", NULL, "s", NULL, 0, 0, "getmtu <interface>", getMtu, "Missing argument" },
+    { "setmtu", NULL, "ss", NULL, 0, 0, "setmtu <interface> <val>", setMtu },
+};
+
+/* Looked up on the command line from "fwmark" on. */
+const SubcommandTable::Entry CommandListener::InterfaceCmd::sFwmarkSubcommands[] = {
+    { "rule", NULL, "ss", NULL, 0, 0, "rule <add|remove> <interface>", fwmarkRule,
+      "Missing argument" },
+    { "route", NULL, "ssss", NULL, 0, 0, "route <add|remove> <interface> <dest> <prefix>",
+      fwmarkRoute, "Missing argument" },
+    { "uid", NULL, "ssss", NULL, 0, 0, "uid <add|remove> <interface> <uid_start> <uid_end>",
+      fwmarkUid, "Missing argument" },
+    { "exempt", NULL, "ss", NULL, 0, 0, "exempt <add|remove> <dest>", fwmarkExempt,
+      "Missing argument" },
+    { "get", NULL, "s", "s", 0, 1, "get <protect|mark <uid>>", fwmarkGet, "Missing argument" },
+};
+
+const SubcommandTable CommandListener::InterfaceCmd::sFwmarkTable("interface fwmark",
+        sFwmarkSubcommands, sizeof(sFwmarkSubcommands) / sizeof(sFwmarkSubcommands[0]),
+        "Missing argument", "Unknown fwmark cmd");
+
 CommandListener::InterfaceCmd::InterfaceCmd() :
-                 NetdCommand("interface") {
+                 NetdCommand("interface"),
+                 mSubcommands("interface", sSubcommands,
+                         sizeof(sSubcommands) / sizeof(sSubcommands[0]),
+                         "Missing argument", "Unknown interface cmd") {
 }
 
 int CommandListener::InterfaceCmd::runCommand(SocketClient *cli,
                                                       int argc, char **argv) {
-    if (argc < 2) {
-        cli->sendMsg(ResponseCode::CommandSyntaxError, "Missing argument", false);
+    return mSubcommands.dispatch(cli, argc, argv);
+}
+
+int CommandListener::InterfaceCmd::list(SocketClient *cli, int, char **) {
+    DIR *d;
+    struct dirent *de;
+
+    if (!(d = opendir("/sys/class/net"))) {
+        cli->sendMsg(ResponseCode::OperationFailed, "Failed to open sysfs dir", true);
         return 0;
     }
 
-    if (!strcmp(argv[1], "list")) {
-        DIR *d;
-        struct dirent *de;
+    while((de = readdir(d))) {
+        if (de->d_name[0] == '.')
+            continue;
+        cli->sendMsg(ResponseCode::InterfaceListResult, de->d_name, false);
+    }
+    closedir(d);
+    cli->sendMsg(ResponseCode::CommandOkay, "Interface list completed", false);
+    return 0;
+}
 
-        if (!(d = opendir("/sys/class/net"))) {
-            cli->sendMsg(ResponseCode::OperationFailed, "Failed to open sysfs dir", true);
-            return 0;
+int CommandListener::InterfaceCmd::driver(SocketClient *cli, int argc, char **argv) {
+    int rc;
+    char *rbuf;
+
+    rc = sInterfaceCtrl->interfaceCommand(argc, argv, &rbuf);
+    if (rc) {
+        cli->sendMsg(ResponseCode::OperationFailed, "Failed to execute command", true);
+    } else {
+        cli->sendMsg(ResponseCode::CommandOkay, rbuf, false);
+    }
+    return 0;
+}
+
+int CommandListener::InterfaceCmd::fwmark(SocketClient *cli, int argc, char **argv) {
+    return sFwmarkTable.dispatch(cli, argc - 1, argv + 1);
+}
+
+int CommandListener::InterfaceCmd::fwmarkRule(SocketClient *cli, int, char **argv) {
+    if (!strcmp(argv[2], "add")) {
+        if (!sSecondaryTableCtrl->addFwmarkRule(argv[3])) {
+            cli->sendMsg(ResponseCode::CommandOkay, "Fwmark rule successfully added", false);
+        } else {
+            cli->sendMsg(ResponseCode::OperationFailed, "Failed to add fwmark rule", true);
+        }
+    } else if (!strcmp(argv[2], "remove")) {
+        if (!sSecondaryTableCtrl->removeFwmarkRule(argv[3])) {
+            cli->sendMsg(ResponseCode::CommandOkay, "Fwmark rule successfully removed", false);
+        } else {
+            cli->sendMsg(ResponseCode::OperationFailed, "Failed to remove fwmark rule", true);
         }
+    } else {
+        cli->sendMsg(ResponseCode::CommandSyntaxError, "Unknown fwmark rule cmd", false);
+    }
+    return 0;
+}
 
-        while((de = readdir(d))) {
-            if (de->d_name[0] == '.')
-                continue;
-            cli->sendMsg(ResponseCode::InterfaceListResult, de->d_name, false);
+int CommandListener::InterfaceCmd::fwmarkRoute(SocketClient *cli, int, char **argv) {
+    if (!strcmp(argv[2], "add")) {
+        if (!sSecondaryTableCtrl->addFwmarkRoute(argv[3], argv[4], atoi(argv[5]))) {
+            cli->sendMsg(ResponseCode::CommandOkay, "Fwmark route successfully added", false);
+        } else {
+            cli->sendMsg(ResponseCode::OperationFailed, "Failed to add fwmark route", true);
         }
-        closedir(d);
-        cli->sendMsg(ResponseCode::CommandOkay, "Interface list completed", false);
-        return 0;
-    } else if (!strcmp(argv[1], "driver")) {
-        int rc;
-        char *rbuf;
+    } else if (!strcmp(argv[2], "remove")) {
+        if (!sSecondaryTableCtrl->removeFwmarkRoute(argv[3], argv[4], atoi(argv[5]))) {
+            cli->sendMsg(ResponseCode::CommandOkay, "Fwmark route successfully removed", false);
+        } else {
+            cli->sendMsg(ResponseCode::OperationFailed, "Failed to remove fwmark route", true);
+        }
+    } else {
+        cli->sendMsg(ResponseCode::CommandSyntaxError, "Unknown fwmark route cmd", false);
+    }
+    return 0;
+}
 
-        if (argc < 4) {
-            cli->sendMsg(ResponseCode::CommandSyntaxError,
-                    "Usage: interface driver <interface> <cmd> <args>", false);
-            return 0;
+int CommandListener::InterfaceCmd::fwmarkUid(SocketClient *cli, int, char **argv) {
+    if (!strcmp(argv[2], "add")) {
+        if (!sSecondaryTableCtrl->addUidRule(argv[3], atoi(argv[4]), atoi(argv[5]))) {
+            cli->sendMsg(ResponseCode::CommandOkay, "uid rule successfully added", false);
+        } else {
+            cli->sendMsg(ResponseCode::OperationFailed, "Failed to add uid rule", true);
         }
-        rc = sInterfaceCtrl->interfaceCommand(argc, argv, &rbuf);
-        if (rc) {
-            cli->sendMsg(ResponseCode::OperationFailed, "Failed to execute command", true);
+    } else if (!strcmp(argv[2], "remove")) {
+        if (!sSecondaryTableCtrl->removeUidRule(argv[3], atoi(argv[4]), atoi(argv[5]))) {
+            cli->sendMsg(ResponseCode::CommandOkay, "uid rule successfully removed", false);
         } else {
-            cli->sendMsg(ResponseCode::CommandOkay, rbuf, false);
+            cli->sendMsg(ResponseCode::OperationFailed, "Failed to remove uid rule", true);
         }
-        return 0;
     } else {
-        /*
-         * These commands take a minimum of 3 arguments
-         */
-        if (argc < 3) {
+        cli->sendMsg(ResponseCode::CommandSyntaxError, "Unknown uid cmd", false);
+    }
+    return 0;
+}
+
+int CommandListener::InterfaceCmd::fwmarkExempt(SocketClient *cli, int, char **argv) {
+    if (!strcmp(argv[2], "add")) {
+        if (!sSecondaryTableCtrl->addHostExemption(argv[3])) {
+            cli->sendMsg(ResponseCode::CommandOkay, "exemption rule successfully added", false);
+        } else {
+            cli->sendMsg(ResponseCode::OperationFailed, "Failed to add exemption rule", true);
+        }
+    } else if (!strcmp(argv[2], "remove")) {
+        if (!sSecondaryTableCtrl->removeHostExemption(argv[3])) {
+            cli->sendMsg(ResponseCode::CommandOkay, "exemption rule successfully removed",
+                    false);
+        } else {
+            cli->sendMsg(ResponseCode::OperationFailed, "Failed to remove exemption rule",
+                    true);
+        }
+    } else {
+        cli->sendMsg(ResponseCode::CommandSyntaxError, "Unknown exemption cmd", false);
+    }
+    return 0;
+}
+
+int CommandListener::InterfaceCmd::fwmarkGet(SocketClient *cli, int argc, char **argv) {
+    if (!strcmp(argv[2], "protect")) {
+        sSecondaryTableCtrl->getProtectMark(cli);
+    } else if (!strcmp(argv[2], "mark")) {
+        if (argc < 4) {
             cli->sendMsg(ResponseCode::CommandSyntaxError, "Missing argument", false);
             return 0;
         }
+        sSecondaryTableCtrl->getUidMark(cli, atoi(argv[3]));
+    } else {
+        cli->sendMsg(ResponseCode::CommandSyntaxError, "Unknown fwmark get cmd", false);
+    }
+    return 0;
+}
 
-        //     0       1       2        3          4           5        6      7
-        // interface route add/remove iface default/secondary dest    prefix gateway
-        // interface fwmark  rule  add/remove    iface
-        // interface fwmark  route add/remove    iface        dest    prefix
-        // interface fwmark  uid   add/remove    iface      uid_start uid_end
-        // interface fwmark exempt add/remove    dest
-        // interface fwmark  get     protect
-        // interface fwmark  get     mark        uid
-        if (!strcmp(argv[1], "fwmark")) {
-            if (!strcmp(argv[2], "rule")) {
-                if (argc < 5) {
-                    cli->sendMsg(ResponseCode::CommandSyntaxError, "Missing argument", false);
-                    return 0;
-                }
-                if (!strcmp(argv[3], "add")) {
-                    if (!sSecondaryTableCtrl->addFwmarkRule(argv[4])) {
-                        cli->sendMsg(ResponseCode::CommandOkay,
-                                "Fwmark rule successfully added", false);
-                    } else {
-                        cli->sendMsg(ResponseCode::OperationFailed, "Failed to add fwmark rule",
-                                true);
-                    }
-                } else if (!strcmp(argv[3], "remove")) {
-                    if (!sSecondaryTableCtrl->removeFwmarkRule(argv[4])) {
-                        cli->sendMsg(ResponseCode::CommandOkay,
-                                "Fwmark rule successfully removed", false);
-                    } else {
-                        cli->sendMsg(ResponseCode::OperationFailed,
-                                "Failed to remove fwmark rule", true);
-                    }
-                } else {
-                    cli->sendMsg(ResponseCode::CommandSyntaxError, "Unknown fwmark rule cmd",
-                            false);
-                }
-                return 0;
-            } else if (!strcmp(argv[2], "route")) {
-                if (argc < 7) {
-                    cli->sendMsg(ResponseCode::CommandSyntaxError, "Missing argument", false);
-                    return 0;
-                }
-                if (!strcmp(argv[3], "add")) {
-                    if (!sSecondaryTableCtrl->addFwmarkRoute(argv[4], argv[5], atoi(argv[6]))) {
-                        cli->sendMsg(ResponseCode::CommandOkay,
-                                "Fwmark route successfully added", false);
-                    } else {
-                        cli->sendMsg(ResponseCode::OperationFailed,
-                                "Failed to add fwmark route", true);
-                    }
-                } else if (!strcmp(argv[3], "remove")) {
-                    if (!sSecondaryTableCtrl->removeFwmarkRoute(argv[4], argv[5],
-                                atoi(argv[6]))) {
-                        cli->sendMsg(ResponseCode::CommandOkay,
-                                "Fwmark route successfully removed", false);
-                    } else {
-                        cli->sendMsg(ResponseCode::OperationFailed,
-                                "Failed to remove fwmark route", true);
-                    }
-                } else {
-                    cli->sendMsg(ResponseCode::CommandSyntaxError, "Unknown fwmark route cmd",
-                            false);
-                }
-                return 0;
+int CommandListener::InterfaceCmd::route(SocketClient *cli, int, char **argv) {
+    int prefix_length = 0;
 
-            } else if (!strcmp(argv[2], "uid")) {
-                if (argc < 7) {
-                    cli->sendMsg(ResponseCode::CommandSyntaxError, "Missing argument", false);
-                    return 0;
-                }
-                if (!strcmp(argv[3], "add")) {
-                    if (!sSecondaryTableCtrl->addUidRule(argv[4], atoi(argv[5]), atoi(argv[6]))) {
-                        cli->sendMsg(ResponseCode::CommandOkay, "uid rule successfully added",
-                                false);
-                    } else {
-                        cli->sendMsg(ResponseCode::OperationFailed, "Failed to add uid rule", true);
-                    }
-                } else if (!strcmp(argv[3], "remove")) {
-                    if (!sSecondaryTableCtrl->removeUidRule(argv[4],
-                                atoi(argv[5]), atoi(argv[6]))) {
-                        cli->sendMsg(ResponseCode::CommandOkay, "uid rule successfully removed",
-                                false);
-                    } else {
-                        cli->sendMsg(ResponseCode::OperationFailed, "Failed to remove uid rule",
-                                true);
-                    }
-                } else {
-                    cli->sendMsg(ResponseCode::CommandSyntaxError, "Unknown uid cmd", false);
-                }
-                return 0;
-            } else if (!strcmp(argv[2], "exempt")) {
-                if (argc < 5) {
-                    cli->sendMsg(ResponseCode::CommandSyntaxError, "Missing argument", false);
-                    return 0;
-                }
-                if (!strcmp(argv[3], "add")) {
-                    if (!sSecondaryTableCtrl->addHostExemption(argv[4])) {
-                        cli->sendMsg(ResponseCode::CommandOkay, "exemption rule successfully added",
-                                false);
-                    } else {
-                        cli->sendMsg(ResponseCode::OperationFailed, "Failed to add exemption rule",
-                                true);
-                    }
-                } else if (!strcmp(argv[3], "remove")) {
-                    if (!sSecondaryTableCtrl->removeHostExemption(argv[4])) {
-                        cli->sendMsg(ResponseCode::CommandOkay,
-                                "exemption rule successfully removed", false);
-                    } else {
-                        cli->sendMsg(ResponseCode::OperationFailed,
-                                "Failed to remove exemption rule", true);
-                    }
-                } else {
-                    cli->sendMsg(ResponseCode::CommandSyntaxError, "Unknown exemption cmd", false);
-                }
-                return 0;
-            } else if (!strcmp(argv[2], "get")) {
-                if (argc < 4) {
-                    cli->sendMsg(ResponseCode::CommandSyntaxError, "Missing argument", false);
-                    return 0;
-                }
-                if (!strcmp(argv[3], "protect")) {
-                    sSecondaryTableCtrl->getProtectMark(cli);
-                    return 0;
-                } else if (!strcmp(argv[3], "mark")) {
-                    if (argc < 5) {
-                        cli->sendMsg(ResponseCode::CommandSyntaxError, "Missing argument", false);
-                        return 0;
-                    }
-                    sSecondaryTableCtrl->getUidMark(cli, atoi(argv[4]));
-                    return 0;
-                } else {
-                    cli->sendMsg(ResponseCode::CommandSyntaxError, "Unknown fwmark get cmd", false);
-                    return 0;
-                }
+    if (sscanf(argv[6], "%d", &prefix_length) != 1) {
+        cli->sendMsg(ResponseCode::CommandParameterError, "Invalid route prefix", false);
+        return 0;
+    }
+    if (!strcmp(argv[2], "add")) {
+        if (!strcmp(argv[4], "default")) {
+            if (ifc_add_route(argv[3], argv[5], prefix_length, argv[7])) {
+                cli->sendMsg(ResponseCode::OperationFailed,
+                        "Failed to add route to default table", true);
             } else {
-                cli->sendMsg(ResponseCode::CommandSyntaxError, "Unknown fwmark cmd", false);
-                return 0;
+                cli->sendMsg(ResponseCode::CommandOkay,
+                        "Route added to default table", false);
             }
+        } else if (!strcmp(argv[4], "secondary")) {
+            return sSecondaryTableCtrl->addRoute(cli, argv[3], argv[5],
+                    prefix_length, argv[7]);
+        } else {
+            cli->sendMsg(ResponseCode::CommandParameterError,
+                    "Invalid route type, expecting 'default' or 'secondary'", false);
+            return 0;
         }
-        if (!strcmp(argv[1], "route")) {
-            int prefix_length = 0;
-            if (argc < 8) {
-                cli->sendMsg(ResponseCode::CommandSyntaxError, "Missing argument", false);
-                return 0;
-            }
-            if (sscanf(argv[6], "%d", &prefix_length) != 1) {
-                cli->sendMsg(ResponseCode::CommandParameterError, "Invalid route prefix", false);
-                return 0;
-            }
-            if (!strcmp(argv[2], "add")) {
-                if (!strcmp(argv[4], "default")) {
-                    if (ifc_add_route(argv[3], argv[5], prefix_length, argv[7])) {
-                        cli->sendMsg(ResponseCode::OperationFailed,
-                                "Failed to add route to default table", true);
-                    } else {
-                        cli->sendMsg(ResponseCode::CommandOkay,
-                                "Route added to default table", false);
-                    }
-                } else if (!strcmp(argv[4], "secondary")) {
-                    return sSecondaryTableCtrl->addRoute(cli, argv[3], argv[5],
-                            prefix_length, argv[7]);
-                } else {
-                    cli->sendMsg(ResponseCode::CommandParameterError,
-                            "Invalid route type, expecting 'default' or 'secondary'", false);
-                    return 0;
-                }
-            } else if (!strcmp(argv[2], "remove")) {
-                if (!strcmp(argv[4], "default")) {
-                    if (ifc_remove_route(argv[3], argv[5], prefix_length, argv[7])) {
-                        cli->sendMsg(ResponseCode::OperationFailed,
-                                "Failed to remove route from default table", true);
-                    } else {
-                        cli->sendMsg(ResponseCode::CommandOkay,
-                                "Route removed from default table", false);
-                    }
-                } else if (!strcmp(argv[4], "secondary")) {
-                    return sSecondaryTableCtrl->removeRoute(cli, argv[3], argv[5],
-                            prefix_length, argv[7]);
-                } else {
-                    cli->sendMsg(ResponseCode::CommandParameterError,
-                            "Invalid route type, expecting 'default' or 'secondary'", false);
-                    return 0;
-                }
+    } else if (!strcmp(argv[2], "remove")) {
+        if (!strcmp(argv[4], "default")) {
+            if (ifc_remove_route(argv[3], argv[5], prefix_length, argv[7])) {
+                cli->sendMsg(ResponseCode::OperationFailed,
+                        "Failed to remove route from default table", true);
             } else {
-                cli->sendMsg(ResponseCode::CommandSyntaxError, "Unknown interface cmd", false);
+                cli->sendMsg(ResponseCode::CommandOkay,
+                        "Route removed from default table", false);
             }
+        } else if (!strcmp(argv[4], "secondary")) {
+            return sSecondaryTableCtrl->removeRoute(cli, argv[3], argv[5],
+                    prefix_length, argv[7]);
+        } else {
+            cli->sendMsg(ResponseCode::CommandParameterError,
+                    "Invalid route type, expecting 'default' or 'secondary'", false);
             return 0;
         }
+    } else {
+        cli->sendMsg(ResponseCode::CommandSyntaxError, "Unknown interface cmd", false);
+    }
+    return 0;
+}
 
-        if (!strcmp(argv[1], "getcfg")) {
-            struct in_addr addr;
-            int prefixLength;
-            unsigned char hwaddr[6];
-            unsigned flags = 0;
-
-            ifc_init();
-            memset(hwaddr, 0, sizeof(hwaddr));
-
-            if (ifc_get_info(argv[2], &addr.s_addr, &prefixLength, &flags)) {
-                cli->sendMsg(ResponseCode::OperationFailed, "Interface not found", true);
-                ifc_close();
-                return 0;
-            }
+int CommandListener::InterfaceCmd::getCfg(SocketClient *cli, int, char **argv) {
+    struct in_addr addr;
+    int prefixLength;
+    unsigned char hwaddr[6];
+    unsigned flags = 0;
 
-            if (ifc_get_hwaddr(argv[2], (void *) hwaddr)) {
-                ALOGW("Failed to retrieve HW addr for %s (%s)", argv[2], strerror(errno));
-            }
+    ifc_init();
+    memset(hwaddr, 0, sizeof(hwaddr));
 
-            char *addr_s = strdup(inet_ntoa(addr));
-            const char *updown, *brdcst, *loopbk, *ppp, *running, *multi;
+    if (ifc_get_info(argv[2], &addr.s_addr, &prefixLength, &flags)) {
+        cli->sendMsg(ResponseCode::OperationFailed, "Interface not found", true);
+        ifc_close();
+        return 0;
+    }
 
-            updown =  (flags & IFF_UP)           ? "up" : "down";
-            brdcst =  (flags & IFF_BROADCAST)    ? " broadcast" : "";
-            loopbk =  (flags & IFF_LOOPBACK)     ? " loopback" : "";
-            ppp =     (flags & IFF_POINTOPOINT)  ? " point-to-point" : "";
-            running = (flags & IFF_RUNNING)      ? " running" : "";
-            multi =   (flags & IFF_MULTICAST)    ? " multicast" : "";
+    if (ifc_get_hwaddr(argv[2], (void *) hwaddr)) {
+        ALOGW("Failed to retrieve HW addr for %s (%s)", argv[2], strerror(errno));
+    }
 
-            char *flag_s;
+    char *addr_s = strdup(inet_ntoa(addr));
+    const char *updown, *brdcst, *loopbk, *ppp, *running, *multi;
 
-            asprintf(&flag_s, "%s%s%s%s%s%s", updown, brdcst, loopbk, ppp, running, multi);
+    updown =  (flags & IFF_UP)           ? "up" : "down";
+    brdcst =  (flags & IFF_BROADCAST)    ? " broadcast" : "";
+    loopbk =  (flags & IFF_LOOPBACK)     ? " loopback" : "";
+    ppp =     (flags & IFF_POINTOPOINT)  ? " point-to-point" : "";
+    running = (flags & IFF_RUNNING)      ? " running" : "";
+    multi =   (flags & IFF_MULTICAST)    ? " multicast" : "";
 
-            char *msg = NULL;
-            asprintf(&msg, "%.2x:%.2x:%.2x:%.2x:%.2x:%.2x %s %d %s",
-                     hwaddr[0], hwaddr[1], hwaddr[2], hwaddr[3], hwaddr[4], hwaddr[5],
-                     addr_s, prefixLength, flag_s);
+    char *flag_s;
 
-            cli->sendMsg(ResponseCode::InterfaceGetCfgResult, msg, false);
+    asprintf(&flag_s, "%s%s%s%s%s%s", updown, brdcst, loopbk, ppp, running, multi);
 
-            free(addr_s);
-            free(flag_s);
-            free(msg);
+    char *msg = NULL;
+    asprintf(&msg, "%.2x:%.2x:%.2x:%.2x:%.2x:%.2x %s %d %s",
+             hwaddr[0], hwaddr[1], hwaddr[2], hwaddr[3], hwaddr[4], hwaddr[5],
+             addr_s, prefixLength, flag_s);
 
-            ifc_close();
-            return 0;
-        } else if (!strcmp(argv[1], "setcfg")) {
-            // arglist: iface [addr prefixLength] flags
-            if (argc < 4) {
-                cli->sendMsg(ResponseCode::CommandSyntaxError, "Missing argument", false);
-                return 0;
-            }
-            ALOGD("Setting iface cfg");
+    cli->sendMsg(ResponseCode::InterfaceGetCfgResult, msg, false);
 
-            struct in_addr addr;
-            unsigned flags = 0;
-            int index = 5;
+    free(addr_s);
+    free(flag_s);
+    free(msg);
 
-            ifc_init();
+    ifc_close();
+    return 0;
+}
 
-            if (!inet_aton(argv[3], &addr)) {
-                // Handle flags only case
-                index = 3;
-            } else {
-                if (ifc_set_addr(argv[2], addr.s_addr)) {
-                    cli->sendMsg(ResponseCode::OperationFailed, "Failed to set address", true);
-                    ifc_close();
-                    return 0;
-                }
+int CommandListener::InterfaceCmd::setCfg(SocketClient *cli, int argc, char **argv) {
+    // arglist: iface [addr prefixLength] flags
+    ALOGD("Setting iface cfg");
 
-                // Set prefix length on a non zero address
-                if (addr.s_addr != 0 && ifc_set_prefixLength(argv[2], atoi(argv[4]))) {
-                   cli->sendMsg(ResponseCode::OperationFailed, "Failed to set prefixLength", true);
-                   ifc_close();
-                   return 0;
-               }
-            }
+    struct in_addr addr;
+    unsigned flags = 0;
+    int index = 5;
 
-            /* Process flags */
-            for (int i = index; i < argc; i++) {
-                char *flag = argv[i];
-                if (!strcmp(flag, "up")) {
-                    ALOGD("Trying to bring up %s", argv[2]);
-                    if (ifc_up(argv[2])) {
-                        ALOGE("Error upping interface");
-                        cli->sendMsg(ResponseCode::OperationFailed, "Failed to up interface", true);
-                        ifc_close();
-                        return 0;
-                    }
-                } else if (!strcmp(flag, "down")) {
-                    ALOGD("Trying to bring down %s", argv[2]);
-                    if (ifc_down(argv[2])) {
-                        ALOGE("Error downing interface");
-                        cli->sendMsg(ResponseCode::OperationFailed, "Failed to down interface", true);
-                        ifc_close();
-                        return 0;
-                    }
-                } else if (!strcmp(flag, "broadcast")) {
-                    // currently ignored
-                } else if (!strcmp(flag, "multicast")) {
-                    // currently ignored
-                } else if (!strcmp(flag, "running")) {
-                    // currently ignored
-                } else if (!strcmp(flag, "loopback")) {
-                    // currently ignored
-                } else if (!strcmp(flag, "point-to-point")) {
-                    // currently ignored
-                } else {
-                    cli->sendMsg(ResponseCode::CommandParameterError, "Flag unsupported", false);
-                    ifc_close();
-                    return 0;
-                }
-            }
+    ifc_init();
 
-            cli->sendMsg(ResponseCode::CommandOkay, "Interface configuration set", false);
+    if (!inet_aton(argv[3], &addr)) {
+        // Handle flags only case
+        index = 3;
+    } else {
+        if (ifc_set_addr(argv[2], addr.s_addr)) {
+            cli->sendMsg(ResponseCode::OperationFailed, "Failed to set address", true);
             ifc_close();
             return 0;
-        } else if (!strcmp(argv[1], "clearaddrs")) {
-            // arglist: iface
-            ALOGD("Clearing all IP addresses on %s", argv[2]);
+        }
 
-            ifc_clear_addresses(argv[2]);
+        // Set prefix length on a non zero address
+        if (addr.s_addr != 0 && ifc_set_prefixLength(argv[2], atoi(argv[4]))) {
+           cli->sendMsg(ResponseCode::OperationFailed, "Failed to set prefixLength", true);
+           ifc_close();
+           return 0;
+       }
+    }
 
-            cli->sendMsg(ResponseCode::CommandOkay, "Interface IP addresses cleared", false);
-            return 0;
-        } else if (!strcmp(argv[1], "ipv6privacyextensions")) {
-            if (argc != 4) {
-                cli->sendMsg(ResponseCode::CommandSyntaxError,
-                        "Usage: interface ipv6privacyextensions <interface> <enable|disable>",
-                        false);
-                return 0;
-            }
-            int enable = !strncmp(argv[3], "enable", 7);
-            if (sInterfaceCtrl->setIPv6PrivacyExtensions(argv[2], enable) == 0) {
-                cli->sendMsg(ResponseCode::CommandOkay, "IPv6 privacy extensions changed", false);
-            } else {
-                cli->sendMsg(ResponseCode::OperationFailed,
-                        "Failed to set ipv6 privacy extensions", true);
-            }
-            return 0;
-        } else if (!strcmp(argv[1], "ipv6")) {
-            if (argc != 4) {
-                cli->sendMsg(ResponseCode::CommandSyntaxError,
-                        "Usage: interface ipv6 <interface> <enable|disable>",
-                        false);
+    /* Process flags */
+    for (int i = index; i < argc; i++) {
+        char *flag = argv[i];
+        if (!strcmp(flag, "up")) {
+            ALOGD("Trying to bring up %s", argv[2]);
+            if (ifc_up(argv[2])) {
+                ALOGE("Error upping interface");
+                cli->sendMsg(ResponseCode::OperationFailed, "Failed to up interface", true);
+                ifc_close();
                 return 0;
             }
-
-            int enable = !strncmp(argv[3], "enable", 7);
-            if (sInterfaceCtrl->setEnableIPv6(argv[2], enable) == 0) {
-                cli->sendMsg(ResponseCode::CommandOkay, "IPv6 state changed", false);
-            } else {
-                cli->sendMsg(ResponseCode::OperationFailed,
-                        "Failed to change IPv6 state", true);
-            }
-            return 0;
-        } else if (!strcmp(argv[1], "getmtu")) {
-            char *msg = NULL;
-            int mtu = 0;
-            if (sInterfaceCtrl->getMtu(argv[2], &mtu) == 0) {
-                asprintf(&msg, "MTU = %d", mtu);
-                cli->sendMsg(ResponseCode::InterfaceGetMtuResult, msg, false);
-                free(msg);
-            } else {
-                cli->sendMsg(ResponseCode::OperationFailed,
-                        "Failed to get MTU", true);
-            }
-            return 0;
-        } else if (!strcmp(argv[1], "setmtu")) {
-            if (argc != 4) {
-                cli->sendMsg(ResponseCode::CommandSyntaxError,
-                        "Usage: interface setmtu <interface> <val>", false);
+        } else if (!strcmp(flag, "down")) {
+            ALOGD("Trying to bring down %s", argv[2]);
+            if (ifc_down(argv[2])) {
+                ALOGE("Error downing interface");
+                cli->sendMsg(ResponseCode::OperationFailed, "Failed to down interface", true);
+                ifc_close();
                 return 0;
             }
-            if (sInterfaceCtrl->setMtu(argv[2], argv[3]) == 0) {
-                cli->sendMsg(ResponseCode::CommandOkay, "MTU changed", false);
-            } else {
-                cli->sendMsg(ResponseCode::OperationFailed,
-                        "Failed to get MTU", true);
-            }
-            return 0;
+        } else if (!strcmp(flag, "broadcast")) {
+            // currently ignored
+        } else if (!strcmp(flag, "multicast")) {
+            // currently ignored
+        } else if (!strcmp(flag, "running")) {
+            // currently ignored
+        } else if (!strcmp(flag, "loopback")) {
+            // currently ignored
+        } else if (!strcmp(flag, "point-to-point")) {
+            // currently ignored
         } else {
-            cli->sendMsg(ResponseCode::CommandSyntaxError, "Unknown interface cmd", false);
+            cli->sendMsg(ResponseCode::CommandParameterError, "Flag unsupported", false);
+            ifc_close();
             return 0;
         }
     }
+
+    cli->sendMsg(ResponseCode::CommandOkay, "Interface configuration set", false);
+    ifc_close();
+    return 0;
+}
+
+int CommandListener::InterfaceCmd::clearAddrs(SocketClient *cli, int, char **argv) {
+    // arglist: iface
+    ALOGD("Clearing all IP addresses on %s", argv[2]);
+
+    ifc_clear_addresses(argv[2]);
+
+    cli->sendMsg(ResponseCode::CommandOkay, "Interface IP addresses cleared", false);
+    return 0;
+}
+
+int CommandListener::InterfaceCmd::ipv6PrivacyExtensions(SocketClient *cli, int, char **argv) {
+    int enable = !strncmp(argv[3], "enable", 7);
+    if (sInterfaceCtrl->setIPv6PrivacyExtensions(argv[2], enable) == 0) {
+        cli->sendMsg(ResponseCode::CommandOkay, "IPv6 privacy extensions changed", false);
+    } else {
+        cli->sendMsg(ResponseCode::OperationFailed,
+                "Failed to set ipv6 privacy extensions", true);
+    }
+    return 0;
+}
+
+int CommandListener::InterfaceCmd::ipv6(SocketClient *cli, int, char **argv) {
+    int enable = !strncmp(argv[3], "enable", 7);
+    if (sInterfaceCtrl->setEnableIPv6(argv[2], enable) == 0) {
+        cli->sendMsg(ResponseCode::CommandOkay, "IPv6 state changed", false);
+    } else {
+        cli->sendMsg(ResponseCode::OperationFailed,
+                "Failed to change IPv6 state", true);
+    }
+    return 0;
+}
+
+int CommandListener::InterfaceCmd::getMtu(SocketClient *cli, int, char **argv) {
+    char *msg = NULL;
+    int mtu = 0;
+    if (sInterfaceCtrl->getMtu(argv[2], &mtu) == 0) {
+        asprintf(&msg, "MTU = %d", mtu);
+        cli->sendMsg(ResponseCode::InterfaceGetMtuResult, msg, false);
+        free(msg);
+    } else {
+        cli->sendMsg(ResponseCode::OperationFailed,
+                "Failed to get MTU", true);
+    }
+    return 0;
+}
+
+int CommandListener::InterfaceCmd::setMtu(SocketClient *cli, int, char **argv) {
+    if (sInterfaceCtrl->setMtu(argv[2], argv[3]) == 0) {
+        cli->sendMsg(ResponseCode::CommandOkay, "MTU changed", false);
+    } else {
+        cli->sendMsg(ResponseCode::OperationFailed,
+                "Failed to get MTU", true);
+    }
     return 0;
 }
 
@@ -982,6 +1128,8 @@ int CommandListener::NatCmd::runCommand(SocketClient *cli,
         return 0;
     }
 
+    sBandwidthCtrl->syncJournal();
+
     if (!rc) {
         cli->sendMsg(ResponseCode::CommandOkay, "Nat operation succeeded", false);
     } else {
@@ -1099,120 +1247,148 @@ int CommandListener::SoftapCmd::runCommand(SocketClient *cli,
     return 0;
 }
 
+const SubcommandTable::Entry CommandListener::ResolverCmd::sSubcommands[] = {
+    { "setdefaultif", NULL, "s", NULL, 0, 0, "setdefaultif <iface>", setDefaultIf,
+      "Wrong number of arguments to resolver setdefaultif" },
+    { "setifdns", NULL, "ss", "s", 1, -1, "setifdns <iface> <domains> <dns1> <dns2> ...",
+      setIfDns, "Wrong number of arguments to resolver setifdns" },
+    { "flushdefaultif", NULL, "", NULL, 0, 0, "flushdefaultif", flushDefaultIf,
+      "Wrong number of arguments to resolver flushdefaultif" },
+    { "flushif", NULL, "s", NULL, 0, 0, "flushif <iface>", flushIf,
+      "Wrong number of arguments to resolver setdefaultif" },
+    { "setifaceforpid", NULL, "ss", NULL, 0, 0, "setifaceforpid <iface> <pid>",
+      setIfaceForPid, "Wrong number of arguments to resolver setifaceforpid" },
+    { "clearifaceforpid", NULL, "s", NULL, 0, 0, "clearifaceforpid <pid>", clearIfaceForPid,
+      "Wrong number of arguments to resolver clearifaceforpid" },
+    { "setifaceforuidrange", NULL, "sss", NULL, 0, 0, "setifaceforuidrange <iface> <l> <h>",
+      setIfaceForUidRange, "Wrong number of arguments to resolver setifaceforuid" },
+    { "clearifaceforuidrange", NULL, "sss", NULL, 0, 0,
+      "clearifaceforuidrange <iface> <l> <h>", clearIfaceForUidRange,
+      "Wrong number of arguments to resolver clearifaceforuid" },
+    { "clearifacemapping", NULL, "", NULL, 0, 0, "clearifacemapping", clearIfaceMapping,
+      "Wrong number of arugments to resolver clearifacemapping" },
+};
+
 CommandListener::ResolverCmd::ResolverCmd() :
-        NetdCommand("resolver") {
+        NetdCommand("resolver"),
+        mSubcommands("resolver", sSubcommands, sizeof(sSubcommands) / sizeof(sSubcommands[0]),
+                "Resolver missing arguments", "Resolver unknown command") {
 }
 
-int CommandListener::ResolverCmd::runCommand(SocketClient *cli, int argc, char **margv) {
-    int rc = 0;
-    struct in_addr addr;
-    const char **argv = const_cast<const char **>(margv);
-
-    if (argc < 2) {
-        cli->sendMsg(ResponseCode::CommandSyntaxError, "Resolver missing arguments", false);
-        return 0;
+int CommandListener::ResolverCmd::sendGenericOkFail(SocketClient *cli, int cond) {
+    if (!cond) {
+        cli->sendMsg(ResponseCode::CommandOkay, "Resolver command succeeded", false);
+    } else {
+        cli->sendMsg(ResponseCode::OperationFailed, "Resolver command failed", true);
     }
+    return 0;
+}
 
-    if (!strcmp(argv[1], "setdefaultif")) { // "resolver setdefaultif <iface>"
-        if (argc == 3) {
-            rc = sResolverCtrl->setDefaultInterface(argv[2]);
-        } else {
-            cli->sendMsg(ResponseCode::CommandSyntaxError,
-                    "Wrong number of arguments to resolver setdefaultif", false);
-            return 0;
-        }
-    } else if (!strcmp(argv[1], "setifdns")) {
-        // "resolver setifdns <iface> <domains> <dns1> <dns2> ..."
-        if (argc >= 5) {
-            rc = sResolverCtrl->setInterfaceDnsServers(argv[2], argv[3], &argv[4], argc - 4);
-        } else {
-            cli->sendMsg(ResponseCode::CommandSyntaxError,
-                    "Wrong number of arguments to resolver setifdns", false);
-            return 0;
-        }
+int CommandListener::ResolverCmd::runCommand(SocketClient *cli, int argc, char **argv) {
+    return mSubcommands.dispatch(cli, argc, argv);
+}
 
-        // set the address of the interface to which the name servers
-        // are bound. Required in order to bind to right interface when
-        // doing the dns query.
-        if (!rc) {
-            ifc_init();
-            ifc_get_info(argv[2], &addr.s_addr, NULL, 0);
+int CommandListener::ResolverCmd::setDefaultIf(SocketClient *cli, int, char **argv) {
+    return sendGenericOkFail(cli, sResolverCtrl->setDefaultInterface(argv[2]));
+}
 
-            rc = sResolverCtrl->setInterfaceAddress(argv[2], &addr);
-        }
-    } else if (!strcmp(argv[1], "flushdefaultif")) { // "resolver flushdefaultif"
-        if (argc == 2) {
-            rc = sResolverCtrl->flushDefaultDnsCache();
-        } else {
-            cli->sendMsg(ResponseCode::CommandSyntaxError,
-                    "Wrong number of arguments to resolver flushdefaultif", false);
-            return 0;
-        }
-    } else if (!strcmp(argv[1], "flushif")) { // "resolver flushif <iface>"
-        if (argc == 3) {
-            rc = sResolverCtrl->flushInterfaceDnsCache(argv[2]);
-        } else {
-            cli->sendMsg(ResponseCode::CommandSyntaxError,
-                    "Wrong number of arguments to resolver setdefaultif", false);
-            return 0;
-        }
-    } else if (!strcmp(argv[1], "setifaceforpid")) { // resolver setifaceforpid <iface> <pid>
-        if (argc == 4) {
-            rc = sResolverCtrl->setDnsInterfaceForPid(argv[2], atoi(argv[3]));
-        } else {
-            cli->sendMsg(ResponseCode::CommandSyntaxError,
-                    "Wrong number of arguments to resolver setifaceforpid", false);
-            return 0;
-        }
-    } else if (!strcmp(argv[1], "clearifaceforpid")) { // resolver clearifaceforpid <pid>
-        if (argc == 3) {
-            rc = sResolverCtrl->clearDnsInterfaceForPid(atoi(argv[2]));
-        } else {
-            cli->sendMsg(ResponseCode::CommandSyntaxError,
-                    "Wrong number of arguments to resolver clearifaceforpid", false);
-            return 0;
-        }
-    } else if (!strcmp(argv[1], "setifaceforuidrange")) { // resolver setifaceforuid <iface> <l> <h>
-        if (argc == 5) {
-            rc = sResolverCtrl->setDnsInterfaceForUidRange(argv[2], atoi(argv[3]), atoi(argv[4]));
-        } else {
-            cli->sendMsg(ResponseCode::CommandSyntaxError,
-                    "Wrong number of arguments to resolver setifaceforuid", false);
-            return 0;
-        }
-    } else if (!strcmp(argv[1], "clearifaceforuidrange")) {
-        // resolver clearifaceforuid <if> <l> <h>
-        if (argc == 5) {
-            rc = sResolverCtrl->clearDnsInterfaceForUidRange(argv[2], atoi(argv[3]),
-                    atoi(argv[4]));
-        } else {
-            cli->sendMsg(ResponseCode::CommandSyntaxError,
-                    "Wrong number of arguments to resolver clearifaceforuid", false);
-            return 0;
-        }
-    } else if (!strcmp(argv[1], "clearifacemapping")) {
-        if (argc == 2) {
-            rc = sResolverCtrl->clearDnsInterfaceMappings();
-        } else {
-            cli->sendMsg(ResponseCode::CommandSyntaxError,
-                    "Wrong number of arugments to resolver clearifacemapping", false);
-        }
-    } else {
-        cli->sendMsg(ResponseCode::CommandSyntaxError,"Resolver unknown command", false);
-        return 0;
-    }
+int CommandListener::ResolverCmd::setIfDns(SocketClient *cli, int argc, char **argv) {
+    struct in_addr addr;
+    int rc;
+
+    rc = sResolverCtrl->setInterfaceDnsServers(argv[2], argv[3],
+            const_cast<const char **>(&argv[4]), argc - 4);
 
+    // set the address of the interface to which the name servers
+    // are bound. Required in order to bind to right interface when
+    // doing the dns query.
     if (!rc) {
-        cli->sendMsg(ResponseCode::CommandOkay, "Resolver command succeeded", false);
-    } else {
-        cli->sendMsg(ResponseCode::OperationFailed, "Resolver command failed", true);
+        ifc_init();
+        ifc_get_info(argv[2], &addr.s_addr, NULL, 0);
+
+        rc = sResolverCtrl->setInterfaceAddress(argv[2], &addr);
     }
+    return sendGenericOkFail(cli, rc);
+}
 
-    return 0;
+int CommandListener::ResolverCmd::flushDefaultIf(SocketClient *cli, int, char **) {
+    return sendGenericOkFail(cli, sResolverCtrl->flushDefaultDnsCache());
+}
+
+int CommandListener::ResolverCmd::flushIf(SocketClient *cli, int, char **argv) {
+    return sendGenericOkFail(cli, sResolverCtrl->flushInterfaceDnsCache(argv[2]));
+}
+
+int CommandListener::ResolverCmd::setIfaceForPid(SocketClient *cli, int, char **argv) {
+    return sendGenericOkFail(cli, sResolverCtrl->setDnsInterfaceForPid(argv[2], atoi(argv[3])));
+}
+
+int CommandListener::ResolverCmd::clearIfaceForPid(SocketClient *cli, int, char **argv) {
+    return sendGenericOkFail(cli, sResolverCtrl->clearDnsInterfaceForPid(atoi(argv[2])));
+}
+
+int CommandListener::ResolverCmd::setIfaceForUidRange(SocketClient *cli, int, char **argv) {
+    return sendGenericOkFail(cli, sResolverCtrl->setDnsInterfaceForUidRange(argv[2],
+            atoi(argv[3]), atoi(argv[4])));
+}
+
+int CommandListener::ResolverCmd::clearIfaceForUidRange(SocketClient *cli, int, char **argv) {
+    return sendGenericOkFail(cli, sResolverCtrl->clearDnsInterfaceForUidRange(argv[2],
+            atoi(argv[3]), atoi(argv[4])));
+}
+
+int CommandListener::ResolverCmd::clearIfaceMapping(SocketClient *cli, int, char **) {
+    return sendGenericOkFail(cli, sResolverCtrl->clearDnsInterfaceMappings());
 }
 
+const SubcommandTable::Entry CommandListener::BandwidthControlCmd::sSubcommands[] = {
+    { "enable", NULL, "", NULL, 0, 0, "enable", enable },
+    { "disable", NULL, "", NULL, 0, 0, "disable", disable },
+    { "removequota", "rq", "s", NULL, 0, 0, "removequota <interface>", removeQuota },
+    { "getquota", "gq", "", NULL, 0, 0, "getquota", getQuota },
+    { "getiquota", "giq", "s", NULL, 0, 0, "getiquota <iface>", getIQuota },
+    { "getallquotas", "gaq", "", NULL, 0, 0, "getallquotas", getAllQuotas },
+    { "setquota", "sq", "sn", NULL, 0, 0, "setquota <interface> <bytes>", setQuota },
+    { "setquotas", "sqs", "n", "s", 1, -1, "setquotas <bytes> <interface> ...", setQuotas },
+    { "setiquotas", "siqs", "", "sn", 1, -1, "setiquotas <interface> <bytes> ...",
+      setIQuotas },
+    { "removequotas", "rqs", "", "s", 1, -1, "removequotas <interface> ...", removeQuotas },
+    { "removeiquota", "riq", "s", NULL, 0, 0, "removeiquota <interface>", removeIQuota },
+    { "setiquota", "siq", "sn", NULL, 0, 0, "setiquota <interface> <bytes>", setIQuota },
+    { "addnaughtyapps", "ana", "", "n", 1, -1, "addnaughtyapps <appUid> ...",
+      addNaughtyApps },
+    { "removenaughtyapps", "rna", "", "n", 1, -1, "removenaughtyapps <appUid> ...",
+      removeNaughtyApps },
+    { "happybox", NULL, "s", NULL, 0, 0, "happybox (enable | disable)", happyBox },
+    { "addniceapps", "aha", "", "n", 1, -1, "addniceapps <appUid> ...", addNiceApps },
+    { "removeniceapps", "rha", "", "n", 1, -1, "removeniceapps <appUid> ...",
+      removeNiceApps },
+    { "setglobalalert", "sga", "n", NULL, 0, 0, "setglobalalert <bytes>", setGlobalAlert },
+    { "debugsettetherglobalalert", "dstga", "ss", NULL, 0, 0,
+      "debugsettetherglobalalert <interface0> <interface1>", debugSetTetherGlobalAlert },
+    { "removeglobalalert", "rga", "", NULL, 0, 0, "removeglobalalert", removeGlobalAlert },
+    { "debugremovetetherglobalalert", "drtga", "ss", NULL, 0, 0,
+      "debugremovetetherglobalalert <interface0> <interface1>",
+      debugRemoveTetherGlobalAlert },
+    { "setsharedalert", "ssa", "n", NULL, 0, 0, "setsharedalert <bytes>", setSharedAlert },
+    { "removesharedalert", "rsa", "", NULL, 0, 0, "removesharedalert", removeSharedAlert },
+    { "setalerts", "sas", "s", "n", 1, -1,
+      "setalerts (global | shared | <interface>) <bytes> ...", setAlerts },
+    { "setinterfacealert", "sia", "sn", NULL, 0, 0, "setinterfacealert <interface> <bytes>",
+      setInterfaceAlert },
+    { "removeinterfacealert", "ria", "s", NULL, 0, 0, "removeinterfacealert <interface>",
+      removeInterfaceAlert },
+    { "getuidstats", "gus", "", "ss", 0, -1,
+      "getuidstats [uid <uid>] [iface <interface>] [tag <tag>] [window <secs>]",
+      getUidStats },
+    { "resetuidstats", "rus", "", NULL, 0, 0, "resetuidstats", resetUidStats },
+    { "gettetherstats", "gts", "", "s", 0, 2, "gettetherstats [<intInterface> <extInterface>]",
+      getTetherStats },
+};
+
 CommandListener::BandwidthControlCmd::BandwidthControlCmd() :
-    NetdCommand("bandwidth") {
+    NetdCommand("bandwidth"),
+    mSubcommands("bandwidth", sSubcommands, sizeof(sSubcommands) / sizeof(sSubcommands[0])) {
 }
 
 void CommandListener::BandwidthControlCmd::sendGenericSyntaxError(SocketClient *cli, const char *usageMsg) {
@@ -1235,304 +1411,250 @@ void CommandListener::BandwidthControlCmd::sendGenericOpFailed(SocketClient *cli
 }
 
 int CommandListener::BandwidthControlCmd::runCommand(SocketClient *cli, int argc, char **argv) {
-    if (argc < 2) {
-        sendGenericSyntaxError(cli, "<cmds> <args...>");
+    ALOGV("bwctrlcmd: argc=%d %s %s ...", argc, argv[0], argc > 1 ? argv[1] : "");
+
+    int rc = mSubcommands.dispatch(cli, argc, argv);
+
+    /*
+     * Whatever the command changed, a restarted netd should find it. The
+     * get* subcommands and their g* aliases only read, so the rules need
+     * not be listed again.
+     */
+    sBandwidthCtrl->syncJournal(argc > 1 && argv[1][0] != 'g');
+    return rc;
+}
+
+int CommandListener::BandwidthControlCmd::enable(SocketClient *cli, int, char **) {
+    sendGenericOkFail(cli, sBandwidthCtrl->enableBandwidthControl(true));
+    return 0;
+}
+
+int CommandListener::BandwidthControlCmd::disable(SocketClient *cli, int, char **) {
+    sendGenericOkFail(cli, sBandwidthCtrl->disableBandwidthControl());
+    return 0;
+}
+
+int CommandListener::BandwidthControlCmd::removeQuota(SocketClient *cli, int, char **argv) {
+    sendGenericOkFail(cli, sBandwidthCtrl->removeInterfaceSharedQuota(argv[2]));
+    return 0;
+}
+
+int CommandListener::BandwidthControlCmd::getQuota(SocketClient *cli, int, char **) {
+    int64_t bytes;
+    char *msg;
+
+    if (sBandwidthCtrl->getInterfaceSharedQuota(&bytes)) {
+        sendGenericOpFailed(cli, "Failed to get quota");
         return 0;
     }
+    asprintf(&msg, "%lld", bytes);
+    cli->sendMsg(ResponseCode::QuotaCounterResult, msg, false);
+    free(msg);
+    return 0;
+}
 
-    ALOGV("bwctrlcmd: argc=%d %s %s ...", argc, argv[0], argv[1]);
+int CommandListener::BandwidthControlCmd::getIQuota(SocketClient *cli, int, char **argv) {
+    int64_t bytes;
+    char *msg;
 
-    if (!strcmp(argv[1], "enable")) {
-        int rc = sBandwidthCtrl->enableBandwidthControl(true);
-        sendGenericOkFail(cli, rc);
+    if (sBandwidthCtrl->getInterfaceQuota(argv[2], &bytes)) {
+        sendGenericOpFailed(cli, "Failed to get quota");
         return 0;
-
     }
-    if (!strcmp(argv[1], "disable")) {
-        int rc = sBandwidthCtrl->disableBandwidthControl();
-        sendGenericOkFail(cli, rc);
-        return 0;
+    asprintf(&msg, "%lld", bytes);
+    cli->sendMsg(ResponseCode::QuotaCounterResult, msg, false);
+    free(msg);
+    return 0;
+}
 
+int CommandListener::BandwidthControlCmd::getAllQuotas(SocketClient *cli, int, char **) {
+    if (sBandwidthCtrl->getAllQuotas(cli)) {
+        sendGenericOpFailed(cli, "Failed to get quotas");
     }
-    if (!strcmp(argv[1], "removequota") || !strcmp(argv[1], "rq")) {
-        if (argc != 3) {
-            sendGenericSyntaxError(cli, "removequota <interface>");
-            return 0;
-        }
-        int rc = sBandwidthCtrl->removeInterfaceSharedQuota(argv[2]);
-        sendGenericOkFail(cli, rc);
-        return 0;
+    return 0;
+}
 
-    }
-    if (!strcmp(argv[1], "getquota") || !strcmp(argv[1], "gq")) {
-        int64_t bytes;
-        if (argc != 2) {
-            sendGenericSyntaxError(cli, "getquota");
-            return 0;
-        }
-        int rc = sBandwidthCtrl->getInterfaceSharedQuota(&bytes);
-        if (rc) {
-            sendGenericOpFailed(cli, "Failed to get quota");
-            return 0;
-        }
+int CommandListener::BandwidthControlCmd::setQuota(SocketClient *cli, int, char **argv) {
+    sendGenericOkFail(cli, sBandwidthCtrl->setInterfaceSharedQuota(argv[2], atoll(argv[3])));
+    return 0;
+}
 
+int CommandListener::BandwidthControlCmd::setQuotas(SocketClient *cli, int argc, char **argv) {
+    if (sBandwidthCtrl->setInterfaceSharedQuotas(argc - 3, argv + 3, atoll(argv[2]))) {
         char *msg;
-        asprintf(&msg, "%lld", bytes);
-        cli->sendMsg(ResponseCode::QuotaCounterResult, msg, false);
+        asprintf(&msg, "bandwidth setquotas %s failed", argv[2]);
+        cli->sendMsg(ResponseCode::OperationFailed, msg, false);
         free(msg);
         return 0;
-
     }
-    if (!strcmp(argv[1], "getiquota") || !strcmp(argv[1], "giq")) {
-        int64_t bytes;
-        if (argc != 3) {
-            sendGenericSyntaxError(cli, "getiquota <iface>");
-            return 0;
-        }
+    sendGenericOkFail(cli, 0);
+    return 0;
+}
 
-        int rc = sBandwidthCtrl->getInterfaceQuota(argv[2], &bytes);
-        if (rc) {
-            sendGenericOpFailed(cli, "Failed to get quota");
-            return 0;
-        }
-        char *msg;
-        asprintf(&msg, "%lld", bytes);
-        cli->sendMsg(ResponseCode::QuotaCounterResult, msg, false);
-        free(msg);
-        return 0;
+int CommandListener::BandwidthControlCmd::setIQuotas(SocketClient *cli, int argc, char **argv) {
+    std::list<std::pair<std::string, int64_t> > quotas;
 
+    for (int q = 2; q < argc; q += 2) {
+        quotas.push_back(std::pair<std::string, int64_t>(argv[q], atoll(argv[q + 1])));
     }
-    if (!strcmp(argv[1], "setquota") || !strcmp(argv[1], "sq")) {
-        if (argc != 4) {
-            sendGenericSyntaxError(cli, "setquota <interface> <bytes>");
+    sendGenericOkFail(cli, sBandwidthCtrl->setInterfaceQuotas(quotas));
+    return 0;
+}
+
+int CommandListener::BandwidthControlCmd::removeQuotas(SocketClient *cli, int argc, char **argv) {
+    for (int q = 2; q < argc; q++) {
+        if (sBandwidthCtrl->removeInterfaceSharedQuota(argv[q])) {
+            char *msg;
+            asprintf(&msg, "bandwidth removequotas %s failed", argv[q]);
+            cli->sendMsg(ResponseCode::OperationFailed, msg, false);
+            free(msg);
             return 0;
         }
-        int rc = sBandwidthCtrl->setInterfaceSharedQuota(argv[2], atoll(argv[3]));
-        sendGenericOkFail(cli, rc);
-        return 0;
     }
-    if (!strcmp(argv[1], "setquotas") || !strcmp(argv[1], "sqs")) {
-        int rc;
-        if (argc < 4) {
-            sendGenericSyntaxError(cli, "setquotas <bytes> <interface> ...");
-            return 0;
-        }
+    sendGenericOkFail(cli, 0);
+    return 0;
+}
 
-        for (int q = 3; argc >= 4; q++, argc--) {
-            rc = sBandwidthCtrl->setInterfaceSharedQuota(argv[q], atoll(argv[2]));
-            if (rc) {
-                char *msg;
-                asprintf(&msg, "bandwidth setquotas %s %s failed", argv[2], argv[q]);
-                cli->sendMsg(ResponseCode::OperationFailed,
-                             msg, false);
-                free(msg);
-                return 0;
-            }
-        }
-        sendGenericOkFail(cli, rc);
-        return 0;
+int CommandListener::BandwidthControlCmd::removeIQuota(SocketClient *cli, int, char **argv) {
+    sendGenericOkFail(cli, sBandwidthCtrl->removeInterfaceQuota(argv[2]));
+    return 0;
+}
 
-    }
-    if (!strcmp(argv[1], "removequotas") || !strcmp(argv[1], "rqs")) {
-        int rc;
-        if (argc < 3) {
-            sendGenericSyntaxError(cli, "removequotas <interface> ...");
-            return 0;
-        }
+int CommandListener::BandwidthControlCmd::setIQuota(SocketClient *cli, int, char **argv) {
+    sendGenericOkFail(cli, sBandwidthCtrl->setInterfaceQuota(argv[2], atoll(argv[3])));
+    return 0;
+}
 
-        for (int q = 2; argc >= 3; q++, argc--) {
-            rc = sBandwidthCtrl->removeInterfaceSharedQuota(argv[q]);
-            if (rc) {
-                char *msg;
-                asprintf(&msg, "bandwidth removequotas %s failed", argv[q]);
-                cli->sendMsg(ResponseCode::OperationFailed,
-                             msg, false);
-                free(msg);
-                return 0;
-            }
-        }
-        sendGenericOkFail(cli, rc);
-        return 0;
+int CommandListener::BandwidthControlCmd::addNaughtyApps(SocketClient *cli, int argc,
+                                                         char **argv) {
+    sendGenericOkFail(cli, sBandwidthCtrl->addNaughtyApps(argc - 2, argv + 2));
+    return 0;
+}
 
-    }
-    if (!strcmp(argv[1], "removeiquota") || !strcmp(argv[1], "riq")) {
-        if (argc != 3) {
-            sendGenericSyntaxError(cli, "removeiquota <interface>");
-            return 0;
-        }
-        int rc = sBandwidthCtrl->removeInterfaceQuota(argv[2]);
-        sendGenericOkFail(cli, rc);
-        return 0;
+int CommandListener::BandwidthControlCmd::removeNaughtyApps(SocketClient *cli, int argc,
+                                                            char **argv) {
+    sendGenericOkFail(cli, sBandwidthCtrl->removeNaughtyApps(argc - 2, argv + 2));
+    return 0;
+}
 
+int CommandListener::BandwidthControlCmd::happyBox(SocketClient *cli, int, char **argv) {
+    if (!strcmp(argv[2], "enable")) {
+        sendGenericOkFail(cli, sBandwidthCtrl->enableHappyBox());
+    } else if (!strcmp(argv[2], "disable")) {
+        sendGenericOkFail(cli, sBandwidthCtrl->disableHappyBox());
+    } else {
+        sendGenericSyntaxError(cli, "happybox (enable | disable)");
     }
-    if (!strcmp(argv[1], "setiquota") || !strcmp(argv[1], "siq")) {
-        if (argc != 4) {
-            sendGenericSyntaxError(cli, "setiquota <interface> <bytes>");
-            return 0;
-        }
-        int rc = sBandwidthCtrl->setInterfaceQuota(argv[2], atoll(argv[3]));
-        sendGenericOkFail(cli, rc);
-        return 0;
+    return 0;
+}
 
-    }
-    if (!strcmp(argv[1], "addnaughtyapps") || !strcmp(argv[1], "ana")) {
-        if (argc < 3) {
-            sendGenericSyntaxError(cli, "addnaughtyapps <appUid> ...");
-            return 0;
-        }
-        int rc = sBandwidthCtrl->addNaughtyApps(argc - 2, argv + 2);
-        sendGenericOkFail(cli, rc);
-        return 0;
+int CommandListener::BandwidthControlCmd::addNiceApps(SocketClient *cli, int argc, char **argv) {
+    sendGenericOkFail(cli, sBandwidthCtrl->addNiceApps(argc - 2, argv + 2));
+    return 0;
+}
 
+int CommandListener::BandwidthControlCmd::removeNiceApps(SocketClient *cli, int argc,
+                                                         char **argv) {
+    sendGenericOkFail(cli, sBandwidthCtrl->removeNiceApps(argc - 2, argv + 2));
+    return 0;
+}
 
-    }
-    if (!strcmp(argv[1], "removenaughtyapps") || !strcmp(argv[1], "rna")) {
-        if (argc < 3) {
-            sendGenericSyntaxError(cli, "removenaughtyapps <appUid> ...");
-            return 0;
-        }
-        int rc = sBandwidthCtrl->removeNaughtyApps(argc - 2, argv + 2);
-        sendGenericOkFail(cli, rc);
-        return 0;
-    }
-    if (!strcmp(argv[1], "happybox")) {
-        if (argc < 3) {
-            sendGenericSyntaxError(cli, "happybox (enable | disable)");
-            return 0;
-        }
-        if (!strcmp(argv[2], "enable")) {
-            int rc = sBandwidthCtrl->enableHappyBox();
-            sendGenericOkFail(cli, rc);
-            return 0;
+int CommandListener::BandwidthControlCmd::setGlobalAlert(SocketClient *cli, int, char **argv) {
+    sendGenericOkFail(cli, sBandwidthCtrl->setGlobalAlert(atoll(argv[2])));
+    return 0;
+}
 
-        }
-        if (!strcmp(argv[2], "disable")) {
-            int rc = sBandwidthCtrl->disableHappyBox();
-            sendGenericOkFail(cli, rc);
-            return 0;
-        }
-        sendGenericSyntaxError(cli, "happybox (enable | disable)");
-        return 0;
-    }
-    if (!strcmp(argv[1], "addniceapps") || !strcmp(argv[1], "aha")) {
-        if (argc < 3) {
-            sendGenericSyntaxError(cli, "addniceapps <appUid> ...");
-            return 0;
-        }
-        int rc = sBandwidthCtrl->addNiceApps(argc - 2, argv + 2);
-        sendGenericOkFail(cli, rc);
-        return 0;
-    }
-    if (!strcmp(argv[1], "removeniceapps") || !strcmp(argv[1], "rha")) {
-        if (argc < 3) {
-            sendGenericSyntaxError(cli, "removeniceapps <appUid> ...");
-            return 0;
-        }
-        int rc = sBandwidthCtrl->removeNiceApps(argc - 2, argv + 2);
-        sendGenericOkFail(cli, rc);
-        return 0;
-    }
-    if (!strcmp(argv[1], "setglobalalert") || !strcmp(argv[1], "sga")) {
-        if (argc != 3) {
-            sendGenericSyntaxError(cli, "setglobalalert <bytes>");
-            return 0;
-        }
-        int rc = sBandwidthCtrl->setGlobalAlert(atoll(argv[2]));
-        sendGenericOkFail(cli, rc);
-        return 0;
-    }
-    if (!strcmp(argv[1], "debugsettetherglobalalert") || !strcmp(argv[1], "dstga")) {
-        if (argc != 4) {
-            sendGenericSyntaxError(cli, "debugsettetherglobalalert <interface0> <interface1>");
-            return 0;
-        }
-        /* We ignore the interfaces for now. */
-        int rc = sBandwidthCtrl->setGlobalAlertInForwardChain();
-        sendGenericOkFail(cli, rc);
-        return 0;
+int CommandListener::BandwidthControlCmd::debugSetTetherGlobalAlert(SocketClient *cli, int,
+                                                                    char **) {
+    /* We ignore the interfaces for now. */
+    sendGenericOkFail(cli, sBandwidthCtrl->setGlobalAlertInForwardChain());
+    return 0;
+}
 
-    }
-    if (!strcmp(argv[1], "removeglobalalert") || !strcmp(argv[1], "rga")) {
-        if (argc != 2) {
-            sendGenericSyntaxError(cli, "removeglobalalert");
-            return 0;
-        }
-        int rc = sBandwidthCtrl->removeGlobalAlert();
-        sendGenericOkFail(cli, rc);
-        return 0;
+int CommandListener::BandwidthControlCmd::removeGlobalAlert(SocketClient *cli, int, char **) {
+    sendGenericOkFail(cli, sBandwidthCtrl->removeGlobalAlert());
+    return 0;
+}
 
-    }
-    if (!strcmp(argv[1], "debugremovetetherglobalalert") || !strcmp(argv[1], "drtga")) {
-        if (argc != 4) {
-            sendGenericSyntaxError(cli, "debugremovetetherglobalalert <interface0> <interface1>");
-            return 0;
-        }
-        /* We ignore the interfaces for now. */
-        int rc = sBandwidthCtrl->removeGlobalAlertInForwardChain();
-        sendGenericOkFail(cli, rc);
-        return 0;
+int CommandListener::BandwidthControlCmd::debugRemoveTetherGlobalAlert(SocketClient *cli, int,
+                                                                       char **) {
+    /* We ignore the interfaces for now. */
+    sendGenericOkFail(cli, sBandwidthCtrl->removeGlobalAlertInForwardChain());
+    return 0;
+}
 
-    }
-    if (!strcmp(argv[1], "setsharedalert") || !strcmp(argv[1], "ssa")) {
-        if (argc != 3) {
-            sendGenericSyntaxError(cli, "setsharedalert <bytes>");
-            return 0;
-        }
-        int rc = sBandwidthCtrl->setSharedAlert(atoll(argv[2]));
-        sendGenericOkFail(cli, rc);
-        return 0;
+int CommandListener::BandwidthControlCmd::setSharedAlert(SocketClient *cli, int, char **argv) {
+    sendGenericOkFail(cli, sBandwidthCtrl->setSharedAlert(atoll(argv[2])));
+    return 0;
+}
 
-    }
-    if (!strcmp(argv[1], "removesharedalert") || !strcmp(argv[1], "rsa")) {
-        if (argc != 2) {
-            sendGenericSyntaxError(cli, "removesharedalert");
-            return 0;
-        }
-        int rc = sBandwidthCtrl->removeSharedAlert();
-        sendGenericOkFail(cli, rc);
-        return 0;
+int CommandListener::BandwidthControlCmd::removeSharedAlert(SocketClient *cli, int, char **) {
+    sendGenericOkFail(cli, sBandwidthCtrl->removeSharedAlert());
+    return 0;
+}
 
-    }
-    if (!strcmp(argv[1], "setinterfacealert") || !strcmp(argv[1], "sia")) {
-        if (argc != 4) {
-            sendGenericSyntaxError(cli, "setinterfacealert <interface> <bytes>");
-            return 0;
-        }
-        int rc = sBandwidthCtrl->setInterfaceAlert(argv[2], atoll(argv[3]));
-        sendGenericOkFail(cli, rc);
-        return 0;
+int CommandListener::BandwidthControlCmd::setAlerts(SocketClient *cli, int argc, char **argv) {
+    int64_t thresholds[argc - 3];
 
+    for (int t = 3; t < argc; t++) {
+        thresholds[t - 3] = atoll(argv[t]);
     }
-    if (!strcmp(argv[1], "removeinterfacealert") || !strcmp(argv[1], "ria")) {
-        if (argc != 3) {
-            sendGenericSyntaxError(cli, "removeinterfacealert <interface>");
-            return 0;
-        }
-        int rc = sBandwidthCtrl->removeInterfaceAlert(argv[2]);
-        sendGenericOkFail(cli, rc);
-        return 0;
+    sendGenericOkFail(cli, sBandwidthCtrl->setAlerts(argv[2], argc - 3, thresholds));
+    return 0;
+}
 
-    }
-    if (!strcmp(argv[1], "gettetherstats") || !strcmp(argv[1], "gts")) {
-        BandwidthController::TetherStats tetherStats;
-        std::string extraProcessingInfo = "";
-        if (argc < 2 || argc > 4) {
-            sendGenericSyntaxError(cli, "gettetherstats [<intInterface> <extInterface>]");
+int CommandListener::BandwidthControlCmd::setInterfaceAlert(SocketClient *cli, int,
+                                                            char **argv) {
+    sendGenericOkFail(cli, sBandwidthCtrl->setInterfaceAlert(argv[2], atoll(argv[3])));
+    return 0;
+}
+
+int CommandListener::BandwidthControlCmd::removeInterfaceAlert(SocketClient *cli, int,
+                                                               char **argv) {
+    sendGenericOkFail(cli, sBandwidthCtrl->removeInterfaceAlert(argv[2]));
+    return 0;
+}
+
+int CommandListener::BandwidthControlCmd::getUidStats(SocketClient *cli, int argc, char **argv) {
+    QtaguidStats::Filter filter;
+
+    for (int a = 2; a < argc; a += 2) {
+        if (!strcmp(argv[a], "uid")) {
+            filter.uid = atoll(argv[a + 1]);
+        } else if (!strcmp(argv[a], "iface")) {
+            filter.iface = argv[a + 1];
+        } else if (!strcmp(argv[a], "tag")) {
+            filter.tag = strtoll(argv[a + 1], NULL, 0);
+        } else if (!strcmp(argv[a], "window")) {
+            filter.windowSecs = atoi(argv[a + 1]);
+        } else {
+            sendGenericSyntaxError(cli,
+                    "getuidstats [uid <uid>] [iface <interface>] [tag <tag>] [window <secs>]");
             return 0;
         }
-        tetherStats.intIface = argc > 2 ? argv[2] : "";
-        tetherStats.extIface = argc > 3 ? argv[3] : "";
-        int rc = sBandwidthCtrl->getTetherStats(cli, tetherStats, extraProcessingInfo);
-        if (rc) {
-                extraProcessingInfo.insert(0, "Failed to get tethering stats.\n");
-                sendGenericOpFailed(cli, extraProcessingInfo.c_str());
-                return 0;
-        }
-        return 0;
-
     }
+    if (sBandwidthCtrl->getUidStats(cli, filter)) {
+        sendGenericOpFailed(cli, "Failed to get uid stats");
+    }
+    return 0;
+}
 
-    cli->sendMsg(ResponseCode::CommandSyntaxError, "Unknown bandwidth cmd", false);
+int CommandListener::BandwidthControlCmd::resetUidStats(SocketClient *cli, int, char **) {
+    sendGenericOkFail(cli, sBandwidthCtrl->resetUidStats());
+    return 0;
+}
+
+int CommandListener::BandwidthControlCmd::getTetherStats(SocketClient *cli, int argc,
+                                                         char **argv) {
+    BandwidthController::TetherStats tetherStats;
+    std::string extraProcessingInfo = "";
+
+    tetherStats.intIface = argc > 2 ? argv[2] : "";
+    tetherStats.extIface = argc > 3 ? argv[3] : "";
+    if (sBandwidthCtrl->getTetherStats(cli, tetherStats, extraProcessingInfo)) {
+        extraProcessingInfo.insert(0, "Failed to get tethering stats.\n");
+        sendGenericOpFailed(cli, extraProcessingInfo.c_str());
+    }
     return 0;
 }
 
@@ -1567,12 +1689,11 @@ int CommandListener::IdletimerControlCmd::runCommand(SocketClient *cli, int argc
       return 0;
     }
     if (!strcmp(argv[1], "add")) {
-        if (argc != 5) {
+        if (argc < 5 || (argc - 2) % 3) {
             cli->sendMsg(ResponseCode::CommandSyntaxError, "Missing argument", false);
             return 0;
         }
-        if(0 != sIdletimerCtrl->addInterfaceIdletimer(
-                                        argv[2], atoi(argv[3]), argv[4])) {
+        if(0 != sIdletimerCtrl->addInterfaceIdletimers((argc - 2) / 3, argv + 2)) {
           cli->sendMsg(ResponseCode::OperationFailed, "Failed to add interface", false);
         } else {
           cli->sendMsg(ResponseCode::CommandOkay,  "Add success", false);
@@ -1580,476 +1701,620 @@ int CommandListener::IdletimerControlCmd::runCommand(SocketClient *cli, int argc
         return 0;
     }
     if (!strcmp(argv[1], "remove")) {
-        if (argc != 5) {
+        if (argc < 5 || (argc - 2) % 3) {
             cli->sendMsg(ResponseCode::CommandSyntaxError, "Missing argument", false);
             return 0;
         }
         // ashish: fixme timeout
-        if (0 != sIdletimerCtrl->removeInterfaceIdletimer(
-                                        argv[2], atoi(argv[3]), argv[4])) {
+        if (0 != sIdletimerCtrl->removeInterfaceIdletimers((argc - 2) / 3, argv + 2)) {
           cli->sendMsg(ResponseCode::OperationFailed, "Failed to remove interface", false);
         } else {
-          cli->sendMsg(ResponseCode::CommandOkay, "Remove success", false);
+          cli->sendMsg(ResponseCode::CommandOkay, "Remove success", false);
+        }
+        return 0;
+    }
+    if (!strcmp(argv[1], "list")) {
+        sIdletimerCtrl->listIdletimers(cli);
+        return 0;
+    }
+
+    cli->sendMsg(ResponseCode::CommandSyntaxError, "Unknown idletimer cmd", false);
+    return 0;
+}
+
+const SubcommandTable::Entry CommandListener::FirewallCmd::sSubcommands[] = {
+    { "enable", NULL, "", NULL, 0, 0, "enable", enable },
+    { "disable", NULL, "", NULL, 0, 0, "disable", disable },
+    { "is_enabled", NULL, "", NULL, 0, 0, "is_enabled", isEnabled },
+    { "set_interface_rule", NULL, "ss", NULL, 0, 0,
+      "set_interface_rule <rmnet0> <allow|deny>", setInterfaceRule },
+    { "set_egress_source_rule", NULL, "ss", NULL, 0, 0,
+      "set_egress_source_rule <192.168.0.1> <allow|deny>", setEgressSourceRule },
+    { "set_egress_dest_rule", NULL, "sns", NULL, 0, 0,
+      "set_egress_dest_rule <192.168.0.1> <80> <allow|deny>", setEgressDestRule },
+    { "set_uid_rule", NULL, "ns", NULL, 0, 0, "set_uid_rule <1000> <allow|deny>", setUidRule },
+};
+
+CommandListener::FirewallCmd::FirewallCmd() :
+    NetdCommand("firewall"),
+    mSubcommands("firewall", sSubcommands, sizeof(sSubcommands) / sizeof(sSubcommands[0]),
+            "Missing command", "Unknown command") {
+}
+
+int CommandListener::FirewallCmd::sendGenericOkFail(SocketClient *cli, int cond) {
+    if (!cond) {
+        cli->sendMsg(ResponseCode::CommandOkay, "Firewall command succeeded", false);
+    } else {
+        cli->sendMsg(ResponseCode::OperationFailed, "Firewall command failed", false);
+    }
+    return 0;
+}
+
+FirewallRule CommandListener::FirewallCmd::parseRule(const char* arg) {
+    if (!strcmp(arg, "allow")) {
+        return ALLOW;
+    } else {
+        return DENY;
+    }
+}
+
+int CommandListener::FirewallCmd::runCommand(SocketClient *cli, int argc,
+        char **argv) {
+    int rc = mSubcommands.dispatch(cli, argc, argv);
+
+    /* The journal holds a digest of the fw_* rules, for a restarted netd. */
+    if (argc > 1 && strcmp(argv[1], "is_enabled")) {
+        sBandwidthCtrl->syncJournal();
+    }
+    return rc;
+}
+
+int CommandListener::FirewallCmd::enable(SocketClient *cli, int, char **) {
+    return sendGenericOkFail(cli, sFirewallCtrl->enableFirewall());
+}
+
+int CommandListener::FirewallCmd::disable(SocketClient *cli, int, char **) {
+    return sendGenericOkFail(cli, sFirewallCtrl->disableFirewall());
+}
+
+int CommandListener::FirewallCmd::isEnabled(SocketClient *cli, int, char **) {
+    return sendGenericOkFail(cli, sFirewallCtrl->isFirewallEnabled());
+}
+
+int CommandListener::FirewallCmd::setInterfaceRule(SocketClient *cli, int, char **argv) {
+    const char* iface = argv[2];
+    FirewallRule rule = parseRule(argv[3]);
+
+    return sendGenericOkFail(cli, sFirewallCtrl->setInterfaceRule(iface, rule));
+}
+
+int CommandListener::FirewallCmd::setEgressSourceRule(SocketClient *cli, int, char **argv) {
+    const char* addr = argv[2];
+    FirewallRule rule = parseRule(argv[3]);
+
+    return sendGenericOkFail(cli, sFirewallCtrl->setEgressSourceRule(addr, rule));
+}
+
+int CommandListener::FirewallCmd::setEgressDestRule(SocketClient *cli, int, char **argv) {
+    const char* addr = argv[2];
+    int port = atoi(argv[3]);
+    FirewallRule rule = parseRule(argv[4]);
+
+    int res = 0;
+    res |= sFirewallCtrl->setEgressDestRule(addr, PROTOCOL_TCP, port, rule);
+    res |= sFirewallCtrl->setEgressDestRule(addr, PROTOCOL_UDP, port, rule);
+    return sendGenericOkFail(cli, res);
+}
+
+int CommandListener::FirewallCmd::setUidRule(SocketClient *cli, int, char **argv) {
+    int uid = atoi(argv[2]);
+    FirewallRule rule = parseRule(argv[3]);
+
+    return sendGenericOkFail(cli, sFirewallCtrl->setUidRule(uid, rule));
+}
+
+CommandListener::ClatdCmd::ClatdCmd() : NetdCommand("clatd") {
+}
+
+int CommandListener::ClatdCmd::runCommand(SocketClient *cli, int argc,
+                                                            char **argv) {
+    int rc = 0;
+    if (argc < 2) {
+        cli->sendMsg(ResponseCode::CommandSyntaxError, "Missing argument", false);
+        return 0;
+    }
+
+    if(!strcmp(argv[1], "stop")) {
+        rc = sClatdCtrl->stopClatd();
+    } else if (!strcmp(argv[1], "status")) {
+        char *tmp = NULL;
+
+        asprintf(&tmp, "Clatd status: %s", (sClatdCtrl->isClatdStarted() ?
+                                                        "started" : "stopped"));
+        cli->sendMsg(ResponseCode::ClatdStatusResult, tmp, false);
+        free(tmp);
+        return 0;
+    } else if(!strcmp(argv[1], "start")) {
+        if (argc < 3) {
+            cli->sendMsg(ResponseCode::CommandSyntaxError, "Missing argument", false);
+            return 0;
+        }
+        rc = sClatdCtrl->startClatd(argv[2]);
+    } else {
+        cli->sendMsg(ResponseCode::CommandSyntaxError, "Unknown clatd cmd", false);
+        return 0;
+    }
+
+    if (!rc) {
+        cli->sendMsg(ResponseCode::CommandOkay, "Clatd operation succeeded", false);
+    } else {
+        cli->sendMsg(ResponseCode::OperationFailed, "Clatd operation failed", false);
+    }
+
+    return 0;
+}
+
+/* Looked up on "route <action> <type> <family> <args...>", once the type is known. */
+const SubcommandTable::Entry CommandListener::RouteCmd::sSrcSubcommands[] = {
+    { "replace", NULL, "sssss", "s", 0, 1,
+      "replace src inet_family <interface> <ipaddr> <routeId> [<gateway>]", replaceSrc },
+    { "del", NULL, "sss", NULL, 0, 0, "del src v[4|6] <routeId>", delSrc },
+};
+
+const SubcommandTable::Entry CommandListener::RouteCmd::sDefSubcommands[] = {
+    { "replace", NULL, "sss", "s", 0, 1, "replace def v[4|6] <interface> [<gateway>]",
+      replaceDef },
+    { "add", NULL, "ssss", "s", 0, 1, "add def v[4|6] <interface> <metric> [<gateway>]",
+      addDef },
+};
+
+const SubcommandTable::Entry CommandListener::RouteCmd::sDstSubcommands[] = {
+    { "add", NULL, "sssss", "s", 0, 1,
+      "add dst v[4|6] <interface> <metric> <dstIpAddr> [<gateway>]", addDst },
+    { "del", NULL, "sss", NULL, 0, 0, "del dst v[4|6] <ipaddr>", delDst },
+};
+
+CommandListener::RouteCmd::RouteCmd() :
+                 NetdCommand("route"),
+                 mSrcSubcommands("route", sSrcSubcommands,
+                         sizeof(sSrcSubcommands) / sizeof(sSrcSubcommands[0]),
+                         NULL, "permitted operation for src routes: <replace|del>"),
+                 mDefSubcommands("route", sDefSubcommands,
+                         sizeof(sDefSubcommands) / sizeof(sDefSubcommands[0]),
+                         NULL, "Permitted action for def routes <replace|add>"),
+                 mDstSubcommands("route", sDstSubcommands,
+                         sizeof(sDstSubcommands) / sizeof(sDstSubcommands[0]),
+                         NULL, "permitted operation for dst routes: <add|del>") {
+}
+
+const char *CommandListener::RouteCmd::ipVersion(const char *family) {
+    if (!strcmp(family, "v4")) {
+        return "-4";
+    } else if (!strcmp(family, "v6")) {
+        return "-6";
+    }
+    return NULL;
+}
+
+int CommandListener::RouteCmd::runCommand(SocketClient *cli, int argc, char **argv) {
+    if (argc < 5) {
+        cli->sendMsg(ResponseCode::CommandSyntaxError,
+                    "Missing argument", false);
+        return 0;
+    }
+
+    if (!ipVersion(argv[3])) {
+        cli->sendMsg(ResponseCode::CommandSyntaxError,
+                     "Supported family v4|v6",false);
+        return 0;
+    }
+
+    if (!strcmp(argv[2], "src")) {
+        /* source based routing */
+        return mSrcSubcommands.dispatch(cli, argc, argv);
+    } else if (!strcmp(argv[2], "def")) {
+        /* default route configuration */
+        return mDefSubcommands.dispatch(cli, argc, argv);
+    } else if (!strcmp(argv[2], "dst")) {
+        /* destination based route configuration */
+        return mDstSubcommands.dispatch(cli, argc, argv);
+    }
+    cli->sendMsg(ResponseCode::CommandParameterError,
+                 "allowed route types: <src|dst|def>", false);
+    return 0;
+}
+
+int CommandListener::RouteCmd::replaceSrc(SocketClient *cli, int argc, char **argv) {
+    const char *ipVer = ipVersion(argv[3]);
+    char* end;
+    long int rid =  strtol(argv[6], &end, 10);
+    if (*end != '\0')
+    {
+        cli->sendMsg(ResponseCode::CommandParameterError,
+                        "RouteID: invalid numerical value", false);
+        return 0;
+    }
+    if ((rid < 1) || (rid > 252)) {
+        cli->sendMsg(ResponseCode::CommandParameterError,
+                        "0 < RouteID < 253", false);
+        return 0;
+    }
+
+    struct in_addr addr;
+    int prefix_length;
+    unsigned flags = 0;
+
+    ifc_init();
+    ifc_get_info(argv[4], &addr.s_addr, &prefix_length, &flags);
+    ifc_close();
+
+    char *iface = argv[4],
+         *srcPrefix = argv[5],
+         *routeId = argv[6],
+         *network = NULL,
+         *gateway = NULL;
+
+    if (false == isValidIface(iface)) {
+        cli->sendMsg(ResponseCode::CommandParameterError,
+                        "invalid interface", false);
+        return 0;
+    }
+
+    if (false == isValidIp(srcPrefix, argv[3]) ) {
+        cli->sendMsg(ResponseCode::CommandParameterError,
+                        "invalid IP address", false);
+        return 0;
+    }
+
+    if (argc > 7) {
+        gateway = argv[7];
+        if (false == isValidIp(gateway, argv[3]) ) {
+            cli->sendMsg(ResponseCode::CommandParameterError,
+                    "invalid gateway", false);
+            return 0;
+        }
+    }
+
+    // compute the network block in CIDR notation (for IPv4 only)
+    if (!strcmp(argv[3], "v4")) {
+        struct in_addr net;
+        in_addr_t mask = prefixLengthToIpv4Netmask(prefix_length);
+        net.s_addr = (addr.s_addr & mask);
+
+
+        char net_s[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &(net.s_addr), net_s, INET_ADDRSTRLEN);
+        asprintf(&network, "%s/%d", net_s, prefix_length);
+    }
+
+    std::string res = sRouteCtrl->repSrcRoute( iface,
+                                               srcPrefix,
+                                               gateway,
+                                               routeId,
+                                               ipVer);
+    if (!res.empty()) {
+        cli->sendMsg(ResponseCode::OperationFailed, res.c_str(), false);
+    } else {
+        if (network != NULL) {
+             //gateway is null for link local route, metric is 0
+            res = sRouteCtrl->addDstRoute(iface,
+                        network, NULL, 0, routeId);
+            if (res.empty()) {
+                res = "source route replace & local subnet "
+                      "route add succeeded for rid: ";
+                res += routeId;
+            }
+            cli->sendMsg(ResponseCode::CommandOkay, res.c_str(), false);
+        } else {
+            res = "source route replace succeeded for rid:";
+            res += routeId;
+            cli->sendMsg(ResponseCode::CommandOkay, res.c_str(), false);
         }
-        return 0;
     }
-
-    cli->sendMsg(ResponseCode::CommandSyntaxError, "Unknown idletimer cmd", false);
+    free(network);
     return 0;
 }
 
-CommandListener::FirewallCmd::FirewallCmd() :
-    NetdCommand("firewall") {
-}
+int CommandListener::RouteCmd::delSrc(SocketClient *cli, int, char **argv) {
+    char* end;
+    long int rid =  strtol(argv[4], &end, 10);
+    if (*end != '\0')
+    {
+        cli->sendMsg(ResponseCode::CommandParameterError,
+                "RouteID: invalid numerical value", false);
+        return 0;
+    }
+    if ((rid < 1) || (rid > 252)) {
+        cli->sendMsg(ResponseCode::CommandParameterError,
+                    "RouteID: between 0 and 253", false);
+        return 0;
+    }
 
-int CommandListener::FirewallCmd::sendGenericOkFail(SocketClient *cli, int cond) {
-    if (!cond) {
-        cli->sendMsg(ResponseCode::CommandOkay, "Firewall command succeeded", false);
+    std::string res = sRouteCtrl->delSrcRoute(argv[4], ipVersion(argv[3]));
+    if (!res.empty()) {
+        cli->sendMsg(ResponseCode::OperationFailed, res.c_str(), false);
     } else {
-        cli->sendMsg(ResponseCode::OperationFailed, "Firewall command failed", false);
+        res = "source route delete succeeded for rid:";
+        res += argv[4];
+        cli->sendMsg(ResponseCode::CommandOkay, res.c_str(), false);
     }
     return 0;
 }
 
-FirewallRule CommandListener::FirewallCmd::parseRule(const char* arg) {
-    if (!strcmp(arg, "allow")) {
-        return ALLOW;
-    } else {
-        return DENY;
-    }
-}
+int CommandListener::RouteCmd::replaceDef(SocketClient *cli, int argc, char **argv) {
+    char *iface = argv[4],
+         *gateway = NULL;
 
-int CommandListener::FirewallCmd::runCommand(SocketClient *cli, int argc,
-        char **argv) {
-    if (argc < 2) {
-        cli->sendMsg(ResponseCode::CommandSyntaxError, "Missing command", false);
+    if (false == isValidIface(iface)) {
+        cli->sendMsg(ResponseCode::CommandParameterError,
+                        "invalid interface", false);
         return 0;
     }
 
-    if (!strcmp(argv[1], "enable")) {
-        int res = sFirewallCtrl->enableFirewall();
-        return sendGenericOkFail(cli, res);
-    }
-    if (!strcmp(argv[1], "disable")) {
-        int res = sFirewallCtrl->disableFirewall();
-        return sendGenericOkFail(cli, res);
-    }
-    if (!strcmp(argv[1], "is_enabled")) {
-        int res = sFirewallCtrl->isFirewallEnabled();
-        return sendGenericOkFail(cli, res);
-    }
-
-    if (!strcmp(argv[1], "set_interface_rule")) {
-        if (argc != 4) {
-            cli->sendMsg(ResponseCode::CommandSyntaxError,
-                         "Usage: firewall set_interface_rule <rmnet0> <allow|deny>", false);
+    if (argc > 5) {
+        gateway = argv[5];
+        if (false == isValidIp(gateway, argv[3]) ) {
+            cli->sendMsg(ResponseCode::CommandParameterError,
+                    "invalid gateway", false);
             return 0;
         }
+    }
+
+    std::string res =
+        sRouteCtrl->replaceDefRoute(iface, gateway, ipVersion(argv[3]));
+    if (!res.empty()) {
+        cli->sendMsg(ResponseCode::OperationFailed, res.c_str(), false);
+    } else {
+        cli->sendMsg(ResponseCode::CommandOkay,
+                    "default route replace succeeded", false);
+    }
+    return 0;
+}
 
-        const char* iface = argv[2];
-        FirewallRule rule = parseRule(argv[3]);
+int CommandListener::RouteCmd::addDef(SocketClient *cli, int argc, char **argv) {
+    char *iface = argv[4],
+         *gateway = NULL;
+    int metric = atoi(argv[5]);
 
-        int res = sFirewallCtrl->setInterfaceRule(iface, rule);
-        return sendGenericOkFail(cli, res);
+    if (false == isValidIface(iface)) {
+        cli->sendMsg(ResponseCode::CommandParameterError,
+                        "invalid interface", false);
+        return 0;
     }
 
-    if (!strcmp(argv[1], "set_egress_source_rule")) {
-        if (argc != 4) {
-            cli->sendMsg(ResponseCode::CommandSyntaxError,
-                         "Usage: firewall set_egress_source_rule <192.168.0.1> <allow|deny>",
-                         false);
+    if (argc > 6) {
+        gateway = argv[6];
+        if (false == isValidIp(gateway, argv[3]) ) {
+            cli->sendMsg(ResponseCode::CommandParameterError,
+                    "invalid gateway", false);
             return 0;
         }
+    }
 
-        const char* addr = argv[2];
-        FirewallRule rule = parseRule(argv[3]);
-
-        int res = sFirewallCtrl->setEgressSourceRule(addr, rule);
-        return sendGenericOkFail(cli, res);
+    std::string res =
+        sRouteCtrl->addDefRoute(iface, gateway, ipVersion(argv[3]), metric);
+    if (!res.empty()) {
+        cli->sendMsg(ResponseCode::OperationFailed, res.c_str(), false);
+    } else {
+        cli->sendMsg(ResponseCode::CommandOkay,
+                    "default route add with metric succeeded", false);
     }
+    return 0;
+}
 
-    if (!strcmp(argv[1], "set_egress_dest_rule")) {
-        if (argc != 5) {
-            cli->sendMsg(ResponseCode::CommandSyntaxError,
-                         "Usage: firewall set_egress_dest_rule <192.168.0.1> <80> <allow|deny>",
-                         false);
-            return 0;
-        }
+int CommandListener::RouteCmd::addDst(SocketClient *cli, int argc, char **argv) {
+    char *iface = argv[4],
+         *dstPrefix = argv[6],
+         *gateway = NULL;
+    int metric = atoi(argv[5]);
 
-        const char* addr = argv[2];
-        int port = atoi(argv[3]);
-        FirewallRule rule = parseRule(argv[4]);
+    if (false == isValidIface(iface)) {
+        cli->sendMsg(ResponseCode::CommandParameterError,
+                        "invalid interface", false);
+        return 0;
+    }
 
-        int res = 0;
-        res |= sFirewallCtrl->setEgressDestRule(addr, PROTOCOL_TCP, port, rule);
-        res |= sFirewallCtrl->setEgressDestRule(addr, PROTOCOL_UDP, port, rule);
-        return sendGenericOkFail(cli, res);
+    if (false == isValidIp(dstPrefix, argv[3]) ) {
+        cli->sendMsg(ResponseCode::CommandParameterError,
+                        "invalid IP address", false);
+        return 0;
     }
 
-    if (!strcmp(argv[1], "set_uid_rule")) {
-        if (argc != 4) {
-            cli->sendMsg(ResponseCode::CommandSyntaxError,
-                         "Usage: firewall set_uid_rule <1000> <allow|deny>",
-                         false);
+    if (argc > 7) {
+        gateway = argv[7];
+        if (false == isValidIp(gateway, argv[3]) ) {
+            cli->sendMsg(ResponseCode::CommandParameterError,
+                    "invalid gateway", false);
             return 0;
         }
+    }
 
-        int uid = atoi(argv[2]);
-        FirewallRule rule = parseRule(argv[3]);
+    std::string res =
+        sRouteCtrl->addDstRoute(iface, dstPrefix, gateway, metric);
+    if (!res.empty()) {
+        cli->sendMsg(ResponseCode::OperationFailed, res.c_str(), false);
+    } else {
+        cli->sendMsg(ResponseCode::CommandOkay,
+                    "destination route add succeeded", false);
+    }
+    return 0;
+}
 
-        int res = sFirewallCtrl->setUidRule(uid, rule);
-        return sendGenericOkFail(cli, res);
+int CommandListener::RouteCmd::delDst(SocketClient *cli, int, char **argv) {
+    if (false == isValidIp(argv[4], argv[3]) ) {
+        cli->sendMsg(ResponseCode::CommandParameterError,
+                        "invalid IP address", false);
+        return 0;
     }
 
-    cli->sendMsg(ResponseCode::CommandSyntaxError, "Unknown command", false);
+    std::string res = sRouteCtrl->delDstRoute(argv[4]);
+    if (!res.empty()){
+        cli->sendMsg(ResponseCode::OperationFailed, res.c_str(), false);
+    } else {
+        cli->sendMsg(ResponseCode::CommandOkay,
+                    "destination route delete succeeded", false);
+    }
     return 0;
 }
 
-CommandListener::ClatdCmd::ClatdCmd() : NetdCommand("clatd") {
+CommandListener::ExecutorCmd::ExecutorCmd() :
+                 NetdCommand("executor") {
 }
 
-int CommandListener::ClatdCmd::runCommand(SocketClient *cli, int argc,
-                                                            char **argv) {
-    int rc = 0;
+/*
+ * executor get
+ * executor set <fork|batch|record>
+ * executor flush
+ * executor dump
+ * executor clear
+ */
+int CommandListener::ExecutorCmd::runCommand(SocketClient *cli, int argc, char **argv) {
+    static BatchExecutor batchExecutor;
+    static RecordingExecutor recordingExecutor;
+
     if (argc < 2) {
         cli->sendMsg(ResponseCode::CommandSyntaxError, "Missing argument", false);
         return 0;
     }
 
-    if(!strcmp(argv[1], "stop")) {
-        rc = sClatdCtrl->stopClatd();
-    } else if (!strcmp(argv[1], "status")) {
-        char *tmp = NULL;
-
-        asprintf(&tmp, "Clatd status: %s", (sClatdCtrl->isClatdStarted() ?
-                                                        "started" : "stopped"));
-        cli->sendMsg(ResponseCode::ClatdStatusResult, tmp, false);
-        free(tmp);
+    if (!strcmp(argv[1], "get")) {
+        cli->sendMsg(ResponseCode::CommandOkay, CommandExecutor::get()->getName(), false);
         return 0;
-    } else if(!strcmp(argv[1], "start")) {
-        if (argc < 3) {
-            cli->sendMsg(ResponseCode::CommandSyntaxError, "Missing argument", false);
+    }
+    if (!strcmp(argv[1], "set")) {
+        if (argc != 3) {
+            cli->sendMsg(ResponseCode::CommandSyntaxError,
+                         "Usage: executor set <fork|batch|record>", false);
             return 0;
         }
-        rc = sClatdCtrl->startClatd(argv[2]);
-    } else {
-        cli->sendMsg(ResponseCode::CommandSyntaxError, "Unknown clatd cmd", false);
+        if (!strcmp(argv[2], "fork")) {
+            CommandExecutor::set(NULL);
+        } else if (!strcmp(argv[2], "batch")) {
+            CommandExecutor::set(&batchExecutor);
+        } else if (!strcmp(argv[2], "record")) {
+            CommandExecutor::set(&recordingExecutor);
+        } else {
+            cli->sendMsg(ResponseCode::CommandParameterError, "Unknown executor", false);
+            return 0;
+        }
+        ALOGW("Commands now go to the %s executor", argv[2]);
+        cli->sendMsg(ResponseCode::CommandOkay, "Executor set", false);
         return 0;
     }
-
-    if (!rc) {
-        cli->sendMsg(ResponseCode::CommandOkay, "Clatd operation succeeded", false);
-    } else {
-        cli->sendMsg(ResponseCode::OperationFailed, "Clatd operation failed", false);
+    if (!strcmp(argv[1], "flush")) {
+        if (CommandExecutor::get()->flush()) {
+            cli->sendMsg(ResponseCode::OperationFailed, "Some held commands failed", false);
+        } else {
+            cli->sendMsg(ResponseCode::CommandOkay, "Executor flushed", false);
+        }
+        return 0;
+    }
+    if (!strcmp(argv[1], "dump")) {
+        recordingExecutor.dump(cli);
+        return 0;
+    }
+    if (!strcmp(argv[1], "clear")) {
+        recordingExecutor.clear();
+        cli->sendMsg(ResponseCode::CommandOkay, "Records cleared", false);
+        return 0;
     }
 
+    cli->sendMsg(ResponseCode::CommandSyntaxError, "Unknown executor cmd", false);
     return 0;
 }
 
-CommandListener::RouteCmd::RouteCmd() :
-                 NetdCommand("route") {
+CommandListener::MetricsCmd::MetricsCmd() :
+                 NetdCommand("metrics") {
 }
 
-int CommandListener::RouteCmd::runCommand(SocketClient *cli, int argc, char **argv) {
-    if (argc < 5) {
-        cli->sendMsg(ResponseCode::CommandSyntaxError,
-                    "Missing argument", false);
+int CommandListener::MetricsCmd::runCommand(SocketClient *cli, int argc, char **argv) {
+    if (argc < 2 || !strcmp(argv[1], "dump")) {
+        LatencyMetrics::Instance()->dump(cli);
         return 0;
     }
-
-    const char *ipVer = NULL;
-    int domain;
-
-    if (!strcmp(argv[3], "v4")) {
-        ipVer = "-4";
-        domain = AF_INET;
-    } else if (!strcmp(argv[3], "v6")) {
-        ipVer = "-6";
-        domain = AF_INET6;
-    } else {
-        cli->sendMsg(ResponseCode::CommandSyntaxError,
-                     "Supported family v4|v6",false);
+    if (!strcmp(argv[1], "reset")) {
+        LatencyMetrics::Instance()->reset();
+        cli->sendMsg(ResponseCode::CommandOkay, "Metrics reset", false);
         return 0;
     }
 
-    if (!strcmp(argv[2], "src")) {
-        /* source based routing */
-        if (!strcmp(argv[1], "replace")) {
-            if (argc != 7 && argc != 8) {
-                cli->sendMsg(ResponseCode::CommandSyntaxError,
-                   "Usage: route replace src inet_family <interface>"
-                   " <ipaddr> <routeId> [<gateway>]", false);
-                return 0;
-            }
-
-            char* end;
-            long int rid =  strtol(argv[6], &end, 10);
-            if (*end != '\0')
-            {
-                cli->sendMsg(ResponseCode::CommandParameterError,
-                                "RouteID: invalid numerical value", false);
-                return 0;
-            }
-            if ((rid < 1) || (rid > 252)) {
-                cli->sendMsg(ResponseCode::CommandParameterError,
-                                "0 < RouteID < 253", false);
-                return 0;
-            }
-
-            struct in_addr addr;
-            int prefix_length;
-            unsigned flags = 0;
-
-            ifc_init();
-            ifc_get_info(argv[4], &addr.s_addr, &prefix_length, &flags);
-            ifc_close();
-
-            char *iface = argv[4],
-                 *srcPrefix = argv[5],
-                 *routeId = argv[6],
-                 *network = NULL,
-                 *gateway = NULL;
-
-            if (false == isValidIface(iface)) {
-                cli->sendMsg(ResponseCode::CommandParameterError,
-                                "invalid interface", false);
-                return 0;
-            }
-
-            if (false == isValidIp(srcPrefix, argv[3]) ) {
-                cli->sendMsg(ResponseCode::CommandParameterError,
-                                "invalid IP address", false);
-                return 0;
-            }
-
-            if (argc > 7) {
-                gateway = argv[7];
-                if (false == isValidIp(gateway, argv[3]) ) {
-                    cli->sendMsg(ResponseCode::CommandParameterError,
-                            "invalid gateway", false);
-                    return 0;
-                }
-            }
-
-            // compute the network block in CIDR notation (for IPv4 only)
-            if (domain == AF_INET) {
-                struct in_addr net;
-                in_addr_t mask = prefixLengthToIpv4Netmask(prefix_length);
-                net.s_addr = (addr.s_addr & mask);
-
-
-                char net_s[INET_ADDRSTRLEN];
-                inet_ntop(AF_INET, &(net.s_addr), net_s, INET_ADDRSTRLEN);
-                asprintf(&network, "%s/%d", net_s, prefix_length);
-            }
-
-            std::string res = sRouteCtrl->repSrcRoute( iface,
-                                                       srcPrefix,
-                                                       gateway,
-                                                       routeId,
-                                                       ipVer);
-            if (!res.empty()) {
-                cli->sendMsg(ResponseCode::OperationFailed, res.c_str(), false);
-            } else {
-                if (network != NULL) {
-                     //gateway is null for link local route, metric is 0
-                    res = sRouteCtrl->addDstRoute(iface,
-                                network, NULL, 0, routeId);
-                    if (res.empty()) {
-                        res = "source route replace & local subnet "
-                              "route add succeeded for rid: ";
-                        res += routeId;
-                    }
-                    cli->sendMsg(ResponseCode::CommandOkay, res.c_str(), false);
-                } else {
-                    res = "source route replace succeeded for rid:";
-                    res += routeId;
-                    cli->sendMsg(ResponseCode::CommandOkay, res.c_str(), false);
-                }
-            }
-            free(network);
-        } else if (!strcmp(argv[1], "del")) {
-            if (argc != 5) {
-                cli->sendMsg(ResponseCode::CommandSyntaxError,
-                            "Usage: route del src v[4|6] <routeId>", false);
-                return 0;
-            }
-
-            char* end;
-            long int rid =  strtol(argv[4], &end, 10);
-            if (*end != '\0')
-            {
-                cli->sendMsg(ResponseCode::CommandParameterError,
-                        "RouteID: invalid numerical value", false);
-                return 0;
-            }
-            if ((rid < 1) || (rid > 252)) {
-                cli->sendMsg(ResponseCode::CommandParameterError,
-                            "RouteID: between 0 and 253", false);
-                return 0;
-            }
-
-            std::string res = sRouteCtrl->delSrcRoute(argv[4], ipVer);
-            if (!res.empty()) {
-                cli->sendMsg(ResponseCode::OperationFailed, res.c_str(), false);
-            } else {
-                res = "source route delete succeeded for rid:";
-                res += argv[4];
-                cli->sendMsg(ResponseCode::CommandOkay, res.c_str(), false);
-            }
-        } else {
-            cli->sendMsg(ResponseCode::CommandSyntaxError,
-                        "permitted operation for src routes: <replace|del>",
-                        false);
-        }
-    } else if (!strcmp(argv[2], "def")) {
-        /* default route configuration */
-        if (!strcmp(argv[1], "replace")) {
-            if ((argc != 5) && (argc != 6)) {
-                cli->sendMsg(ResponseCode::CommandSyntaxError,
-                        "Usage: route replace def v[4|6]"
-                        " <interface> [<gateway>]", false);
-                return 0;
-            }
+    cli->sendMsg(ResponseCode::CommandSyntaxError, "Usage: metrics [dump|reset]", false);
+    return 0;
+}
 
-            char *iface = argv[4],
-                 *gateway = NULL;
+CommandListener::ProtocolCmd::ProtocolCmd() :
+                 NetdCommand("protocol") {
+}
 
-            if (false == isValidIface(iface)) {
-                cli->sendMsg(ResponseCode::CommandParameterError,
-                                "invalid interface", false);
-                return 0;
-            }
+int CommandListener::ProtocolCmd::runCommand(SocketClient *cli, int argc, char **argv) {
+    if (argc == 2 && (!strcmp(argv[1], "binary") || !strcmp(argv[1], "text"))) {
+        /* Answered before the switch, so the client can tell when to start framing. */
+        cli->sendMsg(ResponseCode::CommandOkay, "Protocol switched", false);
+        BinaryProtocol::Instance()->setBinary(cli, !strcmp(argv[1], "binary"));
+        return 0;
+    }
 
-            if (argc > 5) {
-                gateway = argv[5];
-                if (false == isValidIp(gateway, argv[3]) ) {
-                    cli->sendMsg(ResponseCode::CommandParameterError,
-                            "invalid gateway", false);
-                    return 0;
-                }
-            }
+    cli->sendMsg(ResponseCode::CommandSyntaxError, "Usage: protocol <binary|text>", false);
+    return 0;
+}
 
-            std::string res =
-                sRouteCtrl->replaceDefRoute(iface, gateway, ipVer);
-            if (!res.empty()) {
-                cli->sendMsg(ResponseCode::OperationFailed, res.c_str(), false);
-            } else {
-                cli->sendMsg(ResponseCode::CommandOkay,
-                            "default route replace succeeded", false);
-            }
-        } else if (!strcmp(argv[1], "add")) {
-            if ((argc !=6) && (argc != 7)) {
-                cli->sendMsg(ResponseCode::CommandSyntaxError,
-                        "Usage: route add def v[4|6]"
-                        " <interface> <metric> [<gateway>]", false);
-                return 0;
-            }
+/* The commands with steps that take seconds. */
+const char *CommandListener::AsyncCmd::ASYNC_COMMANDS[] = {
+    "softap",
+    "tether",
+    "pppd",
+    "clatd",
+    NULL,
+};
 
-            char *iface = argv[4],
-                 *gateway = NULL;
-            int metric = atoi(argv[5]);
+CommandListener::AsyncCmd::AsyncCmd(CommandListener *listener) :
+                 NetdCommand("async"), mListener(listener) {
+}
 
-            if (false == isValidIface(iface)) {
-                cli->sendMsg(ResponseCode::CommandParameterError,
-                                "invalid interface", false);
-                return 0;
-            }
+int CommandListener::AsyncCmd::runCommand(SocketClient *cli, int argc, char **argv) {
+    std::list<NetdCommand *>::iterator it;
+    const char **name;
+    char *msg;
+    int id;
 
-            if (argc > 6) {
-                gateway = argv[6];
-                if (false == isValidIp(gateway, argv[3]) ) {
-                    cli->sendMsg(ResponseCode::CommandParameterError,
-                            "invalid gateway", false);
-                    return 0;
-                }
-            }
+    if (argc < 3) {
+        cli->sendMsg(ResponseCode::CommandSyntaxError, "Usage: async <command> <args...>", false);
+        return 0;
+    }
+    for (name = ASYNC_COMMANDS; *name && strcmp(*name, argv[1]); name++) {
+    }
+    if (!*name) {
+        cli->sendMsg(ResponseCode::CommandParameterError, "Command cannot run async", false);
+        return 0;
+    }
 
-            std::string res =
-                sRouteCtrl->addDefRoute(iface, gateway, ipVer, metric);
-            if (!res.empty()) {
-                cli->sendMsg(ResponseCode::OperationFailed, res.c_str(), false);
-            } else {
-                cli->sendMsg(ResponseCode::CommandOkay,
-                            "default route add with metric succeeded", false);
-            }
-        } else {
-            cli->sendMsg(ResponseCode::CommandSyntaxError,
-                         "Permitted action for def routes <replace|add>",
-                         false);
+    for (it = mListener->mCommands.begin(); it != mListener->mCommands.end(); it++) {
+        if (!strcmp((*it)->getCommand(), argv[1])) {
+            break;
         }
-    } else if (!strcmp(argv[2], "dst")) {
-        /* destination based route configuration */
-        if (!strcmp(argv[1], "add")) {
-            if (argc != 7 && argc != 8) {
-                cli->sendMsg(ResponseCode::CommandSyntaxError,
-                   "Usage: route add dst v[4|6]"
-                   " <interface> <metric> <dstIpAddr> [<gateway>]", false);
-                return 0;
-            }
-
-            char *iface = argv[4],
-                 *dstPrefix = argv[6],
-                 *gateway = NULL;
-            int metric = atoi(argv[5]);
-
-            if (false == isValidIface(iface)) {
-                cli->sendMsg(ResponseCode::CommandParameterError,
-                                "invalid interface", false);
-                return 0;
-            }
-
-            if (false == isValidIp(dstPrefix, argv[3]) ) {
-                cli->sendMsg(ResponseCode::CommandParameterError,
-                                "invalid IP address", false);
-                return 0;
-            }
-
-            if (argc > 7) {
-                gateway = argv[7];
-                if (false == isValidIp(gateway, argv[3]) ) {
-                    cli->sendMsg(ResponseCode::CommandParameterError,
-                            "invalid gateway", false);
-                    return 0;
-                }
-            }
+    }
+    if (it == mListener->mCommands.end() ||
+            (id = AsyncOperations::Instance()->start(mListener, *it, argc - 1, argv + 1)) < 0) {
+        cli->sendMsg(ResponseCode::OperationFailed, "Unable to start async command", false);
+        return 0;
+    }
 
-            std::string res =
-                sRouteCtrl->addDstRoute(iface, dstPrefix, gateway, metric);
-            if (!res.empty()) {
-                cli->sendMsg(ResponseCode::OperationFailed, res.c_str(), false);
-            } else {
-                cli->sendMsg(ResponseCode::CommandOkay,
-                            "destination route add succeeded", false);
-            }
-        } else if (!strcmp(argv[1], "del")) {
-            if (argc != 5) {
-                cli->sendMsg(ResponseCode::CommandSyntaxError,
-                             "Usage: route del dst v[4|6] <ipaddr>", false);
-                return 0;
-            }
+    asprintf(&msg, "%d", id);
+    cli->sendMsg(ResponseCode::AsyncOperationStarted, msg, false);
+    free(msg);
+    return 0;
+}
 
-            if (false == isValidIp(argv[4], argv[3]) ) {
-                cli->sendMsg(ResponseCode::CommandParameterError,
-                                "invalid IP address", false);
-                return 0;
-            }
+CommandListener::TraceCmd::TraceCmd() :
+                 NetdCommand("trace") {
+}
 
-            std::string res = sRouteCtrl->delDstRoute(argv[4]);
-            if (!res.empty()){
-                cli->sendMsg(ResponseCode::OperationFailed, res.c_str(), false);
-            } else {
-                cli->sendMsg(ResponseCode::CommandOkay,
-                            "destination route delete succeeded", false);
-            }
-        } else {
-            cli->sendMsg(ResponseCode::CommandSyntaxError,
-                         "permitted operation for dst routes: <add|del>",
-                         false);
-        }
-    } else {
-        cli->sendMsg(ResponseCode::CommandParameterError,
-                     "allowed route types: <src|dst|def>", false);
+int CommandListener::TraceCmd::runCommand(SocketClient *cli, int argc, char **argv) {
+    if (argc < 2 || !strcmp(argv[1], "dump")) {
+        CommandTrace::Instance()->dump(cli);
+        return 0;
     }
+
+    cli->sendMsg(ResponseCode::CommandSyntaxError, "Usage: trace [dump]", false);
     return 0;
 }
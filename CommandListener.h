@@ -20,8 +20,11 @@
 #ifndef _COMMANDLISTENER_H__
 #define _COMMANDLISTENER_H__
 
+#include <list>
+
 #include <sysutils/FrameworkListener.h>
 
+#include "BinaryProtocol.h"
 #include "NetdCommand.h"
 #include "TetherController.h"
 #include "NatController.h"
@@ -55,7 +58,23 @@ public:
     CommandListener(UidMarkMap *map);
     virtual ~CommandListener() {}
 
+    static BandwidthController *getBandwidthController() { return sBandwidthCtrl; }
+    static ResolverController *getResolverController() { return sResolverCtrl; }
+
+protected:
+    /* Takes the frames of BinaryProtocol clients, and leaves text to FrameworkListener. */
+    virtual bool onDataAvailable(SocketClient *c);
+
 private:
+    /* The iptables setup of the constructor, as one restore per family. */
+    static int compileIptablesSetup(const char** keptChains, bool bandwidthAdopted);
+    static void setupIptables(const char** keptChains, bool bandwidthAdopted);
+
+    /* Also keeps cmd, for the binary requests. */
+    void registerCmd(NetdCommand *cmd);
+    void dispatchBinary(SocketClient *cli, BinaryProtocol::Request &request);
+
+    std::list<NetdCommand *> mCommands;
 
     class SoftapCmd : public NetdCommand {
     public:
@@ -78,6 +97,28 @@ private:
         InterfaceCmd();
         virtual ~InterfaceCmd() {}
         int runCommand(SocketClient *c, int argc, char ** argv);
+    protected:
+        static int list(SocketClient *cli, int argc, char **argv);
+        static int driver(SocketClient *cli, int argc, char **argv);
+        static int fwmark(SocketClient *cli, int argc, char **argv);
+        static int fwmarkRule(SocketClient *cli, int argc, char **argv);
+        static int fwmarkRoute(SocketClient *cli, int argc, char **argv);
+        static int fwmarkUid(SocketClient *cli, int argc, char **argv);
+        static int fwmarkExempt(SocketClient *cli, int argc, char **argv);
+        static int fwmarkGet(SocketClient *cli, int argc, char **argv);
+        static int route(SocketClient *cli, int argc, char **argv);
+        static int getCfg(SocketClient *cli, int argc, char **argv);
+        static int setCfg(SocketClient *cli, int argc, char **argv);
+        static int clearAddrs(SocketClient *cli, int argc, char **argv);
+        static int ipv6PrivacyExtensions(SocketClient *cli, int argc, char **argv);
+        static int ipv6(SocketClient *cli, int argc, char **argv);
+        static int getMtu(SocketClient *cli, int argc, char **argv);
+        static int setMtu(SocketClient *cli, int argc, char **argv);
+
+        static const SubcommandTable::Entry sSubcommands[];
+        static const SubcommandTable::Entry sFwmarkSubcommands[];
+        static const SubcommandTable sFwmarkTable;
+        SubcommandTable mSubcommands;
     };
 
     class IpFwdCmd : public NetdCommand {
@@ -129,9 +170,42 @@ private:
         virtual ~BandwidthControlCmd() {}
         int runCommand(SocketClient *c, int argc, char ** argv);
     protected:
-        void sendGenericOkFail(SocketClient *cli, int cond);
-        void sendGenericOpFailed(SocketClient *cli, const char *errMsg);
-        void sendGenericSyntaxError(SocketClient *cli, const char *usageMsg);
+        static void sendGenericOkFail(SocketClient *cli, int cond);
+        static void sendGenericOpFailed(SocketClient *cli, const char *errMsg);
+        static void sendGenericSyntaxError(SocketClient *cli, const char *usageMsg);
+
+        static int enable(SocketClient *cli, int argc, char **argv);
+        static int disable(SocketClient *cli, int argc, char **argv);
+        static int removeQuota(SocketClient *cli, int argc, char **argv);
+        static int getQuota(SocketClient *cli, int argc, char **argv);
+        static int getIQuota(SocketClient *cli, int argc, char **argv);
+        static int getAllQuotas(SocketClient *cli, int argc, char **argv);
+        static int setQuota(SocketClient *cli, int argc, char **argv);
+        static int setQuotas(SocketClient *cli, int argc, char **argv);
+        static int setIQuotas(SocketClient *cli, int argc, char **argv);
+        static int removeQuotas(SocketClient *cli, int argc, char **argv);
+        static int removeIQuota(SocketClient *cli, int argc, char **argv);
+        static int setIQuota(SocketClient *cli, int argc, char **argv);
+        static int addNaughtyApps(SocketClient *cli, int argc, char **argv);
+        static int removeNaughtyApps(SocketClient *cli, int argc, char **argv);
+        static int happyBox(SocketClient *cli, int argc, char **argv);
+        static int addNiceApps(SocketClient *cli, int argc, char **argv);
+        static int removeNiceApps(SocketClient *cli, int argc, char **argv);
+        static int setGlobalAlert(SocketClient *cli, int argc, char **argv);
+        static int debugSetTetherGlobalAlert(SocketClient *cli, int argc, char **argv);
+        static int removeGlobalAlert(SocketClient *cli, int argc, char **argv);
+        static int debugRemoveTetherGlobalAlert(SocketClient *cli, int argc, char **argv);
+        static int setSharedAlert(SocketClient *cli, int argc, char **argv);
+        static int removeSharedAlert(SocketClient *cli, int argc, char **argv);
+        static int setAlerts(SocketClient *cli, int argc, char **argv);
+        static int setInterfaceAlert(SocketClient *cli, int argc, char **argv);
+        static int removeInterfaceAlert(SocketClient *cli, int argc, char **argv);
+        static int getUidStats(SocketClient *cli, int argc, char **argv);
+        static int resetUidStats(SocketClient *cli, int argc, char **argv);
+        static int getTetherStats(SocketClient *cli, int argc, char **argv);
+
+        static const SubcommandTable::Entry sSubcommands[];
+        SubcommandTable mSubcommands;
     };
 
     class IdletimerControlCmd : public NetdCommand {
@@ -146,6 +220,21 @@ private:
         ResolverCmd();
         virtual ~ResolverCmd() {}
         int runCommand(SocketClient *c, int argc, char ** argv);
+    protected:
+        static int sendGenericOkFail(SocketClient *cli, int cond);
+
+        static int setDefaultIf(SocketClient *cli, int argc, char **argv);
+        static int setIfDns(SocketClient *cli, int argc, char **argv);
+        static int flushDefaultIf(SocketClient *cli, int argc, char **argv);
+        static int flushIf(SocketClient *cli, int argc, char **argv);
+        static int setIfaceForPid(SocketClient *cli, int argc, char **argv);
+        static int clearIfaceForPid(SocketClient *cli, int argc, char **argv);
+        static int setIfaceForUidRange(SocketClient *cli, int argc, char **argv);
+        static int clearIfaceForUidRange(SocketClient *cli, int argc, char **argv);
+        static int clearIfaceMapping(SocketClient *cli, int argc, char **argv);
+
+        static const SubcommandTable::Entry sSubcommands[];
+        SubcommandTable mSubcommands;
     };
 
     class FirewallCmd: public NetdCommand {
@@ -154,8 +243,19 @@ private:
         virtual ~FirewallCmd() {}
         int runCommand(SocketClient *c, int argc, char ** argv);
     protected:
-        int sendGenericOkFail(SocketClient *cli, int cond);
+        static int sendGenericOkFail(SocketClient *cli, int cond);
         static FirewallRule parseRule(const char* arg);
+
+        static int enable(SocketClient *cli, int argc, char **argv);
+        static int disable(SocketClient *cli, int argc, char **argv);
+        static int isEnabled(SocketClient *cli, int argc, char **argv);
+        static int setInterfaceRule(SocketClient *cli, int argc, char **argv);
+        static int setEgressSourceRule(SocketClient *cli, int argc, char **argv);
+        static int setEgressDestRule(SocketClient *cli, int argc, char **argv);
+        static int setUidRule(SocketClient *cli, int argc, char **argv);
+
+        static const SubcommandTable::Entry sSubcommands[];
+        SubcommandTable mSubcommands;
     };
 
     class ClatdCmd : public NetdCommand {
@@ -170,6 +270,60 @@ private:
         RouteCmd();
         virtual ~RouteCmd() {}
         int runCommand(SocketClient *c, int argc, char ** argv);
+    protected:
+        static const char *ipVersion(const char *family);
+
+        static int replaceSrc(SocketClient *cli, int argc, char **argv);
+        static int delSrc(SocketClient *cli, int argc, char **argv);
+        static int replaceDef(SocketClient *cli, int argc, char **argv);
+        static int addDef(SocketClient *cli, int argc, char **argv);
+        static int addDst(SocketClient *cli, int argc, char **argv);
+        static int delDst(SocketClient *cli, int argc, char **argv);
+
+        static const SubcommandTable::Entry sSrcSubcommands[];
+        static const SubcommandTable::Entry sDefSubcommands[];
+        static const SubcommandTable::Entry sDstSubcommands[];
+        SubcommandTable mSrcSubcommands;
+        SubcommandTable mDefSubcommands;
+        SubcommandTable mDstSubcommands;
+    };
+
+    class ExecutorCmd : public NetdCommand {
+    public:
+        ExecutorCmd();
+        virtual ~ExecutorCmd() {}
+        int runCommand(SocketClient *c, int argc, char ** argv);
+    };
+
+    class MetricsCmd : public NetdCommand {
+    public:
+        MetricsCmd();
+        virtual ~MetricsCmd() {}
+        int runCommand(SocketClient *c, int argc, char ** argv);
+    };
+
+    class TraceCmd : public NetdCommand {
+    public:
+        TraceCmd();
+        virtual ~TraceCmd() {}
+        int runCommand(SocketClient *c, int argc, char ** argv);
+    };
+
+    class ProtocolCmd : public NetdCommand {
+    public:
+        ProtocolCmd();
+        virtual ~ProtocolCmd() {}
+        int runCommand(SocketClient *c, int argc, char ** argv);
+    };
+
+    class AsyncCmd : public NetdCommand {
+    public:
+        AsyncCmd(CommandListener *listener);
+        virtual ~AsyncCmd() {}
+        int runCommand(SocketClient *c, int argc, char ** argv);
+    private:
+        static const char *ASYNC_COMMANDS[];
+        CommandListener *mListener;
     };
 };
 
@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG_TAG "CommandTrace"
+#include <cutils/log.h>
+
+#include "CommandTrace.h"
+#include "LatencyMetrics.h"
+#include "ResponseCode.h"
+
+CommandTrace::CommandTrace() {
+    memset(mRecords, 0, sizeof(mRecords));
+    mNextSeq = 0;
+    if (pthread_key_create(&mCommandKey, NULL)) {
+        ALOGE("Unable to create the command trace key");
+    }
+}
+
+CommandTrace *CommandTrace::Instance() {
+    static CommandTrace sInstance;
+    return &sInstance;
+}
+
+/* FNV-1a over the arguments, each one terminated by its NUL. */
+uint32_t CommandTrace::hashArgs(int argc, const char **argv) {
+    uint32_t hash = 2166136261U;
+
+    for (int i = 0; i < argc; i++) {
+        const char *p = argv[i];
+        do {
+            hash = (hash ^ (unsigned char) *p) * 16777619U;
+        } while (*p++);
+    }
+    return hash;
+}
+
+/* Returns the record's seq, which is also the id of a command it starts. */
+uint32_t CommandTrace::add(Event event, uint32_t command, int argc, const char **argv,
+                           int64_t startUs, int64_t endUs, int result) {
+    uint32_t seq = __sync_add_and_fetch(&mNextSeq, 1);
+    const char *name = argc > 0 ? argv[0] : "";
+    const char *slash;
+    Record *record;
+
+    if (!seq) {
+        /* 0 marks a record in progress; skip it on wrap around. */
+        seq = __sync_add_and_fetch(&mNextSeq, 1);
+    }
+    record = &mRecords[seq % MAX_RECORDS];
+    record->seq = 0;
+    __sync_synchronize();
+
+    if ((slash = strrchr(name, '/'))) {
+        name = slash + 1;
+    }
+    record->event = event;
+    record->command = command ? command : seq;
+    record->argsHash = hashArgs(argc, argv);
+    record->result = result;
+    record->startUs = startUs;
+    record->endUs = endUs;
+    strlcpy(record->name, name, sizeof(record->name));
+    strlcpy(record->detail, argc > 1 ? argv[1] : "", sizeof(record->detail));
+
+    __sync_synchronize();
+    record->seq = seq;
+    return seq;
+}
+
+uint32_t CommandTrace::commandStart(int argc, char **argv) {
+    uint32_t id = add(COMMAND_START, 0, argc, (const char **) argv,
+                      LatencyMetrics::nowUs(), 0, 0);
+
+    pthread_setspecific(mCommandKey, (void *) (uintptr_t) id);
+    return id;
+}
+
+void CommandTrace::commandEnd(uint32_t id, int argc, char **argv, int64_t startUs,
+                              int result) {
+    pthread_setspecific(mCommandKey, NULL);
+    add(COMMAND_END, id, argc, (const char **) argv, startUs, LatencyMetrics::nowUs(),
+        result);
+}
+
+void CommandTrace::execStart(int argc, const char **argv) {
+    uint32_t command = (uintptr_t) pthread_getspecific(mCommandKey);
+
+    add(EXEC_START, command, argc, argv, LatencyMetrics::nowUs(), 0, 0);
+}
+
+void CommandTrace::execEnd(int argc, const char **argv, int64_t startUs, int result) {
+    uint32_t command = (uintptr_t) pthread_getspecific(mCommandKey);
+
+    add(EXEC_END, command, argc, argv, startUs, LatencyMetrics::nowUs(), result);
+}
+
+void CommandTrace::dump(SocketClient *cli) {
+    static const char *eventNames[] = { "?", "cmd-start", "cmd-end", "exec-start", "exec-end" };
+    uint32_t last = mNextSeq;
+    uint32_t first = last > MAX_RECORDS ? last - MAX_RECORDS + 1 : 1;
+
+    for (uint32_t seq = first; seq != last + 1; seq++) {
+        Record *record = &mRecords[seq % MAX_RECORDS];
+        Record copy;
+        char endUs[24];
+        char result[16];
+        char *msg;
+
+        /* Copied between two reads of seq; a record rewritten meanwhile is skipped. */
+        if (record->seq != seq) {
+            continue;
+        }
+        __sync_synchronize();
+        memcpy(&copy, record, sizeof(copy));
+        __sync_synchronize();
+        if (record->seq != seq || copy.event > EXEC_END) {
+            continue;
+        }
+        copy.name[sizeof(copy.name) - 1] = '\0';
+        copy.detail[sizeof(copy.detail) - 1] = '\0';
+
+        if (copy.event == COMMAND_START || copy.event == EXEC_START) {
+            strcpy(endUs, "-");
+            strcpy(result, "-");
+        } else {
+            snprintf(endUs, sizeof(endUs), "%lld", (long long) copy.endUs);
+            snprintf(result, sizeof(result), "%d", copy.result);
+        }
+        asprintf(&msg, "%u %s %u %lld %s %s %s %s %08x", seq, eventNames[copy.event],
+                 copy.command, (long long) copy.startUs, endUs, result,
+                 copy.name[0] ? copy.name : "-", copy.detail[0] ? copy.detail : "-",
+                 copy.argsHash);
+        cli->sendMsg(ResponseCode::TraceResult, msg, false);
+        free(msg);
+    }
+    cli->sendMsg(ResponseCode::CommandOkay, "Trace dump completed", false);
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _COMMAND_TRACE_H
+#define _COMMAND_TRACE_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <sysutils/SocketClient.h>
+
+/*
+ * The last few hundred commands and the children they ran, for finding
+ * out after the fact what netd was doing when a framework call hung.
+ *
+ * Records go into a preallocated ring that writers claim slots of with one
+ * atomic add, so tracing takes no lock and allocates nothing. Starts and
+ * ends are separate records: a command or child that never finished shows
+ * up as a start without an end. Arguments are only kept as a hash, so that
+ * keys and passphrases stay out of the dump.
+ */
+class CommandTrace {
+public:
+    static CommandTrace *Instance();
+
+    /* Returns the command's id, which children run on this thread get too. */
+    uint32_t commandStart(int argc, char **argv);
+    void commandEnd(uint32_t id, int argc, char **argv, int64_t startUs, int result);
+    void execStart(int argc, const char **argv);
+    void execEnd(int argc, const char **argv, int64_t startUs, int result);
+
+    /*
+     * Sends a TraceResult per record, oldest first:
+     *   "<seq> <event> <command id> <start_us> <end_us> <result> <name> <detail> <args hash>"
+     * event being cmd-start, cmd-end, exec-start or exec-end, and name and
+     * detail the command and subcommand, or the binary and its first
+     * argument. end_us and result are "-" on start records.
+     * Then a CommandOkay.
+     */
+    void dump(SocketClient *cli);
+
+private:
+    static const int MAX_RECORDS = 512;
+
+    enum Event { COMMAND_START = 1, COMMAND_END, EXEC_START, EXEC_END };
+
+    class Record {
+    public:
+        /* Set last; 0 while the record is being written. */
+        volatile uint32_t seq;
+        uint8_t event;
+        uint32_t command;
+        uint32_t argsHash;
+        int32_t result;
+        int64_t startUs;
+        int64_t endUs;
+        char name[16];
+        char detail[24];
+    };
+
+    CommandTrace();
+    uint32_t add(Event event, uint32_t command, int argc, const char **argv,
+                 int64_t startUs, int64_t endUs, int result);
+    static uint32_t hashArgs(int argc, const char **argv);
+
+    Record mRecords[MAX_RECORDS];
+    volatile uint32_t mNextSeq;
+    /* The id of the command running on the calling thread, if any. */
+    pthread_key_t mCommandKey;
+};
+
+#endif
@@ -25,9 +25,13 @@
 #include <sys/types.h>
 #include <string.h>
 #include <pthread.h>
+#include <unistd.h>
 #include <resolv_iface.h>
 #include <net/if.h>
 
+#include <algorithm>
+#include <vector>
+
 #define LOG_TAG "DnsProxyListener"
 #define DBG 0
 #define VDBG 0
@@ -37,8 +41,11 @@
 
 #include "NetdConstants.h"
 #include "DnsProxyListener.h"
+#include "LatencyMetrics.h"
 #include "ResponseCode.h"
 
+ResolverController *DnsProxyListener::sResolverCtrl = NULL;
+
 DnsProxyListener::DnsProxyListener(UidMarkMap *map) :
                  FrameworkListener("dnsproxyd") {
     registerCmd(new GetAddrInfoCmd(map));
@@ -62,7 +69,8 @@ DnsProxyListener::GetAddrInfoHandler::GetAddrInfoHandler(SocketClient *c,
           mIface(iface),
           mPid(pid),
           mUid(uid),
-          mMark(mark) {
+          mMark(mark),
+          mQueuedUs(LatencyMetrics::nowUs()) {
 }
 
 DnsProxyListener::GetAddrInfoHandler::~GetAddrInfoHandler() {
@@ -87,6 +95,22 @@ void* DnsProxyListener::GetAddrInfoHandler::threadStart(void* obj) {
     return NULL;
 }
 
+// Records into "dns.<kind>.<iface>" the time since startUs.
+static void recordDnsLatency(const char *kind, const char *iface, int64_t startUs) {
+    char name[64];
+
+    snprintf(name, sizeof(name), "dns.%s.%s", kind, (iface && *iface) ? iface : "default");
+    LatencyMetrics::Instance()->record(name, LatencyMetrics::nowUs() - startUs);
+}
+
+// Lets the resolver controller know how the interface's first server did.
+static void reportDnsLookup(ResolverController *ctrl, const char *iface, int64_t startUs,
+                            bool serverFailed) {
+    if (ctrl) {
+        ctrl->reportLookup(iface, LatencyMetrics::nowUs() - startUs, serverFailed);
+    }
+}
+
 // Sends 4 bytes of big-endian length, followed by the data.
 // Returns true on success.
 static bool sendLenAndData(SocketClient *c, const int len, const void* data) {
@@ -123,6 +147,338 @@ static bool sendhostent(SocketClient *c, struct hostent *hp) {
     return success;
 }
 
+// One address family's half of a lookup that wants both.
+class FamilyLookup {
+public:
+    const char *host;
+    const char *service;
+    struct addrinfo hints;
+    const char *iface;
+    int mark;
+    struct addrinfo *result;
+    uint32_t rv;
+};
+
+static void *familyLookupStart(void *obj) {
+    FamilyLookup *lookup = reinterpret_cast<FamilyLookup *>(obj);
+    lookup->rv = android_getaddrinfoforiface(lookup->host, lookup->service, &lookup->hints,
+                                             lookup->iface, lookup->mark, &lookup->result);
+    return NULL;
+}
+
+// A destination being sorted, with the source address the kernel would use for it.
+class SortEntry {
+public:
+    struct addrinfo *ai;
+    bool hasSrc;
+    struct sockaddr_storage src;
+};
+
+static bool isInet6(const struct sockaddr *addr, const struct in6_addr **addr6) {
+    if (addr->sa_family != AF_INET6) {
+        return false;
+    }
+    *addr6 = &((const struct sockaddr_in6 *) addr)->sin6_addr;
+    return true;
+}
+
+// RFC 6724 section 3.1, IPv4 counting as IPv4-mapped.
+static int addrScope(const struct sockaddr *addr) {
+    const struct in6_addr *a6;
+
+    if (isInet6(addr, &a6)) {
+        if (IN6_IS_ADDR_MULTICAST(a6)) {
+            return a6->s6_addr[1] & 0x0f;
+        }
+        if (IN6_IS_ADDR_LOOPBACK(a6) || IN6_IS_ADDR_LINKLOCAL(a6)) {
+            return 2;
+        }
+        if (IN6_IS_ADDR_SITELOCAL(a6)) {
+            return 5;
+        }
+        return 14;
+    }
+    if (addr->sa_family == AF_INET) {
+        uint32_t a = ntohl(((const struct sockaddr_in *) addr)->sin_addr.s_addr);
+        if ((a >> 24) == 127 || (a >> 16) == 0xa9fe) {
+            return 2;
+        }
+        return 14;
+    }
+    return 1;
+}
+
+// The RFC 6724 section 2.1 policy table, as precedence << 8 | label.
+static int addrPolicy(const struct sockaddr *addr) {
+    const struct in6_addr *a6;
+
+    if (!isInet6(addr, &a6)) {
+        return 35 << 8 | 4;
+    }
+    const uint8_t *b = a6->s6_addr;
+    if (IN6_IS_ADDR_LOOPBACK(a6)) {
+        return 50 << 8 | 0;
+    }
+    if (IN6_IS_ADDR_V4MAPPED(a6)) {
+        return 35 << 8 | 4;
+    }
+    if (b[0] == 0x20 && b[1] == 0x02) {
+        return 30 << 8 | 2;
+    }
+    if (b[0] == 0x20 && b[1] == 0x01 && b[2] == 0 && b[3] == 0) {
+        return 5 << 8 | 5;
+    }
+    if ((b[0] & 0xfe) == 0xfc) {
+        return 3 << 8 | 13;
+    }
+    if (IN6_IS_ADDR_V4COMPAT(a6)) {
+        return 1 << 8 | 3;
+    }
+    if (IN6_IS_ADDR_SITELOCAL(a6)) {
+        return 1 << 8 | 11;
+    }
+    if (b[0] == 0x3f && b[1] == 0xfe) {
+        return 1 << 8 | 12;
+    }
+    return 40 << 8 | 1;
+}
+
+static int commonPrefixLen(const struct in6_addr *a, const struct in6_addr *b) {
+    for (int i = 0; i < 16; i++) {
+        uint8_t diff = a->s6_addr[i] ^ b->s6_addr[i];
+        if (diff) {
+            int len = i * 8;
+            while (!(diff & 0x80)) {
+                diff <<= 1;
+                len++;
+            }
+            return len;
+        }
+    }
+    return 128;
+}
+
+// RFC 6724 section 6 destination address selection, the rules bionic applies.
+// Returns whether a goes before b.
+static bool destinationBefore(const SortEntry &a, const SortEntry &b) {
+    const struct sockaddr *dstA = a.ai->ai_addr;
+    const struct sockaddr *dstB = b.ai->ai_addr;
+    const struct sockaddr *srcA = (const struct sockaddr *) &a.src;
+    const struct sockaddr *srcB = (const struct sockaddr *) &b.src;
+
+    // Rule 1: avoid unusable destinations.
+    if (a.hasSrc != b.hasSrc) {
+        return a.hasSrc;
+    }
+    if (!a.hasSrc) {
+        return false;
+    }
+
+    // Rule 2: prefer matching scope.
+    bool scopeA = addrScope(dstA) == addrScope(srcA);
+    bool scopeB = addrScope(dstB) == addrScope(srcB);
+    if (scopeA != scopeB) {
+        return scopeA;
+    }
+
+    // Rule 5: prefer matching label.
+    int policyA = addrPolicy(dstA), policyB = addrPolicy(dstB);
+    bool labelA = (policyA & 0xff) == (addrPolicy(srcA) & 0xff);
+    bool labelB = (policyB & 0xff) == (addrPolicy(srcB) & 0xff);
+    if (labelA != labelB) {
+        return labelA;
+    }
+
+    // Rule 6: prefer higher precedence.
+    if ((policyA >> 8) != (policyB >> 8)) {
+        return (policyA >> 8) > (policyB >> 8);
+    }
+
+    // Rule 8: prefer smaller scope.
+    if (addrScope(dstA) != addrScope(dstB)) {
+        return addrScope(dstA) < addrScope(dstB);
+    }
+
+    // Rule 9: use longest matching prefix, for IPv6 only.
+    const struct in6_addr *dst6A, *dst6B, *src6A, *src6B;
+    if (isInet6(dstA, &dst6A) && isInet6(dstB, &dst6B) &&
+            isInet6(srcA, &src6A) && isInet6(srcB, &src6B)) {
+        int prefixA = commonPrefixLen(dst6A, src6A);
+        int prefixB = commonPrefixLen(dst6B, src6B);
+        if (prefixA != prefixB) {
+            return prefixA > prefixB;
+        }
+    }
+
+    // Rule 10: otherwise, leave the order unchanged.
+    return false;
+}
+
+// Finds the source address the kernel picks for addr, by connecting a UDP socket.
+// Returns false if addr is unreachable.
+static bool findSrcAddr(const struct sockaddr *addr, socklen_t addrLen, int mark,
+                        struct sockaddr_storage *src) {
+    socklen_t len = sizeof(*src);
+    int sock;
+    int ret;
+
+    sock = socket(addr->sa_family, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
+    if (sock < 0) {
+        return false;
+    }
+    if (mark && setsockopt(sock, SOL_SOCKET, SO_MARK, &mark, sizeof(mark))) {
+        close(sock);
+        return false;
+    }
+    ret = TEMP_FAILURE_RETRY(connect(sock, addr, addrLen));
+    if (!ret) {
+        ret = getsockname(sock, (struct sockaddr *) src, &len);
+    }
+    close(sock);
+    return !ret;
+}
+
+// Joins the results of the two halves of a lookup into the one list getaddrinfo
+// would have given, and takes ownership of both. Each half comes sorted already;
+// they are put together as bionic does, IPv4 first, and sorted again as a whole.
+static struct addrinfo *mergeFamilies(struct addrinfo *v4, struct addrinfo *v6, int mark) {
+    std::vector<SortEntry> entries;
+    struct addrinfo *ai;
+
+    if (!v4 || !v6) {
+        return v4 ? v4 : v6;
+    }
+
+    for (ai = v4; ai->ai_next; ai = ai->ai_next) {
+    }
+    ai->ai_next = v6;
+    for (ai = v4; ai; ai = ai->ai_next) {
+        SortEntry entry;
+        entry.ai = ai;
+        // One address comes once per socket type; only look up its source once.
+        if (!entries.empty() && entries.back().ai->ai_addrlen == ai->ai_addrlen &&
+                !memcmp(entries.back().ai->ai_addr, ai->ai_addr, ai->ai_addrlen)) {
+            entry.hasSrc = entries.back().hasSrc;
+            entry.src = entries.back().src;
+        } else {
+            entry.hasSrc = findSrcAddr(ai->ai_addr, ai->ai_addrlen, mark, &entry.src);
+        }
+        entries.push_back(entry);
+    }
+
+    std::stable_sort(entries.begin(), entries.end(), destinationBefore);
+
+    for (size_t i = 0; i + 1 < entries.size(); i++) {
+        entries[i].ai->ai_next = entries[i + 1].ai;
+    }
+    entries.back().ai->ai_next = NULL;
+
+    // The canonical name goes with the first result.
+    struct addrinfo *head = entries[0].ai;
+    for (ai = head->ai_next; ai && !head->ai_canonname; ai = ai->ai_next) {
+        if (ai->ai_canonname) {
+            head->ai_canonname = ai->ai_canonname;
+            ai->ai_canonname = NULL;
+        }
+    }
+    return head;
+}
+
+// Whether there is a route for family, the way bionic checks for AI_ADDRCONFIG:
+// by connecting to 8.8.8.8 or 2000::.
+static bool haveFamily(int family, int mark) {
+    struct sockaddr_storage src;
+
+    if (family == AF_INET) {
+        struct sockaddr_in sin;
+        memset(&sin, 0, sizeof(sin));
+        sin.sin_family = AF_INET;
+        sin.sin_addr.s_addr = htonl(0x08080808);
+        return findSrcAddr((struct sockaddr *) &sin, sizeof(sin), mark, &src);
+    }
+    struct sockaddr_in6 sin6;
+    memset(&sin6, 0, sizeof(sin6));
+    sin6.sin6_family = AF_INET6;
+    sin6.sin6_addr.s6_addr[0] = 0x20;
+    return findSrcAddr((struct sockaddr *) &sin6, sizeof(sin6), mark, &src);
+}
+
+// Whether a lookup will query both A and AAAA records, which can then go out at once.
+static bool wantsBothFamilies(const char *host, const struct addrinfo *hints, int mark) {
+    struct in6_addr addr;
+
+    if (!host || (hints && (hints->ai_family != AF_UNSPEC ||
+                            (hints->ai_flags & AI_NUMERICHOST)))) {
+        return false;
+    }
+    if (inet_pton(AF_INET, host, &addr) == 1 || inet_pton(AF_INET6, host, &addr) == 1) {
+        return false;
+    }
+    // With AI_ADDRCONFIG bionic skips the query for a family the device has no
+    // route for; the split halves would not, so leave those lookups to it.
+    if (hints && (hints->ai_flags & AI_ADDRCONFIG)) {
+        return haveFamily(AF_INET, mark) && haveFamily(AF_INET6, mark);
+    }
+    return true;
+}
+
+// android_getaddrinfoforiface for AF_UNSPEC, with the AAAA lookup on a thread of
+// its own instead of after the A one, so that a dual stack lookup takes one
+// round trip rather than two. serverFailed is set when either half got a server
+// failure, even if the other half answered.
+static uint32_t getaddrinfoBothFamilies(const char *host, const char *service,
+                                        const struct addrinfo *hints, const char *iface,
+                                        int mark, struct addrinfo **result,
+                                        bool *serverFailed) {
+    FamilyLookup v6, v4;
+    pthread_t thread;
+    int err;
+
+    v6.host = host;
+    v6.service = service;
+    if (hints) {
+        v6.hints = *hints;
+    } else {
+        memset(&v6.hints, 0, sizeof(v6.hints));
+    }
+    v6.iface = iface;
+    v6.mark = mark;
+    v6.result = NULL;
+    v6.rv = 0;
+    v4 = v6;
+    v6.hints.ai_family = AF_INET6;
+    v4.hints.ai_family = AF_INET;
+
+    err = pthread_create(&thread, NULL, familyLookupStart, &v6);
+    bool threaded = !err;
+    if (!threaded) {
+        ALOGW("pthread_create (%s), looking up AAAA after A", strerror(err));
+    }
+    familyLookupStart(&v4);
+    if (threaded) {
+        pthread_join(thread, NULL);
+    } else {
+        familyLookupStart(&v6);
+    }
+
+    *serverFailed = (v6.rv == EAI_AGAIN || v6.rv == EAI_FAIL ||
+                     v4.rv == EAI_AGAIN || v4.rv == EAI_FAIL);
+
+    if (v6.rv && v4.rv) {
+        // Both failed. A server failure means the name might yet exist; say that.
+        *result = NULL;
+        return (v6.rv == EAI_AGAIN || v6.rv == EAI_FAIL) ? v6.rv : v4.rv;
+    }
+    *result = mergeFamilies(v4.rv ? NULL : v4.result, v6.rv ? NULL : v6.result, mark);
+    if (v6.rv && v6.result) {
+        freeaddrinfo(v6.result);
+    }
+    if (v4.rv && v4.result) {
+        freeaddrinfo(v4.result);
+    }
+    return 0;
+}
+
 void DnsProxyListener::GetAddrInfoHandler::run() {
     if (DBG) {
         ALOGD("GetAddrInfoHandler, now for %s / %s / %s", mHost, mService, mIface);
@@ -130,15 +486,28 @@ void DnsProxyListener::GetAddrInfoHandler::run() {
 
     char tmp[IF_NAMESIZE + 1];
     int mark = mMark;
+    tmp[0] = '\0';
     if (mIface == NULL) {
         //fall back to the per uid interface if no per pid interface exists
         if(!_resolv_get_pids_associated_interface(mPid, tmp, sizeof(tmp)))
             _resolv_get_uids_associated_interface(mUid, tmp, sizeof(tmp));
     }
+    recordDnsLatency("wait", mIface ? mIface : tmp, mQueuedUs);
 
     struct addrinfo* result = NULL;
-    uint32_t rv = android_getaddrinfoforiface(mHost, mService, mHints, mIface ? mIface : tmp,
-            mark, &result);
+    int64_t resolveStart = LatencyMetrics::nowUs();
+    uint32_t rv;
+    bool serverFailed;
+    if (wantsBothFamilies(mHost, mHints, mark)) {
+        rv = getaddrinfoBothFamilies(mHost, mService, mHints, mIface ? mIface : tmp, mark,
+                                     &result, &serverFailed);
+    } else {
+        rv = android_getaddrinfoforiface(mHost, mService, mHints, mIface ? mIface : tmp,
+                                         mark, &result);
+        serverFailed = (rv == EAI_AGAIN || rv == EAI_FAIL);
+    }
+    recordDnsLatency("resolve", mIface ? mIface : tmp, resolveStart);
+    reportDnsLookup(sResolverCtrl, mIface ? mIface : tmp, resolveStart, serverFailed);
     if (rv) {
         // getaddrinfo failed
         mClient->sendBinaryMsg(ResponseCode::DnsProxyOperationFailed, &rv, sizeof(rv));
@@ -304,7 +673,8 @@ DnsProxyListener::GetHostByNameHandler::GetHostByNameHandler(SocketClient* c,
           mIface(iface),
           mName(name),
           mAf(af),
-          mMark(mark) {
+          mMark(mark),
+          mQueuedUs(LatencyMetrics::nowUs()) {
 }
 
 DnsProxyListener::GetHostByNameHandler::~GetHostByNameHandler() {
@@ -333,15 +703,21 @@ void DnsProxyListener::GetHostByNameHandler::run() {
     }
 
     char iface[IF_NAMESIZE + 1];
+    iface[0] = '\0';
     if (mIface == NULL) {
         //fall back to the per uid interface if no per pid interface exists
         if(!_resolv_get_pids_associated_interface(mPid, iface, sizeof(iface)))
             _resolv_get_uids_associated_interface(mUid, iface, sizeof(iface));
     }
+    recordDnsLatency("wait", mIface ? mIface : iface, mQueuedUs);
 
     struct hostent* hp;
 
+    int64_t resolveStart = LatencyMetrics::nowUs();
     hp = android_gethostbynameforiface(mName, mAf, mIface ? mIface : iface, mMark);
+    recordDnsLatency("resolve", mIface ? mIface : iface, resolveStart);
+    reportDnsLookup(sResolverCtrl, mIface ? mIface : iface, resolveStart,
+                    !hp && h_errno == TRY_AGAIN);
 
     if (DBG) {
         ALOGD("GetHostByNameHandler::run gethostbyname errno: %s hp->h_name = %s, name_len = %d\n",
@@ -439,7 +815,8 @@ DnsProxyListener::GetHostByAddrHandler::GetHostByAddrHandler(SocketClient* c,
           mIface(iface),
           mPid(pid),
           mUid(uid),
-          mMark(mark) {
+          mMark(mark),
+          mQueuedUs(LatencyMetrics::nowUs()) {
 }
 
 DnsProxyListener::GetHostByAddrHandler::~GetHostByAddrHandler() {
@@ -469,16 +846,22 @@ void DnsProxyListener::GetHostByAddrHandler::run() {
 
     char tmp[IF_NAMESIZE + 1];
     int mark = mMark;
+    tmp[0] = '\0';
     if (mIface == NULL) {
         //fall back to the per uid interface if no per pid interface exists
         if(!_resolv_get_pids_associated_interface(mPid, tmp, sizeof(tmp)))
             _resolv_get_uids_associated_interface(mUid, tmp, sizeof(tmp));
     }
+    recordDnsLatency("wait", mIface ? mIface : tmp, mQueuedUs);
     struct hostent* hp;
 
     // NOTE gethostbyaddr should take a void* but bionic thinks it should be char*
+    int64_t resolveStart = LatencyMetrics::nowUs();
     hp = android_gethostbyaddrforiface((char*)mAddress, mAddressLen, mAddressFamily,
             mIface ? mIface : tmp, mark);
+    recordDnsLatency("resolve", mIface ? mIface : tmp, resolveStart);
+    reportDnsLookup(sResolverCtrl, mIface ? mIface : tmp, resolveStart,
+                    !hp && h_errno == TRY_AGAIN);
 
     if (DBG) {
         ALOGD("GetHostByAddrHandler::run gethostbyaddr errno: %s hp->h_name = %s, name_len = %d\n",
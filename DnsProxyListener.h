@@ -17,9 +17,12 @@
 #ifndef _DNSPROXYLISTENER_H__
 #define _DNSPROXYLISTENER_H__
 
+#include <stdint.h>
+
 #include <sysutils/FrameworkListener.h>
 
 #include "NetdCommand.h"
+#include "ResolverController.h"
 #include "UidMarkMap.h"
 
 class DnsProxyListener : public FrameworkListener {
@@ -27,7 +30,11 @@ public:
     DnsProxyListener(UidMarkMap *map);
     virtual ~DnsProxyListener() {}
 
+    /* Gets the time and outcome of every lookup, to order the servers by. */
+    static void setResolverController(ResolverController *ctrl) { sResolverCtrl = ctrl; }
+
 private:
+    static ResolverController *sResolverCtrl;
     UidMarkMap *mUidMarkMap;
     class GetAddrInfoCmd : public NetdCommand {
     public:
@@ -64,6 +71,7 @@ private:
         pid_t mPid;
         uid_t mUid;
         int mMark;
+        int64_t mQueuedUs;
     };
 
     /* ------ gethostbyname ------*/
@@ -97,6 +105,7 @@ private:
         char* mName; // owned
         int mAf;
         int mMark;
+        int64_t mQueuedUs;
     };
 
     /* ------ gethostbyaddr ------*/
@@ -134,6 +143,7 @@ private:
         pid_t mPid;
         uid_t mUid;
         int   mMark;
+        int64_t mQueuedUs;
     };
 };
 
@@ -52,8 +52,9 @@
  * ndc command sequence
  * ------------------
  * ndc idletimer enable
- * ndc idletimer add <iface> <timeout> <class label>
- * ndc idletimer remove <iface> <timeout> <class label>
+ * ndc idletimer add <iface> <timeout> <class label> [<iface> <timeout> <class label>]...
+ * ndc idletimer remove <iface> <timeout> <class label> [<iface> <timeout> <class label>]...
+ * ndc idletimer list
  *
  * Monitor effect on the iptables chains after each step using:
  *     iptables -nxvL -t raw
@@ -97,6 +98,7 @@
 
 #include <stdlib.h>
 #include <errno.h>
+#include <dirent.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
@@ -111,10 +113,13 @@
 #include <logwrap/logwrap.h>
 
 #include "IdletimerController.h"
+#include "CommandExecutor.h"
 #include "NetdConstants.h"
+#include "ResponseCode.h"
 
 const char* IdletimerController::LOCAL_RAW_PREROUTING = "idletimer_raw_PREROUTING";
 const char* IdletimerController::LOCAL_MANGLE_POSTROUTING = "idletimer_mangle_POSTROUTING";
+const char IdletimerController::TIMERS_SYSFS_DIR[] = "/sys/class/xt_idletimer/timers";
 
 IdletimerController::IdletimerController() {
 }
@@ -125,7 +130,7 @@ IdletimerController::~IdletimerController() {
 int IdletimerController::runIpxtablesCmd(int argc, const char **argv) {
     int res;
 
-    res = android_fork_execvp(argc, (char **)argv, NULL, false, false);
+    res = CommandExecutor::get()->execvp(argc, argv, NULL, false);
     ALOGV("runCmd() res=%d", res);
     return res;
 }
@@ -135,29 +140,14 @@ bool IdletimerController::setupIptablesHooks() {
 }
 
 int IdletimerController::setDefaults() {
-  int res;
-  const char *cmd1[] = {
-      IPTABLES_PATH,
-      "-t",
-      "raw",
-      "-F",
-      LOCAL_RAW_PREROUTING
-  };
-  res = runIpxtablesCmd(ARRAY_SIZE(cmd1), cmd1);
-
-  if (res)
-    return res;
+  std::string rules;
+  char *buf;
 
-  const char *cmd2[] = {
-      IPTABLES_PATH,
-      "-t",
-      "mangle",
-      "-F",
-      LOCAL_MANGLE_POSTROUTING
-  };
-  res = runIpxtablesCmd(ARRAY_SIZE(cmd2), cmd2);
-
-  return res;
+  asprintf(&buf, "*raw\n-F %s\nCOMMIT\n*mangle\n-F %s\nCOMMIT\n",
+           LOCAL_RAW_PREROUTING, LOCAL_MANGLE_POSTROUTING);
+  rules = buf;
+  free(buf);
+  return execIptablesRestore(V4, rules);
 }
 
 int IdletimerController::enableIdletimerControl() {
@@ -233,3 +223,99 @@ int IdletimerController::removeInterfaceIdletimer(const char *iface,
                                                   const char *classLabel) {
   return modifyInterfaceIdletimer(IptOpDelete, iface, timeout, classLabel);
 }
+
+int IdletimerController::addInterfaceIdletimers(int count, char **argv) {
+  return modifyInterfaceIdletimers(IptOpAdd, count, argv);
+}
+
+int IdletimerController::removeInterfaceIdletimers(int count, char **argv) {
+  return modifyInterfaceIdletimers(IptOpDelete, count, argv);
+}
+
+/*
+ * The raw rules are committed first and the mangle ones second, so a failed
+ * mangle commit only has the raw one to take back.
+ */
+int IdletimerController::modifyInterfaceIdletimers(IptOp op, int count, char **argv) {
+  std::string raw, mangle, undo;
+  char *buf;
+  int i;
+
+  for (i = 0; i < count; i++) {
+    const char *iface = argv[i * 3];
+    const char *classLabel = argv[i * 3 + 2];
+    char *end;
+    unsigned long timeout = strtoul(argv[i * 3 + 1], &end, 10);
+
+    if (*end || end == argv[i * 3 + 1] || !*iface || !*classLabel ||
+        strpbrk(iface, " \t\n") || strpbrk(classLabel, " \t\n")) {
+      ALOGE("Bad idletimer %s %s %s", iface, argv[i * 3 + 1], classLabel);
+      errno = EINVAL;
+      return -1;
+    }
+
+    asprintf(&buf, " %s -i %s -j IDLETIMER --timeout %lu --label %s --send_nl_msg 1\n",
+             LOCAL_RAW_PREROUTING, iface, timeout, classLabel);
+    raw += ((op == IptOpAdd) ? "-A" : "-D");
+    raw += buf;
+    undo += ((op == IptOpAdd) ? "-D" : "-A");
+    undo += buf;
+    free(buf);
+
+    asprintf(&buf, "%s %s -o %s -j IDLETIMER --timeout %lu --label %s --send_nl_msg 1\n",
+             (op == IptOpAdd) ? "-A" : "-D", LOCAL_MANGLE_POSTROUTING, iface, timeout,
+             classLabel);
+    mangle += buf;
+    free(buf);
+  }
+
+  if (execIptablesRestore(V4, "*raw\n" + raw + "COMMIT\n")) {
+    return -1;
+  }
+  if (execIptablesRestore(V4, "*mangle\n" + mangle + "COMMIT\n")) {
+    // unwind what's been done, but don't care about success - what more could we do?
+    execIptablesRestore(V4, "*raw\n" + undo + "COMMIT\n");
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Each timer label is a sysfs attribute holding the seconds left before
+ * it expires, 0 once it has.
+ */
+int IdletimerController::listIdletimers(SocketClient *cli) {
+  DIR *dir;
+  struct dirent *de;
+  char *path, *msg;
+  char value[32];
+
+  if (!(dir = opendir(TIMERS_SYSFS_DIR))) {
+    /* No timer was ever created. */
+    cli->sendMsg(ResponseCode::CommandOkay, "Idletimer list completed", false);
+    return 0;
+  }
+
+  while ((de = readdir(dir))) {
+    int size = sizeof(value) - 1;
+
+    if (de->d_name[0] == '.') {
+      continue;
+    }
+    asprintf(&path, "%s/%s", TIMERS_SYSFS_DIR, de->d_name);
+    if (readFile(path, value, &size) < 0) {
+      free(path);
+      continue;
+    }
+    free(path);
+    value[size] = '\0';
+    long left = strtol(value, NULL, 10);
+    asprintf(&msg, "%s %ld %s", de->d_name, left, left > 0 ? "active" : "idle");
+    cli->sendMsg(ResponseCode::IdletimerListResult, msg, false);
+    free(msg);
+  }
+  closedir(dir);
+
+  cli->sendMsg(ResponseCode::CommandOkay, "Idletimer list completed", false);
+  return 0;
+}
@@ -16,6 +16,10 @@
 #ifndef _IDLETIMER_CONTROLLER_H
 #define _IDLETIMER_CONTROLLER_H
 
+#include <string>
+
+#include <sysutils/SocketClient.h>
+
 class IdletimerController {
 public:
 
@@ -28,6 +32,17 @@ public:
                               const char *classLabel);
     int removeInterfaceIdletimer(const char *iface, uint32_t timeout,
                                  const char *classLabel);
+    /*
+     * argv holds count (iface, timeout, class label) triplets. All of them
+     * are added or removed in one commit, or none is.
+     */
+    int addInterfaceIdletimers(int count, char **argv);
+    int removeInterfaceIdletimers(int count, char **argv);
+    /*
+     * Sends an IdletimerListResult "<class label> <seconds left> <active|idle>"
+     * per kernel timer, then a CommandOkay.
+     */
+    int listIdletimers(SocketClient *cli);
     bool setupIptablesHooks();
 
     static const char* LOCAL_RAW_PREROUTING;
@@ -39,6 +54,8 @@ public:
     int runIpxtablesCmd(int argc, const char **cmd);
     int modifyInterfaceIdletimer(IptOp op, const char *iface, uint32_t timeout,
                                  const char *classLabel);
+    int modifyInterfaceIdletimers(IptOp op, int count, char **argv);
+    static const char TIMERS_SYSFS_DIR[];
 };
 
 #endif
@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#define LOG_TAG "IptablesRuleset"
+#include <cutils/log.h>
+
+#include "IptablesRuleset.h"
+
+static const int MAX_SAVE_LINE_LEN = 1024;
+
+IptablesRuleset::IptablesRuleset() {
+}
+
+bool IptablesRuleset::inTarget(IptablesTarget target, int family) {
+    return target == V4V6 || (family == 0 ? target == V4 : target == V6);
+}
+
+int IptablesRuleset::load() {
+    const char *savePaths[] = { IPTABLES_SAVE_PATH, IP6TABLES_SAVE_PATH };
+    char line[MAX_SAVE_LINE_LEN];
+    char chain[MAX_SAVE_LINE_LEN];
+
+    mSavedChains.clear();
+    for (int family = 0; family < 2; family++) {
+        std::string table;
+        FILE *fp = popen(savePaths[family], "r");
+
+        if (!fp) {
+            ALOGE("Failed to run %s err=%s", savePaths[family], strerror(errno));
+            return -1;
+        }
+        mSaved[family].clear();
+        while (fgets(line, sizeof(line), fp)) {
+            line[strcspn(line, "\n")] = '\0';
+            if (line[0] == '*') {
+                table = line + 1;
+            } else if (!strncmp(line, "-A ", 3)) {
+                mSaved[family].push_back(std::make_pair(table, std::string(line + 3)));
+            } else if (family == 0 && sscanf(line, ":%s", chain) == 1) {
+                mSavedChains.push_back(std::make_pair(table, std::string(chain)));
+            }
+        }
+        if (pclose(fp)) {
+            ALOGE("%s failed", savePaths[family]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void IptablesRuleset::findChains(const char *table, const char *prefix,
+                                 std::list<std::string> &chains) {
+    std::list<std::pair<std::string, std::string> >::iterator it;
+    size_t prefixLen = strlen(prefix);
+
+    for (it = mSavedChains.begin(); it != mSavedChains.end(); it++) {
+        if (it->first == table && !it->second.compare(0, prefixLen, prefix)) {
+            chains.push_back(it->second);
+        }
+    }
+}
+
+IptablesRuleset::Table *IptablesRuleset::getTable(int family, const char *table) {
+    std::list<Table>::iterator it;
+
+    for (it = mTables[family].begin(); it != mTables[family].end(); it++) {
+        if (it->name == table) {
+            return &*it;
+        }
+    }
+    mTables[family].push_back(Table());
+    mTables[family].back().name = table;
+    return &mTables[family].back();
+}
+
+void IptablesRuleset::declareChain(IptablesTarget target, const char *table, const char *chain) {
+    for (int family = 0; family < 2; family++) {
+        if (!inTarget(target, family)) {
+            continue;
+        }
+        Table *t = getTable(family, table);
+        std::list<std::string>::iterator it;
+        for (it = t->declared.begin(); it != t->declared.end(); it++) {
+            if (*it == chain)
+                break;
+        }
+        if (it != t->declared.end()) {
+            continue;
+        }
+        t->declared.push_back(chain);
+        /* With --noflush, declaring a chain that exists flushes it. */
+        t->chains += ":";
+        t->chains += chain;
+        t->chains += " - [0:0]\n";
+    }
+}
+
+void IptablesRuleset::deleteChain(IptablesTarget target, const char *table, const char *chain) {
+    for (int family = 0; family < 2; family++) {
+        if (inTarget(target, family)) {
+            Table *t = getTable(family, table);
+            t->deletes += "-X ";
+            t->deletes += chain;
+            t->deletes += "\n";
+        }
+    }
+}
+
+void IptablesRuleset::addRule(IptablesTarget target, const char *table, const std::string &rule) {
+    for (int family = 0; family < 2; family++) {
+        if (inTarget(target, family)) {
+            Table *t = getTable(family, table);
+            t->rules += rule;
+            t->rules += "\n";
+        }
+    }
+}
+
+void IptablesRuleset::deleteExisting(IptablesTarget target, const char *table,
+                                     const std::string &rule) {
+    std::list<std::pair<std::string, std::string> >::iterator it;
+
+    for (int family = 0; family < 2; family++) {
+        if (!inTarget(target, family)) {
+            continue;
+        }
+        for (it = mSaved[family].begin(); it != mSaved[family].end(); it++) {
+            if (it->first == table && it->second == rule) {
+                Table *t = getTable(family, table);
+                t->rules += "-D ";
+                t->rules += rule;
+                t->rules += "\n";
+            }
+        }
+    }
+}
+
+int IptablesRuleset::commit() {
+    const IptablesTarget targets[] = { V4, V6 };
+    std::list<Table>::iterator it;
+
+    for (int family = 0; family < 2; family++) {
+        std::string commands;
+
+        for (it = mTables[family].begin(); it != mTables[family].end(); it++) {
+            commands += "*" + it->name + "\n" + it->chains + it->rules + it->deletes + "COMMIT\n";
+        }
+        if (!commands.empty() && execIptablesRestore(targets[family], commands)) {
+            return -1;
+        }
+    }
+    return 0;
+}
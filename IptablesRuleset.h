@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _IPTABLES_RULESET_H
+#define _IPTABLES_RULESET_H
+
+#include <list>
+#include <string>
+#include <utility>
+
+#include "NetdConstants.h"
+
+/*
+ * Collects iptables changes for several tables and both families, and
+ * applies them with one iptables-restore per family, each table in a
+ * single commit. Used at startup, where running them one iptables at a
+ * time costs well over a hundred forks.
+ *
+ * Rules are given without "-t <table>", as in iptables-save output.
+ */
+class IptablesRuleset {
+public:
+    IptablesRuleset();
+    virtual ~IptablesRuleset() {}
+
+    /* Reads the current tables, for findChains() and deleteExisting(). */
+    int load();
+    /* Appends the v4 chains of table starting with prefix to chains. */
+    void findChains(const char *table, const char *prefix, std::list<std::string> &chains);
+
+    /* Creates the chain, or flushes it if it exists. */
+    void declareChain(IptablesTarget target, const char *table, const char *chain);
+    /* Deletes the chain once all rules are in; it has to be declared first. */
+    void deleteChain(IptablesTarget target, const char *table, const char *chain);
+    void addRule(IptablesTarget target, const char *table, const std::string &rule);
+    /* Deletes every copy of "-A <rule>" found by load(). */
+    void deleteExisting(IptablesTarget target, const char *table, const std::string &rule);
+
+    int commit();
+
+private:
+    class Table {
+    public:
+        std::string name;
+        std::list<std::string> declared;
+        std::string chains;
+        std::string rules;
+        std::string deletes;
+    };
+
+    Table *getTable(int family, const char *table);
+    static bool inTarget(IptablesTarget target, int family);
+
+    /* Indexed by family: 0 for v4, 1 for v6. */
+    std::list<Table> mTables[2];
+    /* (table, rule) for every "-A" line of iptables-save. */
+    std::list<std::pair<std::string, std::string> > mSaved[2];
+    std::list<std::pair<std::string, std::string> > mSavedChains;
+};
+
+#endif
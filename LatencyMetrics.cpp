@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LOG_TAG "LatencyMetrics"
+#include <cutils/log.h>
+
+#include "LatencyMetrics.h"
+#include "ResponseCode.h"
+
+LatencyMetrics::LatencyMetrics() {
+    memset(mSeries, 0, sizeof(mSeries));
+    for (int i = 0; i < MAX_SERIES; i++) {
+        pthread_mutex_init(&mSeries[i].lock, NULL);
+    }
+}
+
+LatencyMetrics *LatencyMetrics::Instance() {
+    static LatencyMetrics sInstance;
+    return &sInstance;
+}
+
+int64_t LatencyMetrics::nowUs() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int LatencyMetrics::bucketOf(int64_t us) {
+    if (us < 0) {
+        us = 0;
+    }
+    int bucket = 63 - __builtin_clzll((uint64_t) us + 1);
+    return bucket < NUM_BUCKETS ? bucket : NUM_BUCKETS - 1;
+}
+
+int64_t LatencyMetrics::bucketLimit(int bucket) {
+    return ((int64_t) 1 << (bucket + 1)) - 1;
+}
+
+/* Open addressing on a hash of the name; a slot's name is set once, by CAS. */
+int LatencyMetrics::getSeries(const char *name) {
+    uint32_t hash = 5381;
+    char *copy = NULL;
+
+    for (const char *p = name; *p; p++) {
+        hash = hash * 33 + (unsigned char) *p;
+    }
+    for (int probe = 0; probe < MAX_SERIES; probe++) {
+        Series *series = &mSeries[(hash + probe) % MAX_SERIES];
+        const char *slotName = series->name;
+
+        if (slotName == NULL) {
+            if (copy == NULL && (copy = strdup(name)) == NULL) {
+                return -1;
+            }
+            if (__sync_bool_compare_and_swap(&series->name, (const char *) NULL, copy)) {
+                return (hash + probe) % MAX_SERIES;
+            }
+            slotName = series->name;
+        }
+        if (!strcmp(slotName, name)) {
+            free(copy);
+            return (hash + probe) % MAX_SERIES;
+        }
+    }
+    free(copy);
+    return -1;
+}
+
+void LatencyMetrics::record(int index, int64_t us) {
+    if (index < 0) {
+        return;
+    }
+    Series *series = &mSeries[index];
+    uint32_t clamped = us > 0xffffffffLL ? 0xffffffffU : (us < 0 ? 0 : (uint32_t) us);
+    uint32_t max;
+
+    __sync_fetch_and_add(&series->buckets[bucketOf(us)], 1);
+    pthread_mutex_lock(&series->lock);
+    series->sumUs += clamped;
+    pthread_mutex_unlock(&series->lock);
+    while ((max = series->maxUs) < clamped &&
+            !__sync_bool_compare_and_swap(&series->maxUs, max, clamped)) {
+    }
+}
+
+void LatencyMetrics::dump(SocketClient *cli) {
+    for (int i = 0; i < MAX_SERIES; i++) {
+        Series *series = &mSeries[i];
+        uint32_t buckets[NUM_BUCKETS];
+        uint32_t count = 0;
+        const double percentiles[] = { 0.50, 0.90, 0.99 };
+        int64_t limits[3];
+        char histogram[NUM_BUCKETS * 11];
+        char *msg;
+        int len = 0;
+        uint64_t sumUs;
+
+        if (!series->name) {
+            continue;
+        }
+        /* Counted from the copied buckets, so the line is consistent. */
+        for (int b = 0; b < NUM_BUCKETS; b++) {
+            buckets[b] = series->buckets[b];
+            count += buckets[b];
+            len += snprintf(histogram + len, sizeof(histogram) - len, "%s%u",
+                            b ? "," : "", buckets[b]);
+        }
+        if (!count) {
+            continue;
+        }
+        for (int p = 0; p < 3; p++) {
+            uint64_t wanted = (uint64_t) (count * percentiles[p] + 0.5);
+            uint64_t seen = 0;
+            int b;
+            for (b = 0; b < NUM_BUCKETS - 1; b++) {
+                seen += buckets[b];
+                if (seen >= wanted && seen > 0)
+                    break;
+            }
+            limits[p] = bucketLimit(b);
+        }
+        pthread_mutex_lock(&series->lock);
+        sumUs = series->sumUs;
+        pthread_mutex_unlock(&series->lock);
+        asprintf(&msg, "%s %u %llu %u %lld %lld %lld %s", series->name, count,
+                 (unsigned long long) sumUs, series->maxUs,
+                 (long long) limits[0], (long long) limits[1], (long long) limits[2],
+                 histogram);
+        cli->sendMsg(ResponseCode::MetricsResult, msg, false);
+        free(msg);
+    }
+    cli->sendMsg(ResponseCode::CommandOkay, "Metrics dump completed", false);
+}
+
+void LatencyMetrics::reset() {
+    for (int i = 0; i < MAX_SERIES; i++) {
+        Series *series = &mSeries[i];
+
+        for (int b = 0; b < NUM_BUCKETS; b++) {
+            __sync_fetch_and_and(&series->buckets[b], 0);
+        }
+        pthread_mutex_lock(&series->lock);
+        series->sumUs = 0;
+        pthread_mutex_unlock(&series->lock);
+        __sync_fetch_and_and(&series->maxUs, 0);
+    }
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LATENCY_METRICS_H
+#define _LATENCY_METRICS_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <sysutils/SocketClient.h>
+
+/*
+ * Latency histograms, cheap enough to keep on in production builds.
+ *
+ * Each series has a name and power of two buckets of microseconds: bucket
+ * i counts samples in [2^i - 1, 2^(i+1) - 1), the last one everything
+ * above. Recording is a handful of atomic adds and one uncontended
+ * per-series lock for the sum, from any thread. Series are created on first use in a fixed table and never go
+ * away; once it is full, new names are not recorded.
+ *
+ * Series names in use:
+ *   cmd.<command>               CommandListener commands, end to end
+ *   exec.<binary>.<exit code>   children run through CommandExecutor
+ *   dns.wait.<iface>            DNS request accepted to handler running
+ *   dns.resolve.<iface>         DNS handler run
+ *   netlink.<subsystem>         NetlinkHandler::onEvent()
+ */
+class LatencyMetrics {
+public:
+    static LatencyMetrics *Instance();
+
+    /* Returns the index for name, adding it if needed, or -1 if full. */
+    int getSeries(const char *name);
+    void record(int series, int64_t us);
+    void record(const char *name, int64_t us) { record(getSeries(name), us); }
+
+    /*
+     * Sends a MetricsResult per series with samples:
+     *   "<name> <count> <sum_us> <max_us> <p50_us> <p90_us> <p99_us> <b0>,<b1>,...,<b23>"
+     * percentiles being bucket upper bounds, then a CommandOkay.
+     */
+    void dump(SocketClient *cli);
+    /* Zeroes all series; samples racing with it may land on either side. */
+    void reset();
+
+    static int64_t nowUs();
+
+private:
+    static const int MAX_SERIES = 256;
+    static const int NUM_BUCKETS = 24;
+
+    class Series {
+    public:
+        const char *volatile name;
+        volatile uint32_t buckets[NUM_BUCKETS];
+        volatile uint32_t maxUs;
+        /* Under lock: 64 bit atomics are not there on every 32 bit target. */
+        pthread_mutex_t lock;
+        uint64_t sumUs;
+    };
+
+    LatencyMetrics();
+    static int bucketOf(int64_t us);
+    static int64_t bucketLimit(int bucket);
+
+    Series mSeries[MAX_SERIES];
+};
+
+/* Records the time from construction to destruction in a series. */
+class LatencyTimer {
+public:
+    LatencyTimer(const char *name) : mName(name), mStart(LatencyMetrics::nowUs()) {}
+    ~LatencyTimer() {
+        LatencyMetrics::Instance()->record(mName, LatencyMetrics::nowUs() - mStart);
+    }
+
+private:
+    const char *mName;
+    int64_t mStart;
+};
+
+#endif
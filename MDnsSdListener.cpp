@@ -22,7 +22,7 @@
 #include <netinet/in.h>
 #include <pthread.h>
 #include <stdlib.h>
-#include <sys/poll.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <string.h>
@@ -41,8 +41,15 @@
 #define MDNS_SERVICE_NAME "mdnsd"
 #define MDNS_SERVICE_STATUS "init.svc.mdnsd"
 
+#define MAX_EPOLL_EVENTS 16
+#define MAX_CACHED_SERVICES 64 // per browse session
+#define ELEMENT_TABLE_INITIAL_SIZE 32 // must be a power of two
+#define ELEMENT_POOL_CHUNK 16
+
 MDnsSdListener::MDnsSdListener() :
                  FrameworkListener("mdns", true) {
+    mNextSessionId = -1;
+    pthread_mutex_init(&mSessionMutex, NULL);
     Monitor *m = new Monitor();
     registerCmd(new Handler(m, this));
 }
@@ -66,65 +73,231 @@ void MDnsSdListener::Handler::discover(SocketClient *cli,
         ALOGD("discover(%s, %s, %s, %d, %d)", iface, regType, domain, requestId,
                 requestFlags);
     }
-    Context *context = new Context(requestId, mListener);
-    DNSServiceRef *ref = mMonitor->allocateServiceRef(requestId, context);
+    if (requestId < 0) {
+        // negative ids are kept for browse sessions
+        ALOGE("discover called with negative requestId %d", requestId);
+        cli->sendMsg(ResponseCode::CommandParameterError,
+                "Invalid requestId during discover call", false);
+        return;
+    }
+    // Reserve the id so no other request can use it while we are subscribed.
+    // The ref is never started, so stopping it as something else is harmless.
+    DNSServiceRef *ref = mMonitor->allocateServiceRef(requestId, new Context(requestId, mListener));
     if (ref == NULL) {
         ALOGE("requestId %d already in use during discover call", requestId);
         cli->sendMsg(ResponseCode::CommandParameterError,
                 "RequestId already in use during discover call", false);
         return;
     }
-    if (VDBG) ALOGD("using ref %p", ref);
+    *ref = NULL;
     DNSServiceFlags nativeFlags = iToFlags(requestFlags);
     int interfaceInt = ifaceNameToI(iface);
 
-    DNSServiceErrorType result = DNSServiceBrowse(ref, nativeFlags, interfaceInt, regType,
-            domain, &MDnsSdListenerDiscoverCallback, context);
-    if (result != kDNSServiceErr_NoError) {
-        ALOGE("Discover request %d got an error from DNSServiceBrowse %d", requestId, result);
-        mMonitor->freeServiceRef(requestId);
-        cli->sendMsg(ResponseCode::CommandParameterError,
-                "Discover request got an error from DNSServiceBrowse", false);
-        return;
+    pthread_mutex_lock(&mListener->mSessionMutex);
+    BrowseSession *session = mListener->findSession(interfaceInt, nativeFlags, regType, domain);
+    if (session == NULL) {
+        int sessionId = mListener->mNextSessionId--;
+        Context *context = new Context(sessionId, mListener);
+        DNSServiceRef *sessionRef = mMonitor->allocateServiceRef(sessionId, context);
+        if (sessionRef == NULL) {
+            // allocateServiceRef has deleted context
+            ALOGE("Session id %d already in use during discover call", sessionId);
+            mMonitor->freeServiceRef(requestId);
+            cli->sendMsg(ResponseCode::CommandParameterError,
+                    "Session id already in use during discover call", false);
+            pthread_mutex_unlock(&mListener->mSessionMutex);
+            return;
+        }
+        if (VDBG) ALOGD("using ref %p for session %d", sessionRef, sessionId);
+        DNSServiceErrorType result = DNSServiceBrowse(sessionRef, nativeFlags, interfaceInt,
+                regType, domain, &MDnsSdListenerDiscoverCallback, context);
+        if (result != kDNSServiceErr_NoError) {
+            ALOGE("Discover request %d got an error from DNSServiceBrowse %d", requestId, result);
+            mMonitor->freeServiceRef(sessionId);
+            mMonitor->freeServiceRef(requestId);
+            cli->sendMsg(ResponseCode::CommandParameterError,
+                    "Discover request got an error from DNSServiceBrowse", false);
+            pthread_mutex_unlock(&mListener->mSessionMutex);
+            return;
+        }
+        mMonitor->startMonitoring(sessionId);
+        session = new BrowseSession();
+        session->mId = sessionId;
+        session->mInterface = interfaceInt;
+        session->mFlags = nativeFlags;
+        session->mRegType = regType;
+        session->mDomain = (domain == NULL ? "" : domain);
+        mListener->mSessions.push_back(session);
+    } else if (VDBG) {
+        ALOGD("discover %d joining session %d with %d cached", requestId, session->mId,
+                (int) session->mCache.size());
     }
-    mMonitor->startMonitoring(requestId);
+    session->mSubscribers.push_back(requestId);
     if (VDBG) ALOGD("discover successful");
     cli->sendMsg(ResponseCode::CommandOkay, "Discover operation started", false);
+    mListener->sendCachedServices(session, requestId);
+    pthread_mutex_unlock(&mListener->mSessionMutex);
     return;
 }
 
+MDnsSdListener::BrowseSession *MDnsSdListener::findSession(int interfaceIndex,
+        DNSServiceFlags flags, const char *regType, const char *domain) {
+    std::list<BrowseSession *>::iterator it;
+    for (it = mSessions.begin(); it != mSessions.end(); it++) {
+        BrowseSession *session = *it;
+        if (session->mInterface == interfaceIndex && session->mFlags == flags &&
+                session->mRegType == regType &&
+                session->mDomain == (domain == NULL ? "" : domain)) {
+            return session;
+        }
+    }
+    return NULL;
+}
+
+MDnsSdListener::BrowseSession *MDnsSdListener::findSessionById(int sessionId) {
+    std::list<BrowseSession *>::iterator it;
+    for (it = mSessions.begin(); it != mSessions.end(); it++) {
+        if ((*it)->mId == sessionId) {
+            return *it;
+        }
+    }
+    return NULL;
+}
+
+MDnsSdListener::BrowseSession *MDnsSdListener::findSessionBySubscriber(int requestId) {
+    std::list<BrowseSession *>::iterator it;
+    for (it = mSessions.begin(); it != mSessions.end(); it++) {
+        std::list<int>::iterator sub;
+        for (sub = (*it)->mSubscribers.begin(); sub != (*it)->mSubscribers.end(); sub++) {
+            if (*sub == requestId) {
+                return *it;
+            }
+        }
+    }
+    return NULL;
+}
+
+void MDnsSdListener::sendCachedServices(BrowseSession *session, int requestId) {
+    std::list<BrowseSession::CachedService>::iterator it;
+    for (it = session->mCache.begin(); it != session->mCache.end(); it++) {
+        char *msg;
+        char *quotedServiceName = SocketClient::quoteArg(it->mName.c_str());
+        asprintf(&msg, "%d %s %s %s", requestId, quotedServiceName, it->mRegType.c_str(),
+                it->mDomain.c_str());
+        free(quotedServiceName);
+        sendBroadcast(ResponseCode::ServiceDiscoveryServiceAdded, msg, false);
+        free(msg);
+    }
+}
+
 void MDnsSdListenerDiscoverCallback(DNSServiceRef sdRef, DNSServiceFlags flags,
         uint32_t interfaceIndex, DNSServiceErrorType errorCode, const char *serviceName,
         const char *regType, const char *replyDomain, void *inContext) {
     MDnsSdListener::Context *context = reinterpret_cast<MDnsSdListener::Context *>(inContext);
-    char *msg;
-    int refNumber = context->mRefNumber;
+    context->mListener->onBrowseResult(context->mRefNumber, flags, interfaceIndex, errorCode,
+            serviceName, regType, replyDomain);
+}
 
+void MDnsSdListener::onBrowseResult(int sessionId, DNSServiceFlags flags,
+        uint32_t interfaceIndex, DNSServiceErrorType errorCode, const char *serviceName,
+        const char *regType, const char *replyDomain) {
+    pthread_mutex_lock(&mSessionMutex);
+    BrowseSession *session = findSessionById(sessionId);
+    if (session == NULL) {
+        // the last subscriber stopped while this result was in flight
+        if (VDBG) ALOGD("dropping browse result for closed session %d", sessionId);
+        pthread_mutex_unlock(&mSessionMutex);
+        return;
+    }
+
+    int respCode;
+    char *quotedServiceName = NULL;
     if (errorCode != kDNSServiceErr_NoError) {
-        asprintf(&msg, "%d %d", refNumber, errorCode);
-        context->mListener->sendBroadcast(ResponseCode::ServiceDiscoveryFailed, msg, false);
-        if (DBG) ALOGE("discover failure for %d, error= %d", refNumber, errorCode);
+        if (DBG) ALOGE("discover failure for session %d, error= %d", sessionId, errorCode);
+        respCode = ResponseCode::ServiceDiscoveryFailed;
     } else {
-        int respCode;
-        char *quotedServiceName = SocketClient::quoteArg(serviceName);
+        std::list<BrowseSession::CachedService>::iterator it;
+        for (it = session->mCache.begin(); it != session->mCache.end(); it++) {
+            if (it->mInterface == interfaceIndex && it->mName == serviceName &&
+                    it->mRegType == regType && it->mDomain == replyDomain) {
+                break;
+            }
+        }
         if (flags & kDNSServiceFlagsAdd) {
             if (VDBG) {
                 ALOGD("Discover found new serviceName %s, regType %s and domain %s for %d",
-                        serviceName, regType, replyDomain, refNumber);
+                        serviceName, regType, replyDomain, sessionId);
             }
             respCode = ResponseCode::ServiceDiscoveryServiceAdded;
+            if (it == session->mCache.end()) {
+                if (session->mCache.size() >= MAX_CACHED_SERVICES) {
+                    ALOGW("Browse cache for session %d full, forgetting %s", sessionId,
+                            session->mCache.front().mName.c_str());
+                    session->mCache.pop_front();
+                }
+                BrowseSession::CachedService service;
+                service.mInterface = interfaceIndex;
+                service.mName = serviceName;
+                service.mRegType = regType;
+                service.mDomain = replyDomain;
+                session->mCache.push_back(service);
+            }
         } else {
             if (VDBG) {
                 ALOGD("Discover lost serviceName %s, regType %s and domain %s for %d",
-                        serviceName, regType, replyDomain, refNumber);
+                        serviceName, regType, replyDomain, sessionId);
             }
             respCode = ResponseCode::ServiceDiscoveryServiceRemoved;
+            if (it != session->mCache.end()) {
+                session->mCache.erase(it);
+            }
         }
-        asprintf(&msg, "%d %s %s %s", refNumber, quotedServiceName, regType, replyDomain);
-        free(quotedServiceName);
-        context->mListener->sendBroadcast(respCode, msg, false);
+        quotedServiceName = SocketClient::quoteArg(serviceName);
     }
-    free(msg);
+
+    std::list<int>::iterator sub;
+    for (sub = session->mSubscribers.begin(); sub != session->mSubscribers.end(); sub++) {
+        char *msg;
+        if (errorCode != kDNSServiceErr_NoError) {
+            asprintf(&msg, "%d %d", *sub, errorCode);
+        } else {
+            asprintf(&msg, "%d %s %s %s", *sub, quotedServiceName, regType, replyDomain);
+        }
+        sendBroadcast(respCode, msg, false);
+        free(msg);
+    }
+    free(quotedServiceName);
+    pthread_mutex_unlock(&mSessionMutex);
+}
+
+void MDnsSdListener::Handler::stopDiscover(SocketClient *cli, int argc, char **argv) {
+    if (argc != 3) {
+        cli->sendMsg(ResponseCode::CommandParameterError,
+                "Invalid number of arguments to discover", false);
+        return;
+    }
+    int requestId = atoi(argv[2]);
+    pthread_mutex_lock(&mListener->mSessionMutex);
+    BrowseSession *session = mListener->findSessionBySubscriber(requestId);
+    if (session == NULL) {
+        pthread_mutex_unlock(&mListener->mSessionMutex);
+        if (DBG) ALOGE("discover stop used unknown requestId %d", requestId);
+        cli->sendMsg(ResponseCode::CommandParameterError, "Unknown requestId", false);
+        return;
+    }
+    session->mSubscribers.remove(requestId);
+    mMonitor->freeServiceRef(requestId);
+    if (session->mSubscribers.empty()) {
+        // The monitor thread may be in DNSServiceProcessResult on the session
+        // ref, waiting for mSessionMutex in onBrowseResult, so leave the
+        // deallocation to it.
+        if (VDBG) ALOGD("Stopping discover session %d", session->mId);
+        mMonitor->freeServiceRef(session->mId, true);
+        mListener->mSessions.remove(session);
+        delete session;
+    }
+    pthread_mutex_unlock(&mListener->mSessionMutex);
+    cli->sendMsg(ResponseCode::CommandOkay, "discover stopped", false);
 }
 
 void MDnsSdListener::Handler::stop(SocketClient *cli, int argc, char **argv, const char *str) {
@@ -136,6 +309,17 @@ void MDnsSdListener::Handler::stop(SocketClient *cli, int argc, char **argv, con
         return;
     }
     int requestId = atoi(argv[2]);
+    // A discover id only reserves its ref; freeing it here would leave the
+    // id in its session, and a later stop-discover would free whoever
+    // reused it.
+    pthread_mutex_lock(&mListener->mSessionMutex);
+    bool subscriber = (mListener->findSessionBySubscriber(requestId) != NULL);
+    pthread_mutex_unlock(&mListener->mSessionMutex);
+    if (subscriber) {
+        if (DBG) ALOGE("%s stop used discover requestId %d", str, requestId);
+        cli->sendMsg(ResponseCode::CommandParameterError, "Unknown requestId", false);
+        return;
+    }
     DNSServiceRef *ref = mMonitor->lookupServiceRef(requestId);
     if (ref == NULL) {
         if (DBG) ALOGE("%s stop used unknown requestId %d", str, requestId);
@@ -413,7 +597,7 @@ int MDnsSdListener::Handler::runCommand(SocketClient *cli,
 
         discover(cli, NULL, serviceType, NULL, requestId, 0);
     } else if (strcmp(cmd, "stop-discover") == 0) {
-        stop(cli, argc, argv, "discover");
+        stopDiscover(cli, argc, argv);
     } else if (strcmp(cmd, "register") == 0) {
         if (argc != 6) {
             cli->sendMsg(ResponseCode::CommandParameterError,
@@ -493,18 +677,54 @@ int MDnsSdListener::Handler::runCommand(SocketClient *cli,
 }
 
 MDnsSdListener::Monitor::Monitor() {
-    mHead = NULL;
-    pthread_mutex_init(&mHeadMutex, NULL);
+    mTableSize = ELEMENT_TABLE_INITIAL_SIZE;
+    mTable = (Element **)calloc(sizeof(Element *), mTableSize);
+    mTableCount = 0;
+    mFreeElements = NULL;
+    mRetired = NULL;
+    mLiveCount = 0;
+    pthread_mutex_init(&mElementMutex, NULL);
     socketpair(AF_LOCAL, SOCK_STREAM, 0, mCtrlSocketPair);
+    mEpollFd = epoll_create(MAX_EPOLL_EVENTS);
+    if (mEpollFd < 0) {
+        ALOGE("Unable to create epoll fd (%s)", strerror(errno));
+    } else {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL; // the control socket is the only entry without an Element
+        if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mCtrlSocketPair[0], &ev) < 0) {
+            ALOGE("Unable to watch control socket (%s)", strerror(errno));
+        }
+    }
+    if (mEpollFd < 0) {
+        // run() would only spin on epoll_wait errors; requests still get
+        // refs, but no results are delivered.
+        ALOGE("Not starting the mdnssd monitor thread");
+        return;
+    }
     pthread_create(&mThread, NULL, MDnsSdListener::Monitor::threadStart, this);
     pthread_detach(mThread);
 }
 
+MDnsSdListener::Monitor::~Monitor() {
+    // deleting the chunks deletes the contexts of the elements still in use
+    free(mTable);
+    std::list<Element *>::iterator it;
+    for (it = mElementChunks.begin(); it != mElementChunks.end(); it++) {
+        delete[] *it;
+    }
+    close(mEpollFd);
+    close(mCtrlSocketPair[0]);
+    close(mCtrlSocketPair[1]);
+    pthread_mutex_destroy(&mElementMutex);
+}
+
 void *MDnsSdListener::Monitor::threadStart(void *obj) {
     Monitor *monitor = reinterpret_cast<Monitor *>(obj);
 
+    // The handler keeps using the monitor, so it outlives this thread.
     monitor->run();
-    delete monitor;
     pthread_exit(NULL);
     return NULL;
 }
@@ -512,7 +732,7 @@ void *MDnsSdListener::Monitor::threadStart(void *obj) {
 int MDnsSdListener::Monitor::startService() {
     int result = 0;
     char property_value[PROPERTY_VALUE_MAX];
-    pthread_mutex_lock(&mHeadMutex);
+    pthread_mutex_lock(&mElementMutex);
     property_get(MDNS_SERVICE_STATUS, property_value, "");
     if (strcmp("running", property_value) != 0) {
         ALOGD("Starting MDNSD");
@@ -522,14 +742,14 @@ int MDnsSdListener::Monitor::startService() {
     } else {
         result = 0;
     }
-    pthread_mutex_unlock(&mHeadMutex);
+    pthread_mutex_unlock(&mElementMutex);
     return result;
 }
 
 int MDnsSdListener::Monitor::stopService() {
     int result = 0;
-    pthread_mutex_lock(&mHeadMutex);
-    if (mHead == NULL) {
+    pthread_mutex_lock(&mElementMutex);
+    if (mTableCount == 0) {
         ALOGD("Stopping MDNSD");
         property_set("ctl.stop", MDNS_SERVICE_NAME);
         wait_for_property(MDNS_SERVICE_STATUS, "stopped", 5);
@@ -537,152 +757,226 @@ int MDnsSdListener::Monitor::stopService() {
     } else {
         result = 0;
     }
-    pthread_mutex_unlock(&mHeadMutex);
+    pthread_mutex_unlock(&mElementMutex);
     return result;
 }
 
 void MDnsSdListener::Monitor::run() {
-    int pollCount = 1;
-    mPollSize = 10;
-
-    mPollFds = (struct pollfd *)calloc(sizeof(struct pollfd), mPollSize);
-    mPollRefs = (DNSServiceRef **)calloc(sizeof(DNSServiceRef *), mPollSize);
-
-    mPollFds[0].fd = mCtrlSocketPair[0];
-    mPollFds[0].events = POLLIN;
+    struct epoll_event events[MAX_EPOLL_EVENTS];
 
     if (VDBG) ALOGD("MDnsSdListener starting to monitor");
     while (1) {
-        if (VDBG) ALOGD("Going to poll with pollCount %d", pollCount);
-        int pollResults = poll(mPollFds, pollCount, 10000000);
-        if (pollResults < 0) {
-            ALOGE("Error in poll - got %d", errno);
-        } else if (pollResults > 0) {
-            if (VDBG) ALOGD("Monitor poll got data pollCount = %d, %d", pollCount, pollResults);
-            for(int i = 1; i < pollCount; i++) {
-                if (mPollFds[i].revents != 0) {
-                    if (VDBG) {
-                        ALOGD("Monitor found [%d].revents = %d - calling ProcessResults",
-                                i, mPollFds[i].revents);
-                    }
-                    DNSServiceProcessResult(*(mPollRefs[i]));
-                    mPollFds[i].revents = 0;
+        int count = epoll_wait(mEpollFd, events, MAX_EPOLL_EVENTS, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Any other error would repeat on every call.
+            ALOGE("Error in epoll_wait - got %d, monitor stopping", errno);
+            return;
+        }
+        if (VDBG) ALOGD("Monitor epoll got %d ready of %d live", count, mLiveCount);
+        bool reapNeeded = false;
+        for (int i = 0; i < count; i++) {
+            Element *e = reinterpret_cast<Element *>(events[i].data.ptr);
+            if (e == NULL) {
+                char readBuf[2];
+                read(mCtrlSocketPair[0], &readBuf, 1);
+                if (DBG) ALOGD("MDnsSdListener::Monitor got %c", readBuf[0]);
+                if (memcmp(REAP, readBuf, 1) == 0) {
+                    reapNeeded = true;
                 }
+                continue;
             }
-            if (VDBG) ALOGD("controlSocket shows revent= %d", mPollFds[0].revents);
-            switch (mPollFds[0].revents) {
-                case POLLIN: {
-                    char readBuf[2];
-                    read(mCtrlSocketPair[0], &readBuf, 1);
-                    if (DBG) ALOGD("MDnsSdListener::Monitor got %c", readBuf[0]);
-                    if (memcmp(RESCAN, readBuf, 1) == 0) {
-                        pollCount = rescan();
-                    }
+            // freeServiceRef may have retired e after epoll_wait returned; it
+            // stays allocated until reap() below, so the check is safe.
+            pthread_mutex_lock(&mElementMutex);
+            bool live = (e->mReady == 1);
+            pthread_mutex_unlock(&mElementMutex);
+            if (live) {
+                if (VDBG) {
+                    ALOGD("Monitor found events %x on %d - calling ProcessResults",
+                            events[i].events, e->mId);
                 }
+                DNSServiceProcessResult(e->mRef);
             }
-            mPollFds[0].revents = 0;
-        } else {
-            if (VDBG) ALOGD("MDnsSdListener::Monitor poll timed out");
+        }
+        if (reapNeeded) {
+            reap();
         }
     }
-    free(mPollFds);
-    free(mPollRefs);
 }
 
-#define DBG_RESCAN 0
+#define DBG_REAP 0
 
-int MDnsSdListener::Monitor::rescan() {
-// rescan the list from mHead and make new pollfds and serviceRefs
-    if (VDBG) {
-        ALOGD("MDnsSdListener::Monitor poll rescanning - size=%d, live=%d", mPollSize, mLiveCount);
-    }
-    int count = 0;
-    pthread_mutex_lock(&mHeadMutex);
-    Element **prevPtr = &mHead;
-    int i = 1;
-    if (mPollSize <= mLiveCount) {
-        mPollSize = mLiveCount + 5;
-        free(mPollFds);
-        free(mPollRefs);
-        mPollFds = (struct pollfd *)calloc(sizeof(struct pollfd), mPollSize);
-        mPollRefs = (DNSServiceRef **)calloc(sizeof(DNSServiceRef *), mPollSize);
-    } else {
-        memset(mPollFds, 0, sizeof(struct pollfd) * mPollSize);
-        memset(mPollRefs, 0, sizeof(DNSServiceRef *) * mPollSize);
-    }
-    mPollFds[0].fd = mCtrlSocketPair[0];
-    mPollFds[0].events = POLLIN;
-    if (DBG_RESCAN) ALOGD("mHead = %p", mHead);
-    while (*prevPtr != NULL) {
-        if (DBG_RESCAN) ALOGD("checking %p, mReady = %d", *prevPtr, (*prevPtr)->mReady);
-        if ((*prevPtr)->mReady == 1) {
-            int fd = DNSServiceRefSockFD((*prevPtr)->mRef);
-            if (fd != -1) {
-                if (DBG_RESCAN) ALOGD("  adding FD %d", fd);
-                mPollFds[i].fd = fd;
-                mPollFds[i].events = POLLIN;
-                mPollRefs[i] = &((*prevPtr)->mRef);
-                i++;
-            } else {
-                ALOGE("Error retreving socket FD for live ServiceRef");
-            }
-            prevPtr = &((*prevPtr)->mNext); // advance to the next element
-        } else if ((*prevPtr)->mReady == -1) {
-            if (DBG_RESCAN) ALOGD("  removing %p from  play", *prevPtr);
-            Element *cur = *prevPtr;
-            *prevPtr = (cur)->mNext; // change our notion of this element and don't advance
-            delete cur;
+void MDnsSdListener::Monitor::reap() {
+    pthread_mutex_lock(&mElementMutex);
+    Element *cur = mRetired;
+    mRetired = NULL;
+    while (cur != NULL) {
+        if (DBG_REAP) ALOGD("  removing %p from play", cur);
+        Element *next = cur->mNext;
+        if (cur->mDeallocate) {
+            DNSServiceRefDeallocate(cur->mRef);
+        }
+        recycleElement(cur);
+        cur = next;
+    }
+    pthread_mutex_unlock(&mElementMutex);
+}
+
+static inline unsigned int hashRequestId(int id) {
+    return (unsigned int)id * 2654435761U; // Knuth's multiplicative hash
+}
+
+int MDnsSdListener::Monitor::findSlot(int id) {
+    unsigned int mask = mTableSize - 1;
+    unsigned int i = hashRequestId(id) & mask;
+    while (mTable[i] != NULL) {
+        if (mTable[i]->mId == id) {
+            return i;
+        }
+        i = (i + 1) & mask;
+    }
+    return -1;
+}
+
+MDnsSdListener::Monitor::Element *MDnsSdListener::Monitor::findElement(int id) {
+    int slot = findSlot(id);
+    return (slot < 0 ? NULL : mTable[slot]);
+}
+
+void MDnsSdListener::Monitor::insertElement(Element *e) {
+    // keep the load factor under 3/4 so probe sequences stay short
+    if ((mTableCount + 1) * 4 > mTableSize * 3) {
+        growTable();
+    }
+    unsigned int mask = mTableSize - 1;
+    unsigned int i = hashRequestId(e->mId) & mask;
+    while (mTable[i] != NULL) {
+        i = (i + 1) & mask;
+    }
+    mTable[i] = e;
+    mTableCount++;
+}
+
+MDnsSdListener::Monitor::Element *MDnsSdListener::Monitor::removeElement(int id) {
+    int slot = findSlot(id);
+    if (slot < 0) {
+        return NULL;
+    }
+    Element *result = mTable[slot];
+    unsigned int mask = mTableSize - 1;
+    unsigned int hole = slot;
+    unsigned int i = slot;
+    mTable[hole] = NULL;
+    // shift later members of the probe run back so lookups need no tombstones
+    while (true) {
+        i = (i + 1) & mask;
+        if (mTable[i] == NULL) {
+            break;
+        }
+        unsigned int home = hashRequestId(mTable[i]->mId) & mask;
+        bool movable = (hole <= i) ? (home <= hole || home > i) : (home <= hole && home > i);
+        if (movable) {
+            mTable[hole] = mTable[i];
+            mTable[i] = NULL;
+            hole = i;
+        }
+    }
+    mTableCount--;
+    return result;
+}
+
+void MDnsSdListener::Monitor::growTable() {
+    Element **oldTable = mTable;
+    int oldSize = mTableSize;
+    mTableSize *= 2;
+    mTable = (Element **)calloc(sizeof(Element *), mTableSize);
+    mTableCount = 0;
+    for (int i = 0; i < oldSize; i++) {
+        if (oldTable[i] != NULL) {
+            insertElement(oldTable[i]);
         }
     }
-    pthread_mutex_unlock(&mHeadMutex);
-    return i;
+    free(oldTable);
+    if (VDBG) ALOGD("MDnsSdListener::Monitor table grown to %d", mTableSize);
+}
+
+MDnsSdListener::Monitor::Element *MDnsSdListener::Monitor::obtainElement(int id,
+        Context *context) {
+    if (mFreeElements == NULL) {
+        Element *chunk = new Element[ELEMENT_POOL_CHUNK];
+        mElementChunks.push_back(chunk);
+        for (int i = 0; i < ELEMENT_POOL_CHUNK; i++) {
+            chunk[i].mNext = mFreeElements;
+            mFreeElements = &chunk[i];
+        }
+    }
+    Element *e = mFreeElements;
+    mFreeElements = e->mNext;
+    e->mId = id;
+    e->mNext = NULL;
+    e->mContext = context;
+    e->mReady = 0;
+    e->mFd = -1;
+    e->mDeallocate = false;
+    return e;
+}
+
+void MDnsSdListener::Monitor::recycleElement(Element *e) {
+    delete e->mContext;
+    e->mContext = NULL;
+    e->mNext = mFreeElements;
+    mFreeElements = e;
 }
 
 DNSServiceRef *MDnsSdListener::Monitor::allocateServiceRef(int id, Context *context) {
-    if (lookupServiceRef(id) != NULL) {
+    pthread_mutex_lock(&mElementMutex);
+    if (findElement(id) != NULL) {
+        pthread_mutex_unlock(&mElementMutex);
         delete(context);
         return NULL;
     }
-    Element *e = new Element(id, context);
-    pthread_mutex_lock(&mHeadMutex);
-    e->mNext = mHead;
-    mHead = e;
-    pthread_mutex_unlock(&mHeadMutex);
+    Element *e = obtainElement(id, context);
+    insertElement(e);
+    pthread_mutex_unlock(&mElementMutex);
     return &(e->mRef);
 }
 
 DNSServiceRef *MDnsSdListener::Monitor::lookupServiceRef(int id) {
-    pthread_mutex_lock(&mHeadMutex);
-    Element *cur = mHead;
-    while (cur != NULL) {
-        if (cur->mId == id) {
-            DNSServiceRef *result = &(cur->mRef);
-            pthread_mutex_unlock(&mHeadMutex);
-            return result;
-        }
-        cur = cur->mNext;
+    DNSServiceRef *result = NULL;
+    pthread_mutex_lock(&mElementMutex);
+    Element *e = findElement(id);
+    if (e != NULL) {
+        result = &(e->mRef);
     }
-    pthread_mutex_unlock(&mHeadMutex);
-    return NULL;
+    pthread_mutex_unlock(&mElementMutex);
+    return result;
 }
 
 void MDnsSdListener::Monitor::startMonitoring(int id) {
     if (VDBG) ALOGD("startMonitoring %d", id);
-    pthread_mutex_lock(&mHeadMutex);
-    Element *cur = mHead;
-    while (cur != NULL) {
-        if (cur->mId == id) {
-            if (DBG_RESCAN) ALOGD("marking %p as ready to be added", cur);
-            mLiveCount++;
+    pthread_mutex_lock(&mElementMutex);
+    Element *cur = findElement(id);
+    if (cur != NULL) {
+        int fd = DNSServiceRefSockFD(cur->mRef);
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = cur;
+        if (fd == -1) {
+            ALOGE("Error retreving socket FD for live ServiceRef");
+        } else if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            ALOGE("Unable to watch fd %d for %d (%s)", fd, id, strerror(errno));
+        } else {
+            if (DBG_REAP) ALOGD("added %p with fd %d", cur, fd);
+            cur->mFd = fd;
             cur->mReady = 1;
-            pthread_mutex_unlock(&mHeadMutex);
-            write(mCtrlSocketPair[1], RESCAN, 1);  // trigger a rescan for a fresh poll
-            if (VDBG) ALOGD("triggering rescan");
-            return;
+            mLiveCount++;
         }
-        cur = cur->mNext;
     }
-    pthread_mutex_unlock(&mHeadMutex);
+    pthread_mutex_unlock(&mElementMutex);
 }
 
 #define NAP_TIME 200  // 200 ms between polls
@@ -706,28 +1000,30 @@ static int wait_for_property(const char *name, const char *desired_value, int ma
     return -1; /* failure */
 }
 
-void MDnsSdListener::Monitor::freeServiceRef(int id) {
+void MDnsSdListener::Monitor::freeServiceRef(int id, bool deallocate) {
     if (VDBG) ALOGD("freeServiceRef %d", id);
-    pthread_mutex_lock(&mHeadMutex);
-    Element **prevPtr = &mHead;
-    Element *cur;
-    while (*prevPtr != NULL) {
-        cur = *prevPtr;
-        if (cur->mId == id) {
-            if (DBG_RESCAN) ALOGD("marking %p as ready to be removed", cur);
+    pthread_mutex_lock(&mElementMutex);
+    Element *cur = removeElement(id);
+    if (cur != NULL) {
+        if (cur->mReady == 1) {
+            // the monitor thread deallocates in reap(), once it is sure not
+            // to be processing results on the ref
+            cur->mDeallocate = deallocate;
+            // DNSServiceRefDeallocate may already have closed the fd, which
+            // drops it from the epoll set by itself, so errors are expected.
+            epoll_ctl(mEpollFd, EPOLL_CTL_DEL, cur->mFd, NULL);
             mLiveCount--;
-            if (cur->mReady == 1) {
-                cur->mReady = -1; // tell poll thread to delete
-                write(mCtrlSocketPair[1], RESCAN, 1); // trigger a rescan for a fresh poll
-                if (VDBG) ALOGD("triggering rescan");
-            } else {
-                *prevPtr = cur->mNext;
-                delete cur;
+            if (DBG_REAP) ALOGD("marking %p as ready to be removed", cur);
+            cur->mReady = -1; // tell the monitor thread to recycle
+            cur->mNext = mRetired;
+            mRetired = cur;
+            write(mCtrlSocketPair[1], REAP, 1);
+        } else {
+            if (deallocate) {
+                DNSServiceRefDeallocate(cur->mRef);
             }
-            pthread_mutex_unlock(&mHeadMutex);
-            return;
+            recycleElement(cur);
         }
-        prevPtr = &(cur->mNext);
     }
-    pthread_mutex_unlock(&mHeadMutex);
+    pthread_mutex_unlock(&mElementMutex);
 }
@@ -21,6 +21,9 @@
 #include <sysutils/FrameworkListener.h>
 #include <dns_sd.h>
 
+#include <list>
+#include <string>
+
 #include "NetdCommand.h"
 
 // callbacks
@@ -44,13 +47,17 @@ void MDnsSdListenerGetAddrInfoCallback(DNSServiceRef sdRef, DNSServiceFlags flag
         uint32_t interface, DNSServiceErrorType errorCode, const char *hostname,
         const struct sockaddr *const sa, uint32_t ttl, void *inContext);
 
-#define RESCAN "1"
+#define REAP "1"
 
 class MDnsSdListener : public FrameworkListener {
 public:
     MDnsSdListener();
     virtual ~MDnsSdListener() {}
 
+    void onBrowseResult(int sessionId, DNSServiceFlags flags, uint32_t interfaceIndex,
+            DNSServiceErrorType errorCode, const char *serviceName, const char *regType,
+            const char *replyDomain);
+
     class Context {
     public:
         MDnsSdListener *mListener;
@@ -68,36 +75,75 @@ public:
     class Monitor {
     public:
         Monitor();
-        virtual ~Monitor() {}
+        virtual ~Monitor();
         DNSServiceRef *allocateServiceRef(int id, Context *c);
         void startMonitoring(int id);
         DNSServiceRef *lookupServiceRef(int id);
-        void freeServiceRef(int id);
+        // With deallocate, the ref is also deallocated, on the monitor thread
+        // if it is being monitored.
+        void freeServiceRef(int id, bool deallocate = false);
         static void *threadStart(void *handler);
         int startService();
         int stopService();
     private:
         void run();
-        int rescan(); // returns the number of elements in the poll
+        void reap(); // recycles the elements retired by freeServiceRef
         class Element {
         public:
             int mId;
-            Element *mNext;
+            Element *mNext; // retired or free list link
             DNSServiceRef mRef;
             Context *mContext;
             int mReady;
-            Element(int id, Context *context)
-                    : mId(id), mNext(NULL), mContext(context), mReady(0) {}
+            int mFd; // registered with mEpollFd while mReady == 1
+            bool mDeallocate; // reap() deallocates mRef
+            Element() : mId(0), mNext(NULL), mContext(NULL), mReady(0), mFd(-1),
+                    mDeallocate(false) {}
             virtual ~Element() { delete(mContext); }
         };
-        Element *mHead;
+
+        // Open addressed (linear probing) table of live elements keyed by
+        // request id.  All of these require mElementMutex to be held.
+        int findSlot(int id);
+        Element *findElement(int id);
+        void insertElement(Element *e);
+        Element *removeElement(int id);
+        void growTable();
+        Element *obtainElement(int id, Context *context);
+        void recycleElement(Element *e);
+
+        Element **mTable;
+        int mTableSize;  // always a power of two
+        int mTableCount;
+        Element *mFreeElements;
+        std::list<Element *> mElementChunks;
+        Element *mRetired; // waiting for the monitor thread to recycle them
         int mLiveCount;
-        struct pollfd *mPollFds;
-        DNSServiceRef **mPollRefs;
-        int mPollSize;
+        int mEpollFd;
         pthread_t mThread;
         int mCtrlSocketPair[2];
-        pthread_mutex_t mHeadMutex;
+        pthread_mutex_t mElementMutex;
+    };
+
+    // One DNSServiceBrowse shared by every discover request for the same
+    // (interface, flags, regType, domain).  Sessions use negative request ids
+    // in the Monitor so they never collide with client ids.
+    class BrowseSession {
+    public:
+        class CachedService {
+        public:
+            uint32_t mInterface;
+            std::string mName;
+            std::string mRegType;
+            std::string mDomain;
+        };
+        int mId;
+        int mInterface;
+        DNSServiceFlags mFlags;
+        std::string mRegType;
+        std::string mDomain;
+        std::list<int> mSubscribers;
+        std::list<CachedService> mCache; // bounded by MAX_CACHED_SERVICES
     };
 
     class Handler : public NetdCommand {
@@ -109,6 +155,7 @@ public:
         MDnsSdListener *mListener; // needed for broadcast purposes
     private:
         void stop(SocketClient *cli, int argc, char **argv, const char *str);
+        void stopDiscover(SocketClient *cli, int argc, char **argv);
 
         void discover(SocketClient *cli, const char *iface, const char *regType,
                 const char *domain, const int requestNumber,
@@ -133,6 +180,17 @@ public:
         int flagsToI(DNSServiceFlags flags);
         Monitor *mMonitor;
     };
+
+private:
+    BrowseSession *findSession(int interfaceIndex, DNSServiceFlags flags, const char *regType,
+            const char *domain);
+    BrowseSession *findSessionById(int sessionId);
+    BrowseSession *findSessionBySubscriber(int requestId);
+    void sendCachedServices(BrowseSession *session, int requestId);
+
+    std::list<BrowseSession *> mSessions;
+    int mNextSessionId;
+    pthread_mutex_t mSessionMutex; // also held while broadcasting browse results
 };
 
 static int wait_for_property(const char *name, const char *desired_value, int maxwait);
@@ -22,6 +22,7 @@
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <fcntl.h>
+#include <unistd.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <string.h>
@@ -33,14 +34,18 @@
 
 #include "NatController.h"
 #include "SecondaryTableController.h"
+#include "CommandExecutor.h"
 #include "NetdConstants.h"
+#include "TetherConntrackStats.h"
 
 const char* NatController::LOCAL_FORWARD = "natctrl_FORWARD";
 const char* NatController::LOCAL_NAT_POSTROUTING = "natctrl_nat_POSTROUTING";
 const char* NatController::LOCAL_TETHER_COUNTERS_CHAIN = "natctrl_tether_counters";
+const char* NatController::LOCAL_OFFLOAD_TABLE = "natctrl_offload";
 
 NatController::NatController(SecondaryTableController *ctrl) {
     secondaryTableCtrl = ctrl;
+    flowOffload = false;
 }
 
 NatController::~NatController() {
@@ -55,7 +60,7 @@ struct CommandsAndArgs {
 int NatController::runCmd(int argc, const char **argv) {
     int res;
 
-    res = android_fork_execvp(argc, (char **)argv, NULL, false, false);
+    res = CommandExecutor::get()->execvp(argc, argv, NULL, false);
 
 #if !LOG_NDEBUG
     std::string full_cmd = argv[0];
@@ -98,9 +103,51 @@ int NatController::setupIptablesHooks() {
         }
     }
 
+    setupTetherBackends();
+
+    return 0;
+}
+
+int NatController::compileIptablesHooks(IptablesRuleset *rs) {
+    rs->declareChain(V4, "filter", LOCAL_FORWARD);
+    rs->addRule(V4, "filter", std::string("-A ") + LOCAL_FORWARD + " -j DROP");
+    rs->declareChain(V4, "nat", LOCAL_NAT_POSTROUTING);
+    rs->declareChain(V4, "filter", LOCAL_TETHER_COUNTERS_CHAIN);
+    writeFile("/proc/sys/net/ipv4/route/flush", "1", 1);
+    natCount = 0;
+
+    setupTetherBackends();
+
     return 0;
 }
 
+/* The conntrack counters and flow offload; neither needs the chains in place. */
+void NatController::setupTetherBackends() {
+    char value[PROPERTY_VALUE_MAX];
+
+    property_get("persist.netd.tether_ct_stats", value, "0");
+    if (!strcmp(value, "1") && !TetherConntrackStats::Instance()->isRunning()) {
+        TetherConntrackStats::Instance()->start();
+    }
+
+    flowOffload = false;
+    offloadPairs.clear();
+    property_get("persist.netd.tether_offload", value, "0");
+    if (!strcmp(value, "1")) {
+        if (!TetherConntrackStats::Instance()->isRunning()) {
+            ALOGW("Tether offload needs persist.netd.tether_ct_stats=1, not enabling it");
+        } else if (access(NFT_PATH, X_OK)) {
+            ALOGW("Tether offload needs %s, not enabling it", NFT_PATH);
+        } else {
+            flowOffload = true;
+        }
+    }
+    /* Whatever an earlier netd left behind would keep offloading. */
+    if (!access(NFT_PATH, X_OK)) {
+        applyFlowOffload();
+    }
+}
+
 int NatController::setDefaults() {
     /*
      * The following only works because:
@@ -122,6 +169,10 @@ int NatController::setDefaults() {
     }
 
     natCount = 0;
+    if (!offloadPairs.empty()) {
+        offloadPairs.clear();
+        applyFlowOffload();
+    }
 
     return 0;
 }
@@ -145,13 +196,8 @@ int NatController::routesOp(bool add, const char *intIface, const char *extIface
                 ret |= secondaryTableCtrl->modifyFromRule(tableNumber, DEL, argv[5+i]);
             }
         }
-        const char *cmd[] = {
-                IP_PATH,
-                "route",
-                "flush",
-                "cache"
-        };
-        runCmd(ARRAY_SIZE(cmd), cmd);
+        /* Same as "ip route flush cache"; gone, and not needed, on newer kernels. */
+        writeFile("/proc/sys/net/ipv4/route/flush", "1", 1);
     }
     return ret;
 }
@@ -159,11 +205,11 @@ int NatController::routesOp(bool add, const char *intIface, const char *extIface
 //  0    1       2       3       4            5
 // nat enable intface extface addrcnt nated-ipaddr/prelength
 int NatController::enableNat(const int argc, char **argv) {
-    int i;
     int addrCount = atoi(argv[4]);
     const char *intIface = argv[2];
     const char *extIface = argv[3];
-    int tableNumber;
+    std::string rules;
+    char *buf;
 
     ALOGV("enableNat(intIface=<%s>, extIface=<%s>)",intIface, extIface);
 
@@ -192,31 +238,29 @@ int NatController::enableNat(const int argc, char **argv) {
         return -1;
     }
 
+    /*
+     * The forward rules, with the drop rule moved back to the end, go first
+     * and the postroute rule for the first nat last. iptables-restore commits
+     * each table on its own and stops at the first failure, so on failure
+     * the filter table is untouched unless this was the first nat, which
+     * setDefaults() undoes anyway.
+     */
+    rules = "*filter\n";
+    makeForwardRules(true, intIface, extIface, &rules);
+    asprintf(&buf, "-D %s -j DROP\n-A %s -j DROP\nCOMMIT\n", LOCAL_FORWARD, LOCAL_FORWARD);
+    rules += buf;
+    free(buf);
     // add this if we are the first added nat
     if (natCount == 0) {
-        const char *cmd[] = {
-                IPTABLES_PATH,
-                "-t",
-                "nat",
-                "-A",
-                LOCAL_NAT_POSTROUTING,
-                "-o",
-                extIface,
-                "-j",
-                "MASQUERADE"
-        };
-        if (runCmd(ARRAY_SIZE(cmd), cmd)) {
-            ALOGE("Error seting postroute rule: iface=%s", extIface);
-            // unwind what's been done, but don't care about success - what more could we do?
-            routesOp(false, intIface, extIface, argv, addrCount);
-            setDefaults();
-            return -1;
-        }
+        asprintf(&buf, "*nat\n-A %s -o %s -j MASQUERADE\nCOMMIT\n",
+                 LOCAL_NAT_POSTROUTING, extIface);
+        rules += buf;
+        free(buf);
     }
 
-
-    if (setForwardRules(true, intIface, extIface) != 0) {
-        ALOGE("Error setting forward rules");
+    if (execIptablesRestore(V4, rules)) {
+        ALOGE("Error setting forward rules: %s %s", intIface, extIface);
+        // unwind what's been done, but don't care about success - what more could we do?
         routesOp(false, intIface, extIface, argv, addrCount);
         if (natCount == 0) {
             setDefaults();
@@ -225,197 +269,195 @@ int NatController::enableNat(const int argc, char **argv) {
         return -1;
     }
 
-    /* Always make sure the drop rule is at the end */
-    const char *cmd1[] = {
-            IPTABLES_PATH,
-            "-D",
-            LOCAL_FORWARD,
-            "-j",
-            "DROP"
-    };
-    runCmd(ARRAY_SIZE(cmd1), cmd1);
-    const char *cmd2[] = {
-            IPTABLES_PATH,
-            "-A",
-            LOCAL_FORWARD,
-            "-j",
-            "DROP"
-    };
-    runCmd(ARRAY_SIZE(cmd2), cmd2);
+    setForwardExtras(true, intIface, extIface);
 
     natCount++;
     return 0;
 }
 
-int NatController::setTetherCountingRules(bool add, const char *intIface, const char *extIface) {
-
-    /* We only ever add tethering quota rules so that they stick. */
-    if (!add) {
-        return 0;
-    }
-    char *quota_name, *proc_path;
-    int quota_fd;
-    asprintf(&quota_name, "%s_%s", intIface, extIface);
-
-    asprintf(&proc_path, "/proc/net/xt_quota/%s", quota_name);
-    quota_fd = open(proc_path, O_RDONLY);
-    if (quota_fd >= 0) {
-        /* quota for iface pair already exists */
+/*
+ * Appends the natctrl_tether_counters rules for a pair to rules. We only
+ * ever add tethering quota rules so that they stick, and only for pairs
+ * that have no quota yet.
+ */
+void NatController::makeTetherCountingRules(const char *intIface, const char *extIface,
+                                             std::string *rules) {
+    const char *ifaces[2][2] = { { intIface, extIface }, { extIface, intIface } };
+    char *quota_name, *proc_path, *buf;
+
+    for (unsigned int i = 0; i < ARRAY_SIZE(ifaces); i++) {
+        asprintf(&quota_name, "%s_%s", ifaces[i][0], ifaces[i][1]);
+        asprintf(&proc_path, "/proc/net/xt_quota/%s", quota_name);
+        if (access(proc_path, F_OK) == 0) {
+            /* quota for iface pair already exists */
+            free(proc_path);
+            free(quota_name);
+            return;
+        }
         free(proc_path);
-        free(quota_name);
-        return 0;
-    }
-    close(quota_fd);
-    free(proc_path);
-
-    const char *cmd2b[] = {
-            IPTABLES_PATH,
-            "-A",
-            LOCAL_TETHER_COUNTERS_CHAIN,
-            "-i",
-            intIface,
-            "-o",
-            extIface,
-            "-m",
-            "quota2",
-            "--name",
-            quota_name,
-            "--grow",
-            "-j",
-          "RETURN"
-    };
 
-    if (runCmd(ARRAY_SIZE(cmd2b), cmd2b) && add) {
+        asprintf(&buf, "-A %s -i %s -o %s -m quota2 --name %s --grow -j RETURN\n",
+                 LOCAL_TETHER_COUNTERS_CHAIN, ifaces[i][0], ifaces[i][1], quota_name);
+        *rules += buf;
+        free(buf);
         free(quota_name);
-        return -1;
     }
-    free(quota_name);
+}
 
-    asprintf(&quota_name, "%s_%s", extIface, intIface);
-    asprintf(&proc_path, "/proc/net/xt_quota/%s", quota_name);
-    quota_fd = open(proc_path, O_RDONLY);
-    if (quota_fd >= 0) {
-        /* quota for iface pair already exists */
-        free(proc_path);
-        free(quota_name);
-        return 0;
+/* Appends the natctrl_FORWARD rules of a pair, or their removal, to rules. */
+void NatController::makeForwardRules(bool add, const char *intIface, const char *extIface,
+                                     std::string *rules) {
+    const char *op = add ? "-A" : "-D";
+    char *buf;
+
+    asprintf(&buf,
+             "%s %s -i %s -o %s -m state --state ESTABLISHED,RELATED -g %s\n"
+             "%s %s -i %s -o %s -m state --state INVALID -j DROP\n"
+             "%s %s -i %s -o %s -g %s\n",
+             op, LOCAL_FORWARD, extIface, intIface, LOCAL_TETHER_COUNTERS_CHAIN,
+             op, LOCAL_FORWARD, intIface, extIface,
+             op, LOCAL_FORWARD, intIface, extIface, LOCAL_TETHER_COUNTERS_CHAIN);
+    *rules += buf;
+    free(buf);
+
+    if (add) {
+        makeTetherCountingRules(intIface, extIface, rules);
     }
-    close(quota_fd);
-    free(proc_path);
-
-    const char *cmd3b[] = {
-            IPTABLES_PATH,
-            "-A",
-            LOCAL_TETHER_COUNTERS_CHAIN,
-            "-i",
-            extIface,
-            "-o",
-            intIface,
-            "-m",
-            "quota2",
-            "--name",
-            quota_name,
-            "--grow",
-            "-j",
-            "RETURN"
-    };
+}
 
-    if (runCmd(ARRAY_SIZE(cmd3b), cmd3b) && add) {
-        // unwind what's been done, but don't care about success - what more could we do?
-        free(quota_name);
-        return -1;
-    }
-    free(quota_name);
-    return 0;
+/*
+ * Removes each forward rule of a pair on its own, for when some of them may
+ * be missing and a single commit of all the deletions would fail.
+ */
+void NatController::removeForwardRules(const char *intIface, const char *extIface) {
+    execIptablesSilently(V4, "-D", LOCAL_FORWARD, "-i", extIface, "-o", intIface,
+            "-m", "state", "--state", "ESTABLISHED,RELATED", "-g", LOCAL_TETHER_COUNTERS_CHAIN,
+            NULL);
+    execIptablesSilently(V4, "-D", LOCAL_FORWARD, "-i", intIface, "-o", extIface,
+            "-m", "state", "--state", "INVALID", "-j", "DROP", NULL);
+    execIptablesSilently(V4, "-D", LOCAL_FORWARD, "-i", intIface, "-o", extIface,
+            "-g", LOCAL_TETHER_COUNTERS_CHAIN, NULL);
 }
 
-int NatController::setForwardRules(bool add, const char *intIface, const char *extIface) {
-    const char *cmd1[] = {
-            IPTABLES_PATH,
-            add ? "-A" : "-D",
-            LOCAL_FORWARD,
-            "-i",
-            extIface,
-            "-o",
-            intIface,
-            "-m",
-            "state",
-            "--state",
-            "ESTABLISHED,RELATED",
-            "-g",
-            LOCAL_TETHER_COUNTERS_CHAIN
-    };
-    int rc = 0;
+/* The parts of a pair's forwarding that live outside natctrl_FORWARD; none is fatal. */
+void NatController::setForwardExtras(bool add, const char *intIface, const char *extIface) {
+    bool counted = false;
 
-    if (runCmd(ARRAY_SIZE(cmd1), cmd1) && add) {
-        return -1;
+    /* Not fatal: the quota2 tether counters still work. */
+    if (TetherConntrackStats::Instance()->isRunning()) {
+        if (TetherConntrackStats::Instance()->setPairMarking(add, intIface, extIface)) {
+            ALOGE("Unable to set up conntrack tether counting for %s %s", intIface, extIface);
+        } else {
+            counted = true;
+        }
     }
+    /*
+     * Offloaded flows skip the quota2 counters, so only offload a pair whose
+     * traffic conntrack counts instead. Removal never depends on that.
+     */
+    if (flowOffload && (counted || !add) && setFlowOffload(add, intIface, extIface)) {
+        /* Not fatal either: the pair's flows just keep going through the chains. */
+        ALOGE("Unable to set up flow offload for %s %s", intIface, extIface);
+    }
+}
 
-    const char *cmd2[] = {
-            IPTABLES_PATH,
-            add ? "-A" : "-D",
-            LOCAL_FORWARD,
-            "-i",
-            intIface,
-            "-o",
-            extIface,
-            "-m",
-            "state",
-            "--state",
-            "INVALID",
-            "-j",
-            "DROP"
-    };
-
-    const char *cmd3[] = {
-            IPTABLES_PATH,
-            add ? "-A" : "-D",
-            LOCAL_FORWARD,
-            "-i",
-            intIface,
-            "-o",
-            extIface,
-            "-g",
-            LOCAL_TETHER_COUNTERS_CHAIN
-    };
+int NatController::setFlowOffload(bool add, const char *intIface, const char *extIface) {
+    std::pair<std::string, std::string> pair(intIface, extIface);
+    std::list<std::pair<std::string, std::string> >::iterator it;
 
-    if (runCmd(ARRAY_SIZE(cmd2), cmd2) && add) {
-        // bail on error, but only if adding
-        rc = -1;
-        goto err_invalid_drop;
+    for (it = offloadPairs.begin(); it != offloadPairs.end(); it++) {
+        if (*it == pair) {
+            break;
+        }
     }
-
-    if (runCmd(ARRAY_SIZE(cmd3), cmd3) && add) {
-        // unwind what's been done, but don't care about success - what more could we do?
-        rc = -1;
-        goto err_return;
+    if (add == (it != offloadPairs.end())) {
+        return 0;
     }
-
-    if (setTetherCountingRules(add, intIface, extIface) && add) {
-        rc = -1;
-        goto err_return;
+    if (add) {
+        offloadPairs.push_back(pair);
+    } else {
+        offloadPairs.erase(it);
+    }
+    if (applyFlowOffload()) {
+        if (add) {
+            offloadPairs.pop_back();
+        }
+        return -1;
     }
-
     return 0;
+}
 
-err_return:
-    cmd2[1] = "-D";
-    runCmd(ARRAY_SIZE(cmd2), cmd2);
-err_invalid_drop:
-    cmd1[1] = "-D";
-    runCmd(ARRAY_SIZE(cmd1), cmd1);
-    return rc;
+/*
+ * Replaces the whole offload table with one for the current pairs, in a
+ * single nft transaction. A flow is only handed to the flowtable once
+ * established, so its first packets still go through natctrl_FORWARD and get
+ * their conntrack mark, and NAT is set up by then. The flowtable counter
+ * keeps conntrack accounting, hence the tether stats, up to date.
+ */
+int NatController::applyFlowOffload() {
+    std::list<std::pair<std::string, std::string> >::iterator it;
+    std::list<std::string> devices;
+    std::list<std::string>::iterator dev;
+    std::string script;
+    char *buf;
+
+    /* Declaring it first makes the delete succeed if it wasn't there. */
+    asprintf(&buf, "table inet %s\ndelete table inet %s\n",
+             LOCAL_OFFLOAD_TABLE, LOCAL_OFFLOAD_TABLE);
+    script = buf;
+    free(buf);
+
+    if (!offloadPairs.empty()) {
+        for (it = offloadPairs.begin(); it != offloadPairs.end(); it++) {
+            devices.push_back(it->first);
+            devices.push_back(it->second);
+        }
+        devices.sort();
+        devices.unique();
+
+        asprintf(&buf, "table inet %s {\n"
+                 "  flowtable ft {\n"
+                 "    hook ingress priority 0\n"
+                 "    devices = { ", LOCAL_OFFLOAD_TABLE);
+        script += buf;
+        free(buf);
+        for (dev = devices.begin(); dev != devices.end(); dev++) {
+            if (dev != devices.begin()) {
+                script += ", ";
+            }
+            script += *dev;
+        }
+        /* Ahead of the iptables filter table, which sits at priority 0. */
+        script += " }\n"
+                  "    counter\n"
+                  "  }\n"
+                  "  chain forward {\n"
+                  "    type filter hook forward priority -1; policy accept;\n";
+        for (it = offloadPairs.begin(); it != offloadPairs.end(); it++) {
+            asprintf(&buf, "    iifname \"%s\" oifname \"%s\" meta l4proto { tcp, udp } "
+                     "ct state established flow add @ft\n"
+                     "    iifname \"%s\" oifname \"%s\" meta l4proto { tcp, udp } "
+                     "ct state established flow add @ft\n",
+                     it->first.c_str(), it->second.c_str(),
+                     it->second.c_str(), it->first.c_str());
+            script += buf;
+            free(buf);
+        }
+        script += "  }\n"
+                  "}\n";
+    }
+
+    return execNftScript(script);
 }
 
 // nat disable intface extface
 //  0    1       2       3       4            5
 // nat enable intface extface addrcnt nated-ipaddr/prelength
 int NatController::disableNat(const int argc, char **argv) {
-    int i;
     int addrCount = atoi(argv[4]);
     const char *intIface = argv[2];
     const char *extIface = argv[3];
-    int tableNumber;
+    std::string rules;
 
     if (!checkInterface(intIface) || !checkInterface(extIface)) {
         ALOGE("Invalid interface specified");
@@ -429,7 +471,13 @@ int NatController::disableNat(const int argc, char **argv) {
         return -1;
     }
 
-    setForwardRules(false, intIface, extIface);
+    rules = "*filter\n";
+    makeForwardRules(false, intIface, extIface, &rules);
+    rules += "COMMIT\n";
+    if (execIptablesRestore(V4, rules)) {
+        removeForwardRules(intIface, extIface);
+    }
+    setForwardExtras(false, intIface, extIface);
     routesOp(false, intIface, extIface, argv, addrCount);
     if (--natCount <= 0) {
         // handle decrement to 0 case (do reset to defaults) and erroneous dec below 0
@@ -19,6 +19,11 @@
 
 #include <linux/in.h>
 
+#include <list>
+#include <string>
+#include <utility>
+
+#include "IptablesRuleset.h"
 #include "SecondaryTableController.h"
 
 class NatController {
@@ -30,20 +35,38 @@ public:
     int enableNat(const int argc, char **argv);
     int disableNat(const int argc, char **argv);
     int setupIptablesHooks();
+    /* Adds the rules setupIptablesHooks() would run to rs instead. */
+    int compileIptablesHooks(IptablesRuleset *rs);
 
     static const char* LOCAL_FORWARD;
     static const char* LOCAL_NAT_POSTROUTING;
     static const char* LOCAL_TETHER_COUNTERS_CHAIN;
+    static const char* LOCAL_OFFLOAD_TABLE;
 
 private:
     int natCount;
+    /*
+     * With persist.netd.tether_offload=1, established TCP/UDP flows of each
+     * tethered pair are moved to an nft flowtable and skip the FORWARD chains,
+     * bw_FORWARD included. Only used along with the conntrack tether counters,
+     * which keep counting them; the quota2 ones would not.
+     */
+    bool flowOffload;
+    std::list<std::pair<std::string, std::string> > offloadPairs;
     SecondaryTableController *secondaryTableCtrl;
 
     int setDefaults();
+    void setupTetherBackends();
     int runCmd(int argc, const char **argv);
     bool checkInterface(const char *iface);
-    int setForwardRules(bool set, const char *intIface, const char *extIface);
-    int setTetherCountingRules(bool add, const char *intIface, const char *extIface);
+    void makeForwardRules(bool add, const char *intIface, const char *extIface,
+                          std::string *rules);
+    void makeTetherCountingRules(const char *intIface, const char *extIface,
+                                 std::string *rules);
+    void removeForwardRules(const char *intIface, const char *extIface);
+    void setForwardExtras(bool add, const char *intIface, const char *extIface);
+    int setFlowOffload(bool add, const char *intIface, const char *extIface);
+    int applyFlowOffload();
     int routesOp(bool add, const char *intIface, const char *extIface, char **argv, int addrCount);
 };
 
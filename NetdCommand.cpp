@@ -14,8 +14,157 @@
  * limitations under the License.
  */
 
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+
+#include <sysutils/SocketClient.h>
+
+#include "CommandTrace.h"
+#include "LatencyMetrics.h"
 #include "NetdCommand.h"
+#include "ResponseCode.h"
 
 NetdCommand::NetdCommand(const char *cmd) :
               FrameworkCommand(cmd)  {
 }
+
+TimedCommand::TimedCommand(NetdCommand *cmd, TimedCommand *lockWith) :
+              NetdCommand(cmd->getCommand()), mCmd(cmd) {
+    mSeries = LatencyMetrics::Instance()->getSeries(
+            (std::string("cmd.") + cmd->getCommand()).c_str());
+    pthread_mutex_init(&mOwnLock, NULL);
+    mLock = lockWith ? lockWith->mLock : &mOwnLock;
+}
+
+TimedCommand::~TimedCommand() {
+    pthread_mutex_destroy(&mOwnLock);
+    delete mCmd;
+}
+
+int TimedCommand::runCommand(SocketClient *c, int argc, char **argv) {
+    int64_t start = LatencyMetrics::nowUs();
+    uint32_t id = CommandTrace::Instance()->commandStart(argc, argv);
+    int res;
+
+    pthread_mutex_lock(mLock);
+    res = mCmd->runCommand(c, argc, argv);
+    pthread_mutex_unlock(mLock);
+
+    CommandTrace::Instance()->commandEnd(id, argc, argv, start, res);
+    LatencyMetrics::Instance()->record(mSeries, LatencyMetrics::nowUs() - start);
+    return res;
+}
+
+class SubcommandTable::KeyLess {
+public:
+    bool operator()(const std::pair<const char *, const Entry *> &a,
+                    const std::pair<const char *, const Entry *> &b) const {
+        return strcmp(a.first, b.first) < 0;
+    }
+};
+
+SubcommandTable::SubcommandTable(const char *command, const Entry *entries, size_t count,
+                                 const char *missingMsg, const char *unknownMsg) :
+                 mCommand(command), mMissingMsg(missingMsg), mUnknownMsg(unknownMsg) {
+    for (size_t i = 0; i < count; i++) {
+        mIndex.push_back(std::make_pair(entries[i].name, &entries[i]));
+        if (entries[i].alias) {
+            mIndex.push_back(std::make_pair(entries[i].alias, &entries[i]));
+        }
+    }
+    std::sort(mIndex.begin(), mIndex.end(), KeyLess());
+}
+
+const SubcommandTable::Entry *SubcommandTable::find(const char *name) const {
+    size_t lo = 0;
+    size_t hi = mIndex.size();
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(name, mIndex[mid].first);
+        if (!cmp) {
+            return mIndex[mid].second;
+        }
+        if (cmp < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return NULL;
+}
+
+bool SubcommandTable::isNumber(const char *arg) {
+    char *end;
+
+    errno = 0;
+    strtoll(arg, &end, 10);
+    return *arg && !*end && !errno;
+}
+
+bool SubcommandTable::checkArgs(const Entry *entry, int argc, char **argv) {
+    int fixed = strlen(entry->args);
+    int group = entry->repeat ? strlen(entry->repeat) : 0;
+    int extra = argc - 2 - fixed;
+
+    if (extra < 0 || (!group && extra) || (group && extra % group)) {
+        return false;
+    }
+    if (group && (extra / group < entry->minRepeats ||
+            (entry->maxRepeats >= 0 && extra / group > entry->maxRepeats))) {
+        return false;
+    }
+    for (int i = 2; i < argc; i++) {
+        char type = i - 2 < fixed ? entry->args[i - 2] : entry->repeat[(i - 2 - fixed) % group];
+        if (type == 'n' && !isNumber(argv[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void SubcommandTable::sendUsage(SocketClient *cli, const Entry *entry) const {
+    char *msg;
+
+    asprintf(&msg, "Usage: %s %s", mCommand, entry ? entry->usage : "<cmds> <args...>");
+    cli->sendMsg(ResponseCode::CommandSyntaxError, msg, false);
+    free(msg);
+}
+
+int SubcommandTable::dispatch(SocketClient *cli, int argc, char **argv) const {
+    const Entry *entry;
+
+    if (argc < 2) {
+        if (mMissingMsg) {
+            cli->sendMsg(ResponseCode::CommandSyntaxError, mMissingMsg, false);
+        } else {
+            sendUsage(cli, NULL);
+        }
+        return 0;
+    }
+    if (!(entry = find(argv[1]))) {
+        char *msg;
+        if (mUnknownMsg) {
+            cli->sendMsg(ResponseCode::CommandSyntaxError, mUnknownMsg, false);
+            return 0;
+        }
+        asprintf(&msg, "Unknown %s cmd", mCommand);
+        cli->sendMsg(ResponseCode::CommandSyntaxError, msg, false);
+        free(msg);
+        return 0;
+    }
+    if (!checkArgs(entry, argc, argv)) {
+        if (entry->syntaxError) {
+            cli->sendMsg(ResponseCode::CommandSyntaxError, entry->syntaxError, false);
+        } else {
+            sendUsage(cli, entry);
+        }
+        return 0;
+    }
+    return entry->handler(cli, argc, argv);
+}
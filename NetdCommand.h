@@ -17,6 +17,12 @@
 #ifndef _NETD_COMMAND_H
 #define _NETD_COMMAND_H
 
+#include <pthread.h>
+#include <stdint.h>
+
+#include <utility>
+#include <vector>
+
 #include <sysutils/FrameworkCommand.h>
 
 class NetdCommand : public FrameworkCommand {
@@ -25,4 +31,82 @@ public:
     virtual ~NetdCommand() {}
 };
 
+/*
+ * Runs another command, timing it into the "cmd.<command>" latency series
+ * and recording it in the CommandTrace.
+ *
+ * Runs of the same command are kept one at a time, as AsyncOperations can
+ * start them off the listener thread. Commands sharing a controller share
+ * the lock, through lockWith.
+ */
+class TimedCommand : public NetdCommand {
+public:
+    TimedCommand(NetdCommand *cmd, TimedCommand *lockWith = NULL);
+    virtual ~TimedCommand();
+    int runCommand(SocketClient *c, int argc, char **argv);
+
+private:
+    NetdCommand *mCmd;
+    int mSeries;
+    pthread_mutex_t mOwnLock;
+    pthread_mutex_t *mLock;
+};
+
+/*
+ * The subcommands of a "<command> <subcommand> <args...>" family, declared
+ * as a table and looked up by binary search on names and aliases.
+ *
+ * Arguments are checked before the handler runs, so handlers can use them
+ * as they are. Their types are given one letter each, 's' for any string
+ * and 'n' for a decimal number: first the fixed ones in args, then the
+ * group in repeat at least minRepeats and at most maxRepeats (-1 for no
+ * limit) times. A batch variant of a subcommand is one more entry with a
+ * repeat group.
+ *
+ * Families that had their own replies before the table keep them: a table
+ * can be given the reply to a missing and to an unknown subcommand, and an
+ * entry the reply to wrong arguments in place of its usage.
+ */
+class SubcommandTable {
+public:
+    /* Gets the whole command line, argv[1] being the subcommand. */
+    typedef int (*Handler)(SocketClient *cli, int argc, char **argv);
+
+    struct Entry {
+        const char *name;
+        const char *alias;      /* NULL for none */
+        const char *args;
+        const char *repeat;     /* NULL for none */
+        int minRepeats;
+        int maxRepeats;
+        const char *usage;      /* After "Usage: <command> " */
+        Handler handler;
+        const char *syntaxError; /* NULL to send the usage */
+    };
+
+    SubcommandTable(const char *command, const Entry *entries, size_t count,
+                    const char *missingMsg = NULL, const char *unknownMsg = NULL);
+
+    /*
+     * Runs the handler of argv[1]. Sends the CommandSyntaxError itself when
+     * there is no such subcommand or its arguments are wrong.
+     */
+    int dispatch(SocketClient *cli, int argc, char **argv) const;
+    void sendUsage(SocketClient *cli, const Entry *entry) const;
+
+    static bool isNumber(const char *arg);
+
+private:
+    class KeyLess;
+
+    const Entry *find(const char *name) const;
+    static bool checkArgs(const Entry *entry, int argc, char **argv);
+
+    const char *mCommand;
+    const char *mMissingMsg;
+    const char *mUnknownMsg;
+    /* Names and aliases, sorted. */
+    std::vector<std::pair<const char *, const Entry *> > mIndex;
+};
+
 #endif
@@ -14,8 +14,11 @@
  * limitations under the License.
  */
 
+#include <errno.h>
 #include <fcntl.h>
+#include <signal.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/wait.h>
 
 #define LOG_TAG "Netd"
@@ -23,11 +26,17 @@
 #include <cutils/log.h>
 #include <logwrap/logwrap.h>
 
+#include "CommandExecutor.h"
 #include "NetdConstants.h"
 
 const char * const OEM_SCRIPT_PATH = "/system/bin/oem-iptables-init.sh";
 const char * const IPTABLES_PATH = "/system/bin/iptables";
 const char * const IP6TABLES_PATH = "/system/bin/ip6tables";
+const char * const IPTABLES_RESTORE_PATH = "/system/bin/iptables-restore";
+const char * const IP6TABLES_RESTORE_PATH = "/system/bin/ip6tables-restore";
+const char * const IPTABLES_SAVE_PATH = "/system/bin/iptables-save";
+const char * const IP6TABLES_SAVE_PATH = "/system/bin/ip6tables-save";
+const char * const NFT_PATH = "/system/bin/nft";
 const char * const TC_PATH = "/system/bin/tc";
 const char * const IP_PATH = "/system/bin/ip";
 const char * const ADD = "add";
@@ -49,8 +58,7 @@ static int execIptablesCommand(int argc, const char *argv[], bool silent) {
     int res;
     int status;
 
-    res = android_fork_execvp(argc, (char **)argv, &status, false,
-        !silent);
+    res = CommandExecutor::get()->execvp(argc, argv, &status, !silent);
     if (res || !WIFEXITED(status) || WEXITSTATUS(status)) {
         if (!silent) {
             logExecError(argv, res, status);
@@ -108,6 +116,32 @@ int execIptablesSilently(IptablesTarget target, ...) {
     return res;
 }
 
+static int execWithInput(const char **argv, const std::string &commands) {
+    return CommandExecutor::get()->execWithInput(argv, commands);
+}
+
+static int execIptablesRestoreCommand(const char *path, const std::string &commands) {
+    const char *argv[] = { path, "--noflush", NULL };
+    return execWithInput(argv, commands);
+}
+
+int execIptablesRestore(IptablesTarget target, const std::string &commands) {
+    int res = 0;
+
+    if (target == V4 || target == V4V6) {
+        res = execIptablesRestoreCommand(IPTABLES_RESTORE_PATH, commands);
+    }
+    if (!res && (target == V6 || target == V4V6)) {
+        res = execIptablesRestoreCommand(IP6TABLES_RESTORE_PATH, commands);
+    }
+    return res;
+}
+
+int execNftScript(const std::string &script) {
+    const char *argv[] = { NFT_PATH, "-f", "-", NULL };
+    return execWithInput(argv, script);
+}
+
 int writeFile(const char *path, const char *value, int size) {
     int fd = open(path, O_WRONLY);
     if (fd < 0) {
@@ -25,6 +25,11 @@ const int PROTECT_MARK = 0x1;
 
 extern const char * const IPTABLES_PATH;
 extern const char * const IP6TABLES_PATH;
+extern const char * const IPTABLES_RESTORE_PATH;
+extern const char * const IP6TABLES_RESTORE_PATH;
+extern const char * const IPTABLES_SAVE_PATH;
+extern const char * const IP6TABLES_SAVE_PATH;
+extern const char * const NFT_PATH;
 extern const char * const IP_PATH;
 extern const char * const TC_PATH;
 extern const char * const OEM_SCRIPT_PATH;
@@ -36,6 +41,14 @@ enum IptablesTarget { V4, V6, V4V6 };
 
 int execIptables(IptablesTarget target, ...);
 int execIptablesSilently(IptablesTarget target, ...);
+/*
+ * Feeds commands, in iptables-save format, to "iptables-restore --noflush".
+ * Each table is committed atomically; for V4V6 the v6 commit only runs if
+ * the v4 one succeeded.
+ */
+int execIptablesRestore(IptablesTarget target, const std::string &commands);
+/* Feeds script to "nft -f -", which applies it as one transaction. */
+int execNftScript(const std::string &script);
 int writeFile(const char *path, const char *value, int size);
 int readFile(const char *path, char *buf, int *sizep);
 
@@ -19,11 +19,15 @@
 #include <string.h>
 #include <errno.h>
 
+#include <string>
+
 #define LOG_TAG "Netd"
 
 #include <cutils/log.h>
 
 #include <sysutils/NetlinkEvent.h>
+#include "BandwidthController.h"
+#include "LatencyMetrics.h"
 #include "NetlinkHandler.h"
 #include "NetlinkManager.h"
 #include "ResponseCode.h"
@@ -52,6 +56,9 @@ void NetlinkHandler::onEvent(NetlinkEvent *evt) {
         return;
     }
 
+    std::string series = std::string("netlink.") + subsys;
+    LatencyTimer timer(series.c_str());
+
     if (!strcmp(subsys, "net")) {
         int action = evt->getAction();
         const char *iface = evt->findParam("INTERFACE");
@@ -136,8 +143,16 @@ void NetlinkHandler::notifyInterfaceLinkChanged(const char *name, bool isUp) {
 }
 
 void NetlinkHandler::notifyQuotaLimitReached(const char *name, const char *iface) {
+    BandwidthController *bc = mNm->getBandwidthController();
+    int64_t crossed;
     char msg[255];
-    snprintf(msg, sizeof(msg), "limit alert %s %s", name, iface);
+
+    if (bc && !bc->rearmAlert(name, &crossed)) {
+        /* One of several thresholds; say which so nobody has to poll. */
+        snprintf(msg, sizeof(msg), "limit alert %s %s %lld", name, iface, crossed);
+    } else {
+        snprintf(msg, sizeof(msg), "limit alert %s %s", name, iface);
+    }
 
     mNm->getBroadcaster()->sendBroadcast(ResponseCode::BandwidthControl,
             msg, false);
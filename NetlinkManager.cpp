@@ -45,6 +45,7 @@ NetlinkManager *NetlinkManager::Instance() {
 
 NetlinkManager::NetlinkManager() {
     mBroadcaster = NULL;
+    mBandwidthCtrl = NULL;
 }
 
 NetlinkManager::~NetlinkManager() {
@@ -22,6 +22,7 @@
 
 
 class NetlinkHandler;
+class BandwidthController;
 
 class NetlinkManager {
 private:
@@ -29,6 +30,7 @@ private:
 
 private:
     SocketListener       *mBroadcaster;
+    BandwidthController  *mBandwidthCtrl;
     NetlinkHandler       *mUeventHandler;
     NetlinkHandler       *mRouteHandler;
     NetlinkHandler       *mQuotaHandler;
@@ -45,6 +47,8 @@ public:
 
     void setBroadcaster(SocketListener *sl) { mBroadcaster = sl; }
     SocketListener *getBroadcaster() { return mBroadcaster; }
+    void setBandwidthController(BandwidthController *bc) { mBandwidthCtrl = bc; }
+    BandwidthController *getBandwidthController() { return mBandwidthCtrl; }
 
     static NetlinkManager *Instance();
 
@@ -37,6 +37,8 @@
 PppController::PppController() {
     mTtys = new TtyCollection();
     mPid = 0;
+    mStoppingPid = 0;
+    pthread_mutex_init(&mLock, NULL);
 }
 
 PppController::~PppController() {
@@ -52,13 +54,27 @@ int PppController::attachPppd(const char *tty, struct in_addr local,
                               struct in_addr remote, struct in_addr dns1,
                               struct in_addr dns2) {
     pid_t pid;
+    bool running;
 
-    if (mPid) {
+    pthread_mutex_lock(&mLock);
+    running = (mPid != 0);
+    pid = mStoppingPid;
+    pthread_mutex_unlock(&mLock);
+    if (running) {
         ALOGE("Multiple PPPD instances not currently supported");
         errno = EBUSY;
         return -1;
     }
 
+    // pppd keeps the tty locked until it is gone, so a detached instance
+    // that is still exiting has to finish first (the supervisor SIGKILLs
+    // stragglers).
+    if (pid != 0 &&
+        ProcessSupervisor::Instance()->waitForExit(pid,
+                ProcessSupervisor::DEFAULT_STOP_TIMEOUT_MS + 500)) {
+        ALOGE("pppd (%d) did not exit", pid);
+    }
+
     TtyCollection::iterator it;
     for (it = mTtys->begin(); it != mTtys->end(); ++it) {
         if (!strcmp(tty, *it)) {
@@ -97,26 +113,49 @@ int PppController::attachPppd(const char *tty, struct in_addr local,
         ALOGE("Should never get here!");
         return 0;
     } else {
+        pthread_mutex_lock(&mLock);
         mPid = pid;
+        pthread_mutex_unlock(&mLock);
+        ProcessSupervisor::Instance()->watch(pid, "pppd", this);
     }
     return 0;
 }
 
 int PppController::detachPppd(const char *tty) {
+    pid_t pid;
+
+    pthread_mutex_lock(&mLock);
+    pid = mPid;
+    mPid = 0;
+    if (pid != 0) {
+        mStoppingPid = pid;
+    }
+    pthread_mutex_unlock(&mLock);
 
-    if (mPid == 0) {
+    if (pid == 0) {
         ALOGE("PPPD already stopped");
         return 0;
     }
 
     ALOGD("Stopping PPPD services on port %s", tty);
-    kill(mPid, SIGTERM);
-    waitpid(mPid, NULL, 0);
-    mPid = 0;
-    ALOGD("PPPD services on port %s stopped", tty);
+    ProcessSupervisor::Instance()->stop(pid);
     return 0;
 }
 
+void PppController::onChildExited(pid_t pid, int status) {
+    pthread_mutex_lock(&mLock);
+    if (mPid == pid) {
+        ALOGE("PPPD exited unexpectedly");
+        mPid = 0;
+    } else {
+        ALOGD("PPPD services stopped");
+        if (mStoppingPid == pid) {
+            mStoppingPid = 0;
+        }
+    }
+    pthread_mutex_unlock(&mLock);
+}
+
 TtyCollection *PppController::getTtyList() {
     updateTtyList();
     return mTtys;
@@ -17,15 +17,19 @@
 #ifndef _PPP_CONTROLLER_H
 #define _PPP_CONTROLLER_H
 
+#include <pthread.h>
 #include <linux/in.h>
 
 #include "List.h"
+#include "ProcessSupervisor.h"
 
 typedef android::netd::List<char *> TtyCollection;
 
-class PppController {
+class PppController : public ProcessSupervisor::Client {
     TtyCollection *mTtys;
     pid_t          mPid; // TODO: Add support for > 1 pppd instance
+    pid_t          mStoppingPid; // detached but maybe not gone yet
+    pthread_mutex_t mLock; // mPid is also cleared from the supervisor thread
 
 public:
     PppController();
@@ -37,6 +41,8 @@ public:
     int detachPppd(const char *tty);
     TtyCollection *getTtyList();
 
+    virtual void onChildExited(pid_t pid, int status);
+
 private:
     int updateTtyList();
 };
@@ -0,0 +1,337 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define LOG_TAG "ProcessSupervisor"
+
+#include <cutils/log.h>
+
+#include "ProcessSupervisor.h"
+
+/* A child that dies sooner than this after being (re)started counts as a quick restart. */
+#define RESTART_MIN_UPTIME_MS   10000
+#define RESTART_MAX_QUICK       5
+
+ProcessSupervisor *ProcessSupervisor::sInstance = NULL;
+
+ProcessSupervisor *ProcessSupervisor::Instance() {
+    if (!sInstance)
+        sInstance = new ProcessSupervisor();
+    return sInstance;
+}
+
+ProcessSupervisor::ProcessSupervisor() {
+    mWakeupPipe[0] = mWakeupPipe[1] = -1;
+    pthread_mutex_init(&mLock, NULL);
+    pthread_cond_init(&mExitCond, NULL);
+}
+
+int ProcessSupervisor::start() {
+    struct sigaction sa;
+    pthread_t thread;
+
+    if (pipe(mWakeupPipe) < 0) {
+        ALOGE("Unable to create wakeup pipe (%s)", strerror(errno));
+        return -1;
+    }
+    fcntl(mWakeupPipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(mWakeupPipe[1], F_SETFL, O_NONBLOCK);
+    fcntl(mWakeupPipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(mWakeupPipe[1], F_SETFD, FD_CLOEXEC);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = ProcessSupervisor::onSigchld;
+    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGCHLD, &sa, NULL) < 0) {
+        ALOGE("Unable to handle SIGCHLD (%s)", strerror(errno));
+        return -1;
+    }
+
+    if (pthread_create(&thread, NULL, ProcessSupervisor::threadStart, this)) {
+        ALOGE("pthread_create (%s)", strerror(errno));
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+/* Runs on whichever thread the signal lands; only wakes the supervisor. */
+void ProcessSupervisor::onSigchld(int) {
+    int savedErrno = errno;
+
+    sInstance->wakeup();
+    errno = savedErrno;
+}
+
+long long ProcessSupervisor::nowMs() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int ProcessSupervisor::watch(pid_t pid, const char *name, Client *client,
+                             RestartPolicy policy) {
+    Child child;
+
+    if (pid <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    child.mPid = pid;
+    child.mName = name;
+    child.mClient = client;
+    child.mPolicy = policy;
+    child.mStopping = false;
+    child.mKilled = false;
+    child.mKillDeadline = 0;
+    child.mStartTime = nowMs();
+    child.mQuickRestarts = 0;
+
+    pthread_mutex_lock(&mLock);
+    mChildren.push_back(child);
+    pthread_mutex_unlock(&mLock);
+
+    // The child may already have exited before we knew about it.
+    wakeup();
+    return 0;
+}
+
+int ProcessSupervisor::stop(pid_t pid, int timeoutMs) {
+    std::list<Child>::iterator it;
+
+    pthread_mutex_lock(&mLock);
+    for (it = mChildren.begin(); it != mChildren.end(); ++it) {
+        if (it->mPid == pid) {
+            break;
+        }
+    }
+    if (it == mChildren.end()) {
+        pthread_mutex_unlock(&mLock);
+        errno = ESRCH;
+        return -1;
+    }
+
+    ALOGD("Stopping %s (%d)", it->mName.c_str(), pid);
+    it->mStopping = true;
+    it->mKillDeadline = nowMs() + timeoutMs;
+    kill(pid, SIGTERM);
+    pthread_mutex_unlock(&mLock);
+
+    // Let the supervisor thread pick up the new deadline.
+    wakeup();
+    return 0;
+}
+
+bool ProcessSupervisor::isRunning(pid_t pid) {
+    std::list<Child>::iterator it;
+    bool running = false;
+
+    pthread_mutex_lock(&mLock);
+    for (it = mChildren.begin(); it != mChildren.end(); ++it) {
+        if (it->mPid == pid) {
+            running = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mLock);
+    return running;
+}
+
+int ProcessSupervisor::waitForExit(pid_t pid, int timeoutMs) {
+    struct timeval now;
+    struct timespec deadline;
+    int rc = 0;
+
+    gettimeofday(&now, NULL);
+    deadline.tv_sec = now.tv_sec + timeoutMs / 1000;
+    deadline.tv_nsec = now.tv_usec * 1000 + (timeoutMs % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&mLock);
+    while (rc == 0) {
+        std::list<Child>::iterator it;
+        for (it = mChildren.begin(); it != mChildren.end(); ++it) {
+            if (it->mPid == pid) {
+                break;
+            }
+        }
+        if (it == mChildren.end()) {
+            break;
+        }
+        rc = pthread_cond_timedwait(&mExitCond, &mLock, &deadline);
+    }
+    pthread_mutex_unlock(&mLock);
+
+    if (rc != 0) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    return 0;
+}
+
+void ProcessSupervisor::wakeup() {
+    if (mWakeupPipe[1] != -1) {
+        write(mWakeupPipe[1], "w", 1);
+    }
+}
+
+void *ProcessSupervisor::threadStart(void *obj) {
+    ProcessSupervisor *supervisor = reinterpret_cast<ProcessSupervisor *>(obj);
+
+    supervisor->run();
+    pthread_exit(NULL);
+    return NULL;
+}
+
+void ProcessSupervisor::run() {
+    struct pollfd fds[1];
+
+    fds[0].fd = mWakeupPipe[0];
+    fds[0].events = POLLIN;
+
+    while (1) {
+        reapChildren();
+        int timeout = killOverdue();
+
+        fds[0].revents = 0;
+        if (poll(fds, 1, timeout) < 0) {
+            if (errno != EINTR) {
+                ALOGE("poll failed (%s)", strerror(errno));
+                sleep(1);
+            }
+            continue;
+        }
+
+        // Several SIGCHLDs may have been coalesced; reapChildren() checks everybody.
+        if (fds[0].revents & POLLIN) {
+            char buf[32];
+            while (read(mWakeupPipe[0], buf, sizeof(buf)) > 0)
+                ;
+        }
+    }
+}
+
+void ProcessSupervisor::reapChildren() {
+    std::list<Child> exited;
+    std::list<int> statuses;
+    std::list<Child>::iterator it;
+
+    pthread_mutex_lock(&mLock);
+    it = mChildren.begin();
+    while (it != mChildren.end()) {
+        int status = 0;
+        pid_t rc = waitpid(it->mPid, &status, WNOHANG);
+        if (rc == it->mPid || (rc < 0 && errno == ECHILD)) {
+            exited.push_back(*it);
+            statuses.push_back(status);
+            it = mChildren.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    if (!exited.empty()) {
+        pthread_cond_broadcast(&mExitCond);
+    }
+    pthread_mutex_unlock(&mLock);
+
+    // Clients are called without mLock so they are free to watch() or stop().
+    std::list<int>::iterator st = statuses.begin();
+    for (it = exited.begin(); it != exited.end(); ++it, ++st) {
+        Child &child = *it;
+        int status = *st;
+        bool restart;
+
+        if (WIFSIGNALED(status)) {
+            ALOGD("%s (%d) killed by signal %d", child.mName.c_str(), child.mPid,
+                  WTERMSIG(status));
+        } else {
+            ALOGD("%s (%d) exited with status %d", child.mName.c_str(), child.mPid,
+                  WEXITSTATUS(status));
+        }
+
+        if (child.mStopping || child.mPolicy == RESTART_NEVER) {
+            restart = false;
+        } else if (child.mPolicy == RESTART_ON_FAILURE) {
+            restart = !(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+        } else {
+            restart = true;
+        }
+
+        if (restart && nowMs() - child.mStartTime < RESTART_MIN_UPTIME_MS) {
+            if (++child.mQuickRestarts > RESTART_MAX_QUICK) {
+                ALOGE("%s keeps dying, giving up", child.mName.c_str());
+                restart = false;
+            }
+        } else {
+            child.mQuickRestarts = 0;
+        }
+
+        if (restart && child.mClient) {
+            pid_t pid = child.mClient->onChildRestart(child.mPid);
+            if (pid > 0) {
+                ALOGD("%s restarted as %d", child.mName.c_str(), pid);
+                child.mPid = pid;
+                child.mStartTime = nowMs();
+                pthread_mutex_lock(&mLock);
+                mChildren.push_back(child);
+                pthread_mutex_unlock(&mLock);
+                continue;
+            }
+        }
+
+        if (child.mClient) {
+            child.mClient->onChildExited(child.mPid, status);
+        }
+    }
+}
+
+int ProcessSupervisor::killOverdue() {
+    std::list<Child>::iterator it;
+    long long now = nowMs();
+    long long next = -1;
+
+    pthread_mutex_lock(&mLock);
+    for (it = mChildren.begin(); it != mChildren.end(); ++it) {
+        if (!it->mStopping || it->mKilled) {
+            continue;
+        }
+        if (now >= it->mKillDeadline) {
+            ALOGW("%s (%d) ignored SIGTERM, sending SIGKILL", it->mName.c_str(), it->mPid);
+            kill(it->mPid, SIGKILL);
+            it->mKilled = true;
+        } else if (next < 0 || it->mKillDeadline - now < next) {
+            next = it->mKillDeadline - now;
+        }
+    }
+    pthread_mutex_unlock(&mLock);
+    return (int) next;
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _PROCESS_SUPERVISOR_H
+#define _PROCESS_SUPERVISOR_H
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/types.h>
+
+#include <list>
+#include <string>
+
+/*
+ * Reaps the daemons netd forks (dnsmasq, radish, pppd, clatd, hostapd) from a
+ * single thread, woken through a pipe by a SIGCHLD handler.  Only pids handed
+ * to watch() are waited for, so android_fork_execvp(), popen() and system()
+ * keep reaping their own children.  SIGCHLD is never blocked, so whatever
+ * netd forks starts with the signal mask it always had.
+ */
+class ProcessSupervisor {
+public:
+    class Client {
+    public:
+        virtual ~Client() {}
+        /* Called on the supervisor thread once the child is gone for good. */
+        virtual void onChildExited(pid_t pid, int status) = 0;
+        /*
+         * Called on the supervisor thread for a child that died under a
+         * restart policy.  Returns the pid of the replacement, which is then
+         * watched with the same policy, or -1 to let it stay dead.
+         */
+        virtual pid_t onChildRestart(pid_t pid) { return -1; }
+    };
+
+    enum RestartPolicy { RESTART_NEVER, RESTART_ON_FAILURE, RESTART_ALWAYS };
+
+    static const int DEFAULT_STOP_TIMEOUT_MS = 2000;
+
+    static ProcessSupervisor *Instance();
+    virtual ~ProcessSupervisor() {}
+
+    /* Installs the SIGCHLD handler (SA_RESTART) and starts the thread. */
+    int start();
+
+    int watch(pid_t pid, const char *name, Client *client,
+              RestartPolicy policy = RESTART_NEVER);
+    /* Sends SIGTERM and returns; SIGKILL follows if still alive after timeoutMs. */
+    int stop(pid_t pid, int timeoutMs = DEFAULT_STOP_TIMEOUT_MS);
+    /* Returns 0 once pid has been reaped, -1 with errno ETIMEDOUT otherwise. */
+    int waitForExit(pid_t pid, int timeoutMs);
+    bool isRunning(pid_t pid);
+
+private:
+    class Child {
+    public:
+        pid_t mPid;
+        std::string mName;
+        Client *mClient;
+        RestartPolicy mPolicy;
+        bool mStopping;
+        bool mKilled;
+        long long mKillDeadline; // monotonic ms, valid while mStopping
+        long long mStartTime;
+        int mQuickRestarts;
+    };
+
+    static ProcessSupervisor *sInstance;
+
+    ProcessSupervisor();
+    static void *threadStart(void *obj);
+    static void onSigchld(int sig);
+    void run();
+    void reapChildren();
+    int killOverdue(); // returns ms until the next deadline, or -1
+    void wakeup();
+    static long long nowMs();
+
+    std::list<Child> mChildren;
+    pthread_mutex_t mLock;
+    pthread_cond_t mExitCond;
+    int mWakeupPipe[2];
+};
+
+#endif
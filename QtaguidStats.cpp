@@ -0,0 +1,403 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// #define LOG_NDEBUG 0
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#define LOG_TAG "QtaguidStats"
+#include <cutils/log.h>
+
+#include "QtaguidStats.h"
+#include "ResponseCode.h"
+
+const char QtaguidStats::STATS_PATH[] = "/proc/net/xt_qtaguid/stats";
+const int  QtaguidStats::MAX_SAMPLES = 16;
+const int  QtaguidStats::SAMPLE_INTERVAL_MS = 60 * 1000;
+
+/*
+ * The stats file looks like:
+ *   idx iface acct_tag_hex uid_tag_int cnt_set rx_bytes rx_packets tx_bytes tx_packets ...
+ *   2 wlan0 0x0 0 0 6788 42 3456 40 ...
+ *   3 wlan0 0x0 10013 1 1172 11 812 9 ...
+ * The tag is in the top 32 bits of acct_tag_hex. The protocol breakdown
+ * columns after tx_packets are ignored.
+ */
+enum {
+    COL_IDX, COL_IFACE, COL_TAG, COL_UID, COL_SET,
+    COL_RX_BYTES, COL_RX_PACKETS, COL_TX_BYTES, COL_TX_PACKETS,
+    COL_USED
+};
+
+/* Splits off the next space separated token of [*pos, end) without copying it. */
+static const char *nextToken(const char **pos, const char *end, size_t *len) {
+    const char *p = *pos;
+    const char *start;
+
+    while (p < end && *p == ' ')
+        p++;
+    start = p;
+    while (p < end && *p != ' ')
+        p++;
+    *len = p - start;
+    *pos = p;
+    return *len ? start : NULL;
+}
+
+static bool parseNumber(const char *token, size_t len, uint64_t *value) {
+    uint64_t v = 0;
+    size_t i = 0;
+    int base = 10;
+
+    if (len > 2 && token[0] == '0' && token[1] == 'x') {
+        base = 16;
+        i = 2;
+    }
+    if (i == len)
+        return false;
+    for (; i < len; i++) {
+        char c = token[i];
+        int digit;
+        if (c >= '0' && c <= '9')
+            digit = c - '0';
+        else if (base == 16 && c >= 'a' && c <= 'f')
+            digit = c - 'a' + 10;
+        else
+            return false;
+        v = v * base + digit;
+    }
+    *value = v;
+    return true;
+}
+
+void QtaguidStats::Table::clear(void) {
+    ifaceIdx.clear();
+    uid.clear();
+    tag.clear();
+    set.clear();
+    rxBytes.clear();
+    rxPackets.clear();
+    txBytes.clear();
+    txPackets.clear();
+}
+
+void QtaguidStats::Table::reserve(size_t n) {
+    ifaceIdx.reserve(n);
+    uid.reserve(n);
+    tag.reserve(n);
+    set.reserve(n);
+    rxBytes.reserve(n);
+    rxPackets.reserve(n);
+    txBytes.reserve(n);
+    txPackets.reserve(n);
+}
+
+void QtaguidStats::Table::swap(Table &other) {
+    std::swap(timestamp, other.timestamp);
+    ifaceIdx.swap(other.ifaceIdx);
+    uid.swap(other.uid);
+    tag.swap(other.tag);
+    set.swap(other.set);
+    rxBytes.swap(other.rxBytes);
+    rxPackets.swap(other.rxPackets);
+    txBytes.swap(other.txBytes);
+    txPackets.swap(other.txPackets);
+}
+
+bool QtaguidStats::Table::keyLess(size_t i, const Table &other, size_t j) const {
+    if (ifaceIdx[i] != other.ifaceIdx[j])
+        return ifaceIdx[i] < other.ifaceIdx[j];
+    if (uid[i] != other.uid[j])
+        return uid[i] < other.uid[j];
+    if (tag[i] != other.tag[j])
+        return tag[i] < other.tag[j];
+    return set[i] < other.set[j];
+}
+
+ssize_t QtaguidStats::Table::find(const Table &other, size_t j) const {
+    size_t lo = 0;
+    size_t hi = size();
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (keyLess(mid, other, j)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo < size() && !other.keyLess(j, *this, lo))
+        return lo;
+    return -1;
+}
+
+class QtaguidStats::RowOrder {
+public:
+    RowOrder(const Table *table) : mTable(table) {};
+    bool operator()(size_t a, size_t b) const { return mTable->keyLess(a, *mTable, b); }
+private:
+    const Table *mTable;
+};
+
+QtaguidStats::QtaguidStats() {
+    mBuffer = NULL;
+    mBufferSize = 0;
+    mHaveBaseline = false;
+    mCurrent.timestamp = mBaseline.timestamp = 0;
+}
+
+QtaguidStats::~QtaguidStats() {
+    free(mBuffer);
+}
+
+long long QtaguidStats::nowMs(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int QtaguidStats::internIface(const char *name, size_t len) {
+    for (size_t i = 0; i < mIfaces.size(); i++) {
+        if (mIfaces[i].size() == len && !memcmp(mIfaces[i].data(), name, len))
+            return i;
+    }
+    mIfaces.push_back(std::string(name, len));
+    return mIfaces.size() - 1;
+}
+
+int QtaguidStats::parse(Table &table) {
+    size_t used = 0;
+    ssize_t len;
+    int fd;
+
+    fd = open(STATS_PATH, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        ALOGE("Unable to open %s (%s)", STATS_PATH, strerror(errno));
+        return -1;
+    }
+    while (1) {
+        if (used == mBufferSize) {
+            size_t newSize = mBufferSize ? mBufferSize * 2 : 16 * 1024;
+            char *newBuffer = (char *) realloc(mBuffer, newSize);
+            if (!newBuffer) {
+                ALOGE("Out of memory reading %s", STATS_PATH);
+                close(fd);
+                return -1;
+            }
+            mBuffer = newBuffer;
+            mBufferSize = newSize;
+        }
+        len = read(fd, mBuffer + used, mBufferSize - used);
+        if (len < 0) {
+            if (errno == EINTR)
+                continue;
+            ALOGE("Unable to read %s (%s)", STATS_PATH, strerror(errno));
+            close(fd);
+            return -1;
+        }
+        if (!len)
+            break;
+        used += len;
+    }
+    close(fd);
+
+    const char *pos = mBuffer;
+    const char *end = mBuffer + used;
+    const char *eol;
+    bool header = true;
+
+    table.clear();
+    /* Roughly 100 bytes per line. */
+    table.reserve(used / 100 + 1);
+    for (; pos < end; pos = eol + 1) {
+        eol = (const char *) memchr(pos, '\n', end - pos);
+        if (!eol)
+            eol = end;
+        if (header) {
+            header = false;
+            continue;
+        }
+
+        const char *linePos = pos;
+        const char *token;
+        size_t tokenLen;
+        uint64_t values[COL_USED];
+        int col;
+
+        for (col = 0; col < COL_USED; col++) {
+            token = nextToken(&linePos, eol, &tokenLen);
+            if (!token)
+                break;
+            if (col == COL_IFACE) {
+                values[col] = internIface(token, tokenLen);
+            } else if (!parseNumber(token, tokenLen, &values[col])) {
+                break;
+            }
+        }
+        if (col != COL_USED) {
+            ALOGV("Skipping line <%.*s>", (int) (eol - pos), pos);
+            continue;
+        }
+
+        table.ifaceIdx.push_back(values[COL_IFACE]);
+        table.uid.push_back(values[COL_UID]);
+        table.tag.push_back(values[COL_TAG] >> 32);
+        table.set.push_back(values[COL_SET]);
+        table.rxBytes.push_back(values[COL_RX_BYTES]);
+        table.rxPackets.push_back(values[COL_RX_PACKETS]);
+        table.txBytes.push_back(values[COL_TX_BYTES]);
+        table.txPackets.push_back(values[COL_TX_PACKETS]);
+    }
+    sortTable(table);
+    return 0;
+}
+
+template <class T>
+static void permute(std::vector<T> &column, const std::vector<size_t> &order) {
+    std::vector<T> sorted;
+
+    sorted.reserve(order.size());
+    for (size_t i = 0; i < order.size(); i++)
+        sorted.push_back(column[order[i]]);
+    column.swap(sorted);
+}
+
+void QtaguidStats::sortTable(Table &table) {
+    std::vector<size_t> order;
+    bool sorted = true;
+
+    /* The kernel mostly hands them out in order already. */
+    for (size_t i = 1; i < table.size() && sorted; i++) {
+        sorted = !table.keyLess(i, table, i - 1);
+    }
+    if (sorted)
+        return;
+
+    order.reserve(table.size());
+    for (size_t i = 0; i < table.size(); i++)
+        order.push_back(i);
+    std::sort(order.begin(), order.end(), RowOrder(&table));
+
+    permute(table.ifaceIdx, order);
+    permute(table.uid, order);
+    permute(table.tag, order);
+    permute(table.set, order);
+    permute(table.rxBytes, order);
+    permute(table.rxPackets, order);
+    permute(table.txBytes, order);
+    permute(table.txPackets, order);
+}
+
+int QtaguidStats::refresh(void) {
+    if (parse(mScratch))
+        return -1;
+    mScratch.timestamp = nowMs();
+    mCurrent.swap(mScratch);
+
+    if (mSamples.empty() ||
+            mCurrent.timestamp - mSamples.back().timestamp >= SAMPLE_INTERVAL_MS) {
+        if ((int) mSamples.size() < MAX_SAMPLES) {
+            mSamples.push_back(mCurrent);
+        } else {
+            /* Copy over the oldest sample, into the room it already has. */
+            mSamples.splice(mSamples.end(), mSamples, mSamples.begin());
+            mSamples.back() = mCurrent;
+        }
+    }
+    return 0;
+}
+
+int QtaguidStats::reset(void) {
+    if (refresh())
+        return -1;
+    mBaseline = mCurrent;
+    mHaveBaseline = true;
+    return 0;
+}
+
+int QtaguidStats::sendStats(SocketClient *cli, const Filter &filter) {
+    const Table *base = NULL;
+    std::list<Table>::reverse_iterator it;
+    long long from = 0;
+    int ifaceIdx = -1;
+    char *msg;
+
+    if (refresh())
+        return -1;
+
+    if (filter.windowSecs > 0) {
+        long long start = mCurrent.timestamp - (long long) filter.windowSecs * 1000;
+        /* Newest sample old enough, or else the oldest we have. */
+        for (it = mSamples.rbegin(); it != mSamples.rend(); it++) {
+            base = &*it;
+            if (it->timestamp <= start)
+                break;
+        }
+    } else if (mHaveBaseline) {
+        base = &mBaseline;
+    }
+    if (base)
+        from = base->timestamp;
+
+    if (!filter.iface.empty()) {
+        for (size_t i = 0; i < mIfaces.size(); i++) {
+            if (mIfaces[i] == filter.iface)
+                ifaceIdx = i;
+        }
+    }
+
+    for (size_t i = 0; i < mCurrent.size(); i++) {
+        if (!filter.iface.empty() && mCurrent.ifaceIdx[i] != ifaceIdx)
+            continue;
+        if (filter.uid != -1 && mCurrent.uid[i] != filter.uid)
+            continue;
+        if (filter.tag != -1 && mCurrent.tag[i] != filter.tag)
+            continue;
+
+        uint64_t rxB = mCurrent.rxBytes[i], rxP = mCurrent.rxPackets[i];
+        uint64_t txB = mCurrent.txBytes[i], txP = mCurrent.txPackets[i];
+        ssize_t b = base ? base->find(mCurrent, i) : -1;
+        /* A counter that went backwards was deleted and recreated in between. */
+        if (b >= 0 && rxB >= base->rxBytes[b] && txB >= base->txBytes[b]) {
+            rxB -= base->rxBytes[b];
+            rxP -= base->rxPackets[b];
+            txB -= base->txBytes[b];
+            txP -= base->txPackets[b];
+        }
+        if (!rxB && !rxP && !txB && !txP)
+            continue;
+
+        asprintf(&msg, "%s %u %u %u %llu %llu %llu %llu",
+                 mIfaces[mCurrent.ifaceIdx[i]].c_str(), mCurrent.uid[i], mCurrent.tag[i],
+                 mCurrent.set[i], (unsigned long long) rxB, (unsigned long long) rxP,
+                 (unsigned long long) txB, (unsigned long long) txP);
+        cli->sendMsg(ResponseCode::UidStatsListResult, msg, false);
+        free(msg);
+    }
+
+    asprintf(&msg, "%lld %lld Uid stats list completed", from, mCurrent.timestamp);
+    cli->sendMsg(ResponseCode::CommandOkay, msg, false);
+    free(msg);
+    return 0;
+}
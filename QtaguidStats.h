@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _QTAGUID_STATS_H
+#define _QTAGUID_STATS_H
+
+#include <stdint.h>
+
+#include <list>
+#include <string>
+#include <vector>
+
+#include <sysutils/SocketClient.h>
+
+/*
+ * Keeps the xt_qtaguid per (iface, uid, tag, set) counters that the
+ * bw_* "--socket-exists" tracking rules feed, so that queries don't make
+ * every caller re-read and re-parse /proc/net/xt_qtaguid/stats.
+ *
+ * Each read is tokenized in place in a buffer that is reused across reads,
+ * and lands in a table with one array per column, whose storage is reused
+ * too. A few older tables are kept around as the baselines for time window
+ * queries. Nothing reads the counters in the background: tables are only
+ * taken when a query or reset comes in, so after a quiet spell a window
+ * query may get a shorter window than asked for, or a longer one.
+ */
+class QtaguidStats {
+public:
+    class Filter {
+    public:
+        Filter() : uid(-1), tag(-1), windowSecs(0) {};
+        std::string iface;   /* "" for all */
+        int64_t uid;         /* -1 for all */
+        int64_t tag;         /* -1 for all */
+        int windowSecs;      /* 0 for since the last reset() */
+    };
+
+    QtaguidStats();
+    virtual ~QtaguidStats();
+
+    /*
+     * Sends a UidStatsListResult
+     *   "<iface> <uid> <tag> <set> <rx_bytes> <rx_packets> <tx_bytes> <tx_packets>"
+     * for every row matching filter that moved since the baseline, then a
+     * CommandOkay "<from_ms> <to_ms> ..." giving the CLOCK_MONOTONIC window
+     * actually covered, which can be shorter than asked for.
+     * Error is to be handled on the outside.
+     */
+    int sendStats(SocketClient *cli, const Filter &filter);
+    /* Makes the current counters the baseline for unwindowed queries. */
+    int reset(void);
+
+private:
+    class Table {
+    public:
+        long long timestamp;
+        /* Sorted by (ifaceIdx, uid, tag, set). */
+        std::vector<uint16_t> ifaceIdx;
+        std::vector<uint32_t> uid;
+        std::vector<uint32_t> tag;
+        std::vector<uint8_t> set;
+        std::vector<uint64_t> rxBytes;
+        std::vector<uint64_t> rxPackets;
+        std::vector<uint64_t> txBytes;
+        std::vector<uint64_t> txPackets;
+
+        size_t size(void) const { return uid.size(); }
+        void clear(void);
+        void reserve(size_t n);
+        void swap(Table &other);
+        bool keyLess(size_t i, const Table &other, size_t j) const;
+        /* Returns the row with the key of other's row j, or -1. */
+        ssize_t find(const Table &other, size_t j) const;
+    };
+
+    class RowOrder;
+
+    static const char STATS_PATH[];
+    static const int  MAX_SAMPLES;
+    static const int  SAMPLE_INTERVAL_MS;
+
+    int refresh(void);
+    int parse(Table &table);
+    int internIface(const char *name, size_t len);
+    void sortTable(Table &table);
+    static long long nowMs(void);
+
+    /* Reused by every read, never shrunk. */
+    char *mBuffer;
+    size_t mBufferSize;
+
+    std::vector<std::string> mIfaces;
+    Table mCurrent;
+    /* What the previous mCurrent leaves behind, for the next parse(). */
+    Table mScratch;
+    Table mBaseline;
+    bool mHaveBaseline;
+    /* Oldest first, at most MAX_SAMPLES, SAMPLE_INTERVAL_MS apart. */
+    std::list<Table> mSamples;
+};
+
+#endif
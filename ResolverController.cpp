@@ -19,14 +19,38 @@
 
 #include <cutils/log.h>
 
+#include <time.h>
 #include <net/if.h>
 
+#include <algorithm>
+
 // NOTE: <resolv_iface.h> is a private C library header that provides
 //       declarations for _resolv_set_default_iface() and others.
 #include <resolv_iface.h>
 
 #include "ResolverController.h"
 
+/* Roughly where the first server has been timing out on some lookups. */
+const int64_t ResolverController::DEGRADED_SRTT_US = 1500000;
+/* Faster than any server round trip, so answered from the resolver cache. */
+const int64_t ResolverController::CACHE_HIT_US = 5000;
+const int ResolverController::MAX_FAILURES = 3;
+const int ResolverController::GOOD_LOOKUPS_TO_FORGIVE = 64;
+const long long ResolverController::BACKOFF_MS = 30000;
+const long long ResolverController::MIN_REORDER_INTERVAL_MS = 10000;
+const int ResolverController::MAX_BACKOFF_SHIFT = 4;
+
+ResolverController::ResolverController() {
+    pthread_mutex_init(&mLock, NULL);
+}
+
+long long ResolverController::nowMs() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 int ResolverController::setDefaultInterface(const char* iface) {
     if (DBG) {
         ALOGD("setDefaultInterface iface = %s\n", iface);
@@ -34,19 +58,140 @@ int ResolverController::setDefaultInterface(const char* iface) {
 
     _resolv_set_default_iface(iface);
 
+    pthread_mutex_lock(&mLock);
+    mDefaultIface = iface;
+    pthread_mutex_unlock(&mLock);
     return 0;
 }
 
+ResolverController::IfaceServers *ResolverController::findIface(const std::string &iface) {
+    std::list<IfaceServers>::iterator it;
+
+    for (it = mIfaces.begin(); it != mIfaces.end(); it++) {
+        if (it->iface == iface) {
+            return &*it;
+        }
+    }
+    return NULL;
+}
+
 int ResolverController::setInterfaceDnsServers(const char* iface, const char* domains,
         const char** servers, int numservers) {
     if (DBG) {
         ALOGD("setInterfaceDnsServers iface = %s\n", iface);
     }
+
+    pthread_mutex_lock(&mLock);
+    IfaceServers *cfg = findIface(iface);
+    if (!cfg) {
+        mIfaces.push_back(IfaceServers());
+        cfg = &mIfaces.back();
+        cfg->iface = iface;
+        cfg->lastReorderMs = 0;
+    }
+    cfg->domains = domains;
+    cfg->servers.clear();
+    for (int i = 0; i < numservers; i++) {
+        Server server;
+        server.addr = servers[i];
+        server.index = i;
+        server.srttUs = 0;
+        server.failures = server.strikes = server.goodLookups = 0;
+        server.backoffUntilMs = 0;
+        cfg->servers.push_back(server);
+    }
+    pthread_mutex_unlock(&mLock);
+
     _resolv_set_nameservers_for_iface(iface, servers, numservers, domains);
 
     return 0;
 }
 
+/* Backed off servers last, soonest back first; the others in the order set. */
+bool ResolverController::serverBefore(const Server &a, const Server &b) {
+    if (!a.backoffUntilMs != !b.backoffUntilMs) {
+        return !a.backoffUntilMs;
+    }
+    if (a.backoffUntilMs) {
+        return a.backoffUntilMs < b.backoffUntilMs;
+    }
+    return a.index < b.index;
+}
+
+/* Called with mLock held. The resolver flushes the interface's cache on any change. */
+void ResolverController::pushServers(IfaceServers &cfg) {
+    const char *addrs[cfg.servers.size()];
+
+    std::stable_sort(cfg.servers.begin(), cfg.servers.end(), serverBefore);
+    for (size_t i = 0; i < cfg.servers.size(); i++) {
+        addrs[i] = cfg.servers[i].addr.c_str();
+    }
+    ALOGI("DNS servers of %s reordered, %s first", cfg.iface.c_str(), addrs[0]);
+    _resolv_set_nameservers_for_iface(cfg.iface.c_str(), addrs, cfg.servers.size(),
+                                      cfg.domains.c_str());
+}
+
+void ResolverController::reportLookup(const char *iface, int64_t us, bool serverFailed) {
+    long long now = nowMs();
+    bool reorder = false;
+    bool canReorder;
+
+    pthread_mutex_lock(&mLock);
+    IfaceServers *cfg = findIface((iface && *iface) ? std::string(iface) : mDefaultIface);
+    if (!cfg || cfg->servers.size() < 2) {
+        pthread_mutex_unlock(&mLock);
+        return;
+    }
+
+    canReorder = (now - cfg->lastReorderMs >= MIN_REORDER_INTERVAL_MS);
+    Server &first = cfg->servers[0];
+    if (!first.backoffUntilMs) {
+        /* Cache hits say nothing about the server's RTT, and would drag it to 0. */
+        if (serverFailed || us >= CACHE_HIT_US) {
+            /* As TCP smooths its RTT, with a gain of 1/8. */
+            first.srttUs = first.srttUs ? first.srttUs + (us - first.srttUs) / 8 : us;
+        }
+        if (serverFailed) {
+            first.failures++;
+            first.goodLookups = 0;
+        } else {
+            first.failures = 0;
+            if (++first.goodLookups >= GOOD_LOOKUPS_TO_FORGIVE) {
+                first.strikes = 0;
+            }
+        }
+        if (canReorder &&
+                (first.failures >= MAX_FAILURES || first.srttUs > DEGRADED_SRTT_US) &&
+                !cfg->servers[1].backoffUntilMs) {
+            int shift = std::min(first.strikes, MAX_BACKOFF_SHIFT);
+            first.strikes++;
+            first.backoffUntilMs = now + (BACKOFF_MS << shift);
+            ALOGW("DNS server %s of %s backed off for %lld s (srtt %lld us, %d failures)",
+                  first.addr.c_str(), cfg->iface.c_str(), (BACKOFF_MS << shift) / 1000,
+                  (long long) first.srttUs, first.failures);
+            reorder = true;
+        }
+    }
+
+    /* Servers whose backoff ran out get another try, with a clean slate. */
+    for (size_t i = 0; i < cfg->servers.size(); i++) {
+        Server &server = cfg->servers[i];
+        if (canReorder && server.backoffUntilMs && now >= server.backoffUntilMs) {
+            server.backoffUntilMs = 0;
+            server.srttUs = 0;
+            server.failures = 0;
+            server.goodLookups = 0;
+            reorder = true;
+        }
+    }
+
+    if (reorder) {
+        pushServers(*cfg);
+        cfg->lastReorderMs = now;
+    }
+    pthread_mutex_unlock(&mLock);
+}
+
 int ResolverController::setInterfaceAddress(const char* iface, struct in_addr* addr) {
     if (DBG) {
         ALOGD("setInterfaceAddress iface = %s\n", iface);
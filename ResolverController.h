@@ -17,12 +17,19 @@
 #ifndef _RESOLVER_CONTROLLER_H_
 #define _RESOLVER_CONTROLLER_H_
 
+#include <pthread.h>
+#include <stdint.h>
+
 #include <netinet/in.h>
 #include <linux/in.h>
 
+#include <list>
+#include <string>
+#include <vector>
+
 class ResolverController {
 public:
-    ResolverController() {};
+    ResolverController();
     virtual ~ResolverController() {};
 
     int setDefaultInterface(const char* iface);
@@ -36,6 +43,64 @@ public:
     int setDnsInterfaceForUidRange(const char* iface, int uid_start, int uid_end);
     int clearDnsInterfaceForUidRange(const char* iface, int uid_start, int uid_end);
     int clearDnsInterfaceMappings();
+
+    /*
+     * Takes the time and outcome of a lookup on iface ("" for the default),
+     * as seen by the DNS proxy.
+     *
+     * The proxy cannot see which server answered, so the whole lookup is
+     * charged to the first server of the interface: its "RTT" is the time
+     * of the lookup, including any timeouts before a later server answered.
+     * That server keeps a smoothed RTT; when it gets too slow or fails
+     * MAX_FAILURES times in a row, and another server is available, it goes
+     * to the back of the list for a backoff that doubles with every strike.
+     * serverFailed is for errors that point at the server, as opposed to
+     * negative answers. Any success ends a run of failures, but successes
+     * under CACHE_HIT_US are taken as cache hits and left out of the RTT.
+     * Since every reorder flushes the interface's cache, the list changes at
+     * most once per MIN_REORDER_INTERVAL_MS.
+     */
+    void reportLookup(const char *iface, int64_t us, bool serverFailed);
+
+private:
+    class Server {
+    public:
+        std::string addr;
+        /* Position in the list as set. */
+        int index;
+        int64_t srttUs;
+        int failures;
+        int strikes;
+        int goodLookups;
+        /* 0 when not backed off. */
+        long long backoffUntilMs;
+    };
+
+    class IfaceServers {
+    public:
+        std::string iface;
+        std::string domains;
+        /* In the order given to the resolver. */
+        std::vector<Server> servers;
+        long long lastReorderMs;
+    };
+
+    static const int64_t DEGRADED_SRTT_US;
+    static const int64_t CACHE_HIT_US;
+    static const int MAX_FAILURES;
+    static const int GOOD_LOOKUPS_TO_FORGIVE;
+    static const long long BACKOFF_MS;
+    static const long long MIN_REORDER_INTERVAL_MS;
+    static const int MAX_BACKOFF_SHIFT;
+
+    IfaceServers *findIface(const std::string &iface);
+    void pushServers(IfaceServers &cfg);
+    static bool serverBefore(const Server &a, const Server &b);
+    static long long nowMs();
+
+    std::list<IfaceServers> mIfaces;
+    std::string mDefaultIface;
+    pthread_mutex_t mLock;
 };
 
 #endif /* _RESOLVER_CONTROLLER_H_ */
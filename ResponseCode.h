@@ -34,6 +34,12 @@ public:
     static const int TetherDnsFwdTgtListResult = 112;
     static const int TtyListResult             = 113;
     static const int TetheringStatsListResult  = 114;
+    static const int QuotaCounterListResult    = 115;
+    static const int UidStatsListResult        = 116;
+    static const int IdletimerListResult       = 117;
+    static const int CommandRecordResult       = 118;
+    static const int MetricsResult             = 119;
+    static const int TraceResult               = 120;
 
     // 200 series - Requested action has been successfully completed
     static const int CommandOkay               = 200;
@@ -54,6 +60,7 @@ public:
     static const int GetMarkResult             = 225;
     static const int V6RtrAdvResult            = 226;
     static const int RouteConfigurationResult  = 227;
+    static const int AsyncOperationStarted     = 228;
 
     // 400 series - The command was accepted but the requested action
     // did not take place.
@@ -83,5 +90,6 @@ public:
     static const int ServiceGetAddrInfoSuccess      = 612;
     static const int InterfaceClassActivity         = 613;
     static const int InterfaceAddressChange         = 614;
+    static const int AsyncOperationCompleted        = 615;
 };
 #endif
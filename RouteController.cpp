@@ -37,7 +37,10 @@
 
 #include <sys/types.h>
 
+#include <vector>
+
 #include <cutils/log.h>
+#include "CommandExecutor.h"
 #include "RouteController.h"
 
 const char *TAG = "RouteController";
@@ -62,6 +65,32 @@ std::string RouteController::_runIpCmd(const char * cmd) {
         return std::string(strerror(E2BIG));
     }
 
+    /*
+     * Only fork/exec gives the error text (and the "exists" the callers
+     * look for); the other executors get the command like any other, so
+     * that recorded or batched route changes don't reach the kernel.
+     */
+    CommandExecutor *executor = CommandExecutor::get();
+    if (executor != ForkExecutor::Instance()) {
+        std::vector<char> words(cmd, cmd + strlen(cmd) + 1);
+        std::vector<const char *> argv;
+        char *next = &words[0];
+        char *word;
+
+        argv.push_back(IP_PATH);
+        while ((word = strsep(&next, " "))) {
+            if (*word) {
+                argv.push_back(word);
+            }
+        }
+        argv.push_back(NULL);
+        if (executor->execvp(argv.size() - 1, &argv[0], NULL, false)) {
+            res = cmd;
+            res += ": failed";
+        }
+        return res;
+    }
+
     buffer = IP_PATH;
     buffer += " ";
     buffer += cmd;
@@ -24,8 +24,12 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 
+#include <net/if.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <linux/fib_rules.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 
 #define LOG_TAG "SecondaryTablController"
 #include <cutils/log.h>
@@ -33,6 +37,7 @@
 #include <logwrap/logwrap.h>
 
 #include "ResponseCode.h"
+#include "CommandExecutor.h"
 #include "NetdConstants.h"
 #include "SecondaryTableController.h"
 
@@ -91,6 +96,20 @@ int SecondaryTableController::setupIptablesHooks() {
     return res;
 }
 
+int SecondaryTableController::compileIptablesHooks(IptablesRuleset *rs) {
+    std::string rule;
+
+    rs->declareChain(V4V6, "mangle", LOCAL_MANGLE_OUTPUT);
+    // Do not mark sockets that have already been marked elsewhere(for example in DNS or protect).
+    rule = std::string("-A ") + LOCAL_MANGLE_OUTPUT + " -m mark ! --mark 0 -j RETURN";
+    rs->addRule(V4V6, "mangle", rule);
+    // protect the legacy VPN daemons from routes.
+    // TODO: Remove this when legacy VPN's are removed.
+    rule = std::string("-A ") + LOCAL_MANGLE_OUTPUT + " -m owner --uid-owner vpn -j RETURN";
+    rs->addRule(V4V6, "mangle", rule);
+    return 0;
+}
+
 int SecondaryTableController::findTableNumber(const char *iface) {
     int i;
     for (i = 0; i < INTERFACES_TRACKED; i++) {
@@ -230,27 +249,126 @@ int SecondaryTableController::removeRoute(SocketClient *cli, char *iface, char *
     return modifyRoute(cli, DEL, iface, dest, prefix, gateway, tableIndex);
 }
 
+/*
+ * The rules and routes NatController sets up for every tethered address are
+ * sent straight over rtnetlink rather than forking ip, as tethering start
+ * and stop run a few of them per address.
+ */
+struct RtRequest {
+    struct nlmsghdr hdr;
+    union {
+        struct rtmsg rtm;
+        struct fib_rule_hdr frh;
+    };
+    char attrs[128];
+};
+
+static void addRtAttr(struct RtRequest *req, int type, const void *data, int len) {
+    struct rtattr *rta = (struct rtattr *) (((char *) req) + NLMSG_ALIGN(req->hdr.nlmsg_len));
+
+    rta->rta_type = type;
+    rta->rta_len = RTA_LENGTH(len);
+    memcpy(RTA_DATA(rta), data, len);
+    req->hdr.nlmsg_len = NLMSG_ALIGN(req->hdr.nlmsg_len) + RTA_ALIGN(rta->rta_len);
+}
+
+/* Parses "addr[/prefix]"; returns the address family, or -1. */
+static int parseRtPrefix(const char *prefix, unsigned char *bytes, int *prefixLen) {
+    char addr[INET6_ADDRSTRLEN];
+    const char *slash = strchr(prefix, '/');
+    size_t len = slash ? (size_t) (slash - prefix) : strlen(prefix);
+    int family = strchr(prefix, ':') ? AF_INET6 : AF_INET;
+    int maxLen = (family == AF_INET6) ? 128 : 32;
+
+    if (len >= sizeof(addr)) {
+        return -1;
+    }
+    memcpy(addr, prefix, len);
+    addr[len] = '\0';
+    if (inet_pton(family, addr, bytes) != 1) {
+        return -1;
+    }
+    *prefixLen = slash ? atoi(slash + 1) : maxLen;
+    if (*prefixLen < 0 || *prefixLen > maxLen) {
+        return -1;
+    }
+    return family;
+}
+
+/* Sends req and waits for its ack; returns 0, or -1 with errno set. */
+static int sendRtRequest(struct RtRequest *req) {
+    struct sockaddr_nl snl;
+    char buf[512];
+    int sock;
+    int rc = -1;
+
+    if ((sock = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_ROUTE)) < 0) {
+        return -1;
+    }
+    memset(&snl, 0, sizeof(snl));
+    snl.nl_family = AF_NETLINK;
+    req->hdr.nlmsg_flags |= NLM_F_REQUEST | NLM_F_ACK;
+    req->hdr.nlmsg_seq = 1;
+    if (sendto(sock, req, req->hdr.nlmsg_len, 0, (struct sockaddr *) &snl, sizeof(snl)) < 0) {
+        goto out;
+    }
+    while (1) {
+        ssize_t len = recv(sock, buf, sizeof(buf), 0);
+        if (len < 0) {
+            if (errno == EINTR)
+                continue;
+            goto out;
+        }
+        struct nlmsghdr *nh;
+        for (nh = (struct nlmsghdr *) buf; NLMSG_OK(nh, (size_t) len); nh = NLMSG_NEXT(nh, len)) {
+            if (nh->nlmsg_type == NLMSG_ERROR) {
+                struct nlmsgerr *err = (struct nlmsgerr *) NLMSG_DATA(nh);
+                if (err->error) {
+                    errno = -err->error;
+                } else {
+                    rc = 0;
+                }
+                goto out;
+            }
+        }
+    }
+out:
+    int saved_errno = errno;
+    close(sock);
+    errno = saved_errno;
+    return rc;
+}
+
 int SecondaryTableController::modifyFromRule(int tableIndex, const char *action,
         const char *addr) {
-    char tableIndex_str[11];
+    struct RtRequest req;
+    unsigned char bytes[sizeof(struct in6_addr)];
+    int prefixLen;
+    int family;
+    bool add = !strcmp(action, ADD);
 
     if (verifyTableIndex(tableIndex)) {
         return -1;
     }
+    if ((family = parseRtPrefix(addr, bytes, &prefixLen)) < 0) {
+        ALOGE("Bad address %s", addr);
+        errno = EINVAL;
+        return -1;
+    }
 
-    snprintf(tableIndex_str, sizeof(tableIndex_str), "%d", tableIndex +
-            BASE_TABLE_NUMBER);
-    const char *cmd[] = {
-            IP_PATH,
-            getVersion(addr),
-            "rule",
-            action,
-            "from",
-            addr,
-            "table",
-            tableIndex_str
-    };
-    if (runCmd(ARRAY_SIZE(cmd), cmd)) {
+    uint32_t table = tableIndex + BASE_TABLE_NUMBER;
+    memset(&req, 0, sizeof(req));
+    req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct fib_rule_hdr));
+    req.hdr.nlmsg_type = add ? RTM_NEWRULE : RTM_DELRULE;
+    req.hdr.nlmsg_flags = add ? NLM_F_CREATE | NLM_F_EXCL : 0;
+    req.frh.family = family;
+    req.frh.src_len = prefixLen;
+    req.frh.table = table;
+    req.frh.action = add ? FR_ACT_TO_TBL : FR_ACT_UNSPEC;
+    addRtAttr(&req, FRA_SRC, bytes, (family == AF_INET6) ? 16 : 4);
+    addRtAttr(&req, FRA_TABLE, &table, sizeof(table));
+    if (sendRtRequest(&req)) {
+        ALOGE("ip rule %s from %s table %d failed (%s)", action, addr, table, strerror(errno));
         return -1;
     }
 
@@ -260,15 +378,11 @@ int SecondaryTableController::modifyFromRule(int tableIndex, const char *action,
 
 int SecondaryTableController::modifyLocalRoute(int tableIndex, const char *action,
         const char *iface, const char *addr) {
-    char tableIndex_str[11];
-    char action_local[IPARGSIZ];
-    /* append ensures that routes are successfully added for
-    the same address but with different interface names */
-    if ( strcmp( action, ADD ) == 0 ) {
-      strncpy(action_local, APPEND, strlen(APPEND)+1);
-    } else {
-      strncpy(action_local, action, IPARGSIZ);
-    }
+    struct RtRequest req;
+    unsigned char bytes[sizeof(struct in6_addr)];
+    int prefixLen;
+    int family;
+    bool add = !strcmp(action, ADD);
 
     if (verifyTableIndex(tableIndex)) {
         return -1;
@@ -276,20 +390,43 @@ int SecondaryTableController::modifyLocalRoute(int tableIndex, const char *actio
 
     modifyRuleCount(tableIndex, action); // some del's will fail as the iface is already gone.
 
-    snprintf(tableIndex_str, sizeof(tableIndex_str), "%d", tableIndex +
-            BASE_TABLE_NUMBER);
-    const char *cmd[] = {
-            IP_PATH,
-            "route",
-            action_local,
-            addr,
-            "dev",
-            iface,
-            "table",
-            tableIndex_str
-    };
+    if ((family = parseRtPrefix(addr, bytes, &prefixLen)) < 0) {
+        ALOGE("Bad address %s", addr);
+        errno = EINVAL;
+        return -1;
+    }
+    uint32_t ifindex = if_nametoindex(iface);
+    if (!ifindex) {
+        errno = ENODEV;
+        return -1;
+    }
 
-    return runCmd(ARRAY_SIZE(cmd), cmd);
+    uint32_t table = tableIndex + BASE_TABLE_NUMBER;
+    memset(&req, 0, sizeof(req));
+    req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+    req.hdr.nlmsg_type = add ? RTM_NEWROUTE : RTM_DELROUTE;
+    /* append ensures that routes are successfully added for
+    the same address but with different interface names */
+    req.hdr.nlmsg_flags = add ? NLM_F_CREATE | NLM_F_APPEND : 0;
+    req.rtm.rtm_family = family;
+    req.rtm.rtm_dst_len = prefixLen;
+    req.rtm.rtm_table = table;
+    if (add) {
+        req.rtm.rtm_protocol = RTPROT_BOOT;
+        req.rtm.rtm_scope = RT_SCOPE_LINK;
+        req.rtm.rtm_type = RTN_UNICAST;
+    } else {
+        req.rtm.rtm_scope = RT_SCOPE_NOWHERE;
+    }
+    addRtAttr(&req, RTA_DST, bytes, (family == AF_INET6) ? 16 : 4);
+    addRtAttr(&req, RTA_OIF, &ifindex, sizeof(ifindex));
+    addRtAttr(&req, RTA_TABLE, &table, sizeof(table));
+    if (sendRtRequest(&req)) {
+        ALOGE("ip route %s %s dev %s table %d failed (%s)", action, addr, iface, table,
+              strerror(errno));
+        return -1;
+    }
+    return 0;
 }
 int SecondaryTableController::addFwmarkRule(const char *iface) {
     return setFwmarkRule(iface, true);
@@ -600,6 +737,6 @@ void SecondaryTableController::getProtectMark(SocketClient *cli) {
 int SecondaryTableController::runCmd(int argc, const char **argv) {
     int ret = 0;
 
-    ret = android_fork_execvp(argc, (char **)argv, NULL, false, false);
+    ret = CommandExecutor::get()->execvp(argc, argv, NULL, false);
     return ret;
 }
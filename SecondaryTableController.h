@@ -21,6 +21,7 @@
 
 #include <net/if.h>
 #include "UidMarkMap.h"
+#include "IptablesRuleset.h"
 #include "NetdConstants.h"
 
 #ifndef IFNAMSIZ
@@ -61,6 +62,8 @@ public:
     void getProtectMark(SocketClient *cli);
 
     int setupIptablesHooks();
+    /* Adds the rules setupIptablesHooks() would run to rs instead. */
+    int compileIptablesHooks(IptablesRuleset *rs);
 
     static const char* LOCAL_MANGLE_OUTPUT;
     static const char* LOCAL_MANGLE_POSTROUTING;
@@ -41,6 +41,8 @@
 #include "ResponseCode.h"
 
 #include "SoftapController.h"
+#include "ProcessSupervisor.h"
+#include "SoftapEvents.h"
 
 #ifndef HOSTAPD_DRIVER_NAME
 #define HOSTAPD_DRIVER_NAME "nl80211"
@@ -48,21 +50,36 @@
 
 static const char HOSTAPD_CONF_FILE[]    = "/data/misc/wifi/hostapd.conf";
 static const char HOSTAPD_BIN_FILE[]    = "/system/bin/hostapd";
+static const char HOSTAPD_CTRL_DIR[]    = "/data/misc/wifi/hostapd";
 
 SoftapController::SoftapController()
-    : mPid(0) {}
+    : mPid(0), mStoppingPid(0) {
+    memset(mIface, 0, sizeof(mIface));
+    pthread_mutex_init(&mLock, NULL);
+}
 
 SoftapController::~SoftapController() {
 }
 
 int SoftapController::startSoftap() {
+    SoftapPhaseTimer timer("startSoftap");
+    char ctrlPath[PATH_MAX];
     pid_t pid = 1;
 
-    if (mPid) {
+    if (isSoftapStarted()) {
         ALOGE("SoftAP is already running");
         return ResponseCode::SoftapStatusResult;
     }
 
+    waitForStoppedHostapd();
+    timer.phase("wait for old hostapd");
+
+    // hostapd creates its control socket once the BSS is set up
+    snprintf(ctrlPath, sizeof(ctrlPath), "%s/%s", HOSTAPD_CTRL_DIR, mIface);
+    if (mIface[0] != '\0') {
+        unlink(ctrlPath);
+    }
+
     if ((pid = fork()) < 0) {
         ALOGE("fork failed (%s)", strerror(errno));
         return ResponseCode::ServiceStartFailed;
@@ -78,32 +95,91 @@ int SoftapController::startSoftap() {
         ALOGE("SoftAP failed to start");
         return ResponseCode::ServiceStartFailed;
     } else {
+        pthread_mutex_lock(&mLock);
         mPid = pid;
+        pthread_mutex_unlock(&mLock);
+        ProcessSupervisor::Instance()->watch(pid, "hostapd", this);
+        timer.phase("fork hostapd");
+        if (mIface[0] == '\0') {
+            // setSoftap has not told us the interface, so there is nothing to watch
+            usleep(AP_BSS_START_DELAY);
+        } else if (softapWaitForPath(ctrlPath, AP_BSS_START_TIMEOUT_MS)) {
+            // Also taken when the control directory does not exist yet and
+            // cannot be watched, so give hostapd at least the old delay.
+            ALOGW("hostapd control socket %s not ready (%s)", ctrlPath, strerror(errno));
+            usleep(AP_BSS_START_DELAY);
+        }
+        timer.phase("wait for hostapd");
         ALOGD("SoftAP started successfully");
-        usleep(AP_BSS_START_DELAY);
     }
+    timer.done();
     return ResponseCode::SoftapStatusResult;
 }
 
 int SoftapController::stopSoftap() {
+    SoftapPhaseTimer timer("stopSoftap");
+    pid_t pid;
+
+    pthread_mutex_lock(&mLock);
+    pid = mPid;
+    mPid = 0;
+    pthread_mutex_unlock(&mLock);
 
-    if (mPid == 0) {
+    if (pid == 0) {
         ALOGE("SoftAP is not running");
         return ResponseCode::SoftapStatusResult;
     }
 
     ALOGD("Stopping the SoftAP service...");
-    kill(mPid, SIGTERM);
-    waitpid(mPid, NULL, 0);
-
-    mPid = 0;
+    // Whoever needs the interface released next waits for the exit in
+    // waitForStoppedHostapd().
+    ProcessSupervisor::Instance()->stop(pid);
+    mStoppingPid = pid;
+    timer.phase("stop hostapd");
     ALOGD("SoftAP stopped successfully");
-    usleep(AP_BSS_STOP_DELAY);
+    timer.done();
     return ResponseCode::SoftapStatusResult;
 }
 
+/*
+ * hostapd must have released the interface before a new hostapd is started
+ * or the firmware is reloaded.  Waits for a stopped one to exit (the
+ * supervisor SIGKILLs stragglers) and for the link to go down.
+ */
+void SoftapController::waitForStoppedHostapd() {
+    if (mStoppingPid == 0) {
+        return;
+    }
+
+    if (ProcessSupervisor::Instance()->waitForExit(mStoppingPid,
+            ProcessSupervisor::DEFAULT_STOP_TIMEOUT_MS + 500)) {
+        ALOGE("hostapd (%d) did not exit", mStoppingPid);
+    }
+    mStoppingPid = 0;
+
+    if (mIface[0] == '\0') {
+        usleep(AP_BSS_STOP_DELAY);
+    } else if (softapWaitForLink(mIface, SOFTAP_LINK_DOWN, AP_BSS_STOP_TIMEOUT_MS)) {
+        ALOGW("%s still up %d ms after hostapd exited", mIface, AP_BSS_STOP_TIMEOUT_MS);
+    }
+}
+
 bool SoftapController::isSoftapStarted() {
-    return (mPid != 0);
+    bool started;
+
+    pthread_mutex_lock(&mLock);
+    started = (mPid != 0);
+    pthread_mutex_unlock(&mLock);
+    return started;
+}
+
+void SoftapController::onChildExited(pid_t pid, int status) {
+    pthread_mutex_lock(&mLock);
+    if (mPid == pid) {
+        ALOGE("hostapd exited unexpectedly");
+        mPid = 0; // let it be started again
+    }
+    pthread_mutex_unlock(&mLock);
 }
 
 /*
@@ -131,6 +207,8 @@ int SoftapController::setSoftap(int argc, char *argv[]) {
         return ResponseCode::CommandSyntaxError;
     }
 
+    strlcpy(mIface, argv[2], sizeof(mIface));
+
     if (!strcasecmp(argv[4], "hidden"))
         hidden = 1;
 
@@ -229,6 +307,7 @@ int SoftapController::fwReloadSoftap(int argc, char *argv[])
     }
     if (!fwpath)
         return ResponseCode::CommandParameterError;
+    waitForStoppedHostapd();
     if (wifi_change_fw_path((const char *)fwpath)) {
         ALOGE("Softap fwReload failed");
         return ResponseCode::OperationFailed;
@@ -17,17 +17,24 @@
 #ifndef _SOFTAP_CONTROLLER_H
 #define _SOFTAP_CONTROLLER_H
 
+#include <pthread.h>
 #include <linux/in.h>
 #include <net/if.h>
 
+#include "ProcessSupervisor.h"
+
 #define SOFTAP_MAX_BUFFER_SIZE	4096
 #define AP_BSS_START_DELAY	200000
 #define AP_BSS_STOP_DELAY	500000
 #define AP_SET_CFG_DELAY	500000
 #define AP_DRIVER_START_DELAY	800000
+#define AP_BSS_START_TIMEOUT_MS	3000
+#define AP_BSS_STOP_TIMEOUT_MS	(AP_BSS_STOP_DELAY / 1000) // never longer than the old sleep
+#define AP_LINK_TIMEOUT_MS	2000
+#define AP_RFKILL_TIMEOUT_MS	3000
 #define AP_CHANNEL_DEFAULT	6
 
-class SoftapController {
+class SoftapController : public ProcessSupervisor::Client {
 public:
     SoftapController();
     virtual ~SoftapController();
@@ -41,13 +48,18 @@ public:
     bool isSoftapStarted();
     int setSoftap(int argc, char *argv[]);
     int fwReloadSoftap(int argc, char *argv[]);
+
+    virtual void onChildExited(pid_t pid, int status);
 private:
 #ifdef BLADE_SOFTAP
     char mBuf[SOFTAP_MAX_BUFFER_SIZE];
-    char mIface[IFNAMSIZ];
 #endif
+    char mIface[IFNAMSIZ];
     pid_t mPid;
+    pthread_mutex_t mLock; // mPid is also cleared from the supervisor thread
+    pid_t mStoppingPid; // stopped hostapd that may still hold the interface
     void generatePsk(char *ssid, char *passphrase, char *psk);
+    void waitForStoppedHostapd();
 };
 
 #endif
@@ -35,6 +35,7 @@
 #include <cutils/log.h>
 
 #include "SoftapController.h"
+#include "SoftapEvents.h"
 #include "ResponseCode.h"
 
 extern "C" int delete_module(const char *, unsigned int);
@@ -74,6 +75,8 @@ static const char DRIVER_MODULE_AP_ARG[] = WIFI_DRIVER_MODULE_AP_ARG;
 
 static struct wpa_ctrl *ctrl_conn;
 static char iface[PROPERTY_VALUE_MAX];
+
+#define HOSTAPD_CTRL_TIMEOUT_MS 8000
 int mProfileValid;
 
 /* rfkill support borrowed from bluetooth */
@@ -145,6 +148,7 @@ out:
 static int set_wifi_power(int on) {
     int sz;
     int fd = -1;
+    int eventFd = -1;
     int ret = -1;
     const char buffer = (on ? '1' : '0');
 
@@ -162,18 +166,26 @@ static int set_wifi_power(int on) {
                 strerror(errno), errno);
         goto out;
     }
-    /* Give it a few seconds before changing state */
-    sleep(3);
+    /* Listen before writing so the change event cannot be missed */
+    eventFd = softapOpenRfkillEvents();
     sz = write(fd, &buffer, 1);
     if (sz < 0) {
         ALOGE("write(%s) failed: %s (%d)", rfkill_state_path, strerror(errno),
                 errno);
         goto out;
     }
+    if (eventFd >= 0) {
+        if (softapWaitForRfkill(eventFd, rfkill_id, on, AP_RFKILL_TIMEOUT_MS)) {
+            ALOGW("rfkill%d did not report state %d within %d ms", rfkill_id, on,
+                    AP_RFKILL_TIMEOUT_MS);
+        }
+        eventFd = -1;
+    }
     ret = 0;
 
 out:
     if (fd >= 0) close(fd);
+    if (eventFd >= 0) close(eventFd);
     return ret;
 }
 
@@ -325,19 +337,13 @@ int wifi_connect_to_hostapd()
     snprintf(ifname, sizeof(ifname), "%s/%s", IFACE_DIR, iface);
     ALOGD("ifname = %s\n", ifname);
 
-    { /* check iface file is ready */
-	    int cnt = 160; /* 8 seconds (160*50)*/
-	    sched_yield();
-	    while ( access(ifname, F_OK|W_OK)!=0 && cnt-- > 0) {
-		    usleep(50000);
-	    }
-	    if (access(ifname, F_OK|W_OK)==0) {
-		    snprintf(ifname, sizeof(ifname), "%s/%s", IFACE_DIR, iface);
-		    ALOGD("ifname %s is ready to read/write cnt=%d\n", ifname, cnt);
-	    } else {
-		    strlcpy(ifname, iface, sizeof(ifname));
-		    ALOGD("ifname %s is not ready, cnt=%d\n", ifname, cnt);
-	    }
+    /* check iface file is ready; hostapd creates it once it is listening */
+    if (softapWaitForPath(ifname, HOSTAPD_CTRL_TIMEOUT_MS) == 0 &&
+            access(ifname, F_OK|W_OK) == 0) {
+        ALOGD("ifname %s is ready to read/write\n", ifname);
+    } else {
+        strlcpy(ifname, iface, sizeof(ifname));
+        ALOGD("ifname %s is not ready\n", ifname);
     }
 
     while (--connretry && (ctrl_conn = wpa_ctrl_open(ifname)) == NULL) {
@@ -413,7 +419,8 @@ static int rmmod(const char *modname)
 }
 
 SoftapController::SoftapController()
-    : mPid(0) {
+    : mPid(0), mStoppingPid(0) {
+    pthread_mutex_init(&mLock, NULL);
     memset(mIface, 0, sizeof(mIface));
     mProfileValid = 0;
     ctrl_conn = NULL;
@@ -463,7 +470,9 @@ int SoftapController::startDriver(const char *iface) {
 #else
 	ret = insmod(WIFI_MODULE_PATH, "ifname=athap0 wowenable=0");
 #endif
-	sleep(1);
+	if (!ret && softapWaitForLink("athap0", SOFTAP_LINK_PRESENT, AP_LINK_TIMEOUT_MS)) {
+		ALOGW("athap0 did not appear after loading the driver");
+	}
 #else
 	set_wifi_power(0);
 	{
@@ -483,6 +492,9 @@ int SoftapController::startDriver(const char *iface) {
 			ALOGD("interface renamed for AP mode");
 			usleep(500000); /* Give it a while after a name change... */
 			ret = set_wifi_power(1);
+			if (!ret && softapWaitForLink("athap0", SOFTAP_LINK_PRESENT, AP_LINK_TIMEOUT_MS)) {
+				ALOGW("athap0 did not appear after powering up");
+			}
 		} else if (buffer == 'a') {
 			ALOGD("interface already named for AP mode");
 			ret = 0;
@@ -526,7 +538,9 @@ int SoftapController::stopDriver(const char *iface) {
 #ifdef WIFI_MODULE_PATH
 	rmmod("ar6000");
 	ret = insmod(WIFI_MODULE_PATH, "");
-	sleep(1);
+	if (!ret && softapWaitForLink("wlan0", SOFTAP_LINK_PRESENT, AP_LINK_TIMEOUT_MS)) {
+		ALOGW("wlan0 did not appear after reloading the driver");
+	}
 #else
 	ret = set_wifi_power(0);
 	if (!ret) {
@@ -562,6 +576,7 @@ int SoftapController::stopDriver(const char *iface) {
 }
 
 int SoftapController::startSoftap() {
+    SoftapPhaseTimer timer("startSoftap");
     struct iwreq wrq;
     pid_t pid = 1;
     int fnum, ret;
@@ -576,6 +591,7 @@ int SoftapController::startSoftap() {
     if (!mPid) {
         ALOGW("Softap driver not started - loading now");
         startDriver("athap0");
+        timer.phase("start driver");
     }
 #if 0
    if ((pid = fork()) < 0) {
@@ -590,7 +606,10 @@ int SoftapController::startSoftap() {
     } else {
         ifc_init();
         ifc_up("athap0");
-        sleep(1); /* Give the driver time to settle... */
+        if (softapWaitForLink("athap0", SOFTAP_LINK_UP, AP_LINK_TIMEOUT_MS)) {
+            ALOGW("Softap startap - athap0 not up after %d ms", AP_LINK_TIMEOUT_MS);
+        }
+        timer.phase("interface up");
 
         ret = wifi_start_hostapd();
         if (ret < 0) {
@@ -598,15 +617,14 @@ int SoftapController::startSoftap() {
             stopDriver("athap0");
             return ResponseCode::ServiceStartFailed;
         }
-
-        sched_yield();
-	usleep(100000);
+        timer.phase("start hostapd");
 
         ret = wifi_connect_to_hostapd();
         if (ret < 0) {
             ALOGE("Softap startap - connect to hostapd fails");
             return ResponseCode::ServiceStartFailed;
         }
+        timer.phase("attach to hostapd");
 
         /* Indicate interface up */
 
@@ -621,7 +639,6 @@ int SoftapController::startSoftap() {
         else {
            mPid = pid;
            ALOGD("Softap startap - Ok");
-           usleep(AP_BSS_START_DELAY);
         }
     }
 
@@ -633,11 +650,13 @@ int SoftapController::startSoftap() {
         acquire_wake_lock(PARTIAL_WAKE_LOCK, AP_WAKE_LOCK);
     }
 
+    timer.done();
     return ResponseCode::SoftapStatusResult;
 
 }
 
 int SoftapController::stopSoftap() {
+    SoftapPhaseTimer timer("stopSoftap");
     struct iwreq wrq;
     int fnum, ret;
 
@@ -651,6 +670,7 @@ int SoftapController::stopSoftap() {
     ret = wifi_stop_hostapd();
     mPid = 0;
     ALOGD("Softap service stopped: %d", ret);
+    timer.phase("stop hostapd");
 
 #ifndef WIFI_MODULE_PATH
     set_wifi_power(0);
@@ -682,7 +702,11 @@ int SoftapController::stopSoftap() {
     }
 #endif
     release_wake_lock(AP_WAKE_LOCK);
-    usleep(AP_BSS_STOP_DELAY);
+    if (softapWaitForLink("athap0", SOFTAP_LINK_DOWN, AP_BSS_STOP_TIMEOUT_MS)) {
+        ALOGW("Softap stopap - athap0 still up after %d ms", AP_BSS_STOP_TIMEOUT_MS);
+    }
+    timer.phase("interface down");
+    timer.done();
     return ResponseCode::SoftapStatusResult;
 }
 
@@ -690,6 +714,10 @@ bool SoftapController::isSoftapStarted() {
     return (mPid != 0);
 }
 
+void SoftapController::onChildExited(pid_t pid, int status) {
+    // hostapd is started through libhardware_legacy here, so nothing is watched.
+}
+
 /*
  * Arguments:
  *  argv[2] - wlan interface
@@ -792,7 +820,6 @@ int SoftapController::setSoftap(int argc, char *argv[]) {
     }
 
     ALOGD("Softap set - Ok");
-    usleep(AP_SET_CFG_DELAY);
     return ResponseCode::SoftapStatusResult;
 }
 
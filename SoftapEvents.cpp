@@ -0,0 +1,263 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include <net/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/rfkill.h>
+
+#define LOG_TAG "SoftapController"
+#include <cutils/log.h>
+
+#include "SoftapEvents.h"
+
+static long long monotonicMs() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Polls fd until readable or deadline; returns 1, 0 on timeout, -1 on error. */
+static int waitReadable(int fd, long long deadline) {
+    struct pollfd pfd;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while (1) {
+        long long remaining = deadline - monotonicMs();
+        if (remaining <= 0) {
+            return 0;
+        }
+        pfd.revents = 0;
+        int rc = poll(&pfd, 1, (int) remaining);
+        if (rc < 0 && errno == EINTR) {
+            continue;
+        }
+        return (rc > 0 ? 1 : rc);
+    }
+}
+
+static bool linkConditionHolds(const char *iface, SoftapLinkCondition cond) {
+    struct ifreq ifr;
+    bool present;
+    int sock;
+
+    if ((sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+        return false;
+    }
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, iface, IFNAMSIZ - 1);
+    present = (ioctl(sock, SIOCGIFFLAGS, &ifr) == 0);
+    close(sock);
+
+    switch (cond) {
+    case SOFTAP_LINK_PRESENT:
+        return present;
+    case SOFTAP_LINK_UP:
+        return present && (ifr.ifr_flags & IFF_UP);
+    case SOFTAP_LINK_DOWN:
+        return !present || !(ifr.ifr_flags & IFF_UP);
+    }
+    return false;
+}
+
+int softapWaitForLink(const char *iface, SoftapLinkCondition cond, int timeoutMs) {
+    struct sockaddr_nl snl;
+    long long deadline = monotonicMs() + timeoutMs;
+    int sock;
+    int rc = -1;
+
+    if ((sock = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_ROUTE)) < 0) {
+        ALOGE("Unable to open rtnetlink socket (%s)", strerror(errno));
+        return -1;
+    }
+    memset(&snl, 0, sizeof(snl));
+    snl.nl_family = AF_NETLINK;
+    snl.nl_groups = RTMGRP_LINK;
+    if (bind(sock, (struct sockaddr *) &snl, sizeof(snl)) < 0) {
+        ALOGE("Unable to bind rtnetlink socket (%s)", strerror(errno));
+        close(sock);
+        return -1;
+    }
+
+    // Subscribed first, so a change between this check and the wait is not lost.
+    if (linkConditionHolds(iface, cond)) {
+        close(sock);
+        return 0;
+    }
+
+    while (rc != 0 && waitReadable(sock, deadline) > 0) {
+        char buf[4096];
+        ssize_t len = recv(sock, buf, sizeof(buf), 0);
+        if (len <= 0) {
+            continue;
+        }
+        struct nlmsghdr *nh;
+        for (nh = (struct nlmsghdr *) buf; NLMSG_OK(nh, (size_t) len);
+                nh = NLMSG_NEXT(nh, len)) {
+            if (nh->nlmsg_type != RTM_NEWLINK && nh->nlmsg_type != RTM_DELLINK) {
+                continue;
+            }
+            struct ifinfomsg *ifi = (struct ifinfomsg *) NLMSG_DATA(nh);
+            int attrLen = IFLA_PAYLOAD(nh);
+            const char *name = NULL;
+            struct rtattr *rta;
+            for (rta = IFLA_RTA(ifi); RTA_OK(rta, attrLen); rta = RTA_NEXT(rta, attrLen)) {
+                if (rta->rta_type == IFLA_IFNAME) {
+                    name = (const char *) RTA_DATA(rta);
+                }
+            }
+            if (name == NULL || strcmp(name, iface)) {
+                continue;
+            }
+            bool gone = (nh->nlmsg_type == RTM_DELLINK);
+            bool up = !gone && (ifi->ifi_flags & IFF_UP);
+            if ((cond == SOFTAP_LINK_PRESENT && !gone) ||
+                    (cond == SOFTAP_LINK_UP && up) ||
+                    (cond == SOFTAP_LINK_DOWN && !up)) {
+                rc = 0;
+                break;
+            }
+        }
+    }
+    close(sock);
+    if (rc) {
+        errno = ETIMEDOUT;
+    }
+    return rc;
+}
+
+int softapWaitForPath(const char *path, int timeoutMs) {
+    long long deadline = monotonicMs() + timeoutMs;
+    char dir[PATH_MAX];
+    const char *base;
+    int fd;
+    int rc = -1;
+
+    base = strrchr(path, '/');
+    if (base == NULL || (size_t) (base - path) >= sizeof(dir)) {
+        errno = EINVAL;
+        return -1;
+    }
+    strncpy(dir, path, base - path);
+    dir[base - path] = '\0';
+    base++;
+
+    if ((fd = inotify_init()) < 0) {
+        rc = errno;
+        ALOGE("inotify_init failed (%s)", strerror(rc));
+        errno = rc;
+        return -1;
+    }
+    if (inotify_add_watch(fd, dir, IN_CREATE | IN_MOVED_TO) < 0) {
+        rc = errno;
+        ALOGE("Unable to watch %s (%s)", dir, strerror(rc));
+        close(fd);
+        errno = rc;
+        return -1;
+    }
+
+    if (access(path, F_OK) == 0) {
+        close(fd);
+        return 0;
+    }
+
+    while (rc != 0 && waitReadable(fd, deadline) > 0) {
+        char buf[sizeof(struct inotify_event) + NAME_MAX + 1];
+        ssize_t len = read(fd, buf, sizeof(buf));
+        ssize_t off = 0;
+        while (off + (ssize_t) sizeof(struct inotify_event) <= len) {
+            struct inotify_event *ev = (struct inotify_event *) (buf + off);
+            if (ev->len > 0 && !strcmp(ev->name, base)) {
+                rc = 0;
+                break;
+            }
+            off += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+    close(fd);
+    if (rc) {
+        errno = ETIMEDOUT;
+    }
+    return rc;
+}
+
+int softapOpenRfkillEvents() {
+    int fd = open("/dev/rfkill", O_RDONLY | O_NONBLOCK);
+
+    if (fd < 0) {
+        ALOGW("Unable to open /dev/rfkill (%s)", strerror(errno));
+    }
+    return fd;
+}
+
+int softapWaitForRfkill(int fd, int idx, bool unblocked, int timeoutMs) {
+    long long deadline = monotonicMs() + timeoutMs;
+    int rc = -1;
+
+    if (fd < 0) {
+        errno = EBADF;
+        return -1;
+    }
+
+    while (rc != 0 && waitReadable(fd, deadline) > 0) {
+        struct rfkill_event ev;
+        // The first events replay the current state of every switch.
+        while (read(fd, &ev, sizeof(ev)) >= (ssize_t) RFKILL_EVENT_SIZE_V1) {
+            if ((int) ev.idx != idx || ev.op == RFKILL_OP_DEL) {
+                continue;
+            }
+            if ((!ev.soft && !ev.hard) == unblocked) {
+                rc = 0;
+            }
+        }
+    }
+    close(fd);
+    if (rc) {
+        errno = ETIMEDOUT;
+    }
+    return rc;
+}
+
+SoftapPhaseTimer::SoftapPhaseTimer(const char *operation) {
+    mOperation = operation;
+    mStart = mLast = monotonicMs();
+}
+
+void SoftapPhaseTimer::phase(const char *name) {
+    long long now = monotonicMs();
+
+    ALOGD("%s: %s took %lld ms", mOperation, name, now - mLast);
+    mLast = now;
+}
+
+void SoftapPhaseTimer::done() {
+    ALOGD("%s: done in %lld ms", mOperation, monotonicMs() - mStart);
+}
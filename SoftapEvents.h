@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SOFTAP_EVENTS_H
+#define _SOFTAP_EVENTS_H
+
+/*
+ * Bounded waits used by the SoftapController variants in place of fixed
+ * sleeps.  Each returns 0 as soon as the condition holds (including when it
+ * already holds on entry) and -1 with errno set to ETIMEDOUT otherwise.
+ */
+
+enum SoftapLinkCondition {
+    SOFTAP_LINK_PRESENT,
+    SOFTAP_LINK_UP,
+    SOFTAP_LINK_DOWN,   /* also satisfied by the interface going away */
+};
+
+/* Waits for RTM_NEWLINK/RTM_DELLINK on iface matching cond. */
+int softapWaitForLink(const char *iface, SoftapLinkCondition cond, int timeoutMs);
+
+/* Waits for path to be created, e.g. hostapd's control socket. */
+int softapWaitForPath(const char *path, int timeoutMs);
+
+/*
+ * Opens /dev/rfkill so that a state change made after this call is not
+ * missed by softapWaitForRfkill().  Returns the fd, or -1.
+ */
+int softapOpenRfkillEvents();
+
+/* Waits on fd from softapOpenRfkillEvents() for rfkill idx to become (un)blocked, then closes fd. */
+int softapWaitForRfkill(int fd, int idx, bool unblocked, int timeoutMs);
+
+/* Logs how long each phase of a softap operation really took. */
+class SoftapPhaseTimer {
+public:
+    SoftapPhaseTimer(const char *operation);
+    void phase(const char *name);
+    void done();
+
+private:
+    const char *mOperation;
+    long long mStart;
+    long long mLast;
+};
+
+#endif
@@ -0,0 +1,398 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// #define LOG_NDEBUG 0
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nfnetlink_compat.h>
+#include <linux/netfilter/nfnetlink_conntrack.h>
+
+#define LOG_TAG "TetherConntrackStats"
+#include <cutils/log.h>
+
+#include "BandwidthController.h"
+#include "NatController.h"
+#include "NetdConstants.h"
+#include "ResponseCode.h"
+#include "TetherConntrackStats.h"
+
+/* Bits of the connmark we own; nobody else in netd uses connmarks. */
+const uint32_t TetherConntrackStats::CT_MARK_MASK = 0x00ff0000;
+const int TetherConntrackStats::CT_MARK_SHIFT = 16;
+/* Two marks per pair, one per direction the flow was opened in. */
+const int TetherConntrackStats::MAX_PAIRS = 127;
+
+TetherConntrackStats *TetherConntrackStats::sInstance = NULL;
+
+TetherConntrackStats *TetherConntrackStats::Instance() {
+    if (!sInstance)
+        sInstance = new TetherConntrackStats();
+    return sInstance;
+}
+
+TetherConntrackStats::TetherConntrackStats() {
+    pthread_mutex_init(&mLock, NULL);
+    mEventSock = -1;
+    mNextSlot = 1;
+}
+
+int TetherConntrackStats::start() {
+    struct sockaddr_nl addr;
+    int sz = 1024 * 1024;
+    pthread_t thread;
+    int sock;
+
+    /* Counters only exist for flows created after this. */
+    if (writeFile("/proc/sys/net/netfilter/nf_conntrack_acct", "1", 1)) {
+        return -1;
+    }
+
+    if ((sock = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_NETFILTER)) < 0) {
+        ALOGE("Unable to create ctnetlink socket (%s)", strerror(errno));
+        return -1;
+    }
+    /* A lost destroy event is traffic we never count, so be generous. */
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVBUFFORCE, &sz, sizeof(sz)) < 0) {
+        setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &sz, sizeof(sz));
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = NF_NETLINK_CONNTRACK_DESTROY;
+    if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        ALOGE("Unable to bind ctnetlink socket (%s)", strerror(errno));
+        close(sock);
+        return -1;
+    }
+    mEventSock = sock;
+
+    if (pthread_create(&thread, NULL, TetherConntrackStats::threadStart, this)) {
+        ALOGE("pthread_create (%s)", strerror(errno));
+        close(sock);
+        mEventSock = -1;
+        return -1;
+    }
+    pthread_detach(thread);
+    ALOGI("Tether stats from conntrack enabled");
+    return 0;
+}
+
+uint32_t TetherConntrackStats::markFor(int slot, bool fromInt) {
+    return ((slot << 1) | (fromInt ? 1 : 0)) << CT_MARK_SHIFT;
+}
+
+TetherConntrackStats::Pair *TetherConntrackStats::findPair(const char *intIface,
+                                                           const char *extIface) {
+    std::list<Pair>::iterator it;
+
+    for (it = mPairs.begin(); it != mPairs.end(); it++) {
+        if (it->intIface == intIface && it->extIface == extIface)
+            return &*it;
+    }
+    return NULL;
+}
+
+int TetherConntrackStats::setPairMarking(bool add, const char *intIface, const char *extIface) {
+    char markInt[32], markExt[32], mask[32];
+    int slot;
+    int res = 0;
+
+    pthread_mutex_lock(&mLock);
+    Pair *pair = findPair(intIface, extIface);
+    if (!pair) {
+        if (!add || mNextSlot > MAX_PAIRS) {
+            pthread_mutex_unlock(&mLock);
+            ALOGE("No connmark for %s %s", intIface, extIface);
+            return -1;
+        }
+        /* Pairs are kept once seen so their totals survive a re-tether. */
+        Pair newPair;
+        newPair.intIface = intIface;
+        newPair.extIface = extIface;
+        newPair.slot = mNextSlot++;
+        mPairs.push_back(newPair);
+        pair = &mPairs.back();
+    }
+    slot = pair->slot;
+    pthread_mutex_unlock(&mLock);
+
+    snprintf(markInt, sizeof(markInt), "0x%x/0x%x", markFor(slot, true), CT_MARK_MASK);
+    snprintf(markExt, sizeof(markExt), "0x%x/0x%x", markFor(slot, false), CT_MARK_MASK);
+    snprintf(mask, sizeof(mask), "0/0x%x", CT_MARK_MASK);
+
+    /* These go first so that flows get marked whatever the rules after them do. */
+    res |= execIptables(V4V6, add ? "-I" : "-D", NatController::LOCAL_FORWARD,
+            "-i", intIface, "-o", extIface, "-m", "connmark", "--mark", mask,
+            "-j", "CONNMARK", "--set-xmark", markInt, NULL);
+    res |= execIptables(V4V6, add ? "-I" : "-D", NatController::LOCAL_FORWARD,
+            "-i", extIface, "-o", intIface, "-m", "connmark", "--mark", mask,
+            "-j", "CONNMARK", "--set-xmark", markExt, NULL);
+    return res;
+}
+
+void *TetherConntrackStats::threadStart(void *obj) {
+    TetherConntrackStats *stats = reinterpret_cast<TetherConntrackStats *>(obj);
+
+    stats->run();
+    pthread_exit(NULL);
+    return NULL;
+}
+
+void TetherConntrackStats::run() {
+    struct pollfd pfd;
+    char buf[16 * 1024];
+    ssize_t len;
+
+    pfd.fd = mEventSock;
+    pfd.events = POLLIN;
+    while (1) {
+        pfd.revents = 0;
+        if (poll(&pfd, 1, -1) < 0) {
+            if (errno != EINTR) {
+                ALOGE("poll failed (%s)", strerror(errno));
+                sleep(1);
+            }
+            continue;
+        }
+
+        pthread_mutex_lock(&mLock);
+        while ((len = recv(mEventSock, buf, sizeof(buf), MSG_DONTWAIT)) != 0) {
+            if (len < 0) {
+                if (errno == ENOBUFS) {
+                    ALOGW("Lost conntrack destroy events, tether stats will be short");
+                    continue;
+                }
+                break;
+            }
+            processMessages(buf, len, true, NULL);
+        }
+        pthread_mutex_unlock(&mLock);
+    }
+}
+
+static uint64_t readBe64(const struct nlattr *attr) {
+    uint64_t value;
+
+    memcpy(&value, (const char *) attr + NLA_HDRLEN, sizeof(value));
+    return be64toh(value);
+}
+
+static void readCounters(const struct nlattr *nest, uint64_t *bytes, uint64_t *packets) {
+    const struct nlattr *attr = (const struct nlattr *) ((const char *) nest + NLA_HDRLEN);
+    int left = nest->nla_len - NLA_HDRLEN;
+
+    *bytes = *packets = 0;
+    while (left >= NLA_HDRLEN && attr->nla_len >= NLA_HDRLEN && attr->nla_len <= left) {
+        int type = attr->nla_type & NLA_TYPE_MASK;
+        if (attr->nla_len >= NLA_HDRLEN + sizeof(uint64_t)) {
+            if (type == CTA_COUNTERS_BYTES)
+                *bytes = readBe64(attr);
+            else if (type == CTA_COUNTERS_PACKETS)
+                *packets = readBe64(attr);
+        }
+        left -= NLA_ALIGN(attr->nla_len);
+        attr = (const struct nlattr *) ((const char *) attr + NLA_ALIGN(attr->nla_len));
+    }
+}
+
+int TetherConntrackStats::processMessages(const char *buf, ssize_t len, bool ended,
+                                          Counters *live) {
+    const struct nlmsghdr *nh;
+    int done = 0;
+
+    for (nh = (const struct nlmsghdr *) buf; NLMSG_OK(nh, (size_t) len);
+            nh = NLMSG_NEXT(nh, len)) {
+        if (nh->nlmsg_type == NLMSG_DONE) {
+            done = 1;
+            break;
+        }
+        if (nh->nlmsg_type == NLMSG_ERROR) {
+            const struct nlmsgerr *err = (const struct nlmsgerr *) NLMSG_DATA(nh);
+            if (err->error) {
+                errno = -err->error;
+                return -1;
+            }
+            continue;
+        }
+        if (NFNL_SUBSYS_ID(nh->nlmsg_type) != NFNL_SUBSYS_CTNETLINK)
+            continue;
+
+        const struct nlattr *attr = (const struct nlattr *)
+                ((const char *) NLMSG_DATA(nh) + NLMSG_ALIGN(sizeof(struct nfgenmsg)));
+        int left = nh->nlmsg_len - NLMSG_LENGTH(NLMSG_ALIGN(sizeof(struct nfgenmsg)));
+        uint32_t mark = 0;
+        uint64_t origBytes = 0, origPackets = 0, replyBytes = 0, replyPackets = 0;
+
+        while (left >= NLA_HDRLEN && attr->nla_len >= NLA_HDRLEN && attr->nla_len <= left) {
+            switch (attr->nla_type & NLA_TYPE_MASK) {
+            case CTA_MARK:
+                if (attr->nla_len >= NLA_HDRLEN + sizeof(uint32_t)) {
+                    memcpy(&mark, (const char *) attr + NLA_HDRLEN, sizeof(mark));
+                    mark = be32toh(mark);
+                }
+                break;
+            case CTA_COUNTERS_ORIG:
+                readCounters(attr, &origBytes, &origPackets);
+                break;
+            case CTA_COUNTERS_REPLY:
+                readCounters(attr, &replyBytes, &replyPackets);
+                break;
+            }
+            left -= NLA_ALIGN(attr->nla_len);
+            attr = (const struct nlattr *) ((const char *) attr + NLA_ALIGN(attr->nla_len));
+        }
+
+        mark = (mark & CT_MARK_MASK) >> CT_MARK_SHIFT;
+        int slot = mark >> 1;
+        if (!slot || slot > MAX_PAIRS)
+            continue;
+
+        Counters *counters;
+        if (ended) {
+            std::list<Pair>::iterator it;
+            for (it = mPairs.begin(); it != mPairs.end(); it++) {
+                if (it->slot == slot)
+                    break;
+            }
+            if (it == mPairs.end())
+                continue;
+            counters = &it->ended;
+        } else {
+            counters = &live[slot];
+        }
+
+        /* The original direction is whichever side opened the flow. */
+        if (mark & 1) {
+            counters->rxBytes += origBytes;
+            counters->rxPackets += origPackets;
+            counters->txBytes += replyBytes;
+            counters->txPackets += replyPackets;
+        } else {
+            counters->txBytes += origBytes;
+            counters->txPackets += origPackets;
+            counters->rxBytes += replyBytes;
+            counters->rxPackets += replyPackets;
+        }
+    }
+    return done;
+}
+
+int TetherConntrackStats::dumpLive(Counters *live) {
+    struct {
+        struct nlmsghdr nh;
+        struct nfgenmsg nfg;
+    } req;
+    struct sockaddr_nl addr;
+    char buf[16 * 1024];
+    int sock;
+    int res = 0;
+
+    if ((sock = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_NETFILTER)) < 0) {
+        ALOGE("Unable to create ctnetlink socket (%s)", strerror(errno));
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+
+    memset(&req, 0, sizeof(req));
+    req.nh.nlmsg_len = sizeof(req);
+    req.nh.nlmsg_type = (NFNL_SUBSYS_CTNETLINK << 8) | IPCTNL_MSG_CT_GET;
+    req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.nh.nlmsg_seq = 1;
+    /* AF_UNSPEC dumps IPv4 and IPv6 flows alike. */
+    req.nfg.nfgen_family = AF_UNSPEC;
+    req.nfg.version = NFNETLINK_V0;
+
+    if (sendto(sock, &req, sizeof(req), 0, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        ALOGE("Unable to request conntrack dump (%s)", strerror(errno));
+        close(sock);
+        return -1;
+    }
+
+    while (res == 0) {
+        ssize_t len = recv(sock, buf, sizeof(buf), 0);
+        if (len < 0) {
+            if (errno == EINTR)
+                continue;
+            ALOGE("Conntrack dump failed (%s)", strerror(errno));
+            res = -1;
+            break;
+        }
+        if (len == 0)
+            break;
+        res = processMessages(buf, len, false, live);
+    }
+    close(sock);
+    return res < 0 ? -1 : 0;
+}
+
+int TetherConntrackStats::sendStats(SocketClient *cli, const std::string &intIface,
+                                    const std::string &extIface) {
+    Counters live[MAX_PAIRS + 1];
+    std::list<Pair>::iterator it;
+    bool filterPair = !intIface.empty() && !extIface.empty();
+    char buf[16 * 1024];
+    ssize_t len;
+
+    pthread_mutex_lock(&mLock);
+    /*
+     * Take in the destroy events already queued, or a flow that ended just
+     * now would be in neither the totals nor the dump.
+     */
+    while ((len = recv(mEventSock, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+        processMessages(buf, len, true, NULL);
+    }
+    if (dumpLive(live)) {
+        pthread_mutex_unlock(&mLock);
+        return -1;
+    }
+
+    for (it = mPairs.begin(); it != mPairs.end(); it++) {
+        if (!intIface.empty() && it->intIface != intIface)
+            continue;
+        if (!extIface.empty() && it->extIface != extIface)
+            continue;
+
+        const Counters &l = live[it->slot];
+        BandwidthController::TetherStats stats(it->intIface, it->extIface,
+                it->ended.rxBytes + l.rxBytes, it->ended.rxPackets + l.rxPackets,
+                it->ended.txBytes + l.txBytes, it->ended.txPackets + l.txPackets);
+        if (filterPair) {
+            stats.send(cli, ResponseCode::TetheringStatsResult);
+            pthread_mutex_unlock(&mLock);
+            return 0;
+        }
+        stats.send(cli, ResponseCode::TetheringStatsListResult);
+    }
+    pthread_mutex_unlock(&mLock);
+
+    if (filterPair) {
+        /* Same as the iptables path: an unknown pair is an error. */
+        return -1;
+    }
+    cli->sendMsg(ResponseCode::CommandOkay, "Tethering stats list completed", false);
+    return 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _TETHER_CONNTRACK_STATS_H
+#define _TETHER_CONNTRACK_STATS_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <list>
+#include <string>
+
+#include <sysutils/SocketClient.h>
+
+/*
+ * Tether accounting from conntrack instead of the natctrl_tether_counters
+ * quota2 rules, for IPv4 and IPv6 alike.
+ *
+ * Each tethered (intIface, extIface) pair gets a connmark, set on the first
+ * packet of a flow in natctrl_FORWARD. Flows that ended are summed up from
+ * ctnetlink destroy events as they come; flows still alive are read from a
+ * ctnetlink dump when stats are asked for. Neither touches iptables.
+ *
+ * Enabled with persist.netd.tether_ct_stats=1, which takes effect at netd
+ * start.
+ */
+class TetherConntrackStats {
+public:
+    static TetherConntrackStats *Instance();
+    virtual ~TetherConntrackStats() {}
+
+    int start();
+    bool isRunning() { return mEventSock != -1; }
+
+    /* Adds or removes the connmark rules for a tethered pair. */
+    int setPairMarking(bool add, const char *intIface, const char *extIface);
+
+    /*
+     * Same replies as BandwidthController::getTetherStats(): a single
+     * TetheringStatsResult when both ifaces are given, otherwise a
+     * TetheringStatsListResult per matching pair and a CommandOkay.
+     */
+    int sendStats(SocketClient *cli, const std::string &intIface,
+                  const std::string &extIface);
+
+private:
+    class Counters {
+    public:
+        Counters() : rxBytes(0), rxPackets(0), txBytes(0), txPackets(0) {};
+        /* rx is intIface to extIface, as with the quota2 counters. */
+        uint64_t rxBytes, rxPackets;
+        uint64_t txBytes, txPackets;
+    };
+
+    class Pair {
+    public:
+        std::string intIface;
+        std::string extIface;
+        int slot;
+        Counters ended;
+    };
+
+    static const uint32_t CT_MARK_MASK;
+    static const int CT_MARK_SHIFT;
+    static const int MAX_PAIRS;
+
+    static TetherConntrackStats *sInstance;
+
+    TetherConntrackStats();
+    static void *threadStart(void *obj);
+    void run();
+    /* Walks a buffer of ctnetlink messages; ended picks destroy events over dump replies. */
+    int processMessages(const char *buf, ssize_t len, bool ended, Counters *live);
+    int dumpLive(Counters *live);
+    static uint32_t markFor(int slot, bool fromInt);
+    Pair *findPair(const char *intIface, const char *extIface);
+
+    std::list<Pair> mPairs;
+    pthread_mutex_t mLock;
+    int mEventSock;
+    int mNextSlot;
+};
+
+#endif
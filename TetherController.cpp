@@ -65,6 +65,9 @@ TetherController::TetherController(SecondaryTableController *ctrl) {
     mDnsForwarders = new NetAddressCollection();
     mDaemonFd = -1;
     mDaemonPid = 0;
+    mStoppingDaemonPid = 0;
+    mRtrAdvPid = 0;
+    pthread_mutex_init(&mLock, NULL);
     secondaryTableCtrl = ctrl;
 }
 
@@ -160,7 +163,7 @@ bool TetherController::getIpFwdEnabled() {
 
 #define TETHER_START_CONST_ARG		8
 int TetherController::startTethering(int num_addrs, struct in_addr* addrs, int lease_time) {
-    if (mDaemonPid != 0) {
+    if (isTetheringStarted()) {
         ALOGE("Tethering already started");
         errno = EBUSY;
         return -1;
@@ -176,15 +179,29 @@ int TetherController::startTethering(int num_addrs, struct in_addr* addrs, int l
     pid_t pid;
     int pipefd[2];
 
+    // dnsmasq holds ports 53 and 67 until it is gone, so a stopped instance
+    // that is still exiting has to finish first or the new one fails to bind
+    // (the supervisor SIGKILLs stragglers).
+    pthread_mutex_lock(&mLock);
+    pid = mStoppingDaemonPid;
+    pthread_mutex_unlock(&mLock);
+    if (pid != 0 &&
+        ProcessSupervisor::Instance()->waitForExit(pid,
+                ProcessSupervisor::DEFAULT_STOP_TIMEOUT_MS + 500)) {
+        ALOGE("dnsmasq (%d) did not exit", pid);
+    }
+
+    // dnsmasq may have died on its own, leaving its end of the old pipe behind
+    if (mDaemonFd != -1) {
+        close(mDaemonFd);
+        mDaemonFd = -1;
+    }
+
     if (pipe(pipefd) < 0) {
         ALOGE("pipe failed (%s)", strerror(errno));
         return -1;
     }
 
-    /*
-     * TODO: Create a monitoring thread to handle and restart
-     * the daemon if it exits prematurely
-     */
     if ((pid = fork()) < 0) {
         ALOGE("fork failed (%s)", strerror(errno));
         close(pipefd[0]);
@@ -229,8 +246,11 @@ int TetherController::startTethering(int num_addrs, struct in_addr* addrs, int l
         _exit(-1);
     } else {
         close(pipefd[0]);
+        pthread_mutex_lock(&mLock);
         mDaemonPid = pid;
+        pthread_mutex_unlock(&mLock);
         mDaemonFd = pipefd[1];
+        ProcessSupervisor::Instance()->watch(pid, "dnsmasq", this);
         applyDnsInterfaces();
         ALOGD("Tethering services running");
     }
@@ -239,25 +259,36 @@ int TetherController::startTethering(int num_addrs, struct in_addr* addrs, int l
 }
 
 int TetherController::stopTethering() {
+    pid_t pid;
+
+    pthread_mutex_lock(&mLock);
+    pid = mDaemonPid;
+    mDaemonPid = 0;
+    if (pid != 0) {
+        mStoppingDaemonPid = pid;
+    }
+    pthread_mutex_unlock(&mLock);
 
-    if (mDaemonPid == 0) {
+    if (pid == 0) {
         ALOGE("Tethering already stopped");
         return 0;
     }
 
     ALOGD("Stopping tethering services");
 
-    kill(mDaemonPid, SIGTERM);
-    waitpid(mDaemonPid, NULL, 0);
-    mDaemonPid = 0;
+    ProcessSupervisor::Instance()->stop(pid);
     close(mDaemonFd);
     mDaemonFd = -1;
-    ALOGD("Tethering services stopped");
     return 0;
 }
 
 bool TetherController::isTetheringStarted() {
-    return (mDaemonPid == 0 ? false : true);
+    bool started;
+
+    pthread_mutex_lock(&mLock);
+    started = (mDaemonPid != 0);
+    pthread_mutex_unlock(&mLock);
+    return started;
 }
 
 int TetherController::startV6RtrAdv(int num_ifaces, char **ifaces, int table_number) {
@@ -311,25 +342,50 @@ int TetherController::startV6RtrAdv(int num_ifaces, char **ifaces, int table_num
         free(args);
         exit(0);
     } else {
+        pthread_mutex_lock(&mLock);
         mRtrAdvPid = pid;
+        pthread_mutex_unlock(&mLock);
+        ProcessSupervisor::Instance()->watch(pid, "radish", this);
         ALOGD("Router advertisement daemon running");
     }
     return 0;
 }
 
 int TetherController::stopV6RtrAdv() {
-    if (!mRtrAdvPid) {
+    pid_t pid;
+
+    pthread_mutex_lock(&mLock);
+    pid = mRtrAdvPid;
+    mRtrAdvPid = 0;
+    pthread_mutex_unlock(&mLock);
+
+    if (!pid) {
         ALOGD("Router advertisement daemon already stopped");
         return 0;
     }
 
-    kill(mRtrAdvPid, SIGTERM);
-    waitpid(mRtrAdvPid, NULL, 0);
-    mRtrAdvPid = 0;
-    ALOGD("Router advertisement daemon stopped");
+    ProcessSupervisor::Instance()->stop(pid);
     return 0;
 }
 
+void TetherController::onChildExited(pid_t pid, int status) {
+    pthread_mutex_lock(&mLock);
+    if (pid == mDaemonPid) {
+        // mDaemonFd is left for the command thread to close on the next start
+        ALOGE("Tethering daemon exited unexpectedly");
+        mDaemonPid = 0;
+    } else if (pid == mRtrAdvPid) {
+        ALOGE("Router advertisement daemon exited unexpectedly");
+        mRtrAdvPid = 0;
+    } else {
+        ALOGD("Tethering helper %d stopped", pid);
+        if (pid == mStoppingDaemonPid) {
+            mStoppingDaemonPid = 0;
+        }
+    }
+    pthread_mutex_unlock(&mLock);
+}
+
 int TetherController::addV6RtrAdvIface(const char *iface) {
     char **args;
     int i;
@@ -374,7 +430,12 @@ int TetherController::removeV6RtrAdvIface(const char *iface) {
     return addV6RtrAdvIface(iface);
 }
 bool TetherController::isV6RtrAdvStarted() {
-    return (mRtrAdvPid == 0 ? false : true);
+    bool started;
+
+    pthread_mutex_lock(&mLock);
+    started = (mRtrAdvPid != 0);
+    pthread_mutex_unlock(&mLock);
+    return started;
 }
 
 #define MAX_CMD_SIZE 1024
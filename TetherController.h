@@ -17,10 +17,12 @@
 #ifndef _TETHER_CONTROLLER_H
 #define _TETHER_CONTROLLER_H
 
+#include <pthread.h>
 #include <netinet/in.h>
 
 #include "List.h"
 #include "SecondaryTableController.h"
+#include "ProcessSupervisor.h"
 
 #define HOUR 3600
 
@@ -31,13 +33,15 @@
 typedef android::netd::List<char *> InterfaceCollection;
 typedef android::netd::List<struct in_addr> NetAddressCollection;
 
-class TetherController {
+class TetherController : public ProcessSupervisor::Client {
     InterfaceCollection  *mInterfaces;
     NetAddressCollection *mDnsForwarders;
     pid_t                 mDaemonPid;
     int                   mDaemonFd;
+    pid_t                 mStoppingDaemonPid; // stopped but maybe not gone yet
     pid_t                 mRtrAdvPid; // IPv6 support
     InterfaceCollection  *mUpstreamInterfaces;
+    pthread_mutex_t       mLock; // the pids are also cleared from the supervisor thread
 
 public:
     TetherController(SecondaryTableController *ctrl);
@@ -65,6 +69,8 @@ public:
     int addUpstreamInterface(char *iface);
     int removeUpstreamInterface(char *iface);
 
+    virtual void onChildExited(pid_t pid, int status);
+
 private:
     SecondaryTableController *secondaryTableCtrl;
     int applyDnsInterfaces();
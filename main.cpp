@@ -35,9 +35,9 @@
 #include "DnsProxyListener.h"
 #include "MDnsSdListener.h"
 #include "UidMarkMap.h"
+#include "ProcessSupervisor.h"
 
 static void coldboot(const char *path);
-static void sigchld_handler(int sig);
 static void blockSigpipe();
 
 int main() {
@@ -49,9 +49,14 @@ int main() {
 
     ALOGI("Netd 1.0 starting");
 
-//    signal(SIGCHLD, sigchld_handler);
     blockSigpipe();
 
+    // Before anything forks a daemon it watches.
+    if (ProcessSupervisor::Instance()->start()) {
+        ALOGE("Unable to start ProcessSupervisor (%s)", strerror(errno));
+        exit(1);
+    }
+
     if (!(nm = NetlinkManager::Instance())) {
         ALOGE("Unable to create NetlinkManager");
         exit(1);
@@ -61,6 +66,7 @@ int main() {
 
     cl = new CommandListener(rangeMap);
     nm->setBroadcaster((SocketListener *) cl);
+    nm->setBandwidthController(CommandListener::getBandwidthController());
 
     if (nm->start()) {
         ALOGE("Unable to start NetlinkManager (%s)", strerror(errno));
@@ -70,6 +76,7 @@ int main() {
     // Set local DNS mode, to prevent bionic from proxying
     // back to this service, recursively.
     setenv("ANDROID_DNS_MODE", "local", 1);
+    DnsProxyListener::setResolverController(CommandListener::getResolverController());
     dpl = new DnsProxyListener(rangeMap);
     if (dpl->startListener()) {
         ALOGE("Unable to start DnsProxyListener (%s)", strerror(errno));
@@ -143,11 +150,6 @@ static void coldboot(const char *path)
     }
 }
 
-static void sigchld_handler(int sig) {
-    pid_t pid = wait(NULL);
-    ALOGD("Child process %d exited", pid);
-}
-
 static void blockSigpipe()
 {
     sigset_t mask;
@@ -21,12 +21,18 @@
 #include <signal.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <poll.h>
+#include <stdint.h>
 
 #include <sys/socket.h>
 #include <sys/select.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/un.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <time.h>
 
 #include <cutils/sockets.h>
 #include <private/android_filesystem_config.h>
@@ -34,6 +40,9 @@
 static void usage(char *progname);
 static int do_monitor(int sock, int stop_after_cmd);
 static int do_cmd(int sock, int argc, char **argv);
+static int do_bench(int sock, int argc, char **argv);
+static int do_dnsbench(int argc, char **argv);
+static int do_fakedns(int argc, char **argv);
 
 int main(int argc, char **argv) {
     int sock;
@@ -42,6 +51,12 @@ int main(int argc, char **argv) {
     if (argc < 2)
         usage(argv[0]);
 
+    // dnsbench opens its own dnsproxyd connections
+    if (!strcmp(argv[1], "dnsbench"))
+        exit(do_dnsbench(argc - 1, &(argv[1])));
+    if (!strcmp(argv[1], "fakedns"))
+        exit(do_fakedns(argc - 1, &(argv[1])));
+
     // try interpreting the first arg as the socket name - if it fails go back to netd
 
     if ((sock = socket_local_client(argv[1],
@@ -61,6 +76,8 @@ int main(int argc, char **argv) {
 
     if (!strcmp(argv[1+cmdOffset], "monitor"))
         exit(do_monitor(sock, 0));
+    if (!strcmp(argv[1+cmdOffset], "bench"))
+        exit(do_bench(sock, argc-cmdOffset-1, &(argv[cmdOffset+1])));
     exit(do_cmd(sock, argc-cmdOffset, &(argv[cmdOffset])));
 }
 
@@ -180,7 +197,861 @@ static int do_monitor(int sock, int stop_after_cmd) {
     return 0;
 }
 
+/*
+ * Where the commands of a benchmark come from: the lines of a script,
+ * replayed in a loop, or one of the generators.
+ */
+struct bench_source {
+    char **lines;
+    int num_lines;
+    const char *generator;
+    const char *iface;
+};
+
+static long long now_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int cmp_ll(const void *a, const void *b) {
+    long long x = *(const long long *) a;
+    long long y = *(const long long *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+static int read_script(const char *path, struct bench_source *src) {
+    FILE *fp = fopen(path, "r");
+    char line[1024];
+
+    if (!fp) {
+        fprintf(stderr, "Unable to open %s (%s)\n", path, strerror(errno));
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (!line[0] || line[0] == '#')
+            continue;
+        src->lines = realloc(src->lines, (src->num_lines + 1) * sizeof(char *));
+        src->lines[src->num_lines++] = strdup(line);
+    }
+    fclose(fp);
+    if (!src->num_lines) {
+        fprintf(stderr, "No commands in %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Formats the i-th command. The generators pair up their changes, so that
+ * a benchmark leaves behind no more than one of them.
+ */
+static int bench_command(const struct bench_source *src, int i, char *buf, size_t len) {
+    if (src->lines) {
+        snprintf(buf, len, "%s", src->lines[i % src->num_lines]);
+    } else if (!strcmp(src->generator, "firewall")) {
+        snprintf(buf, len, "firewall set_uid_rule %d %s", 10000 + (i / 2) % 1000,
+                 i % 2 ? "deny" : "allow");
+    } else if (!strcmp(src->generator, "quota")) {
+        if (i % 2)
+            snprintf(buf, len, "bandwidth removeiquota %s", src->iface);
+        else
+            snprintf(buf, len, "bandwidth setiquota %s %d", src->iface, 1000000 + i);
+    } else if (!strcmp(src->generator, "getcfg")) {
+        snprintf(buf, len, "interface getcfg %s", src->iface);
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static int write_all(int sock, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t rc = write(sock, buf, len);
+        if (rc < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += rc;
+        len -= rc;
+    }
+    return 0;
+}
+
+/*
+ * FrameworkListener reads commands 1024 bytes at a time and drops one that
+ * is split across two reads, so the unanswered commands must stay below that.
+ */
+#define BENCH_MAX_UNANSWERED 1024
+
+/*
+ * Keeps up to window commands in flight on the one connection, matching
+ * replies to commands by their sequence numbers, and reports the throughput
+ * and the latency percentiles of the final replies. Fewer commands are in
+ * flight when their bytes would reach BENCH_MAX_UNANSWERED.
+ */
+static int do_bench(int sock, int argc, char **argv) {
+    struct bench_source src;
+    int count = 1000;
+    int window = 16;
+    long long *sent_at;
+    int *sent_len;
+    int unanswered = 0;
+    long long *latencies;
+    char cmd[1024];
+    char msg[1100];
+    char *buffer;
+    int buf_len = 0;
+    int skipping = 0;
+    int next = 1;
+    int done = 0;
+    int in_flight = 0;
+    int errors_4xx = 0, errors_5xx = 0;
+    long long start;
+    double secs;
+    int c;
+
+    memset(&src, 0, sizeof(src));
+    optind = 1;
+    while ((c = getopt(argc, argv, "n:w:f:i:")) != -1) {
+        switch (c) {
+        case 'n':
+            count = atoi(optarg);
+            break;
+        case 'w':
+            window = atoi(optarg);
+            break;
+        case 'f':
+            if (read_script(optarg, &src))
+                return 1;
+            break;
+        case 'i':
+            src.iface = optarg;
+            break;
+        default:
+            usage("ndc");
+        }
+    }
+    if (!src.lines) {
+        if (optind >= argc)
+            usage("ndc");
+        src.generator = argv[optind];
+        if (!src.iface)
+            src.iface = strcmp(src.generator, "getcfg") ? "bench0" : "lo";
+        if (bench_command(&src, 0, cmd, sizeof(cmd))) {
+            fprintf(stderr, "Unknown generator %s\n", src.generator);
+            return 1;
+        }
+    }
+    if (count < 1 || window < 1)
+        usage("ndc");
+
+    sent_at = calloc(count + 1, sizeof(long long));
+    sent_len = calloc(count + 1, sizeof(int));
+    latencies = malloc(count * sizeof(long long));
+    buffer = malloc(65536);
+    if (!sent_at || !sent_len || !latencies || !buffer) {
+        perror("malloc");
+        return ENOMEM;
+    }
+
+    start = now_us();
+    while (done < count) {
+        fd_set read_fds;
+        struct timeval to;
+        int rc;
+        int i, offset;
+
+        while (in_flight < window && next <= count) {
+            int len;
+
+            bench_command(&src, next - 1, cmd, sizeof(cmd));
+            snprintf(msg, sizeof(msg), "%d %s", next, cmd);
+            len = strlen(msg) + 1;
+            if (in_flight && unanswered + len >= BENCH_MAX_UNANSWERED)
+                break;
+            sent_at[next] = now_us();
+            if (write_all(sock, msg, len)) {
+                int res = errno;
+                perror("write");
+                return res;
+            }
+            sent_len[next] = len;
+            unanswered += len;
+            next++;
+            in_flight++;
+        }
+
+        to.tv_sec = 10;
+        to.tv_usec = 0;
+        FD_ZERO(&read_fds);
+        FD_SET(sock, &read_fds);
+        if ((rc = select(sock + 1, &read_fds, NULL, NULL, &to)) < 0) {
+            if (errno == EINTR)
+                continue;
+            int res = errno;
+            fprintf(stderr, "Error in select (%s)\n", strerror(errno));
+            return res;
+        } else if (!rc) {
+            fprintf(stderr, "[TIMEOUT] %d replies missing\n", in_flight);
+            return ETIMEDOUT;
+        }
+
+        if ((rc = read(sock, buffer + buf_len, 65536 - buf_len)) <= 0) {
+            fprintf(stderr, "Lost connection to Netd - did it crash?\n");
+            return rc ? errno : ECONNRESET;
+        }
+        buf_len += rc;
+
+        /* Replies are "<code> <seq> <message>\0"; broadcasts carry no seq. */
+        for (i = 0, offset = 0; i < buf_len; i++) {
+            if (buffer[i] != '\0')
+                continue;
+            if (!skipping) {
+                char *end;
+                int code = strtol(buffer + offset, &end, 10);
+                int seq = strtol(end, NULL, 10);
+
+                if (code >= 200 && code < 600 && seq >= 1 && seq < next && sent_at[seq]) {
+                    latencies[done++] = now_us() - sent_at[seq];
+                    sent_at[seq] = 0;
+                    unanswered -= sent_len[seq];
+                    in_flight--;
+                    if (code >= 500)
+                        errors_5xx++;
+                    else if (code >= 400)
+                        errors_4xx++;
+                }
+            }
+            skipping = 0;
+            offset = i + 1;
+        }
+        if (offset == 0 && buf_len == 65536) {
+            /* A reply longer than the buffer; only its seq mattered. */
+            skipping = 1;
+            buf_len = 0;
+        } else {
+            memmove(buffer, buffer + offset, buf_len - offset);
+            buf_len -= offset;
+        }
+    }
+    secs = (now_us() - start) / 1e6;
+
+    qsort(latencies, count, sizeof(long long), cmp_ll);
+    printf("%d commands in %.3f s, %.1f/s, window %d\n", count, secs, count / secs, window);
+    printf("latency us: p50 %lld p99 %lld p999 %lld max %lld\n",
+           latencies[(int) (0.5 * (count - 1))], latencies[(int) (0.99 * (count - 1))],
+           latencies[(int) (0.999 * (count - 1))], latencies[count - 1]);
+    printf("errors: %d (%d 4xx, %d 5xx)\n", errors_4xx + errors_5xx, errors_4xx, errors_5xx);
+
+    free(buffer);
+    free(latencies);
+    free(sent_len);
+    free(sent_at);
+    return 0;
+}
+
+/*
+ * dnsbench: clients of the dnsproxyd socket, each asking one query per
+ * connection the way bionic does, and reading the reply to its end.
+ */
+struct dns_bench {
+    const char *type;
+    const char *iface;
+    char **targets;
+    int num_targets;
+    int count;
+    volatile int next;
+    long long *latencies;
+    volatile int done;
+    volatile int failures;
+    volatile int errors;
+    volatile int running;
+};
+
+static int read_exact(int sock, void *buf, size_t len) {
+    char *p = buf;
+
+    while (len > 0) {
+        ssize_t rc = read(sock, p, len);
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc <= 0)
+            return -1;
+        p += rc;
+        len -= rc;
+    }
+    return 0;
+}
+
+/* Reads a length prefixed item; returns its length, or -1. */
+static int skip_item(int sock) {
+    uint32_t len;
+    char buf[512];
+
+    if (read_exact(sock, &len, sizeof(len)))
+        return -1;
+    len = ntohl(len);
+    for (uint32_t left = len; left > 0; ) {
+        uint32_t chunk = left < sizeof(buf) ? left : sizeof(buf);
+        if (read_exact(sock, buf, chunk))
+            return -1;
+        left -= chunk;
+    }
+    return len;
+}
+
+/* Reads the rest of a DnsProxyQueryResult, as DnsProxyListener writes it. */
+static int read_dns_result(int sock, int addrinfo) {
+    uint32_t word;
+    int len;
+
+    if (addrinfo) {
+        /* addrinfo, sockaddr and canonical name, until an empty addrinfo. */
+        while ((len = skip_item(sock)) > 0) {
+            if (skip_item(sock) < 0 || skip_item(sock) < 0)
+                return -1;
+        }
+        return len;
+    }
+    /* hostent: name, aliases until empty, type and length, addresses until empty. */
+    if (skip_item(sock) < 0)
+        return -1;
+    while ((len = skip_item(sock)) > 0)
+        ;
+    if (len < 0 || read_exact(sock, &word, sizeof(word)) || read_exact(sock, &word, sizeof(word)))
+        return -1;
+    while ((len = skip_item(sock)) > 0)
+        ;
+    return len;
+}
+
+/* Runs one query; returns its reply code, or -1 if the exchange broke. */
+static int dns_query(const struct dns_bench *bench, const char *target, int i) {
+    const char *iface = bench->iface ? bench->iface : "^";
+    const char *type = bench->type;
+    struct in6_addr addr;
+    char code[4];
+    char *cmd;
+    int family = strchr(target, ':') ? AF_INET6 : AF_INET;
+    int is_addr = inet_pton(family, target, &addr) == 1;
+    int sock;
+    int rc = -1;
+
+    if (!strcmp(type, "mix"))
+        type = is_addr ? "gethostbyaddr" : (i % 2 ? "gethostbyname" : "getaddrinfo");
+    if (!strcmp(type, "getaddrinfo"))
+        asprintf(&cmd, "getaddrinfo %s ^ -1 -1 -1 -1 %s", target, iface);
+    else if (!strcmp(type, "gethostbyname"))
+        asprintf(&cmd, "gethostbyname %s %s %d", iface, target, AF_INET);
+    else
+        asprintf(&cmd, "gethostbyaddr %s %d %d %s", target,
+                 family == AF_INET ? 4 : 16, family, iface);
+
+    if ((sock = socket_local_client("dnsproxyd", ANDROID_SOCKET_NAMESPACE_RESERVED,
+                                    SOCK_STREAM)) < 0) {
+        free(cmd);
+        return -1;
+    }
+    if (write_all(sock, cmd, strlen(cmd) + 1) || read_exact(sock, code, sizeof(code)))
+        goto out;
+
+    if (code[3] != '\0') {
+        /* A text reply, such as a parameter error. */
+        char c;
+        while (read_exact(sock, &c, 1) == 0 && c != '\0')
+            ;
+        rc = atoi(code);
+    } else if (atoi(code) == 222) {
+        if (read_dns_result(sock, !strcmp(type, "getaddrinfo")) == 0)
+            rc = 222;
+    } else {
+        /* A DnsProxyOperationFailed, with its error. */
+        if (skip_item(sock) >= 0)
+            rc = atoi(code);
+    }
+out:
+    close(sock);
+    free(cmd);
+    return rc;
+}
+
+static void *dns_client(void *arg) {
+    struct dns_bench *bench = arg;
+    int i;
+
+    while ((i = __sync_fetch_and_add(&bench->next, 1)) < bench->count) {
+        long long start = now_us();
+        int rc = dns_query(bench, bench->targets[i % bench->num_targets], i);
+
+        bench->latencies[__sync_fetch_and_add(&bench->done, 1)] = now_us() - start;
+        if (rc < 0)
+            __sync_fetch_and_add(&bench->errors, 1);
+        else if (rc != 222)
+            __sync_fetch_and_add(&bench->failures, 1);
+    }
+    __sync_fetch_and_sub(&bench->running, 1);
+    return NULL;
+}
+
+/* Reads "<key>: <value>" from /proc/<pid>/status. */
+static long read_proc_status(pid_t pid, const char *key) {
+    char path[64];
+    char line[256];
+    long value = -1;
+    size_t key_len = strlen(key);
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    if (!(fp = fopen(path, "r")))
+        return -1;
+    while (fgets(line, sizeof(line), fp)) {
+        if (!strncmp(line, key, key_len) && line[key_len] == ':') {
+            value = atol(line + key_len + 1);
+            break;
+        }
+    }
+    fclose(fp);
+    return value;
+}
+
+/*
+ * Runs count queries from clients concurrent clients against the resolver
+ * of iface, and reports the rate, latency percentiles, and the peak thread
+ * count and RSS of the process behind dnsproxyd.
+ */
+static int do_dnsbench(int argc, char **argv) {
+    struct dns_bench bench;
+    int clients = 8;
+    struct ucred cred;
+    socklen_t cred_len = sizeof(cred);
+    long max_threads = -1, max_rss_kb = -1;
+    pthread_t *threads;
+    long long start;
+    double secs;
+    int sock;
+    int c, i;
+
+    memset(&bench, 0, sizeof(bench));
+    bench.count = 1000;
+    optind = 1;
+    while ((c = getopt(argc, argv, "n:c:i:")) != -1) {
+        switch (c) {
+        case 'n':
+            bench.count = atoi(optarg);
+            break;
+        case 'c':
+            clients = atoi(optarg);
+            break;
+        case 'i':
+            bench.iface = optarg;
+            break;
+        default:
+            usage("ndc");
+        }
+    }
+    if (argc - optind < 2 || bench.count < 1 || clients < 1)
+        usage("ndc");
+    bench.type = argv[optind];
+    if (strcmp(bench.type, "getaddrinfo") && strcmp(bench.type, "gethostbyname") &&
+            strcmp(bench.type, "gethostbyaddr") && strcmp(bench.type, "mix"))
+        usage("ndc");
+    bench.targets = argv + optind + 1;
+    bench.num_targets = argc - optind - 1;
+
+    if ((sock = socket_local_client("dnsproxyd", ANDROID_SOCKET_NAMESPACE_RESERVED,
+                                    SOCK_STREAM)) < 0) {
+        fprintf(stderr, "Error connecting to dnsproxyd (%s)\n", strerror(errno));
+        return 4;
+    }
+    if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len))
+        cred.pid = 0;
+    close(sock);
+
+    bench.latencies = malloc(bench.count * sizeof(long long));
+    threads = malloc(clients * sizeof(pthread_t));
+    if (!bench.latencies || !threads) {
+        perror("malloc");
+        return ENOMEM;
+    }
+
+    start = now_us();
+    bench.running = clients;
+    for (i = 0; i < clients; i++) {
+        if (pthread_create(&threads[i], NULL, dns_client, &bench)) {
+            perror("pthread_create");
+            bench.running -= clients - i;
+            clients = i;
+            break;
+        }
+    }
+    while (bench.running > 0) {
+        if (cred.pid > 0) {
+            long threads_now = read_proc_status(cred.pid, "Threads");
+            long rss_now = read_proc_status(cred.pid, "VmRSS");
+            if (threads_now > max_threads)
+                max_threads = threads_now;
+            if (rss_now > max_rss_kb)
+                max_rss_kb = rss_now;
+        }
+        usleep(50000);
+    }
+    for (i = 0; i < clients; i++)
+        pthread_join(threads[i], NULL);
+    secs = (now_us() - start) / 1e6;
+
+    if (!bench.done) {
+        fprintf(stderr, "No queries were run\n");
+        return 1;
+    }
+    qsort(bench.latencies, bench.done, sizeof(long long), cmp_ll);
+    printf("%d %s queries in %.3f s, %.1f/s, %d clients\n", bench.done, bench.type, secs,
+           bench.done / secs, clients);
+    printf("latency us: p50 %lld p99 %lld p999 %lld max %lld\n",
+           bench.latencies[(int) (0.5 * (bench.done - 1))],
+           bench.latencies[(int) (0.99 * (bench.done - 1))],
+           bench.latencies[(int) (0.999 * (bench.done - 1))],
+           bench.latencies[bench.done - 1]);
+    printf("failed lookups: %d, broken exchanges: %d\n", bench.failures, bench.errors);
+    if (cred.pid > 0)
+        printf("pid %d peak: %ld threads, %ld kB rss\n", cred.pid, max_threads, max_rss_kb);
+
+    free(threads);
+    free(bench.latencies);
+    return 0;
+}
+
+/*
+ * fakedns: an authoritative server for every name, for dnsbench to run
+ * against instead of the real network:
+ *   ndc fakedns -d 50 -l 5 &
+ *   ndc resolver setifdns <iface> "" 127.0.0.1
+ *   ndc dnsbench -i <iface> getaddrinfo a.test b.test
+ * A gets 192.0.2.x and AAAA 2001:db8::x, x from a hash of the name; PTR gets
+ * fake.invalid; names whose first label is "nxdomain" get NXDOMAIN, and
+ * other types no data. Every reply is held for the delay, and the loss
+ * percentage of queries get none. With -T, UDP replies come truncated, so
+ * the resolver retries over TCP.
+ */
+struct fake_dns {
+    int delay_ms;
+    int loss;
+    int ttl;
+    int truncate;
+    volatile int udp_queries;
+    volatile int tcp_queries;
+    volatile int dropped;
+};
+
+#define FAKE_DNS_MAX_UDP    512
+#define FAKE_DNS_PENDING    1024
+
+/* A UDP reply waiting out the delay. */
+struct fake_dns_reply {
+    long long due_us;
+    struct sockaddr_storage peer;
+    socklen_t peer_len;
+    int len;
+    uint8_t buf[FAKE_DNS_MAX_UDP];
+};
+
+struct fake_dns_conn {
+    struct fake_dns *dns;
+    int sock;
+};
+
+static volatile sig_atomic_t fake_dns_stop;
+
+static void fake_dns_signal(int sig) {
+    fake_dns_stop = 1;
+}
+
+static int fake_dns_lost(const struct fake_dns *dns) {
+    return dns->loss > 0 && rand() % 100 < dns->loss;
+}
+
+/* Builds the reply to query into reply; returns its length, or -1 to ignore it. */
+static int fake_dns_answer(const struct fake_dns *dns, const uint8_t *query, int len,
+                           uint8_t *reply, int size, int truncate) {
+    static const uint8_t ptr_name[] = "\x04" "fake" "\x07" "invalid";
+    uint32_t hash = 2166136261u;
+    int off = 12;
+    int rcode = 0;
+    int qtype;
+    int rdlen = 0;
+    uint8_t rdata[16];
+
+    /* A standard query with one question. */
+    if (len < 12 || (query[2] & 0xf8) || query[4] != 0 || query[5] != 1)
+        return -1;
+    while (off < len && query[off]) {
+        int label = query[off];
+        if (label > 63 || off + 1 + label >= len)
+            return -1;
+        if (off == 12 && label == 8 && !strncasecmp((const char *) query + 13, "nxdomain", 8))
+            rcode = 3;
+        for (int i = 0; i <= label; i++)
+            hash = (hash ^ (query[off + i] | 0x20)) * 16777619u;
+        off += 1 + label;
+    }
+    if (off + 5 > len)
+        return -1;
+    qtype = (query[off + 1] << 8) | query[off + 2];
+    off += 5;
+    if (off > size)
+        return -1;
+
+    if (!rcode && !truncate) {
+        if (qtype == 1) {
+            rdata[0] = 192;
+            rdata[1] = 0;
+            rdata[2] = 2;
+            rdata[3] = hash % 254 + 1;
+            rdlen = 4;
+        } else if (qtype == 28) {
+            memset(rdata, 0, sizeof(rdata));
+            rdata[0] = 0x20;
+            rdata[1] = 0x01;
+            rdata[2] = 0x0d;
+            rdata[3] = 0xb8;
+            rdata[14] = (hash >> 8) & 0xff;
+            rdata[15] = hash & 0xff;
+            rdlen = 16;
+        } else if (qtype == 12) {
+            rdlen = sizeof(ptr_name);
+        }
+    }
+    if (rdlen && off + 12 + rdlen > size)
+        return -1;
+
+    memcpy(reply, query, off);
+    reply[2] = 0x84 | (query[2] & 0x01) | (truncate ? 0x02 : 0);  /* QR, AA, RD, TC */
+    reply[3] = rcode;
+    reply[6] = 0;
+    reply[7] = rdlen ? 1 : 0;
+    memset(reply + 8, 0, 4);
+    if (!rdlen)
+        return off;
+
+    reply[off++] = 0xc0;  /* the name, pointing at the question */
+    reply[off++] = 12;
+    reply[off++] = 0;
+    reply[off++] = qtype;
+    reply[off++] = 0;
+    reply[off++] = 1;
+    reply[off++] = (dns->ttl >> 24) & 0xff;
+    reply[off++] = (dns->ttl >> 16) & 0xff;
+    reply[off++] = (dns->ttl >> 8) & 0xff;
+    reply[off++] = dns->ttl & 0xff;
+    reply[off++] = 0;
+    reply[off++] = rdlen;
+    memcpy(reply + off, qtype == 12 ? ptr_name : rdata, rdlen);
+    return off + rdlen;
+}
+
+/* Serves one TCP connection: length prefixed queries, each answered after the delay. */
+static void *fake_dns_tcp(void *arg) {
+    struct fake_dns_conn *conn = arg;
+    struct fake_dns *dns = conn->dns;
+    uint8_t query[65535];
+    uint8_t reply[2 + 65535];
+    uint16_t len;
+    int reply_len;
+
+    while (read_exact(conn->sock, &len, sizeof(len)) == 0) {
+        len = ntohs(len);
+        if (read_exact(conn->sock, query, len))
+            break;
+        __sync_fetch_and_add(&dns->tcp_queries, 1);
+        if (fake_dns_lost(dns)) {
+            /* Over TCP the resolver only gives up on a query when the connection goes. */
+            __sync_fetch_and_add(&dns->dropped, 1);
+            break;
+        }
+        if ((reply_len = fake_dns_answer(dns, query, len, reply + 2, sizeof(reply) - 2, 0)) < 0)
+            continue;
+        usleep(dns->delay_ms * 1000);
+        reply[0] = reply_len >> 8;
+        reply[1] = reply_len & 0xff;
+        if (write_all(conn->sock, (const char *) reply, reply_len + 2))
+            break;
+    }
+    close(conn->sock);
+    free(conn);
+    return NULL;
+}
+
+static int do_fakedns(int argc, char **argv) {
+    struct fake_dns dns;
+    const char *addr = "127.0.0.1";
+    int port = 53;
+    struct sockaddr_storage ss;
+    socklen_t ss_len;
+    struct fake_dns_reply *pending;
+    int head = 0, queued = 0;
+    struct sigaction sa;
+    struct pollfd fds[2];
+    int udp, tcp;
+    int on = 1;
+    int c;
+
+    memset(&dns, 0, sizeof(dns));
+    optind = 1;
+    while ((c = getopt(argc, argv, "a:p:d:l:t:T")) != -1) {
+        switch (c) {
+        case 'a':
+            addr = optarg;
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'd':
+            dns.delay_ms = atoi(optarg);
+            break;
+        case 'l':
+            dns.loss = atoi(optarg);
+            break;
+        case 't':
+            dns.ttl = atoi(optarg);
+            break;
+        case 'T':
+            dns.truncate = 1;
+            break;
+        default:
+            usage("ndc");
+        }
+    }
+    if (optind != argc || port <= 0 || port > 65535 || dns.delay_ms < 0 ||
+            dns.loss < 0 || dns.loss > 100 || dns.ttl < 0)
+        usage("ndc");
+
+    memset(&ss, 0, sizeof(ss));
+    if (strchr(addr, ':')) {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) &ss;
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(port);
+        c = inet_pton(AF_INET6, addr, &sin6->sin6_addr);
+        ss_len = sizeof(*sin6);
+    } else {
+        struct sockaddr_in *sin = (struct sockaddr_in *) &ss;
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(port);
+        c = inet_pton(AF_INET, addr, &sin->sin_addr);
+        ss_len = sizeof(*sin);
+    }
+    if (c != 1)
+        usage("ndc");
+
+    if ((udp = socket(ss.ss_family, SOCK_DGRAM, 0)) < 0 ||
+            (tcp = socket(ss.ss_family, SOCK_STREAM, 0)) < 0) {
+        perror("socket");
+        return 4;
+    }
+    setsockopt(tcp, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(udp, (struct sockaddr *) &ss, ss_len) || bind(tcp, (struct sockaddr *) &ss, ss_len) ||
+            listen(tcp, 64)) {
+        fprintf(stderr, "Unable to listen on %s port %d (%s)\n", addr, port, strerror(errno));
+        return 4;
+    }
+    if (!(pending = malloc(FAKE_DNS_PENDING * sizeof(*pending)))) {
+        perror("malloc");
+        return ENOMEM;
+    }
+
+    /* No SA_RESTART, so that poll() returns on ^C. */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = fake_dns_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    srand(time(NULL));
+    printf("Serving DNS on %s port %d, %d ms delay, %d%% loss\n", addr, port, dns.delay_ms,
+           dns.loss);
+    fflush(stdout);
+
+    fds[0].fd = udp;
+    fds[0].events = POLLIN;
+    fds[1].fd = tcp;
+    fds[1].events = POLLIN;
+    while (!fake_dns_stop) {
+        int timeout = -1;
+        long long now;
+
+        if (queued) {
+            long long wait_us = pending[head].due_us - now_us();
+            timeout = wait_us > 0 ? (int) ((wait_us + 999) / 1000) : 0;
+        }
+        if (poll(fds, 2, timeout) < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            /* Replies all wait the same delay, so they go out in arrival order. */
+            struct fake_dns_reply *r = &pending[(head + queued) % FAKE_DNS_PENDING];
+            uint8_t query[FAKE_DNS_MAX_UDP];
+            ssize_t len;
+
+            r->peer_len = sizeof(r->peer);
+            len = recvfrom(udp, query, sizeof(query), 0, (struct sockaddr *) &r->peer,
+                           &r->peer_len);
+            if (len > 0) {
+                __sync_fetch_and_add(&dns.udp_queries, 1);
+                if (queued == FAKE_DNS_PENDING || fake_dns_lost(&dns)) {
+                    __sync_fetch_and_add(&dns.dropped, 1);
+                } else if ((r->len = fake_dns_answer(&dns, query, len, r->buf, sizeof(r->buf),
+                                                     dns.truncate)) >= 0) {
+                    r->due_us = now_us() + dns.delay_ms * 1000LL;
+                    queued++;
+                }
+            }
+        }
+        if (fds[1].revents & POLLIN) {
+            struct fake_dns_conn *conn = malloc(sizeof(*conn));
+            pthread_t thread;
+
+            if (conn && (conn->sock = accept(tcp, NULL, NULL)) >= 0) {
+                conn->dns = &dns;
+                if (pthread_create(&thread, NULL, fake_dns_tcp, conn)) {
+                    close(conn->sock);
+                    free(conn);
+                } else {
+                    pthread_detach(thread);
+                }
+            } else {
+                free(conn);
+            }
+        }
+
+        now = now_us();
+        while (queued && pending[head].due_us <= now) {
+            struct fake_dns_reply *r = &pending[head];
+            sendto(udp, r->buf, r->len, 0, (struct sockaddr *) &r->peer, r->peer_len);
+            head = (head + 1) % FAKE_DNS_PENDING;
+            queued--;
+        }
+    }
+
+    printf("%d udp queries, %d tcp queries, %d dropped\n", dns.udp_queries, dns.tcp_queries,
+           dns.dropped);
+    free(pending);
+    close(udp);
+    close(tcp);
+    return 0;
+}
+
 static void usage(char *progname) {
     fprintf(stderr, "Usage: %s [<sockname>] ([monitor] | ([<cmd_seq_num>] <cmd> [arg ...]))\n", progname);
+    fprintf(stderr, "       %s [<sockname>] bench [-n <count>] [-w <window>] [-i <iface>]\n"
+                    "           (-f <script> | firewall | quota | getcfg)\n", progname);
+    fprintf(stderr, "       %s dnsbench [-n <count>] [-c <clients>] [-i <iface>]\n"
+                    "           (getaddrinfo | gethostbyname | gethostbyaddr | mix)"
+                    " <host|addr> ...\n", progname);
+    fprintf(stderr, "       %s fakedns [-a <addr>] [-p <port>] [-d <delay_ms>] [-l <loss%%>]"
+                    " [-t <ttl>] [-T]\n", progname);
     exit(1);
 }
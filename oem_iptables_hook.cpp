@@ -25,12 +25,13 @@
 #define LOG_TAG "OemIptablesHook"
 #include <cutils/log.h>
 #include <logwrap/logwrap.h>
+#include "CommandExecutor.h"
 #include "NetdConstants.h"
 
 static int runIptablesCmd(int argc, const char **argv) {
     int res;
 
-    res = android_fork_execvp(argc, (char **)argv, NULL, false, false);
+    res = CommandExecutor::get()->execvp(argc, argv, NULL, false);
     return res;
 }
 